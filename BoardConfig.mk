@@ -54,6 +54,10 @@ WIFI_DRIVER_FW_PATH_PARAM := "/sys/module/bcmdhd/parameters/firmware_path"
 WIFI_DRIVER_FW_PATH_STA := "/vendor/firmware/fw_bcmdhd.bin"
 WIFI_DRIVER_FW_PATH_AP := "/vendor/firmware/fw_bcmdhd_apsta.bin"
 
+# Sensors
+# The stock kernel does not report the rotation vector of akmdfs.
+BOARD_AKM_HAS_ROTATION_VECTOR := false
+
 # Bluetooth
 BOARD_HAVE_BLUETOOTH_BCM := true
 BOARD_BLUEDROID_VENDOR_CONF := device/huawei/u8800pro/bluetooth/vnd_u8800pro.txt
@@ -72,6 +72,12 @@ int16 AKFS_Init(
 	/* Copy layout pattern */
 	prms->e_hpat = hpat;
 
+	/* ASA, sensitivity and layout are applied by one transform. */
+	if (AKFS_InitHXform(hpat, &prms->i8v_asa, &prms->s_hxform) != AKFS_SUCCESS) {
+		AKMERROR_STR("AKFS_InitHXform");
+		return AKM_ERROR;
+	}
+
 	return AKM_SUCCESS;
 }
 
@@ -92,10 +98,94 @@ void AKFS_Release(void *mem)
 	/* Do nothing */
 }
 
+/******************************************************************************/
+/*! Initialize the output buffers and their running averages, so that the
+  next outputs are not averaged with vectors of an earlier measurement.
+  AOC, ellipsoid calibration and the offset are not changed.
+  This function is called when a measurement sequence restarts.
+  @return The return value is #AKM_SUCCESS.
+  @param[in/out] mem A pointer to a handler.
+ */
+int16 AKFS_ResetBuffers(void *mem)
+{
+	AKMPRMS *prms;
+#ifdef AKM_VALUE_CHECK
+	if (mem == NULL) {
+		AKMDEBUG(AKMDATA_CHECK, "%s: Invalid mem pointer.", __FUNCTION__);
+		return AKM_ERROR;
+	}
+#endif
+
+	/* Copy pointer */
+	prms = (AKMPRMS *)mem;
+
+	/* Initialize buffer */
+#ifdef AKFS_PRECISION_FIXED
+	AKFS_InitQBuf(AKFS_HDATA_SIZE, &prms->fva_hvbuf);
+	AKFS_InitQBuf(AKFS_ADATA_SIZE, &prms->fva_avbuf);
+	AKFS_InitQNorm(&prms->s_hqn);
+	AKFS_InitQNorm(&prms->s_aqn);
+	AKFS_InitQAve(CSPEC_HNAVE_V, &prms->s_hvave);
+	AKFS_InitQAve(CSPEC_HNAVE_D, &prms->s_hdave);
+	AKFS_InitQAve(CSPEC_ANAVE_V, &prms->s_avave);
+	AKFS_InitQAve(CSPEC_ANAVE_D, &prms->s_adave);
+#else
+	AKFS_InitVBuf(AKFS_HDATA_SIZE, &prms->fva_hvbuf);
+	AKFS_InitVBuf(AKFS_ADATA_SIZE, &prms->fva_avbuf);
+	AKFS_InitVAve(CSPEC_HNAVE_V, &prms->s_hvave);
+	AKFS_InitVAve(CSPEC_HNAVE_D, &prms->s_hdave);
+	AKFS_InitVAve(CSPEC_ANAVE_V, &prms->s_avave);
+	AKFS_InitVAve(CSPEC_ANAVE_D, &prms->s_adave);
+#endif
+
+	return AKM_SUCCESS;
+}
+
+/******************************************************************************/
+/*! Initialize buffers and calibration status. The offset is not changed.
+  This function is a part of #AKFS_Start, which does not access any file.
+  @return The return value is #AKM_SUCCESS.
+  @param[in/out] mem A pointer to a handler.
+ */
+int16 AKFS_Reset(void *mem)
+{
+	AKMPRMS *prms;
+#ifdef AKM_VALUE_CHECK
+	if (mem == NULL) {
+		AKMDEBUG(AKMDATA_CHECK, "%s: Invalid mem pointer.", __FUNCTION__);
+		return AKM_ERROR;
+	}
+#endif
+
+	/* Copy pointer */
+	prms = (AKMPRMS *)mem;
+
+	/* Initialize buffer */
+#ifdef AKFS_PRECISION_FIXED
+	AKFS_InitQBuf(AKFS_HDATA_SIZE, &prms->fva_hdata);
+#else
+	AKFS_InitVBuf(AKFS_HDATA_SIZE, &prms->fva_hdata);
+#endif
+	AKFS_ResetBuffers(prms);
+
+	/* Initialize for AOC */
+	AKFS_InitAOC(&prms->s_aocv);
+	/* Initialize for ellipsoid calibration */
+	AKFS_InitECal(&prms->s_ecal);
+	prms->i16_hsi = 0;
+	/* Initialize magnetic status */
+	prms->i16_hstatus = 0;
+	prms->i16_ckpt = 0;
+
+	return AKM_SUCCESS;
+}
+
 /******************************************************************************/
 /* This function is called just before a measurement sequence starts.
   Load parameters from a file and initialize library. This function must be
-  called when a sequential measurement thread boots up.
+  called when a sequential measurement thread boots up. When a valid state
+  file #CSPEC_STATE_FILE exists, the whole calibration state is restored from
+  it, so the magnetic accuracy is kept from the last measurement.
   @return The return value is #AKM_SUCCESS.
   @param[in/out] mem A pointer to a handler.
   @param[in] path The path to a setting file to be read out. The path name
@@ -104,6 +194,7 @@ void AKFS_Release(void *mem)
 int16 AKFS_Start(void *mem, const char *path)
 {
 	AKMPRMS *prms;
+	AKFS_STATE st;
 #ifdef AKM_VALUE_CHECK
 	if (mem == NULL || path == NULL) {
 		AKMDEBUG(AKMDATA_CHECK, "%s: Invalid mem pointer.", __FUNCTION__);
@@ -121,22 +212,22 @@ int16 AKFS_Start(void *mem, const char *path)
 	}
 
 	/* Initialize buffer */
-	AKFS_InitBuffer(AKFS_HDATA_SIZE, prms->fva_hdata);
-	AKFS_InitBuffer(AKFS_HDATA_SIZE, prms->fva_hvbuf);
-	AKFS_InitBuffer(AKFS_ADATA_SIZE, prms->fva_avbuf);
+	AKFS_Reset(prms);
 
-	/* Initialize for AOC */
-	AKFS_InitAOC(&prms->s_aocv);
-	/* Initialize magnetic status */
-	prms->i16_hstatus = 0;
+	/* Restore calibration state. The text file is used, if not restored.
+	   AKFS_LoadState reports its own failures, and a state of another
+	   device is ignored by AKFS_PutState. */
+	if (AKFS_LoadState(&st, CSPEC_STATE_FILE) == AKM_SUCCESS) {
+		AKFS_PutState(&st, prms);
+	}
 
 	return AKM_SUCCESS;
 }
 
 /******************************************************************************/
 /*! This function is called when a measurement sequence is done.
-  Save parameters to a file. This function must be called when a sequential
-  measurement thread ends.
+  Save parameters to a file, and the calibration state to #CSPEC_STATE_FILE.
+  This function must be called when a sequential measurement thread ends.
   @return The return value is #AKM_SUCCESS.
   @param[in/out] mem A pointer to a handler.
   @param[in] path The path to a setting file to be written. The path name
@@ -145,6 +236,7 @@ int16 AKFS_Start(void *mem, const char *path)
 int16 AKFS_Stop(void *mem, const char *path)
 {
 	AKMPRMS *prms;
+	AKFS_STATE st;
 #ifdef AKM_VALUE_CHECK
 	if (mem == NULL || path == NULL) {
 		AKMDEBUG(AKMDATA_CHECK, "%s: Invalid mem pointer.", __FUNCTION__);
@@ -161,6 +253,12 @@ int16 AKFS_Stop(void *mem, const char *path)
 		AKMERROR_STR("AKFS_SaveParameters");
 	}
 
+	/* Write calibration state */
+	AKFS_GetState(prms, &st);
+	if (AKFS_SaveState(&st, CSPEC_STATE_FILE) != AKM_SUCCESS) {
+		AKMERROR_STR("AKFS_SaveState");
+	}
+
 	return AKM_SUCCESS;
 }
 
@@ -285,6 +383,7 @@ int16 AKFS_Get_ORIENTATION(
 {
 	int16 akret;
 	AKMPRMS *prms;
+	AKFVEC have, aave;
 #ifdef AKM_VALUE_CHECK
 	if (mem == NULL) {
 		AKMDEBUG(AKMDATA_CHECK, "%s: Invalid mem pointer.", __FUNCTION__);
@@ -299,21 +398,27 @@ int16 AKFS_Get_ORIENTATION(
 	/* Copy pointer */
 	prms = (AKMPRMS *)mem;
 
+	/* Averaging */
+	/* hdave, adave are updated whenever hvbuf, avbuf are updated. */
+#ifdef AKFS_PRECISION_FIXED
+	AKFS_QAveGet(&prms->s_hdave, &have);
+	AKFS_QAveGet(&prms->s_adave, &aave);
+#else
+	AKFS_VAveGet(&prms->s_hdave, &have);
+	AKFS_VAveGet(&prms->s_adave, &aave);
+#endif
+
 	/* Azimuth calculation */
-	/* hvbuf[in] : Android coordinate, sensitivity adjusted, */
-	/*			   offset subtracted. */
-	/* avbuf[in] : Android coordinate, sensitivity adjusted, */
-	/*			   offset subtracted. */
+	/* have   [in] : Android coordinate, sensitivity adjusted, */
+	/*			   offset subtracted, averaged. */
+	/* aave   [in] : Android coordinate, sensitivity adjusted, */
+	/*			   offset subtracted, averaged. */
 	/* azimuth[out]: Android coordinate and unit (degree). */
 	/* pitch  [out]: Android coordinate and unit (degree). */
 	/* roll   [out]: Android coordinate and unit (degree). */
-	akret = AKFS_Direction(
-		AKFS_HDATA_SIZE,
-		prms->fva_hvbuf,
-		CSPEC_HNAVE_D,
-		AKFS_ADATA_SIZE,
-		prms->fva_avbuf,
-		CSPEC_ANAVE_D,
+	akret = AKFS_DirectionVec(
+		&have,
+		&aave,
 		&prms->f_azimuth,
 		&prms->f_pitch,
 		&prms->f_roll
@@ -337,3 +442,82 @@ int16 AKFS_Get_ORIENTATION(
 	return AKM_SUCCESS;
 }
 
+/*!
+  Get rotation vector sensor's elements. The vector format and coordination
+   system follow the Android definition. The quaternion is calculated from
+   averaged vectors directly, so it does not suffer from gimbal lock. Before
+   this function is called, magnetic field vector and acceleration vector
+   should be stored in the buffer by calling #AKFS_Get_MAGNETIC_FIELD and
+   #AKFS_Get_ACCELEROMETER.
+  @return The return value is #AKM_SUCCESS when function succeeds. Otherwise
+   the return value is #AKM_ERROR.
+  @param[out] qx x*sin(theta/2) of the unit quaternion.
+  @param[out] qy y*sin(theta/2) of the unit quaternion.
+  @param[out] qz z*sin(theta/2) of the unit quaternion.
+  @param[out] qw cos(theta/2) of the unit quaternion.
+  @param[out] accuracy Accuracy of rotation vector sensor.
+ */
+int16 AKFS_Get_ROTATION_VECTOR(
+			void		*mem,
+			AKFLOAT		*qx,
+			AKFLOAT		*qy,
+			AKFLOAT		*qz,
+			AKFLOAT		*qw,
+			int16		*accuracy
+)
+{
+	int16 akret;
+	AKMPRMS *prms;
+	AKFVEC have, aave;
+	AKFLOAT quat[4];
+#ifdef AKM_VALUE_CHECK
+	if (mem == NULL) {
+		AKMDEBUG(AKMDATA_CHECK, "%s: Invalid mem pointer.", __FUNCTION__);
+		return AKM_ERROR;
+	}
+	if (qx == NULL || qy == NULL || qz == NULL || qw == NULL ||
+		accuracy == NULL) {
+		AKMDEBUG(AKMDATA_CHECK, "%s: Invalid data pointer.", __FUNCTION__);
+		return AKM_ERROR;
+	}
+#endif
+
+	/* Copy pointer */
+	prms = (AKMPRMS *)mem;
+
+	/* Averaging */
+#ifdef AKFS_PRECISION_FIXED
+	AKFS_QAveGet(&prms->s_hdave, &have);
+	AKFS_QAveGet(&prms->s_adave, &aave);
+#else
+	AKFS_VAveGet(&prms->s_hdave, &have);
+	AKFS_VAveGet(&prms->s_adave, &aave);
+#endif
+
+	/* Quaternion calculation */
+	/* have   [in] : Android coordinate, sensitivity adjusted, */
+	/*			   offset subtracted, averaged. */
+	/* aave   [in] : Android coordinate, sensitivity adjusted, */
+	/*			   offset subtracted, averaged. */
+	/* quat   [out]: x, y, z, w. Device to world (east, north, up). */
+	akret = AKFS_Quaternion(&have, &aave, quat);
+
+	if (akret == AKFS_ERROR) {
+		AKMERROR;
+		return AKM_ERROR;
+	}
+
+	/* Success */
+	*qx = quat[0];
+	*qy = quat[1];
+	*qz = quat[2];
+	*qw = quat[3];
+	*accuracy = 3;
+
+	/* Debug output */
+	AKMDEBUG(AKMDATA_ORI, "Rot(?):%8.5f, %8.5f, %8.5f, %8.5f\n",
+			*qx, *qy, *qz, *qw);
+
+	return AKM_SUCCESS;
+}
+
@@ -37,6 +37,14 @@ int16 AKFS_Init(
 
 void AKFS_Release(void *mem);
 
+int16 AKFS_ResetBuffers(
+			void		*mem
+);
+
+int16 AKFS_Reset(
+			void		*mem
+);
+
 int16 AKFS_Start(void *mem, const char *path);
 
 int16 AKFS_Stop(void *mem, const char *path);
@@ -69,5 +77,14 @@ int16 AKFS_Get_ORIENTATION(
 			int16		*accuracy
 );
 
+int16 AKFS_Get_ROTATION_VECTOR(
+			void		*mem,
+			AKFLOAT		*qx,
+			AKFLOAT		*qy,
+			AKFLOAT		*qz,
+			AKFLOAT		*qw,
+			int16		*accuracy
+);
+
 #endif
 
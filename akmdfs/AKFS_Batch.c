@@ -0,0 +1,455 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2012 Asahi Kasei Microdevices Corporation, Japan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************/
+#include <math.h>
+#include <time.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "AKFS_Common.h"
+#include "AKFS_APIs.h"
+#include "AKFS_Calib.h"
+#include "AKFS_Replay.h"
+#include "AKFS_Batch.h"
+
+/*
+ * Each file in a directory is a replay file (see AKFS_Replay.c), and is
+ * processed by an independent instance of the library, i.e. its own AKMPRMS
+ * and AKFS_CALIB. Ellipsoid fit runs synchronously in each worker thread, so
+ * results do not depend on the number of threads or on timing.
+ *
+ * "M" and "A" records are paired in order, the same as replay. Orientation
+ * error is the difference from "R" records, counted only while the accuracy
+ * is 3. Results are written in the order of file names.
+ */
+
+/*** Constant definition ******************************************************/
+#define BATCH_PATH_SIZE		1024
+
+/*** Type declaration *********************************************************/
+typedef struct _AKFS_BATCH_RESULT {
+	char		*name;
+	int16		ret;		/*!< AKM_SUCCESS or AKM_ERROR */
+	int			nsample;
+	AKFVEC		ho;			/*!< Offset at the end */
+	AKFLOAT		hr;			/*!< Radius of the fit, if hsi is 1 */
+	int16		hsi;		/*!< 1: Soft-iron correction is valid */
+	int16		accuracy;	/*!< Accuracy at the end */
+	int			nacc3;		/*!< Samples until accuracy 3, -1 if never */
+	double		tacc3;		/*!< Seconds until accuracy 3 */
+	int			nref;		/*!< Number of compared samples */
+	double		azSum;		/*!< Sum of |azimuth error| */
+	double		azSum2;		/*!< Sum of azimuth error^2 */
+	double		azMax;		/*!< Maximum |azimuth error| */
+	double		tiltSum2;	/*!< Sum of pitch error^2 + roll error^2 */
+} AKFS_BATCH_RESULT;
+
+/*! Shared by worker threads. Only next is changed, under mutex. */
+typedef struct _AKFS_BATCH {
+	const char			*dir;
+	AKFS_PATNO			pat;
+	AKFS_BATCH_RESULT	*res;
+	int					n;
+	int					next;	/*!< Index of the next file */
+	pthread_mutex_t		mutex;
+	AKFS_TRACE			*trace;	/*!< Ring of the caller, or NULL */
+} AKFS_BATCH;
+
+/*!
+ Difference of angles in degree, in [-180, 180).
+ */
+static double BatchAngleDiff(double a, double b)
+{
+	double d = fmod(a - b, 360.0);
+	if (d < -180.0) {
+		d += 360.0;
+	} else if (d >= 180.0) {
+		d -= 360.0;
+	}
+	return d;
+}
+
+/*!
+ Measurement interval of the compass in second, i.e. the shortest one of the
+ magnetic and fusion sensors which are enabled.
+ */
+static double BatchInterval(const int64_t delay[AKM_NUM_SENSORS])
+{
+	int64_t d = -1;
+	int i;
+
+	for (i = 1; i < AKM_NUM_SENSORS; i++) {
+		if ((delay[i] >= 0) && ((d < 0) || (delay[i] < d))) {
+			d = delay[i];
+		}
+	}
+	if (d < 0) {
+		d = AKD_REPLAY_DEFAULT_DELAY;
+	}
+	return (double)d * 1e-9;
+}
+
+/*!
+ Process one file with a new instance of the library.
+ @return If this function succeeds, the return value is #AKM_SUCCESS.
+ Otherwise the return value is #AKM_ERROR.
+ @param[in] path A path to a replay file.
+ @param[in] pat Layout pattern. If #PAT_INVALID, the one in the file is used.
+ @param[out] res
+ */
+static int16 BatchRun(
+	const	char				*path,
+	const	AKFS_PATNO			pat,
+			AKFS_BATCH_RESULT	*res)
+{
+	AKD_REPLAY_LOG log;
+	AKMPRMS *prms = NULL;
+	AKFS_CALIB *cal = NULL;
+	AKFS_PATNO hpat = pat;
+	const BYTE *d;
+	int64_t delay[AKM_NUM_SENSORS];
+	int16 mag[3], mstat, acc[3];
+	AKFLOAT x, y, z, ypr[3];
+	int16 accuracy;
+	double t = 0.0, e;
+	int i, j, idelay = 0, iref = 0;
+	int16 ret = AKM_ERROR;
+
+	if (AKD_ReplayLoad(path, &log) != AKD_SUCCESS) {
+		AKMERROR_STR("AKD_ReplayLoad");
+		return AKM_ERROR;
+	}
+	if (hpat == PAT_INVALID) {
+		if ((log.layout < PAT1) || (PAT8 < log.layout)) {
+			AKMERROR_STR("layout");
+			goto BATCH_RUN_END;
+		}
+		hpat = (AKFS_PATNO)log.layout;
+	}
+
+	/* Both are too large for the stack of a worker thread. */
+	prms = malloc(sizeof(AKMPRMS));
+	cal = malloc(sizeof(AKFS_CALIB));
+	if ((prms == NULL) || (cal == NULL)) {
+		AKMERROR_STR("malloc");
+		goto BATCH_RUN_END;
+	}
+	if (AKFS_CalibInit(cal) != AKM_SUCCESS) {
+		free(cal);
+		cal = NULL;
+		goto BATCH_RUN_END;
+	}
+	AKFS_CalibSetSync(cal, AKM_TRUE);
+
+	/* Start from scratch, without setting and state files. */
+	if ((AKFS_Init(prms, hpat, log.conf) != AKM_SUCCESS) ||
+		(AKFS_Reset(prms) != AKM_SUCCESS)) {
+		goto BATCH_RUN_END;
+	}
+	prms->p_calib = cal;
+
+	for (j = 0; j < AKM_NUM_SENSORS; j++) {
+		delay[j] = AKD_REPLAY_DEFAULT_DELAY;
+	}
+	res->nacc3 = -1;
+	res->nsample = (log.nmag < log.nacc) ? log.nmag : log.nacc;
+	for (i = 0; i < res->nsample; i++) {
+		/* "D" records which take effect before this sample */
+		for (; (idelay < log.ndelay) && (log.delay[idelay].at <= i); idelay++) {
+			memcpy(delay, log.delay[idelay].delay, sizeof(delay));
+		}
+		t += BatchInterval(delay);
+
+		for (j = 0; j < 3; j++) {
+			acc[j] = log.acc[i][j];
+		}
+		if (AKFS_Get_ACCELEROMETER(prms, acc, 0, &x, &y, &z, &accuracy)
+				!= AKM_SUCCESS) {
+			continue;
+		}
+
+		/* Same as the measurement loop */
+		d = log.mag[i];
+		mag[0] = (int16)((int16_t)(d[2]<<8)+((int16_t)d[1]));
+		mag[1] = (int16)((int16_t)(d[4]<<8)+((int16_t)d[3]));
+		mag[2] = (int16)((int16_t)(d[6]<<8)+((int16_t)d[5]));
+		mstat = d[0] | d[7];
+		if (AKFS_Get_MAGNETIC_FIELD(prms, mag, mstat, &x, &y, &z, &accuracy)
+				!= AKM_SUCCESS) {
+			continue;
+		}
+		if ((accuracy == 3) && (res->nacc3 < 0)) {
+			res->nacc3 = i + 1;
+			res->tacc3 = t;
+		}
+		if (AKFS_Get_ORIENTATION(prms, &ypr[0], &ypr[1], &ypr[2], &accuracy)
+				!= AKM_SUCCESS) {
+			continue;
+		}
+
+		/* "R" records of this sample, i.e. after i + 1 "M" records */
+		for (; (iref < log.nref) && (log.ref[iref].at <= i + 1); iref++) {
+			if ((log.ref[iref].at != i + 1) || (prms->i16_hstatus != 3)) {
+				continue;
+			}
+			e = BatchAngleDiff(ypr[0], log.ref[iref].ypr[0]);
+			res->azSum += fabs(e);
+			res->azSum2 += e * e;
+			if (fabs(e) > res->azMax) {
+				res->azMax = fabs(e);
+			}
+			for (j = 1; j < 3; j++) {
+				e = BatchAngleDiff(ypr[j], log.ref[iref].ypr[j]);
+				res->tiltSum2 += e * e;
+			}
+			res->nref++;
+		}
+	}
+
+	res->ho = prms->fv_ho;
+	res->hr = prms->f_hr;
+	res->hsi = prms->i16_hsi;
+	res->accuracy = prms->i16_hstatus;
+	ret = AKM_SUCCESS;
+
+BATCH_RUN_END:
+	if (cal != NULL) {
+		AKFS_CalibRelease(cal);
+	}
+	free(cal);
+	free(prms);
+	AKD_ReplayFree(&log);
+	return ret;
+}
+
+/*!
+ A worker thread function, which takes files one by one until all files are
+ taken.
+ @param[in] args A pointer to #AKFS_BATCH.
+ */
+static void* batch_main(void* args)
+{
+	AKFS_BATCH *batch = (AKFS_BATCH *)args;
+	char path[BATCH_PATH_SIZE];
+	int i;
+
+	AKFS_TraceAttach(batch->trace);
+	while (AKM_TRUE) {
+		pthread_mutex_lock(&batch->mutex);
+		i = batch->next++;
+		pthread_mutex_unlock(&batch->mutex);
+		if (i >= batch->n) {
+			break;
+		}
+		snprintf(path, sizeof(path), "%s/%s", batch->dir, batch->res[i].name);
+		batch->res[i].ret = BatchRun(path, batch->pat, &batch->res[i]);
+	}
+	return ((void*)0);
+}
+
+static int BatchCompare(const void *a, const void *b)
+{
+	return strcmp(((const AKFS_BATCH_RESULT *)a)->name,
+		((const AKFS_BATCH_RESULT *)b)->name);
+}
+
+/*!
+ List regular files in a directory, sorted by name. Hidden files are skipped.
+ @return If this function succeeds, the return value is #AKM_SUCCESS.
+ Otherwise the return value is #AKM_ERROR.
+ */
+static int16 BatchList(AKFS_BATCH *batch)
+{
+	char path[BATCH_PATH_SIZE];
+	struct dirent *ent;
+	struct stat st;
+	DIR *dp;
+	int size = 0;
+	void *p;
+
+	if ((dp = opendir(batch->dir)) == NULL) {
+		AKMERROR_STR("opendir");
+		return AKM_ERROR;
+	}
+	while ((ent = readdir(dp)) != NULL) {
+		if (ent->d_name[0] == '.') {
+			continue;
+		}
+		snprintf(path, sizeof(path), "%s/%s", batch->dir, ent->d_name);
+		if ((stat(path, &st) != 0) || !S_ISREG(st.st_mode)) {
+			continue;
+		}
+		if (batch->n >= size) {
+			size = (size == 0) ? 256 : (size * 2);
+			p = realloc(batch->res, size * sizeof(AKFS_BATCH_RESULT));
+			if (p == NULL) {
+				closedir(dp);
+				return AKM_ERROR;
+			}
+			batch->res = p;
+		}
+		memset(&batch->res[batch->n], 0, sizeof(AKFS_BATCH_RESULT));
+		if ((batch->res[batch->n].name = strdup(ent->d_name)) == NULL) {
+			closedir(dp);
+			return AKM_ERROR;
+		}
+		batch->n++;
+	}
+	closedir(dp);
+
+	if (batch->n > 0) {
+		qsort(batch->res, batch->n, sizeof(AKFS_BATCH_RESULT), BatchCompare);
+	}
+	return AKM_SUCCESS;
+}
+
+/*!
+ Write a result as a line.
+ */
+static void BatchPrint(FILE *fp, const AKFS_BATCH_RESULT *r)
+{
+	fprintf(fp, "%s\t", r->name);
+	if (r->ret != AKM_SUCCESS) {
+		fprintf(fp, "error\n");
+		return;
+	}
+	fprintf(fp, "%d\t%d\t%8.2f\t%8.2f\t%8.2f\t%d\t",
+		r->nsample, r->accuracy, r->ho.u.x, r->ho.u.y, r->ho.u.z, r->hsi);
+	if (r->hsi != 0) {
+		fprintf(fp, "%6.2f\t", r->hr);
+	} else {
+		fprintf(fp, "-\t");
+	}
+	if (r->nacc3 >= 0) {
+		fprintf(fp, "%d\t%7.3f\t", r->nacc3, r->tacc3);
+	} else {
+		fprintf(fp, "-\t-\t");
+	}
+	if (r->nref > 0) {
+		fprintf(fp, "%d\t%6.2f\t%6.2f\t%6.2f\t%6.2f\n", r->nref,
+			r->azSum / r->nref, sqrt(r->azSum2 / r->nref), r->azMax,
+			sqrt(r->tiltSum2 / r->nref));
+	} else {
+		fprintf(fp, "0\t-\t-\t-\t-\n");
+	}
+}
+
+/*!
+ Process all replay files in a directory in parallel, and write the converged
+ offset, time to accuracy 3 and orientation error of each file.
+ @return If all files are processed, the return value is #AKM_SUCCESS.
+ Otherwise the return value is #AKM_ERROR.
+ @param[in] dir A directory of replay files.
+ @param[in] output A path to which results are written. If NULL, results are
+ written to stdout.
+ @param[in] pat Layout pattern. If #PAT_INVALID, the one in each file is used.
+ @param[in] nthread Number of worker threads. If 0 or less, the number of
+ online processors is used.
+ */
+int16 AKFS_Batch(
+	const	char		*dir,
+	const	char		*output,
+	const	AKFS_PATNO	pat,
+	const	int			nthread)
+{
+	AKFS_BATCH batch;
+	pthread_t thread[AKFS_BATCH_MAX_THREAD];
+	struct timespec t0, t1;
+	FILE *fp = stdout;
+	int nth = nthread;
+	int i, nok = 0, nconv = 0;
+	double tconv = 0.0;
+	int16 ret = AKM_ERROR;
+
+	memset(&batch, 0, sizeof(batch));
+	batch.dir = dir;
+	batch.pat = pat;
+	batch.trace = AKFS_TraceCurrent();
+	if (pthread_mutex_init(&batch.mutex, NULL) != 0) {
+		AKMERROR_STR("pthread_mutex_init");
+		return AKM_ERROR;
+	}
+	if (BatchList(&batch) != AKM_SUCCESS) {
+		goto BATCH_END;
+	}
+
+	if (nth <= 0) {
+		nth = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if (nth > batch.n) {
+		nth = batch.n;
+	}
+	if (nth > AKFS_BATCH_MAX_THREAD) {
+		nth = AKFS_BATCH_MAX_THREAD;
+	}
+	if (nth < 1) {
+		nth = 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < nth; i++) {
+		if (pthread_create(&thread[i], NULL, batch_main, &batch) != 0) {
+			AKMERROR_STR("pthread_create");
+			break;
+		}
+	}
+	if (i == 0) {
+		goto BATCH_END;
+	}
+	nth = i;
+	for (i = 0; i < nth; i++) {
+		pthread_join(thread[i], NULL);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	if ((output != NULL) && ((fp = fopen(output, "w")) == NULL)) {
+		AKMERROR_STR("fopen");
+		goto BATCH_END;
+	}
+	fprintf(fp, "# file\tsamples\taccuracy\thox\thoy\thoz\thsi\thr"
+		"\tacc3_samples\tacc3_sec\tref\taz_mean\taz_rms\taz_max\ttilt_rms\n");
+	for (i = 0; i < batch.n; i++) {
+		BatchPrint(fp, &batch.res[i]);
+		if (batch.res[i].ret == AKM_SUCCESS) {
+			nok++;
+			if (batch.res[i].nacc3 >= 0) {
+				nconv++;
+				tconv += batch.res[i].tacc3;
+			}
+		}
+	}
+	if (fp != stdout) {
+		fclose(fp);
+	} else {
+		fflush(fp);
+	}
+
+	ALOGI("batch: %d/%d files in %.3f s with %d threads, "
+		"%d reached accuracy 3 (mean %.3f s)",
+		nok, batch.n,
+		(double)(t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9,
+		nth, nconv, (nconv > 0) ? (tconv / nconv) : 0.0);
+	ret = (nok == batch.n) ? AKM_SUCCESS : AKM_ERROR;
+
+BATCH_END:
+	for (i = 0; i < batch.n; i++) {
+		free(batch.res[i].name);
+	}
+	free(batch.res);
+	pthread_mutex_destroy(&batch.mutex);
+	return ret;
+}
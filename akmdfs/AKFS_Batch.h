@@ -0,0 +1,40 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2012 Asahi Kasei Microdevices Corporation, Japan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************/
+#ifndef AKFS_INC_BATCH_H
+#define AKFS_INC_BATCH_H
+
+#include "AKFS_Compass.h"
+
+/*** Constant definition ******************************************************/
+/*! Maximum number of worker threads */
+#define AKFS_BATCH_MAX_THREAD	64
+
+/*** Type declaration *********************************************************/
+
+/*** Global variables *********************************************************/
+
+/*** Prototype of function ****************************************************/
+int16 AKFS_Batch(
+	const	char		*dir,
+	const	char		*output,
+	const	AKFS_PATNO	pat,
+	const	int			nthread
+);
+
+#endif
+
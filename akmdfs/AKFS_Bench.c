@@ -0,0 +1,1175 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2012 Asahi Kasei Microdevices Corporation, Japan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************/
+#include <math.h>
+#include <time.h>
+#include <malloc.h>
+#include "AKFS_Common.h"
+#include "AKFS_APIs.h"
+#include "AKFS_Bench.h"
+#include "AKFS_BenchRef.h"
+
+/*
+ * Each stage runs over a whole stream, and its input is the output of the
+ * previous stage, which is prepared before timing. So a stage is timed alone.
+ * The whole library state is reset before each run, and nothing is written
+ * to a file, so the results do not depend on the device.
+ *
+ * Golden file format. One value per line, and '#' begins a comment line.
+ *   <stream> <stage> <index> <x> <y> <z>
+ * If the file does not exist, it is created from the current results. The
+ * first line records the precision of the build, and a golden file is only
+ * compared by a build of the same precision. Results of float and double
+ * builds differ beyond the tolerance, since a decision in AOC can flip.
+ *
+ * Apart from the golden file, the synthetic stream is checked against its
+ * true offset and orientation, which are calculated in double. So every
+ * precision is checked against the same reference.
+ *
+ * Some stages are calculated again by the reference implementations in
+ * AKFS_BenchRef.c, i.e. the code which the library replaced. They are timed
+ * in the same way, and their results are compared with the stages.
+ */
+
+/*** Constant definition ******************************************************/
+#define BENCH_DECOMP		0	/*!< AKFS_DecompXform */
+#define BENCH_AOC			1	/*!< AKFS_AOC */
+#define BENCH_VNORM			2	/*!< AKFS_VbNorm + AKFS_VbAve */
+#define BENCH_DIR			3	/*!< AKFS_Direction */
+#define BENCH_E2E			4	/*!< Get_MAGNETIC_FIELD + Get_ORIENTATION */
+#define BENCH_NSTAGE		5
+
+#define BENCH_NSTREAM		2
+#define BENCH_LINE_SIZE		128
+
+#if defined(AKFS_PRECISION_DOUBLE)
+#define BENCH_PRECISION		"double"
+#elif defined(AKFS_PRECISION_FIXED)
+#define BENCH_PRECISION		"fixed"
+#else
+#define BENCH_PRECISION		"float"
+#endif
+
+#if defined(AKFS_SIMD_NEON)
+#define BENCH_KERNEL		"neon"
+#elif defined(AKFS_SIMD_SSE2)
+#define BENCH_KERNEL		"sse2"
+#else
+#define BENCH_KERNEL		"scalar"
+#endif
+
+#if defined(AKFS_DIRECTION_ALGEBRAIC) && defined(AKFS_FAST_ATAN2)
+#define BENCH_DIRECTION		"algebraic + fast atan2"
+#elif defined(AKFS_DIRECTION_ALGEBRAIC)
+#define BENCH_DIRECTION		"algebraic + libm"
+#elif defined(AKFS_FAST_ATAN2)
+#define BENCH_DIRECTION		"trig + fast atan2"
+#else
+#define BENCH_DIRECTION		"trig + libm"
+#endif
+
+/*! The fixed point backend is compared with the float reference code within
+  a tolerance. Otherwise the results must be the same bit by bit. */
+#ifdef AKFS_PRECISION_FIXED
+#define BENCH_VBUF_TOL		AKFS_BENCH_FIXED_TOL
+#else
+#define BENCH_VBUF_TOL		0.0
+#endif
+
+/*! AKFS_Get4points is too short to be timed alone, so it is repeated
+  this many times in a row. */
+#define BENCH_SCAN_REPEAT	16
+
+/* mallinfo is deprecated since glibc 2.33. */
+#if defined(__GLIBC__) && defined(__GLIBC_PREREQ)
+#if __GLIBC_PREREQ(2, 33)
+#define BENCH_MALLINFO2
+#endif
+#endif
+
+/*** Type declaration *********************************************************/
+typedef struct _AKFS_BENCH_STREAM {
+	const char	*name;
+	int			n;
+	int16		(*mag)[3];	/*!< Raw magnetic data */
+	int16		*mstat;		/*!< ST1 | ST2 */
+	int16		(*acc)[3];	/*!< Raw acceleration data */
+	AKFVEC		*av;		/*!< Acceleration in SI unit */
+	AKFVEC		*hv;		/*!< Offset subtracted, not averaged */
+#ifdef AKFS_PRECISION_FIXED
+	AKFS_QVEC	*qh;		/*!< Result of decomp in Q16.16 */
+	AKFS_QVEC	*qav;		/*!< av in Q16.16 */
+	AKFS_QVEC	*qhv;		/*!< hv in Q16.16 */
+#endif
+	double		(*th)[3];	/*!< True magnetic data without offset and noise.
+								 NULL if unknown. */
+	double		(*ta)[3];	/*!< True acceleration data without noise */
+	double		tho[3];		/*!< True offset of magnetic data */
+	AKFVEC		*out[BENCH_NSTAGE];	/*!< Result of each stage */
+	AKFVEC		*ref;		/*!< Result of a reference implementation */
+	AKFVEC		*rho;		/*!< Offsets by AKFS_RefAOC */
+	AKFVEC		ho0;		/*!< Offset after AKFS_Reset */
+	int64_t		best[BENCH_NSTAGE];	/*!< Best time in nano second */
+} AKFS_BENCH_STREAM;
+
+/*** Static variables *********************************************************/
+static const char* s_stageName[BENCH_NSTAGE] = {
+	"decomp", "aoc", "vnorm", "dir", "e2e"
+};
+
+/* The state is large, so it is not on the stack. */
+static AKMPRMS s_prms;
+
+/*!
+ Current time of the monotonic clock in nano second.
+ */
+static int64_t BenchNow(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((int64_t)ts.tv_sec * 1000000000LL) + ts.tv_nsec;
+}
+
+/*!
+ Size of the heap in use. Any allocation left in a stage increases this.
+ */
+static long BenchHeapUsed(void)
+{
+#ifdef BENCH_MALLINFO2
+	struct mallinfo2 mi = mallinfo2();
+#else
+	struct mallinfo mi = mallinfo();
+#endif
+	return (long)mi.uordblks;
+}
+
+/*!
+ Allocate buffers for n samples. Raw data buffers are allocated only if
+ raw is true, otherwise they must be allocated already.
+ @return If this function succeeds, the return value is #AKM_SUCCESS.
+ Otherwise the return value is #AKM_ERROR.
+ */
+static int16 BenchAlloc(
+	AKFS_BENCH_STREAM	*st,
+	const int			n,
+	const int			raw)
+{
+	int i;
+
+	st->n = n;
+	if (raw) {
+		st->mag = malloc(n * sizeof(*st->mag));
+		st->mstat = malloc(n * sizeof(*st->mstat));
+		st->acc = malloc(n * sizeof(*st->acc));
+		if ((st->mag == NULL) || (st->mstat == NULL) || (st->acc == NULL)) {
+			return AKM_ERROR;
+		}
+	}
+	st->av = malloc(n * sizeof(AKFVEC));
+	st->hv = malloc(n * sizeof(AKFVEC));
+	st->ref = malloc(n * sizeof(AKFVEC));
+	st->rho = malloc(n * sizeof(AKFVEC));
+	if ((st->av == NULL) || (st->hv == NULL) || (st->ref == NULL) ||
+		(st->rho == NULL)) {
+		return AKM_ERROR;
+	}
+#ifdef AKFS_PRECISION_FIXED
+	st->qh = malloc(n * sizeof(AKFS_QVEC));
+	st->qav = malloc(n * sizeof(AKFS_QVEC));
+	st->qhv = malloc(n * sizeof(AKFS_QVEC));
+	if ((st->qh == NULL) || (st->qav == NULL) || (st->qhv == NULL)) {
+		return AKM_ERROR;
+	}
+#endif
+	for (i = 0; i < BENCH_NSTAGE; i++) {
+		st->out[i] = calloc(n, sizeof(AKFVEC));
+		if (st->out[i] == NULL) {
+			return AKM_ERROR;
+		}
+		st->best[i] = -1;
+	}
+	return AKM_SUCCESS;
+}
+
+static void BenchFree(AKFS_BENCH_STREAM *st)
+{
+	int i;
+
+	free(st->mag);
+	free(st->mstat);
+	free(st->acc);
+	free(st->av);
+	free(st->hv);
+	free(st->ref);
+	free(st->rho);
+#ifdef AKFS_PRECISION_FIXED
+	free(st->qh);
+	free(st->qav);
+	free(st->qhv);
+#endif
+	free(st->th);
+	free(st->ta);
+	for (i = 0; i < BENCH_NSTAGE; i++) {
+		free(st->out[i]);
+	}
+	memset(st, 0, sizeof(*st));
+}
+
+/*!
+ Make a synthetic stream. The device turns around quickly first, so that
+ the offset converges, and then it moves slowly. Noise is added by a fixed
+ random sequence, so the stream is always the same.
+ */
+static int16 BenchSynthetic(AKFS_BENCH_STREAM *st)
+{
+	unsigned int seed = 12345;
+	int i, j;
+	double t, a, b, noise[6];
+
+	st->name = "synthetic";
+	if (BenchAlloc(st, AKFS_BENCH_SAMPLES, 1) != AKM_SUCCESS) {
+		return AKM_ERROR;
+	}
+	st->th = malloc(st->n * sizeof(*st->th));
+	st->ta = malloc(st->n * sizeof(*st->ta));
+	if ((st->th == NULL) || (st->ta == NULL)) {
+		return AKM_ERROR;
+	}
+	st->tho[0] = 40;
+	st->tho[1] = -25;
+	st->tho[2] = 60;
+	for (i = 0; i < st->n; i++) {
+		for (j = 0; j < 6; j++) {
+			seed = (seed * 1103515245u) + 12345u;
+			noise[j] = (double)((seed >> 8) & 0xFFFF) / 65536.0 - 0.5;
+		}
+		t = i * 0.01;
+		a = t * ((i < (st->n / 2)) ? 40.0 : 0.3);
+		b = sin(t * ((i < (st->n / 2)) ? 23.0 : 4.1)) * 1.3;
+		st->th[i][0] = 150 * cos(a) * cos(b);
+		st->th[i][1] = 150 * sin(a) * cos(b);
+		st->th[i][2] = 150 * sin(b);
+		st->ta[i][0] = 720 * sin(b * 0.5);
+		st->ta[i][1] = 720 * sin(a * 0.2) * 0.3;
+		st->ta[i][2] = 700;
+		for (j = 0; j < 3; j++) {
+			st->mag[i][j] = (int16)(st->th[i][j] + st->tho[j] + noise[j] * 3);
+			st->acc[i][j] = (int16)(st->ta[i][j] + noise[3 + j] * 10);
+		}
+		st->mstat[i] = 0x01;
+	}
+	return AKM_SUCCESS;
+}
+
+/*!
+ Read a recorded stream from the driver, i.e. the replay backend. Each
+ magnetic data is paired with an acceleration data in order, and the stream
+ ends when either of them runs out.
+ */
+static int16 BenchRecorded(AKFS_BENCH_STREAM *st, AKD_CONTEXT *dev)
+{
+	BYTE i2cData[AKM_SENSOR_DATA_SIZE];
+	int16_t acc[3];
+	int n = 0, size = 0;
+	void *p;
+
+	st->name = "recorded";
+	while (n < AKFS_BENCH_MAX_REC) {
+		if ((AKD_GetMagneticData(dev, i2cData) != AKD_SUCCESS) ||
+			(AKD_GetAccelerationData(dev, acc) != AKD_SUCCESS)) {
+			break;
+		}
+		if (n >= size) {
+			size = (size == 0) ? 1024 : (size * 2);
+			if ((p = realloc(st->mag, size * sizeof(*st->mag))) == NULL) {
+				return AKM_ERROR;
+			}
+			st->mag = p;
+			if ((p = realloc(st->mstat, size * sizeof(*st->mstat))) == NULL) {
+				return AKM_ERROR;
+			}
+			st->mstat = p;
+			if ((p = realloc(st->acc, size * sizeof(*st->acc))) == NULL) {
+				return AKM_ERROR;
+			}
+			st->acc = p;
+		}
+		/* Same as the measurement loop */
+		st->mag[n][0] = (int16)((int16_t)(i2cData[2]<<8)+((int16_t)i2cData[1]));
+		st->mag[n][1] = (int16)((int16_t)(i2cData[4]<<8)+((int16_t)i2cData[3]));
+		st->mag[n][2] = (int16)((int16_t)(i2cData[6]<<8)+((int16_t)i2cData[5]));
+		st->mstat[n] = i2cData[0] | i2cData[7];
+		st->acc[n][0] = acc[0];
+		st->acc[n][1] = acc[1];
+		st->acc[n][2] = acc[2];
+		n++;
+	}
+	return BenchAlloc(st, n, 0);
+}
+
+/*!
+ Run a stage over the whole stream once.
+ @param[in,out] prms Library state. It is reset by the caller.
+ @param[in,out] st A stream. Inputs are the results of the previous stages.
+ @param[in] stage Stage to run.
+ */
+static void BenchRun(
+	AKMPRMS				*prms,
+	AKFS_BENCH_STREAM	*st,
+	const int			stage)
+{
+	AKFVEC *out = st->out[stage];
+	AKFVEC ho;
+	int i;
+	int16 acc;
+
+	switch (stage) {
+#ifdef AKFS_PRECISION_FIXED
+	case BENCH_DECOMP:
+		for (i = 0; i < st->n; i++) {
+			AKFS_QDecompXform(st->mag[i], st->mstat[i], &prms->s_hxform,
+				&prms->fva_hdata);
+			st->qh[i] = AKFS_QBUF_AT(&prms->fva_hdata, 0);
+			AKFS_QToVec(&st->qh[i], &out[i]);
+		}
+		break;
+#else
+	case BENCH_DECOMP:
+		for (i = 0; i < st->n; i++) {
+			AKFS_DecompXform(st->mag[i], st->mstat[i], &prms->s_hxform,
+				&prms->fva_hdata);
+			out[i] = AKFS_VBUF_AT(&prms->fva_hdata, 0);
+		}
+		break;
+#endif
+	case BENCH_AOC:
+		ho = prms->fv_ho;
+		for (i = 0; i < st->n; i++) {
+			AKFS_AOC(&prms->s_aocv, &st->out[BENCH_DECOMP][i], &ho);
+			out[i] = ho;
+		}
+		break;
+#ifdef AKFS_PRECISION_FIXED
+	case BENCH_VNORM:
+		for (i = 0; i < st->n; i++) {
+			*AKFS_QBufPush(&prms->fva_hdata) = st->qh[i];
+			AKFS_QNormSet(&st->out[BENCH_AOC][i], &prms->fv_hs, AKM_MAG_SENSE,
+				NULL, &prms->s_hqn);
+			AKFS_QbNorm(&prms->fva_hdata, 1, &prms->s_hqn, &prms->fva_hvbuf);
+			AKFS_QbAve(&prms->fva_hvbuf, CSPEC_HNAVE_V, &out[i]);
+			st->qhv[i] = AKFS_QBUF_AT(&prms->fva_hvbuf, 0);
+			AKFS_QToVec(&st->qhv[i], &st->hv[i]);
+		}
+		break;
+	case BENCH_DIR:
+		for (i = 0; i < st->n; i++) {
+			AKFVEC have, aave;
+			*AKFS_QBufPush(&prms->fva_hvbuf) = st->qhv[i];
+			*AKFS_QBufPush(&prms->fva_avbuf) = st->qav[i];
+			/* Same as AKFS_Direction */
+			AKFS_QbAve(&prms->fva_hvbuf, CSPEC_HNAVE_D, &have);
+			AKFS_QbAve(&prms->fva_avbuf, CSPEC_ANAVE_D, &aave);
+			AKFS_DirectionVec(&have, &aave,
+				&out[i].u.x, &out[i].u.y, &out[i].u.z);
+		}
+		break;
+#else
+	case BENCH_VNORM:
+		for (i = 0; i < st->n; i++) {
+			*AKFS_VBufPush(&prms->fva_hdata) = st->out[BENCH_DECOMP][i];
+			AKFS_VbNorm(&prms->fva_hdata, 1, &st->out[BENCH_AOC][i],
+				&prms->fv_hs, AKM_MAG_SENSE, &prms->fva_hvbuf);
+			AKFS_VbAve(&prms->fva_hvbuf, CSPEC_HNAVE_V, &out[i]);
+			st->hv[i] = AKFS_VBUF_AT(&prms->fva_hvbuf, 0);
+		}
+		break;
+	case BENCH_DIR:
+		for (i = 0; i < st->n; i++) {
+			*AKFS_VBufPush(&prms->fva_hvbuf) = st->hv[i];
+			*AKFS_VBufPush(&prms->fva_avbuf) = st->av[i];
+			AKFS_Direction(&prms->fva_hvbuf, CSPEC_HNAVE_D,
+				&prms->fva_avbuf, CSPEC_ANAVE_D,
+				&out[i].u.x, &out[i].u.y, &out[i].u.z);
+		}
+		break;
+#endif
+	case BENCH_E2E:
+		for (i = 0; i < st->n; i++) {
+			AKFLOAT x, y, z;
+			AKFS_Get_ACCELEROMETER(prms, st->acc[i], 0, &x, &y, &z, &acc);
+			AKFS_Get_MAGNETIC_FIELD(prms, st->mag[i], st->mstat[i],
+				&x, &y, &z, &acc);
+			AKFS_Get_ORIENTATION(prms,
+				&out[i].u.x, &out[i].u.y, &out[i].u.z, &acc);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/*!
+ Time each stage of a stream. Stages run in order, since a stage takes the
+ results of the previous stages.
+ @return If this function succeeds, the return value is #AKM_SUCCESS.
+ Otherwise the return value is #AKM_ERROR.
+ */
+static int16 BenchStream(
+	AKFS_BENCH_STREAM	*st,
+	const	AKFS_PATNO	pat,
+	const	uint8		regs[])
+{
+	AKMPRMS *prms = &s_prms;
+	int64_t t;
+	int stage, rep, i;
+
+	for (stage = 0; stage < BENCH_NSTAGE; stage++) {
+		for (rep = 0; rep < AKFS_BENCH_REPEAT; rep++) {
+			if ((AKFS_Init(prms, pat, regs) != AKM_SUCCESS) ||
+				(AKFS_Reset(prms) != AKM_SUCCESS)) {
+				return AKM_ERROR;
+			}
+			if ((stage == BENCH_DECOMP) && (rep == 0)) {
+				st->ho0 = prms->fv_ho;
+				/* Same as AKFS_Set_ACCELEROMETER */
+#ifdef AKFS_PRECISION_FIXED
+				AKFS_QNormSet(&prms->fv_ao, &prms->fv_as, AKM_ACC_TARGET, NULL,
+					&prms->s_aqn);
+				for (i = 0; i < st->n; i++) {
+					st->qav[i].u.x = (AKFS_Q16)st->acc[i][0] * AKFS_Q16_ONE;
+					st->qav[i].u.y = (AKFS_Q16)st->acc[i][1] * AKFS_Q16_ONE;
+					st->qav[i].u.z = (AKFS_Q16)st->acc[i][2] * AKFS_Q16_ONE;
+					AKFS_QNormApply(&prms->s_aqn, &st->qav[i], &st->qav[i]);
+					AKFS_QToVec(&st->qav[i], &st->av[i]);
+				}
+#else
+				for (i = 0; i < st->n; i++) {
+					st->av[i].u.x = AKM_ACC_TARGET *
+						(((AKFLOAT)st->acc[i][0] - prms->fv_ao.u.x) / prms->fv_as.u.x);
+					st->av[i].u.y = AKM_ACC_TARGET *
+						(((AKFLOAT)st->acc[i][1] - prms->fv_ao.u.y) / prms->fv_as.u.y);
+					st->av[i].u.z = AKM_ACC_TARGET *
+						(((AKFLOAT)st->acc[i][2] - prms->fv_ao.u.z) / prms->fv_as.u.z);
+				}
+#endif
+			}
+			t = BenchNow();
+			BenchRun(prms, st, stage);
+			t = BenchNow() - t;
+			if ((st->best[stage] < 0) || (t < st->best[stage])) {
+				st->best[stage] = t;
+			}
+		}
+	}
+	return AKM_SUCCESS;
+}
+
+/*!
+ Difference of angles in degree, modulo 360 degree.
+ */
+static double BenchAngleDiff(const double a, const double b)
+{
+	double d = fmod(fabs(a - b), 360.0);
+	return (d > 180.0) ? (360.0 - d) : d;
+}
+
+/*!
+ Check the results of a stream against its truth. The latter half of the
+ stream is checked, i.e. after the offset converged. The true orientation is
+ made of the averages of the true vectors, which are taken as many as the
+ library does. Azimuth is not checked while the field is within
+ #AKFS_BENCH_DIR_VERT degree from the vertical, since it is ill-conditioned.
+ @return If the errors are within #AKFS_BENCH_OFFSET_TOL and
+ #AKFS_BENCH_DIR_TOL, the return value is #AKM_SUCCESS. Otherwise the return
+ value is #AKM_ERROR.
+ @param[in] prms Library state. Only the transforms of data are used.
+ @param[in] st A stream which has the truth.
+ */
+static int16 BenchAccuracy(
+	const	AKMPRMS				*prms,
+	const	AKFS_BENCH_STREAM	*st)
+{
+	const AKFLOAT (*m)[3] = prms->s_hxform.m;
+	double ho[3], h[3], a[3], hr[3], ref[3];
+	const double cv = cos(AKFS_BENCH_DIR_VERT * M_PI / 180.0);
+	double d, hv, hh, aa, maxOffset = 0.0, maxDir = 0.0;
+	int i, j, k;
+
+	for (j = 0; j < 3; j++) {
+		ho[j] = m[j][0] * st->tho[0] + m[j][1] * st->tho[1]
+			+ m[j][2] * st->tho[2];
+	}
+	for (i = st->n / 2; i < st->n; i++) {
+		d = 0.0;
+		for (j = 0; j < 3; j++) {
+			d += (st->out[BENCH_AOC][i].v[j] - ho[j])
+				* (st->out[BENCH_AOC][i].v[j] - ho[j]);
+		}
+		d = sqrt(d);
+		/* NaN is never equal to anything. */
+		if (!(d <= maxOffset)) {
+			maxOffset = d;
+		}
+
+		for (j = 0; j < 3; j++) {
+			hr[j] = 0.0;
+			a[j] = 0.0;
+			for (k = 0; k < CSPEC_HNAVE_D; k++) {
+				hr[j] += st->th[i - k][j] / CSPEC_HNAVE_D;
+			}
+			for (k = 0; k < CSPEC_ANAVE_D; k++) {
+				a[j] += st->ta[i - k][j] / CSPEC_ANAVE_D;
+			}
+		}
+		for (j = 0; j < 3; j++) {
+			h[j] = m[j][0] * hr[0] + m[j][1] * hr[1] + m[j][2] * hr[2];
+			a[j] = (a[j] - prms->fv_ao.v[j]) / prms->fv_as.v[j];
+		}
+		if (AKFS_RefDirection(h, a, ref) != AKM_SUCCESS) {
+			continue;
+		}
+		hv = h[0] * a[0] + h[1] * a[1] + h[2] * a[2];
+		hh = h[0] * h[0] + h[1] * h[1] + h[2] * h[2];
+		aa = a[0] * a[0] + a[1] * a[1] + a[2] * a[2];
+		/* cos^2 of the angle between the field and the vertical */
+		hv = (hv * hv) / (hh * aa);
+		for (j = (hv > (cv * cv)) ? 1 : 0; j < 3; j++) {
+			d = BenchAngleDiff(st->out[BENCH_E2E][i].v[j], ref[j]);
+			if (!(d <= maxDir)) {
+				maxDir = d;
+			}
+		}
+	}
+
+	if ((maxOffset <= AKFS_BENCH_OFFSET_TOL) && (maxDir <= AKFS_BENCH_DIR_TOL)) {
+		ALOGI("bench %-9s truth : OK (offset %g uT, orientation %g deg)",
+			st->name, maxOffset, maxDir);
+		return AKM_SUCCESS;
+	}
+	ALOGI("bench %-9s truth : NG (offset %g uT, orientation %g deg)",
+		st->name, maxOffset, maxDir);
+	return AKM_ERROR;
+}
+
+/*!
+ Check AKFS_VBUF against the shift buffers which it replaced. The vnorm and
+ dir stages are calculated again by AKFS_RefVbNorm and AKFS_RefVbAve from the
+ same inputs, and the results must be the same bit by bit. The former is
+ timed. In a fixed point build, this is the accuracy of the fixed point
+ stages from float, and the results must be within #AKFS_BENCH_FIXED_TOL.
+ @return If the results are the same, the return value is #AKM_SUCCESS.
+ Otherwise the return value is #AKM_ERROR.
+ @param[in] prms Library state. Only the sensitivity is used.
+ @param[in,out] st A stream. The reference results are stored to ref.
+ */
+static int16 BenchVBuf(
+	const	AKMPRMS				*prms,
+			AKFS_BENCH_STREAM	*st)
+{
+	AKFVEC hdata[AKFS_HDATA_SIZE];
+	AKFVEC hvbuf[AKFS_HDATA_SIZE];
+	AKFVEC avbuf[AKFS_ADATA_SIZE];
+	AKFVEC have, aave, dir;
+	int64_t t, best = -1;
+	double d, maxDiff = 0.0;
+	int rep, i, j;
+
+	for (rep = 0; rep < AKFS_BENCH_REPEAT; rep++) {
+		AKFS_InitBuffer(AKFS_HDATA_SIZE, hdata);
+		AKFS_InitBuffer(AKFS_HDATA_SIZE, hvbuf);
+		t = BenchNow();
+		for (i = 0; i < st->n; i++) {
+			AKFS_BufShift(AKFS_HDATA_SIZE, 1, hdata);
+			hdata[0] = st->out[BENCH_DECOMP][i];
+			AKFS_RefVbNorm(AKFS_HDATA_SIZE, hdata, 1, &st->out[BENCH_AOC][i],
+				&prms->fv_hs, AKM_MAG_SENSE, AKFS_HDATA_SIZE, hvbuf);
+			AKFS_RefVbAve(AKFS_HDATA_SIZE, hvbuf, CSPEC_HNAVE_V, &st->ref[i]);
+		}
+		t = BenchNow() - t;
+		if ((best < 0) || (t < best)) {
+			best = t;
+		}
+	}
+
+	AKFS_InitBuffer(AKFS_HDATA_SIZE, hvbuf);
+	AKFS_InitBuffer(AKFS_ADATA_SIZE, avbuf);
+	for (i = 0; i < st->n; i++) {
+		AKFS_BufShift(AKFS_HDATA_SIZE, 1, hvbuf);
+		hvbuf[0] = st->hv[i];
+		AKFS_BufShift(AKFS_ADATA_SIZE, 1, avbuf);
+		avbuf[0] = st->av[i];
+		AKFS_RefVbAve(AKFS_HDATA_SIZE, hvbuf, CSPEC_HNAVE_D, &have);
+		AKFS_RefVbAve(AKFS_ADATA_SIZE, avbuf, CSPEC_ANAVE_D, &aave);
+		/* The stage leaves the result as it was allocated on error. */
+		if (AKFS_DirectionVec(&have, &aave, &dir.u.x, &dir.u.y, &dir.u.z)
+				!= AKFS_SUCCESS) {
+			dir.u.x = 0;
+			dir.u.y = 0;
+			dir.u.z = 0;
+		}
+		for (j = 0; j < 3; j++) {
+			d = fabs(st->ref[i].v[j] - st->out[BENCH_VNORM][i].v[j]);
+			/* NaN is never equal to anything. */
+			if (!(d <= maxDiff)) {
+				maxDiff = d;
+			}
+			d = (j == 0) ? BenchAngleDiff(dir.v[j], st->out[BENCH_DIR][i].v[j])
+				: fabs(dir.v[j] - st->out[BENCH_DIR][i].v[j]);
+			if (!(d <= maxDiff)) {
+				maxDiff = d;
+			}
+		}
+	}
+
+	ALOGI("bench %-9s vbuf  : %s (max diff %g, shift buffers %.1f ns/sample)",
+		st->name, (maxDiff <= BENCH_VBUF_TOL) ? "OK" : "NG", maxDiff,
+		(st->n > 0) ? ((double)best / st->n) : 0.0);
+	return (maxDiff <= BENCH_VBUF_TOL) ? AKM_SUCCESS : AKM_ERROR;
+}
+
+/*!
+ Check AKFS_Get4points, which scans the AKFS_SOA mirror of hbuf with the
+ kernels, against the scalar code over an array of structures, i.e.
+ AKFS_RefGet4points. Magnetic data of the stream are pushed to hbuf of an
+ AKFS_AOC_VAR in the same way as AKFS_AOC, and the 4 points are chosen from
+ it in every sample. The results must be the same. Each choice is timed
+ apart from the updates of hbuf.
+ @return If the results are the same, the return value is #AKM_SUCCESS.
+ Otherwise the return value is #AKM_ERROR.
+ @param[in] st A stream.
+ */
+static int16 BenchSimd(const AKFS_BENCH_STREAM *st)
+{
+	AKFS_AOC_VAR aocv;
+	AKFVEC aos[AKFS_HBUF_SIZE];
+	AKFVEC p4[4], r4[4];
+	int64_t t, tsoa, taos, bestSoa = -1, bestAos = -1;
+	int rep, i, k, nscan = 0, ndiff = 0;
+	int16 pret = 0, rret = 0;
+
+	for (rep = 0; rep < AKFS_BENCH_REPEAT; rep++) {
+		AKFS_InitAOC(&aocv);
+		AKFS_InitBuffer(AKFS_HBUF_SIZE, aos);
+		tsoa = 0;
+		taos = 0;
+		nscan = 0;
+		ndiff = 0;
+		for (i = 0; i < st->n; i++) {
+			*AKFS_VBufPush(&aocv.hbuf) = st->out[BENCH_DECOMP][i];
+			AKFS_SoaSet(aocv.hbuf.head, &st->out[BENCH_DECOMP][i], &aocv.hsoa);
+			AKFS_BufShift(AKFS_HBUF_SIZE, 1, aos);
+			aos[0] = st->out[BENCH_DECOMP][i];
+			if (aocv.hbuf.count < 4) {
+				continue;
+			}
+
+			t = BenchNow();
+			for (k = 0; k < BENCH_SCAN_REPEAT; k++) {
+				pret = AKFS_Get4points(&aocv, aocv.hbuf.count, p4);
+			}
+			tsoa += BenchNow() - t;
+
+			t = BenchNow();
+			for (k = 0; k < BENCH_SCAN_REPEAT; k++) {
+				rret = AKFS_RefGet4points(aos, aocv.hbuf.count, r4);
+			}
+			taos += BenchNow() - t;
+
+			/* The 4 points are not given when out[1] is too close. */
+			if ((pret != rret)
+				|| ((pret == 0) && (memcmp(p4, r4, sizeof(p4)) != 0))) {
+				ndiff++;
+			}
+			nscan++;
+		}
+		if ((bestSoa < 0) || (tsoa < bestSoa)) {
+			bestSoa = tsoa;
+		}
+		if ((bestAos < 0) || (taos < bestAos)) {
+			bestAos = taos;
+		}
+	}
+
+	nscan *= BENCH_SCAN_REPEAT;
+	ALOGI("bench %-9s simd  : %s (%d samples differ, " BENCH_KERNEL
+		" %.1f ns/scan, scalar AoS %.1f ns/scan)",
+		st->name, (ndiff == 0) ? "OK" : "NG", ndiff,
+		(nscan > 0) ? ((double)bestSoa / nscan) : 0.0,
+		(nscan > 0) ? ((double)bestAos / nscan) : 0.0);
+	return (ndiff == 0) ? AKM_SUCCESS : AKM_ERROR;
+}
+
+/*!
+ Check AKFS_AOC against AKFS_RefAOC, which scans the whole hbuf with sqrt in
+ every sample. The latter is timed in the same way as the aoc stage, and
+ its offsets must be within #AKFS_BENCH_TOL from the stage. They are also
+ compared with the golden file.
+ @return If the offsets are the same, the return value is #AKM_SUCCESS.
+ Otherwise the return value is #AKM_ERROR.
+ @param[in,out] st A stream. The reference offsets are stored to rho.
+ */
+static int16 BenchAOC(AKFS_BENCH_STREAM *st)
+{
+	AKFS_REF_AOC_VAR aocv;
+	AKFVEC ho;
+	int64_t t, best = -1;
+	double d, maxDiff = 0.0;
+	int rep, i, j, ndiff = 0;
+
+	for (rep = 0; rep < AKFS_BENCH_REPEAT; rep++) {
+		AKFS_RefInitAOC(&aocv);
+		ho = st->ho0;
+		t = BenchNow();
+		for (i = 0; i < st->n; i++) {
+			AKFS_RefAOC(&aocv, &st->out[BENCH_DECOMP][i], &ho);
+			st->rho[i] = ho;
+		}
+		t = BenchNow() - t;
+		if ((best < 0) || (t < best)) {
+			best = t;
+		}
+	}
+
+	for (i = 0; i < st->n; i++) {
+		for (j = 0; j < 3; j++) {
+			d = fabs(st->rho[i].v[j] - st->out[BENCH_AOC][i].v[j]);
+			/* NaN is never equal to anything. */
+			if (!(d <= maxDiff)) {
+				maxDiff = d;
+			}
+			if (!(d == 0.0)) {
+				ndiff++;
+				break;
+			}
+		}
+	}
+
+	ALOGI("bench %-9s aocref: %s (max diff %g in %d samples, "
+		"full scan %.1f ns/sample)",
+		st->name, (maxDiff <= AKFS_BENCH_TOL) ? "OK" : "NG", maxDiff, ndiff,
+		(st->n > 0) ? ((double)best / st->n) : 0.0);
+	return (maxDiff <= AKFS_BENCH_TOL) ? AKM_SUCCESS : AKM_ERROR;
+}
+
+/*!
+ Uniform random number in [0, 1) by a fixed sequence.
+ */
+static double BenchRand(unsigned int *seed)
+{
+	*seed = (*seed * 1103515245u) + 12345u;
+	return (double)((*seed >> 8) & 0xFFFF) / 65536.0;
+}
+
+/*!
+ Random unit vector over the whole sphere.
+ */
+static void BenchRandDir(unsigned int *seed, double v[3])
+{
+	double z = BenchRand(seed) * 2.0 - 1.0;
+	double phi = BenchRand(seed) * 2.0 * M_PI;
+	double r = sqrt(1.0 - z * z);
+
+	v[0] = r * cos(phi);
+	v[1] = r * sin(phi);
+	v[2] = z;
+}
+
+/*!
+ Check AKFS_DirectionVec of this build against AKFS_RefDirection, i.e. the
+ trigonometric path in double, over #AKFS_BENCH_TILT_SAMPLES random
+ directions of the gravity and the field. AKFS_RefDirectionVec, i.e. the
+ trigonometric path and libm in AKFLOAT, is checked and timed in the same
+ way for comparison. If AKFS_FAST_ATAN2 is defined, AKFS_FastAtan2 is also
+ checked against atan2 around the whole circle.
+ @return If the errors are within #AKFS_BENCH_TILT_TOL and
+ #AKFS_BENCH_ATAN2_TOL, the return value is #AKM_SUCCESS. Otherwise the
+ return value is #AKM_ERROR.
+ */
+static int16 BenchTilt(void)
+{
+	const int n = AKFS_BENCH_TILT_SAMPLES;
+	unsigned int seed = 54321;
+	AKFVEC *hv = NULL, *av = NULL;
+	AKFLOAT (*dir)[3] = NULL, (*rdir)[3] = NULL;
+	double dh[3], da[3], tdir[3], e;
+	double maxErr[3] = {0, 0, 0}, maxRef[3] = {0, 0, 0};
+#ifdef AKFS_FAST_ATAN2
+	double d;
+#endif
+	int64_t t, best = -1, bestRef = -1;
+	int rep, i, j;
+	int16 ret = AKM_ERROR;
+
+	hv = malloc(n * sizeof(*hv));
+	av = malloc(n * sizeof(*av));
+	dir = malloc(n * sizeof(*dir));
+	rdir = malloc(n * sizeof(*rdir));
+	if ((hv == NULL) || (av == NULL) || (dir == NULL) || (rdir == NULL)) {
+		AKMERROR_STR("malloc");
+		goto TILT_END;
+	}
+	for (i = 0; i < n; i++) {
+		BenchRandDir(&seed, dh);
+		BenchRandDir(&seed, da);
+		for (j = 0; j < 3; j++) {
+			hv[i].v[j] = (AKFLOAT)(dh[j] * 50.0);
+			av[i].v[j] = (AKFLOAT)(da[j] * 9.8);
+		}
+	}
+
+	for (rep = 0; rep < AKFS_BENCH_REPEAT; rep++) {
+		t = BenchNow();
+		for (i = 0; i < n; i++) {
+			AKFS_DirectionVec(&hv[i], &av[i], &dir[i][0], &dir[i][1], &dir[i][2]);
+		}
+		t = BenchNow() - t;
+		if ((best < 0) || (t < best)) {
+			best = t;
+		}
+		t = BenchNow();
+		for (i = 0; i < n; i++) {
+			AKFS_RefDirectionVec(&hv[i], &av[i],
+				&rdir[i][0], &rdir[i][1], &rdir[i][2]);
+		}
+		t = BenchNow() - t;
+		if ((bestRef < 0) || (t < bestRef)) {
+			bestRef = t;
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		/* The truth is made of the same inputs as AKFLOAT. */
+		for (j = 0; j < 3; j++) {
+			dh[j] = hv[i].v[j];
+			da[j] = av[i].v[j];
+		}
+		if (AKFS_RefDirection(dh, da, tdir) != AKM_SUCCESS) {
+			continue;
+		}
+		for (j = 0; j < 3; j++) {
+			e = (j == 0) ? BenchAngleDiff(dir[i][j], tdir[j])
+				: fabs(dir[i][j] - tdir[j]);
+			/* NaN is never equal to anything. */
+			if (!(e <= maxErr[j])) {
+				maxErr[j] = e;
+			}
+			e = (j == 0) ? BenchAngleDiff(rdir[i][j], tdir[j])
+				: fabs(rdir[i][j] - tdir[j]);
+			if (!(e <= maxRef[j])) {
+				maxRef[j] = e;
+			}
+		}
+	}
+
+	ret = ((maxErr[0] <= AKFS_BENCH_TILT_TOL) &&
+		(maxErr[1] <= AKFS_BENCH_TILT_TOL) &&
+		(maxErr[2] <= AKFS_BENCH_TILT_TOL)) ? AKM_SUCCESS : AKM_ERROR;
+	ALOGI("bench tilt : %s (" BENCH_DIRECTION " in %d orientations, "
+		"max error %g %g %g deg, %.1f ns/call)",
+		(ret == AKM_SUCCESS) ? "OK" : "NG", n,
+		maxErr[0], maxErr[1], maxErr[2], (double)best / n);
+	ALOGI("bench tilt : trig + libm: max error %g %g %g deg, %.1f ns/call",
+		maxRef[0], maxRef[1], maxRef[2], (double)bestRef / n);
+
+#ifdef AKFS_FAST_ATAN2
+	/* y and x of atan2 are stored to u.x and u.y of hv, around the whole
+	   circle with random radius. The axes are included. */
+	for (i = 0; i < n; i++) {
+		e = (2.0 * M_PI * i) / n - M_PI;
+		d = 0.01 + BenchRand(&seed) * 100.0;
+		hv[i].u.x = (AKFLOAT)(sin(e) * d);
+		hv[i].u.y = (AKFLOAT)(cos(e) * d);
+	}
+	best = -1;
+	bestRef = -1;
+	for (rep = 0; rep < AKFS_BENCH_REPEAT; rep++) {
+		t = BenchNow();
+		for (i = 0; i < n; i++) {
+			dir[i][0] = AKFS_FastAtan2(hv[i].u.x, hv[i].u.y);
+		}
+		t = BenchNow() - t;
+		if ((best < 0) || (t < best)) {
+			best = t;
+		}
+		t = BenchNow();
+		for (i = 0; i < n; i++) {
+			rdir[i][0] = AKFS_ATAN2(hv[i].u.x, hv[i].u.y);
+		}
+		t = BenchNow() - t;
+		if ((bestRef < 0) || (t < bestRef)) {
+			bestRef = t;
+		}
+	}
+	d = 0.0;
+	for (i = 0; i < n; i++) {
+		e = fabs(dir[i][0] - atan2((double)hv[i].u.x, (double)hv[i].u.y));
+		/* -PI and PI are the same angle. */
+		e = (e > M_PI) ? (2.0 * M_PI - e) : e;
+		if (!(e <= d)) {
+			d = e;
+		}
+	}
+	if (!(d <= AKFS_BENCH_ATAN2_TOL)) {
+		ret = AKM_ERROR;
+	}
+	ALOGI("bench atan2: %s (max error %g rad in %d samples, "
+		"%.1f ns/call, libm %.1f ns/call)",
+		(d <= AKFS_BENCH_ATAN2_TOL) ? "OK" : "NG", d, n,
+		(double)best / n, (double)bestRef / n);
+#endif
+
+TILT_END:
+	free(hv);
+	free(av);
+	free(dir);
+	free(rdir);
+	return ret;
+}
+
+/*!
+ Write results to a golden file.
+ */
+static int16 BenchWriteGolden(
+	const	char				*path,
+	const	AKFS_BENCH_STREAM	st[],
+	const	int					nst)
+{
+	FILE *fp;
+	int s, stage, i;
+
+	if ((fp = fopen(path, "w")) == NULL) {
+		AKMERROR_STR("fopen");
+		return AKM_ERROR;
+	}
+	fprintf(fp, "# akmdfs bench golden %s\n", BENCH_PRECISION);
+	for (s = 0; s < nst; s++) {
+		for (stage = 0; stage < BENCH_NSTAGE; stage++) {
+			for (i = 0; i < st[s].n; i++) {
+				fprintf(fp, "%s %s %d %.6e %.6e %.6e\n",
+					st[s].name, s_stageName[stage], i,
+					st[s].out[stage][i].u.x,
+					st[s].out[stage][i].u.y,
+					st[s].out[stage][i].u.z);
+			}
+		}
+	}
+	if (fclose(fp) != 0) {
+		AKMERROR_STR("fclose");
+		return AKM_ERROR;
+	}
+	ALOGI("bench: golden results are written to %s", path);
+	return AKM_SUCCESS;
+}
+
+/*!
+ Compare results with a golden file. Azimuth is compared modulo 360 degree.
+ @return If all results match, the return value is #AKM_SUCCESS.
+ Otherwise the return value is #AKM_ERROR.
+ */
+static int16 BenchCompareGolden(
+			FILE				*fp,
+	const	AKFS_BENCH_STREAM	st[],
+	const	int					nst)
+{
+	char line[BENCH_LINE_SIZE];
+	char name[32], stageName[32];
+	double maxDiff[BENCH_NSTREAM][BENCH_NSTAGE];
+	int count[BENCH_NSTREAM][BENCH_NSTAGE];
+	double maxRef[BENCH_NSTREAM];	/* AKFS_RefAOC with aoc */
+	double g[3], d;
+	int s, stage, i, j;
+	int16 ret = AKM_SUCCESS;
+
+	memset(count, 0, sizeof(count));
+	for (s = 0; s < BENCH_NSTREAM; s++) {
+		for (stage = 0; stage < BENCH_NSTAGE; stage++) {
+			maxDiff[s][stage] = 0.0;
+		}
+		maxRef[s] = 0.0;
+	}
+
+	/* The first line is the header, which tells the precision. */
+	if ((fgets(line, sizeof(line), fp) == NULL) ||
+		(sscanf(line, "# akmdfs bench golden %31s", name) != 1) ||
+		(strcmp(name, BENCH_PRECISION) != 0)) {
+		ALOGI("bench golden: NG (not made by a " BENCH_PRECISION " build)");
+		return AKM_ERROR;
+	}
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (line[0] == '#') {
+			continue;
+		}
+		if (sscanf(line, "%31s %31s %d %lf %lf %lf",
+				name, stageName, &i, &g[0], &g[1], &g[2]) != 6) {
+			continue;
+		}
+		for (s = 0; s < nst; s++) {
+			if (strcmp(name, st[s].name) == 0) {
+				break;
+			}
+		}
+		for (stage = 0; stage < BENCH_NSTAGE; stage++) {
+			if (strcmp(stageName, s_stageName[stage]) == 0) {
+				break;
+			}
+		}
+		if ((s >= nst) || (stage >= BENCH_NSTAGE) || (i < 0) || (i >= st[s].n)) {
+			continue;
+		}
+		for (j = 0; j < 3; j++) {
+			if ((j == 0) && ((stage == BENCH_DIR) || (stage == BENCH_E2E))) {
+				d = BenchAngleDiff(st[s].out[stage][i].v[j], g[j]);
+			} else {
+				d = fabs(st[s].out[stage][i].v[j] - g[j]);
+			}
+			/* NaN is never equal to anything. */
+			if (!(d <= maxDiff[s][stage])) {
+				maxDiff[s][stage] = d;
+			}
+			if (stage == BENCH_AOC) {
+				d = fabs(st[s].rho[i].v[j] - g[j]);
+				if (!(d <= maxRef[s])) {
+					maxRef[s] = d;
+				}
+			}
+		}
+		count[s][stage]++;
+	}
+
+	for (s = 0; s < nst; s++) {
+		for (stage = 0; stage < BENCH_NSTAGE; stage++) {
+			if ((count[s][stage] != st[s].n) ||
+				!(maxDiff[s][stage] <= AKFS_BENCH_TOL)) {
+				ret = AKM_ERROR;
+				ALOGI("bench %-9s %-6s: NG (%d/%d compared, max diff %g)",
+					st[s].name, s_stageName[stage],
+					count[s][stage], st[s].n, maxDiff[s][stage]);
+			} else {
+				ALOGI("bench %-9s %-6s: OK (max diff %g)",
+					st[s].name, s_stageName[stage], maxDiff[s][stage]);
+			}
+		}
+		if ((count[s][BENCH_AOC] != st[s].n) || !(maxRef[s] <= AKFS_BENCH_TOL)) {
+			ret = AKM_ERROR;
+			ALOGI("bench %-9s aocref: NG (max diff %g)", st[s].name, maxRef[s]);
+		} else {
+			ALOGI("bench %-9s aocref: OK (max diff %g)", st[s].name, maxRef[s]);
+		}
+	}
+	return ret;
+}
+
+/*!
+ Run the benchmark of the library, and check the results.
+ @return If all stages run without allocation and the results match the
+ golden file, the return value is #AKM_SUCCESS. Otherwise the return value is
+ #AKM_ERROR.
+ @param[in] pat Layout pattern.
+ @param[in] regs ASA values.
+ @param[in] golden A path to a golden file. If NULL, results are not checked.
+ @param[in,out] recorded If not NULL, a recorded stream is read from this
+ driver in addition to the synthetic stream.
+ */
+int16 AKFS_Bench(
+	const	AKFS_PATNO	pat,
+	const	uint8		regs[],
+	const	char		*golden,
+			AKD_CONTEXT	*recorded)
+{
+	AKFS_BENCH_STREAM st[BENCH_NSTREAM];
+	int nst = 0;
+	long heap;
+	int s, stage;
+	FILE *fp;
+	int16 ret = AKM_ERROR;
+
+	memset(st, 0, sizeof(st));
+	if (BenchSynthetic(&st[nst++]) != AKM_SUCCESS) {
+		AKMERROR_STR("malloc");
+		goto BENCH_END;
+	}
+	if (recorded != NULL) {
+		if (BenchRecorded(&st[nst++], recorded) != AKM_SUCCESS) {
+			AKMERROR_STR("malloc");
+			goto BENCH_END;
+		}
+	}
+
+	/* All buffers are allocated above. */
+	heap = BenchHeapUsed();
+	for (s = 0; s < nst; s++) {
+		if (BenchStream(&st[s], pat, regs) != AKM_SUCCESS) {
+			AKMERROR;
+			goto BENCH_END;
+		}
+	}
+	heap = BenchHeapUsed() - heap;
+
+	ALOGI("bench precision: " BENCH_PRECISION);
+	for (s = 0; s < nst; s++) {
+		for (stage = 0; stage < BENCH_NSTAGE; stage++) {
+			ALOGI("bench %-9s %-6s: %6d samples, %8.1f ns/sample",
+				st[s].name, s_stageName[stage], st[s].n,
+				(st[s].n > 0) ? ((double)st[s].best[stage] / st[s].n) : 0.0);
+		}
+	}
+	ALOGI("bench heap: %s (%ld bytes)",
+		(heap == 0) ? "no allocation" : "ALLOCATED", heap);
+	ret = (heap == 0) ? AKM_SUCCESS : AKM_ERROR;
+
+	for (s = 0; s < nst; s++) {
+		if ((st[s].th != NULL) &&
+			(BenchAccuracy(&s_prms, &st[s]) != AKM_SUCCESS)) {
+			ret = AKM_ERROR;
+		}
+		if (BenchVBuf(&s_prms, &st[s]) != AKM_SUCCESS) {
+			ret = AKM_ERROR;
+		}
+		if (BenchSimd(&st[s]) != AKM_SUCCESS) {
+			ret = AKM_ERROR;
+		}
+		if (BenchAOC(&st[s]) != AKM_SUCCESS) {
+			ret = AKM_ERROR;
+		}
+	}
+	if (BenchTilt() != AKM_SUCCESS) {
+		ret = AKM_ERROR;
+	}
+
+	if (golden != NULL) {
+		if ((fp = fopen(golden, "r")) != NULL) {
+			if (BenchCompareGolden(fp, st, nst) != AKM_SUCCESS) {
+				ret = AKM_ERROR;
+			}
+			fclose(fp);
+		} else if (errno == ENOENT) {
+			if (BenchWriteGolden(golden, st, nst) != AKM_SUCCESS) {
+				ret = AKM_ERROR;
+			}
+		} else {
+			AKMERROR_STR("fopen");
+			ret = AKM_ERROR;
+		}
+	}
+
+BENCH_END:
+	for (s = 0; s < nst; s++) {
+		BenchFree(&st[s]);
+	}
+	return ret;
+}
@@ -0,0 +1,70 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2012 Asahi Kasei Microdevices Corporation, Japan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************/
+#ifndef AKFS_INC_BENCH_H
+#define AKFS_INC_BENCH_H
+
+#include "AKFS_Compass.h"
+
+/*** Constant definition ******************************************************/
+/*! Layout of the synthetic stream, when no layout is given and there is no
+  recorded stream */
+#define AKFS_BENCH_LAYOUT	PAT1
+/*! ASA values of the synthetic stream, when there is no recorded stream */
+#define AKFS_BENCH_ASA		128
+/*! Number of samples of the synthetic stream */
+#define AKFS_BENCH_SAMPLES	2000
+/*! Maximum number of samples read from the recorded stream */
+#define AKFS_BENCH_MAX_REC	100000
+/*! Each stage is timed this many times, and the best is reported. */
+#define AKFS_BENCH_REPEAT	20
+/*! Tolerance of the comparison with golden results */
+#define AKFS_BENCH_TOL		(0.01)
+/*! Tolerance of the vnorm and dir stages of a fixed point build from the
+  float reference code, in uT and degree */
+#define AKFS_BENCH_FIXED_TOL	(0.01)
+/*! Tolerance of the offset of the synthetic stream from the truth, in uT */
+#define AKFS_BENCH_OFFSET_TOL	(2.0)
+/*! Tolerance of the orientation of the synthetic stream from the truth, in
+  degree */
+#define AKFS_BENCH_DIR_TOL		(5.0)
+/*! Azimuth is not checked while the field is within this angle from the
+  vertical, in degree */
+#define AKFS_BENCH_DIR_VERT		(30.0)
+/*! Number of random orientations over the whole sphere, which are checked
+  against the trigonometric path */
+#define AKFS_BENCH_TILT_SAMPLES	200000
+/*! Tolerance of the orientation from the trigonometric path in double, in
+  degree */
+#define AKFS_BENCH_TILT_TOL		(0.01)
+/*! Tolerance of AKFS_FastAtan2 from atan2, in radian */
+#define AKFS_BENCH_ATAN2_TOL	(1.0e-5)
+
+/*** Type declaration *********************************************************/
+
+/*** Global variables *********************************************************/
+
+/*** Prototype of function ****************************************************/
+int16 AKFS_Bench(
+	const	AKFS_PATNO	pat,
+	const	uint8		regs[],
+	const	char		*golden,
+			AKD_CONTEXT	*recorded
+);
+
+#endif
+
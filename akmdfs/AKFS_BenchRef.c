@@ -0,0 +1,541 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2012 Asahi Kasei Microdevices Corporation, Japan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************/
+#include <math.h>
+#include "AKFS_Common.h"
+#include "AKFS_BenchRef.h"
+
+/*!
+ Normalize vectors and store them to a shift buffer. Same as AKFS_VbNorm.
+ @return If this function succeeds, the return value is #AKM_SUCCESS.
+ Otherwise the return value is #AKM_ERROR.
+ @param[in] ndata Size of raw vector buffer
+ @param[in] vdata Raw vector buffer
+ @param[in] nbuf Size of data to be buffered
+ @param[in] o Offset
+ @param[in] s Sensitivity
+ @param[in] tgt Target sensitivity
+ @param[in] nvec Size of normalized vector buffer
+ @param[out] vvec Normalized vector buffer
+ */
+int16 AKFS_RefVbNorm(
+	const	int16	ndata,
+	const	AKFVEC	vdata[],
+	const	int16	nbuf,
+	const	AKFVEC	*o,
+	const	AKFVEC	*s,
+	const	AKFLOAT	tgt,
+	const	int16	nvec,
+			AKFVEC	vvec[])
+{
+	int i;
+
+	/* size check */
+	if ((ndata <= 0) || (nvec <= 0) || (nbuf <= 0)) {
+		return AKM_ERROR;
+	}
+	/* dependency check */
+	if ((nbuf < 1) || (ndata < nbuf) || (nvec < nbuf)) {
+		return AKM_ERROR;
+	}
+	/* sensitivity check */
+	if ((s->u.x <= AKFS_EPSILON) ||
+		(s->u.y <= AKFS_EPSILON) ||
+		(s->u.z <= AKFS_EPSILON) ||
+		(tgt <= 0)) {
+		return AKM_ERROR;
+	}
+
+	/* calculate and store data to buffer */
+	if (AKFS_BufShift(nvec, nbuf, vvec) != AKFS_SUCCESS) {
+		return AKM_ERROR;
+	}
+	for (i = 0; i < nbuf; i++) {
+		vvec[i].u.x = ((vdata[i].u.x - o->u.x) / (s->u.x) * (AKFLOAT)tgt);
+		vvec[i].u.y = ((vdata[i].u.y - o->u.y) / (s->u.y) * (AKFLOAT)tgt);
+		vvec[i].u.z = ((vdata[i].u.z - o->u.z) / (s->u.z) * (AKFLOAT)tgt);
+	}
+
+	return AKM_SUCCESS;
+}
+
+/*!
+ Average the newest vectors of a shift buffer. Same as AKFS_VbAve. The
+ average stops at the first element which holds AKFS_INIT_VALUE_F.
+ @return If this function succeeds, the return value is #AKM_SUCCESS.
+ Otherwise the return value is #AKM_ERROR.
+ @param[in] nvec Size of normalized vector buffer
+ @param[in] vvec Normalized vector buffer
+ @param[in] nave Number of average
+ @param[out] vave Averaged vector
+ */
+int16 AKFS_RefVbAve(
+	const	int16	nvec,
+	const	AKFVEC	vvec[],
+	const	int16	nave,
+			AKFVEC	*vave)
+{
+	int i;
+
+	/* arguments check */
+	if ((nave <= 0) || (nvec <= 0) || (nvec < nave)) {
+		return AKM_ERROR;
+	}
+
+	/* calculate average */
+	vave->u.x = 0;
+	vave->u.y = 0;
+	vave->u.z = 0;
+	for (i = 0; i < nave; i++) {
+		if ((vvec[i].u.x == AKFS_INIT_VALUE_F) ||
+			(vvec[i].u.y == AKFS_INIT_VALUE_F) ||
+			(vvec[i].u.z == AKFS_INIT_VALUE_F)) {
+			break;
+		}
+		vave->u.x += vvec[i].u.x;
+		vave->u.y += vvec[i].u.y;
+		vave->u.z += vvec[i].u.z;
+	}
+	if (i > 0) {
+		vave->u.x /= i;
+		vave->u.y /= i;
+		vave->u.z /= i;
+	}
+	return AKM_SUCCESS;
+}
+
+/*!
+ Choose 4 points which are apart from each other. out[0] is the newest one,
+ out[1] is the farthest from it, out[2] makes the largest triangle with them,
+ and out[3] is the farthest from their plane. Same as AKFS_Get4points in
+ AKFS_AOC, but over an array of structures.
+ @return 0 on success, -1 if out[1] is too close.
+ @param[in] v Vectors, the newest one first.
+ @param[in] n Number of vectors.
+ @param[out] out 4 points.
+ */
+int16 AKFS_RefGet4points(
+	const	AKFVEC	v[],
+	const	int16	n,
+			AKFVEC	out[4])
+{
+	int16	i, j;
+	AKFLOAT	temp;
+	AKFLOAT	d;
+	AKFVEC	dv;
+	AKFVEC	dv0;
+	AKFVEC	c;
+	AKFVEC	cross = {{0, 0, 0}};
+
+	out[0] = v[0];
+	out[1] = v[0];
+	out[2] = v[0];
+	out[3] = v[0];
+
+	/* out 1 */
+	d = 0.0;
+	for (i = 1; i < n; i++) {
+		for (j = 0; j < 3; j++) {
+			dv.v[j] = v[i].v[j] - out[0].v[j];
+		}
+		temp = ((dv.u.x * dv.u.x) + (dv.u.y * dv.u.y)) + (dv.u.z * dv.u.z);
+		if (d < temp) {
+			d = temp;
+			out[1] = v[i];
+		}
+	}
+	if (d < (AKFS_HR_TH * AKFS_HR_TH)) {
+		return -1;
+	}
+
+	/* out 2 */
+	for (j = 0; j < 3; j++) {
+		dv0.v[j] = out[1].v[j] - out[0].v[j];
+	}
+	d = 0.0;
+	for (i = 1; i < n; i++) {
+		for (j = 0; j < 3; j++) {
+			dv.v[j] = v[i].v[j] - out[0].v[j];
+		}
+		c.v[0] = (dv0.v[1] * dv.v[2]) - (dv0.v[2] * dv.v[1]);
+		c.v[1] = (dv0.v[2] * dv.v[0]) - (dv0.v[0] * dv.v[2]);
+		c.v[2] = (dv0.v[0] * dv.v[1]) - (dv0.v[1] * dv.v[0]);
+		temp = ((c.u.x * c.u.x) + (c.u.y * c.u.y)) + (c.u.z * c.u.z);
+		if (d < temp) {
+			d = temp;
+			out[2] = v[i];
+			cross = c;
+		}
+	}
+
+	/* out 3 */
+	d = 0.0;
+	for (i = 1; i < n; i++) {
+		temp = AKFS_FABS((((v[i].u.x - out[0].u.x) * cross.u.x)
+			+ ((v[i].u.y - out[0].u.y) * cross.u.y))
+			+ ((v[i].u.z - out[0].u.z) * cross.u.z));
+		if (d < temp) {
+			d = temp;
+			out[3] = v[i];
+		}
+	}
+	return 0;
+}
+
+/*!
+ Distance of two vectors.
+ */
+static AKFLOAT RefCalcR(
+	const	AKFVEC	*x,
+	const	AKFVEC	*y)
+{
+	int16	i;
+	AKFLOAT	r;
+
+	r = 0.0;
+	for (i = 0; i < 3; i++) {
+		r += (x->v[i]-y->v[i]) * (x->v[i]-y->v[i]);
+	}
+	return AKFS_SQRT(r);
+}
+
+/*!
+ Center and radius of the sphere which passes 4 points.
+ @return 0 on success, -1 if the points are on a plane.
+ */
+static int16 RefFrom4Points2Sphere(
+	const	AKFVEC		points[],
+			AKFVEC		*center,
+			AKFLOAT		*r)
+{
+	AKFLOAT	dif[3][3];
+	AKFLOAT	r2[3];
+	AKFLOAT	A, B, C, D, E, F, G;
+	AKFLOAT	OU, OD;
+	int16	i, j;
+
+	for (i = 0; i < 3; i++) {
+		r2[i] = 0.0;
+		for (j = 0; j < 3; j++) {
+			dif[i][j] = points[i].v[j] - points[3].v[j];
+			r2[i] += (points[i].v[j]*points[i].v[j]
+					- points[3].v[j]*points[3].v[j]);
+		}
+		r2[i] *= AKFS_F(0.5);
+	}
+
+	A = dif[0][0]*dif[2][2] - dif[0][2]*dif[2][0];
+	B = dif[0][1]*dif[2][0] - dif[0][0]*dif[2][1];
+	C = dif[0][0]*dif[2][1] - dif[0][1]*dif[2][0];
+	D = dif[0][0]*r2[2]		- dif[2][0]*r2[0];
+	E = dif[0][0]*dif[1][1] - dif[0][1]*dif[1][0];
+	F = dif[1][0]*dif[0][2] - dif[0][0]*dif[1][2];
+	G = dif[0][0]*r2[1]		- dif[1][0]*r2[0];
+
+	OU = D*E + B*G;
+	OD = C*F + A*E;
+	if (AKFS_FABS(OD) < AKFS_EPSILON) {
+		return -1;
+	}
+	center->v[2] = OU / OD;
+
+	OU = F*center->v[2] + G;
+	OD = E;
+	if (AKFS_FABS(OD) < AKFS_EPSILON) {
+		return -1;
+	}
+	center->v[1] = OU / OD;
+
+	OU = r2[0] - dif[0][1]*center->v[1] - dif[0][2]*center->v[2];
+	OD = dif[0][0];
+	if (AKFS_FABS(OD) < AKFS_EPSILON) {
+		return -1;
+	}
+	center->v[0] = OU / OD;
+
+	*r = RefCalcR(&points[0], center);
+	return 0;
+}
+
+/*!
+ Center and size of the bounding box of vectors.
+ */
+static void RefMeanVar(
+	const	AKFVEC	v[],
+	const	int16	n,
+			AKFVEC	*mean,
+			AKFVEC	*var)
+{
+	int16	i, j;
+	AKFVEC	max;
+	AKFVEC	min;
+
+	for (j = 0; j < 3; j++) {
+		min.v[j] = v[0].v[j];
+		max.v[j] = v[0].v[j];
+		for (i = 1; i < n; i++) {
+			if (v[i].v[j] < min.v[j]) {
+				min.v[j] = v[i].v[j];
+			}
+			if (v[i].v[j] > max.v[j]) {
+				max.v[j] = v[i].v[j];
+			}
+		}
+		mean->v[j] = (max.v[j] + min.v[j]) / AKFS_F(2.0);
+		var->v[j] = max.v[j] - min.v[j];
+	}
+}
+
+/*!
+ Same as AKFS_RefGet4points, but out[1] is chosen by the distance with sqrt,
+ and it does not stop when out[1] is too close.
+ */
+static void RefGet4pointsSqrt(
+	const	AKFVEC	v[],
+	const	int16	n,
+			AKFVEC	out[])
+{
+	int16	i, j;
+	AKFLOAT temp;
+	AKFLOAT d;
+	AKFVEC	dv[AKFS_HBUF_SIZE];
+	AKFVEC	cross = {{0, 0, 0}};
+	AKFVEC	tempv;
+
+	out[0] = v[0];
+	out[1] = v[0];
+	out[2] = v[0];
+	out[3] = v[0];
+
+	/* out 1 */
+	d = 0.0;
+	for (i = 1; i < n; i++) {
+		temp = RefCalcR(&v[i], &out[0]);
+		if (d < temp) {
+			d = temp;
+			out[1] = v[i];
+		}
+	}
+
+	/* out 2 */
+	d = 0.0;
+	for (j = 0; j < 3; j++) {
+		dv[0].v[j] = out[1].v[j] - out[0].v[j];
+	}
+	for (i = 1; i < n; i++) {
+		for (j = 0; j < 3; j++) {
+			dv[i].v[j] = v[i].v[j] - out[0].v[j];
+		}
+		tempv.v[0] = dv[0].v[1]*dv[i].v[2] - dv[0].v[2]*dv[i].v[1];
+		tempv.v[1] = dv[0].v[2]*dv[i].v[0] - dv[0].v[0]*dv[i].v[2];
+		tempv.v[2] = dv[0].v[0]*dv[i].v[1] - dv[0].v[1]*dv[i].v[0];
+		temp =	tempv.u.x * tempv.u.x
+			  +	tempv.u.y * tempv.u.y
+			  +	tempv.u.z * tempv.u.z;
+		if (d < temp) {
+			d = temp;
+			out[2] = v[i];
+			cross = tempv;
+		}
+	}
+
+	/* out 3 */
+	d = 0.0;
+	for (i = 1; i < n; i++) {
+		temp =	  dv[i].u.x * cross.u.x
+				+ dv[i].u.y * cross.u.y
+				+ dv[i].u.z * cross.u.z;
+		temp = AKFS_FABS(temp);
+		if (d < temp) {
+			d = temp;
+			out[3] = v[i];
+		}
+	}
+}
+
+/*!
+ Estimate the offset of magnetic data. Same as AKFS_AOC.
+ @return If a new offset is estimated, the return value is #AKM_SUCCESS.
+ Otherwise the return value is #AKM_ERROR.
+ @param[in,out] haocv State of the estimator.
+ @param[in] hdata New magnetic data.
+ @param[in,out] ho Offset. It is updated only on success.
+ */
+int16 AKFS_RefAOC(
+			AKFS_REF_AOC_VAR	*haocv,
+	const	AKFVEC				*hdata,
+			AKFVEC				*ho)
+{
+	int16	i, j;
+	int16	num;
+	AKFLOAT	tempf;
+	AKFVEC	tempho;
+	AKFVEC	fourpoints[4];
+	AKFVEC	var;
+	AKFVEC	mean;
+
+	/* buffer new data */
+	if (AKFS_BufShift(AKFS_HBUF_SIZE, 1, haocv->hbuf) != AKFS_SUCCESS) {
+		return AKM_ERROR;
+	}
+	haocv->hbuf[0] = *hdata;
+
+	/* number of data, i.e. up to the last element which is not initial */
+	num = 0;
+	for (i = AKFS_HBUF_SIZE; 3 < i; i--) {
+		if (haocv->hbuf[i-1].u.x != AKFS_INIT_VALUE_F) {
+			num = i;
+			break;
+		}
+	}
+	if (num < 4) {
+		return AKM_ERROR;
+	}
+
+	RefGet4pointsSqrt(haocv->hbuf, num, fourpoints);
+
+	if (0 != RefFrom4Points2Sphere(fourpoints, &tempho, &haocv->hraoc)) {
+		return AKM_ERROR;
+	}
+
+	/* check distance */
+	for (i = 0; i < 4; i++) {
+		for (j = (i+1); j < 4; j++) {
+			tempf = RefCalcR(&fourpoints[i], &fourpoints[j]);
+			if ((tempf < haocv->hraoc) || (tempf < AKFS_HR_TH)) {
+				return AKM_ERROR;
+			}
+		}
+	}
+
+	/* update offset buffer */
+	if (AKFS_BufShift(AKFS_HOBUF_SIZE, 1, haocv->hobuf) != AKFS_SUCCESS) {
+		return AKM_ERROR;
+	}
+	haocv->hobuf[0] = tempho;
+
+	/* clear hbuf */
+	AKFS_InitBuffer(AKFS_HBUF_SIZE - (AKFS_HBUF_SIZE>>1),
+		&haocv->hbuf[AKFS_HBUF_SIZE>>1]);
+
+	if (haocv->hobuf[AKFS_HOBUF_SIZE-1].u.x == AKFS_INIT_VALUE_F) {
+		return AKM_ERROR;
+	}
+
+	/* Check ovar */
+	tempf = haocv->hraoc * AKFS_HO_TH;
+	RefMeanVar(haocv->hobuf, AKFS_HOBUF_SIZE, &mean, &var);
+	if ((var.u.x >= tempf) || (var.u.y >= tempf) || (var.u.z >= tempf)) {
+		return AKM_ERROR;
+	}
+
+	*ho = mean;
+	return AKM_SUCCESS;
+}
+
+/*!
+ Initialize the state of AKFS_RefAOC.
+ */
+void AKFS_RefInitAOC(
+			AKFS_REF_AOC_VAR	*haocv)
+{
+	AKFS_InitBuffer(AKFS_HBUF_SIZE, haocv->hbuf);
+	AKFS_InitBuffer(AKFS_HOBUF_SIZE, haocv->hobuf);
+	haocv->hraoc = 0.0;
+}
+
+/*!
+ Orientation by the trigonometric path, i.e. pitch and roll by asin, and the
+ magnetic vector is projected to the horizontal plane by sin and cos of them.
+ The coordinate system is the same as AKFS_Direction.
+ @return If this function succeeds, the return value is #AKM_SUCCESS.
+ Otherwise the return value is #AKM_ERROR.
+ @param[in] h Magnetic vector. It does not need to be normalized.
+ @param[in] a Acceleration vector. It does not need to be normalized.
+ @param[out] dir Azimuth [0, 360), pitch and roll in degree.
+ */
+int16 AKFS_RefDirection(
+	const	double	h[3],
+	const	double	a[3],
+			double	dir[3])
+{
+	double av, pitch, roll, xh, yh;
+
+	av = sqrt(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+	if (av <= 0.0) {
+		return AKM_ERROR;
+	}
+	pitch = asin(-a[1] / av);
+	roll = asin(a[0] / av);
+
+	yh = -h[0] * cos(roll) + h[2] * sin(roll);
+	xh = h[0] * sin(pitch) * sin(roll) + h[1] * cos(pitch)
+		+ h[2] * sin(pitch) * cos(roll);
+
+	dir[0] = atan2(yh, xh) * 180.0 / M_PI;
+	dir[1] = pitch * 180.0 / M_PI;
+	dir[2] = roll * 180.0 / M_PI;
+	if (dir[0] < 0.0) {
+		dir[0] += 360.0;
+	}
+	return AKM_SUCCESS;
+}
+
+/*!
+ AKFS_DirectionVec by the trigonometric path in AKFLOAT, i.e. the library
+ without AKFS_DIRECTION_ALGEBRAIC and AKFS_FAST_ATAN2.
+ @return If this function succeeds, the return value is #AKM_SUCCESS.
+ Otherwise the return value is #AKM_ERROR.
+ @param[in] have Magnetic vector.
+ @param[in] aave Acceleration vector.
+ @param[out] azimuth Azimuth [0, 360) in degree.
+ @param[out] pitch Pitch in degree.
+ @param[out] roll Roll in degree.
+ */
+int16 AKFS_RefDirectionVec(
+	const	AKFVEC	*have,
+	const	AKFVEC	*aave,
+			AKFLOAT	*azimuth,
+			AKFLOAT	*pitch,
+			AKFLOAT	*roll)
+{
+	AKFLOAT av, p, r, sinP, cosP, sinR, cosR, xh, yh;
+
+	av = AKFS_SQRT(aave->u.x * aave->u.x + aave->u.y * aave->u.y
+		+ aave->u.z * aave->u.z);
+	if (av < AKFS_EPSILON) {
+		return AKM_ERROR;
+	}
+	p = AKFS_ASIN(-(aave->u.y) / av);
+	r = AKFS_ASIN((aave->u.x) / av);
+
+	sinP = AKFS_SIN(p);
+	cosP = AKFS_COS(p);
+	sinR = AKFS_SIN(r);
+	cosR = AKFS_COS(r);
+	yh = -(have->u.x) * cosR + (have->u.z) * sinR;
+	xh = (have->u.x) * sinP * sinR + (have->u.y) * cosP
+		+ (have->u.z) * sinP * cosR;
+
+	*azimuth = RAD2DEG(AKFS_ATAN2(yh, xh));
+	*pitch = RAD2DEG(p);
+	*roll = RAD2DEG(r);
+	if (*azimuth < 0) {
+		*azimuth += 360.0f;
+	}
+	return AKM_SUCCESS;
+}
@@ -0,0 +1,99 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2012 Asahi Kasei Microdevices Corporation, Japan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************/
+#ifndef AKFS_INC_BENCHREF_H
+#define AKFS_INC_BENCHREF_H
+
+#include "AKFS_Compass.h"
+
+/*
+ * Reference implementations for the benchmark.
+ * - AKFS_RefVb*: the library before AKFS_VBUF, i.e. the history buffers are
+ *   arrays shifted by AKFS_BufShift, and unused elements hold
+ *   AKFS_INIT_VALUE_F. They are calculated in AKFLOAT, and the results must
+ *   be the same as the library bit by bit.
+ * - AKFS_RefGet4points: AKFS_Get4points in AKFS_AOC by scalar code over an
+ *   array of structures, i.e. before the AKFS_SOA kernels. The results must
+ *   be the same as the kernels bit by bit.
+ * - AKFS_RefAOC: AKFS_AOC before the incremental bounding box and the
+ *   memoized sphere fit, i.e. Get4points scans the whole hbuf with sqrt in
+ *   every sample. It is calculated in AKFLOAT.
+ * - AKFS_RefDirection: always calculated in double, whatever AKFLOAT is, so
+ *   that every precision is checked against the same results.
+ * - AKFS_RefDirectionVec: AKFS_DirectionVec by the trigonometric path and
+ *   atan2 of libm in AKFLOAT, i.e. before AKFS_DIRECTION_ALGEBRAIC and
+ *   AKFS_FAST_ATAN2.
+ */
+
+/*** Type declaration *********************************************************/
+typedef struct _AKFS_REF_AOC_VAR {
+	AKFVEC		hbuf[AKFS_HBUF_SIZE];
+	AKFVEC		hobuf[AKFS_HOBUF_SIZE];
+	AKFLOAT		hraoc;
+} AKFS_REF_AOC_VAR;
+
+/*** Prototype of function ****************************************************/
+int16 AKFS_RefVbNorm(
+	const	int16	ndata,
+	const	AKFVEC	vdata[],
+	const	int16	nbuf,
+	const	AKFVEC	*o,
+	const	AKFVEC	*s,
+	const	AKFLOAT	tgt,
+	const	int16	nvec,
+			AKFVEC	vvec[]
+);
+
+int16 AKFS_RefVbAve(
+	const	int16	nvec,
+	const	AKFVEC	vvec[],
+	const	int16	nave,
+			AKFVEC	*vave
+);
+
+int16 AKFS_RefGet4points(
+	const	AKFVEC	v[],
+	const	int16	n,
+			AKFVEC	out[4]
+);
+
+int16 AKFS_RefAOC(
+			AKFS_REF_AOC_VAR	*haocv,
+	const	AKFVEC				*hdata,
+			AKFVEC				*ho
+);
+
+void AKFS_RefInitAOC(
+			AKFS_REF_AOC_VAR	*haocv
+);
+
+int16 AKFS_RefDirection(
+	const	double	h[3],
+	const	double	a[3],
+			double	dir[3]
+);
+
+int16 AKFS_RefDirectionVec(
+	const	AKFVEC	*have,
+	const	AKFVEC	*aave,
+			AKFLOAT	*azimuth,
+			AKFLOAT	*pitch,
+			AKFLOAT	*roll
+);
+
+#endif
+
@@ -28,10 +28,25 @@
 #define CSPEC_HNAVE_V	8
 #define CSPEC_ANAVE_V	8
 
+/* Parameters for adaptive sampling (-a option) */
+/*	The number of acceleration data of which variance is checked. */
+#define CSPEC_STILL_NAVE	8
+/*	The device is still while the variance is less than this value.
+	Sum of 3 axes in (m/s^2)^2. */
+#define CSPEC_STILL_VAR		(0.01f)
+/*	While still, the magnetic sensor is measured once in this many cycles. */
+#define CSPEC_STILL_DIV		5
+
 #ifdef WIN32
 #define CSPEC_SETTING_FILE	"akmdfs.txt"
+#define CSPEC_STATE_FILE	"akmdfs.bin"
+#define CSPEC_TRACE_FILE	"akmdfs_trace.txt"
+#define CSPEC_STATS_FILE	"akmdfs_stats.txt"
 #else
 #define CSPEC_SETTING_FILE	"/data/misc/akmdfs.txt"
+#define CSPEC_STATE_FILE	"/data/misc/akmdfs.bin"
+#define CSPEC_TRACE_FILE	"/data/misc/akmdfs_trace.txt"
+#define CSPEC_STATS_FILE	"/data/misc/akmdfs_stats.txt"
 #endif
 
 #endif
@@ -0,0 +1,295 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2012 Asahi Kasei Microdevices Corporation, Japan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************/
+#include <sys/resource.h>
+#include "AKFS_Common.h"
+#include "AKFS_Calib.h"
+
+/*** Constant definition ******************************************************/
+/* Nice value of the calibration thread. */
+#define AKFS_CALIB_NICE		19
+
+#define CALIB_IDLE			0	/*!< Waiting for a request */
+#define CALIB_REQUESTED		1	/*!< Bins are posted */
+#define CALIB_BUSY			2	/*!< Fitting */
+
+/*!
+ A thread function which fits an ellipsoid whenever bins are posted, and
+ saves the state file whenever a checkpoint is requested.
+ @param[in] args A pointer to #AKFS_CALIB.
+ */
+static void* calib_main(void* args)
+{
+	AKFS_CALIB *cal = (AKFS_CALIB *)args;
+	AKFS_ECAL_RES res;
+	int16 ret;
+
+	AKFS_TraceAttach(cal->trace);
+
+	/* Stay out of the way of the measurement thread. On Linux, the nice
+	   value is per thread. */
+	if (setpriority(PRIO_PROCESS, 0, AKFS_CALIB_NICE) != 0) {
+		AKMERROR_STR("setpriority");
+	}
+
+	pthread_mutex_lock(&cal->mutex);
+	while (cal->quit == AKM_FALSE) {
+		if (cal->ckptState == CALIB_REQUESTED) {
+			cal->ckptState = CALIB_BUSY;
+			pthread_mutex_unlock(&cal->mutex);
+
+			if (AKFS_SaveState(&cal->ckpt, CSPEC_STATE_FILE) != AKM_SUCCESS) {
+				AKMERROR_STR("AKFS_SaveState");
+			}
+
+			pthread_mutex_lock(&cal->mutex);
+			cal->ckptState = CALIB_IDLE;
+			continue;
+		}
+		if (cal->state != CALIB_REQUESTED) {
+			pthread_cond_wait(&cal->cond, &cal->mutex);
+			continue;
+		}
+		cal->state = CALIB_BUSY;
+		pthread_mutex_unlock(&cal->mutex);
+
+		ret = AKFS_ECalFit(&cal->bins, &res);
+
+		pthread_mutex_lock(&cal->mutex);
+		if (ret == AKFS_SUCCESS) {
+			AKMDEBUG(AKMDATA_MAG, "ECal: ho=%8.2f, %8.2f, %8.2f r=%6.2f e=%5.2f\n",
+				res.ho.u.x, res.ho.u.y, res.ho.u.z, res.hr, res.resid);
+			cal->res = res;
+			cal->resNew = AKM_TRUE;
+		}
+		cal->state = CALIB_IDLE;
+	}
+	pthread_mutex_unlock(&cal->mutex);
+
+	return ((void*)0);
+}
+
+/*!
+ Initialize a context. The thread is not started.
+ @return If this function succeeds, the return value is #AKM_SUCCESS.
+ Otherwise the return value is #AKM_ERROR.
+ @param[out] cal
+ */
+int16 AKFS_CalibInit(
+			AKFS_CALIB		*cal
+)
+{
+	memset(cal, 0, sizeof(AKFS_CALIB));
+	cal->running = AKM_FALSE;
+	cal->sync = AKM_FALSE;
+	cal->state = CALIB_IDLE;
+	cal->ckptState = CALIB_IDLE;
+
+	if (pthread_mutex_init(&cal->mutex, NULL) != 0) {
+		AKMERROR_STR("pthread_mutex_init");
+		return AKM_ERROR;
+	}
+	if (pthread_cond_init(&cal->cond, NULL) != 0) {
+		AKMERROR_STR("pthread_cond_init");
+		pthread_mutex_destroy(&cal->mutex);
+		return AKM_ERROR;
+	}
+	return AKM_SUCCESS;
+}
+
+/*!
+ Release a context. The thread is stopped, if it is running.
+ @param[in,out] cal
+ */
+void AKFS_CalibRelease(
+			AKFS_CALIB		*cal
+)
+{
+	AKFS_CalibStop(cal);
+	pthread_cond_destroy(&cal->cond);
+	pthread_mutex_destroy(&cal->mutex);
+}
+
+/*!
+ Start the background calibration thread.
+ @return If this function succeeds, the return value is #AKM_SUCCESS.
+ Otherwise the return value is #AKM_ERROR.
+ @param[in,out] cal
+ */
+int16 AKFS_CalibStart(
+			AKFS_CALIB		*cal
+)
+{
+	if (cal->running == AKM_TRUE) {
+		return AKM_SUCCESS;
+	}
+
+	cal->quit = AKM_FALSE;
+	cal->state = CALIB_IDLE;
+	cal->resNew = AKM_FALSE;
+	cal->ckptState = CALIB_IDLE;
+	cal->trace = AKFS_TraceCurrent();
+
+	if (pthread_create(&cal->thread, NULL, calib_main, cal) != 0) {
+		AKMERROR_STR("pthread_create");
+		return AKM_ERROR;
+	}
+	cal->running = AKM_TRUE;
+
+	return AKM_SUCCESS;
+}
+
+/*!
+ Fit in the caller of #AKFS_CalibPost instead of the calibration thread, so
+ that a result is always taken at the same sample. This is used for replay,
+ where the output should not depend on timing. In this mode, fitting works
+ without the thread, but checkpoints still need it.
+ @param[in,out] cal
+ @param[in] sync #AKM_TRUE: fit synchronously, #AKM_FALSE: in background.
+ */
+void AKFS_CalibSetSync(
+			AKFS_CALIB		*cal,
+	const	int				sync
+)
+{
+	pthread_mutex_lock(&cal->mutex);
+	cal->sync = sync;
+	pthread_mutex_unlock(&cal->mutex);
+}
+
+/*!
+ Stop the background calibration thread. A result which is not taken yet is
+ discarded, and so is a checkpoint which is not saved yet.
+ @param[in,out] cal
+ */
+void AKFS_CalibStop(
+			AKFS_CALIB		*cal
+)
+{
+	if (cal->running == AKM_FALSE) {
+		return;
+	}
+
+	pthread_mutex_lock(&cal->mutex);
+	cal->quit = AKM_TRUE;
+	pthread_cond_signal(&cal->cond);
+	pthread_mutex_unlock(&cal->mutex);
+
+	pthread_join(cal->thread, NULL);
+	cal->running = AKM_FALSE;
+}
+
+/*!
+ Request a fit with a snapshot of the bins. This function never blocks. When
+ the calibration thread is busy, the request is dropped.
+ @return If the request is accepted, the return value is #AKM_SUCCESS.
+ Otherwise the return value is #AKM_ERROR.
+ @param[in,out] cal
+ @param[in] bins
+ */
+int16 AKFS_CalibPost(
+			AKFS_CALIB		*cal,
+	const	AKFS_ECAL_BIN	*bins
+)
+{
+	int16 ret = AKM_ERROR;
+
+	if ((cal->running == AKM_FALSE) && (cal->sync == AKM_FALSE)) {
+		return AKM_ERROR;
+	}
+	if (pthread_mutex_trylock(&cal->mutex) != 0) {
+		return AKM_ERROR;
+	}
+	if (cal->sync == AKM_TRUE) {
+		if (AKFS_ECalFit(bins, &cal->res) == AKFS_SUCCESS) {
+			cal->resNew = AKM_TRUE;
+		}
+		ret = AKM_SUCCESS;
+	} else if (cal->state == CALIB_IDLE) {
+		cal->bins = *bins;
+		cal->state = CALIB_REQUESTED;
+		pthread_cond_signal(&cal->cond);
+		ret = AKM_SUCCESS;
+	}
+	pthread_mutex_unlock(&cal->mutex);
+
+	return ret;
+}
+
+/*!
+ Take a new validated result, if any. This function never blocks.
+ @return If a new result is stored to res, the return value is #AKM_SUCCESS.
+ Otherwise the return value is #AKM_ERROR.
+ @param[in,out] cal
+ @param[out] res
+ */
+int16 AKFS_CalibTake(
+			AKFS_CALIB		*cal,
+			AKFS_ECAL_RES	*res
+)
+{
+	int16 ret = AKM_ERROR;
+
+	if ((cal->running == AKM_FALSE) && (cal->sync == AKM_FALSE)) {
+		return AKM_ERROR;
+	}
+	if (pthread_mutex_trylock(&cal->mutex) != 0) {
+		return AKM_ERROR;
+	}
+	if (cal->resNew == AKM_TRUE) {
+		*res = cal->res;
+		cal->resNew = AKM_FALSE;
+		ret = AKM_SUCCESS;
+	}
+	pthread_mutex_unlock(&cal->mutex);
+
+	return ret;
+}
+
+/*!
+ Request to save a snapshot of the calibration state to #CSPEC_STATE_FILE.
+ This function never blocks. When the calibration thread is saving the
+ previous one, the request is dropped.
+ @return If the request is accepted, the return value is #AKM_SUCCESS.
+ Otherwise the return value is #AKM_ERROR.
+ @param[in,out] cal
+ @param[in] prms
+ */
+int16 AKFS_CalibCheckpoint(
+			AKFS_CALIB		*cal,
+	const	AKMPRMS			*prms
+)
+{
+	int16 ret = AKM_ERROR;
+
+	if (cal->running == AKM_FALSE) {
+		return AKM_ERROR;
+	}
+	if (pthread_mutex_trylock(&cal->mutex) != 0) {
+		return AKM_ERROR;
+	}
+	if (cal->ckptState == CALIB_IDLE) {
+		AKFS_GetState(prms, &cal->ckpt);
+		cal->ckptState = CALIB_REQUESTED;
+		pthread_cond_signal(&cal->cond);
+		ret = AKM_SUCCESS;
+	}
+	pthread_mutex_unlock(&cal->mutex);
+
+	return ret;
+}
+
@@ -0,0 +1,97 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2012 Asahi Kasei Microdevices Corporation, Japan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************/
+#ifndef AKFS_INC_CALIB_H
+#define AKFS_INC_CALIB_H
+
+#include <pthread.h>
+
+/* Include file for AKM OSS library. */
+#include "AKFS_Compass.h"
+#include "AKFS_FileIO.h"
+
+/*** Constant definition ******************************************************/
+
+/*** Type declaration *********************************************************/
+/*! Context of background calibration. One context serves one #AKMPRMS, and
+  contexts are independent of each other. */
+typedef struct _AKFS_CALIB {
+	pthread_t		thread;
+	pthread_mutex_t	mutex;
+	pthread_cond_t	cond;
+	int				running;
+	int				quit;
+	int				state;
+	int				sync;
+
+	/* Input of a fit. Only the calibration thread touches these while BUSY. */
+	AKFS_ECAL_BIN	bins;
+
+	/* Output of a fit. */
+	AKFS_ECAL_RES	res;
+	int				resNew;
+
+	/* A snapshot to be saved. Only the calibration thread touches it while
+	   BUSY. */
+	AKFS_STATE		ckpt;
+	int				ckptState;
+
+	/* Ring of the thread which started the calibration thread. */
+	AKFS_TRACE		*trace;
+} AKFS_CALIB;
+
+/*** Global variables *********************************************************/
+
+/*** Prototype of function ****************************************************/
+int16 AKFS_CalibInit(
+			AKFS_CALIB		*cal
+);
+
+void AKFS_CalibRelease(
+			AKFS_CALIB		*cal
+);
+
+int16 AKFS_CalibStart(
+			AKFS_CALIB		*cal
+);
+
+void AKFS_CalibStop(
+			AKFS_CALIB		*cal
+);
+
+void AKFS_CalibSetSync(
+			AKFS_CALIB		*cal,
+	const	int				sync
+);
+
+int16 AKFS_CalibPost(
+			AKFS_CALIB		*cal,
+	const	AKFS_ECAL_BIN	*bins
+);
+
+int16 AKFS_CalibTake(
+			AKFS_CALIB		*cal,
+			AKFS_ECAL_RES	*res
+);
+
+int16 AKFS_CalibCheckpoint(
+			AKFS_CALIB		*cal,
+	const	AKMPRMS			*prms
+);
+
+#endif
+
@@ -54,13 +54,12 @@
 
 #define OPMODE_CONSOLE		(0x01)
 #define OPMODE_FST			(0x02)
+#define OPMODE_BENCH		(0x04)
+#define OPMODE_BATCH		(0x08)
 
 /*** Type declaration *********************************************************/
 
 /*** Global variables *********************************************************/
-extern int g_stopRequest;	/*!< 0:Not stop,  1:Stop */
-extern int g_opmode;		/*!< 0:Daemon mode, 1:Console mode. */
-extern int g_dbgzone;		/*!< Debug zone. */
 
 /*** Prototype of function ****************************************************/
 
@@ -35,6 +35,8 @@
 #include "./libAKM_OSS/AKFS_Decomp.h"
 #include "./libAKM_OSS/AKFS_Device.h"
 #include "./libAKM_OSS/AKFS_Direction.h"
+#include "./libAKM_OSS/AKFS_ECal.h"
+#include "./libAKM_OSS/AKFS_Fixed.h"
 #include "./libAKM_OSS/AKFS_Math.h"
 #include "./libAKM_OSS/AKFS_VNorm.h"
 
@@ -58,27 +60,69 @@ typedef struct _AKSENSOR_DATA{
 /* e**_ : enum */
 /* *s*_ : struct */
 /* *v*_ : vector (special type of struct) */
+/* *m*_ : matrix */
 /* **a_ : array */
 typedef struct _AKMPRMS{
 
 	/* Variables for Decomp. */
-	AKFVEC			fva_hdata[AKFS_HDATA_SIZE];
+#ifdef AKFS_PRECISION_FIXED
+	AKFS_QBUF		fva_hdata;	/* Q16.16 */
+#else
+	AKFS_VBUF		fva_hdata;
+#endif
 	uint8vec		i8v_asa;
+	AKFS_HXFORM		s_hxform;	/* i8v_asa and e_hpat are folded */
 
 	/* Variables forAOC. */
 	AKFS_AOC_VAR	s_aocv;
 
+	/* Variables for ellipsoid calibration. */
+	AKFS_ECAL_BIN	s_ecal;
+	AKFLOAT			fm_hsi[3][3];
+	AKFLOAT			f_hr;
+	int16			i16_hsi;	/* 1: fm_hsi is valid */
+
+	/* Variables for state file. */
+	int16			i16_ckpt;	/* 1: offset is updated, but not saved */
+
+	/* Context of background calibration, i.e. AKFS_CALIB. */
+	/* NULL: ellipsoid calibration is disabled. */
+	struct _AKFS_CALIB	*p_calib;
+
 	/* Variables for Magnetometer buffer. */
-	AKFVEC			fva_hvbuf[AKFS_HDATA_SIZE];
+#ifdef AKFS_PRECISION_FIXED
+	AKFS_QBUF		fva_hvbuf;	/* Q16.16 */
+	AKFS_QNORM		s_hqn;		/* fv_ho, fv_hs and fm_hsi in fixed point */
+#else
+	AKFS_VBUF		fva_hvbuf;
+#endif
 	AKFVEC			fv_ho;
 	AKFVEC			fv_hs;
 	AKFS_PATNO		e_hpat;
 
 	/* Variables for Accelerometer buffer. */
-	AKFVEC			fva_avbuf[AKFS_ADATA_SIZE];
+#ifdef AKFS_PRECISION_FIXED
+	AKFS_QBUF		fva_avbuf;	/* Q16.16 */
+	AKFS_QNORM		s_aqn;		/* fv_ao and fv_as in fixed point */
+#else
+	AKFS_VBUF		fva_avbuf;
+#endif
 	AKFVEC			fv_ao;
 	AKFVEC			fv_as;
 
+	/* Variables for Averaging. */
+#ifdef AKFS_PRECISION_FIXED
+	AKFS_QAVE		s_hvave;	/* CSPEC_HNAVE_V of fva_hvbuf */
+	AKFS_QAVE		s_hdave;	/* CSPEC_HNAVE_D of fva_hvbuf */
+	AKFS_QAVE		s_avave;	/* CSPEC_ANAVE_V of fva_avbuf */
+	AKFS_QAVE		s_adave;	/* CSPEC_ANAVE_D of fva_avbuf */
+#else
+	AKFS_VAVE		s_hvave;	/* CSPEC_HNAVE_V of fva_hvbuf */
+	AKFS_VAVE		s_hdave;	/* CSPEC_HNAVE_D of fva_hvbuf */
+	AKFS_VAVE		s_avave;	/* CSPEC_ANAVE_V of fva_avbuf */
+	AKFS_VAVE		s_adave;	/* CSPEC_ANAVE_D of fva_avbuf */
+#endif
+
 	/* Variables for Direction. */
 	AKFLOAT			f_azimuth;
 	AKFLOAT			f_pitch;
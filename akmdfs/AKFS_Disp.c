@@ -47,6 +47,9 @@ void Disp_Result(int buf[])
 		buf[8], REVERT_MAG(buf[5]), REVERT_MAG(buf[6]), REVERT_MAG(buf[7]));
 	AKMDEBUG(AKMDATA_CONSOLE, "Ori(%d)=%8.2f, %8.2f, %8.2f\n",
 		buf[8], REVERT_ORI(buf[9]), REVERT_ORI(buf[10]), REVERT_ORI(buf[11]));
+	AKMDEBUG(AKMDATA_CONSOLE, "Rot(%d)=%8.5f, %8.5f, %8.5f, %8.5f\n",
+		buf[8], REVERT_ROT(buf[12]), REVERT_ROT(buf[13]), REVERT_ROT(buf[14]),
+		REVERT_ROT(buf[15]));
 }
 
 /*!
@@ -25,6 +25,7 @@
 #define REVERT_ACC(a)	((float)((a) * 9.8f / 720.0f))
 #define REVERT_MAG(m)	((float)((m) * 0.06f))
 #define REVERT_ORI(o)	((float)((o) / 64.0f))
+#define REVERT_ROT(q)	((float)((q) / 16384.0f))
 
 /*** Type declaration *********************************************************/
 
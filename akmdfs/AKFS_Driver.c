@@ -16,11 +16,142 @@
  *
  ******************************************************************************/
 #include <fcntl.h>
+#include <poll.h>
+#include <time.h>
 #include "AKFS_Common.h"
 #include "AKFS_Driver.h"
+#include "AKFS_Stats.h"
 
 #define AKM_MEASURE_RETRY_NUM	5
-static int s_fdDev = -1;
+#define AKM_DRDY_TIMEOUT_MS		((AKM_MEASURE_TIME_US) / 1000)
+
+/*** Device backend ***********************************************************/
+static int AKD_DevOpen(AKD_CONTEXT* ctx)
+{
+	ctx->fd = open("/dev/" AKM_MISCDEV_NAME, O_RDWR);
+	return (ctx->fd < 0) ? -1 : 0;
+}
+
+static void AKD_DevClose(AKD_CONTEXT* ctx)
+{
+	close(ctx->fd);
+	ctx->fd = -1;
+}
+
+static int AKD_DevIoctl(AKD_CONTEXT* ctx, int request, void* arg)
+{
+	return ioctl(ctx->fd, request, arg);
+}
+
+static int AKD_DevPoll(AKD_CONTEXT* ctx, int timeout_ms)
+{
+	struct pollfd pfd;
+
+	pfd.fd = ctx->fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	if (poll(&pfd, 1, timeout_ms) <= 0) {
+		return 0;
+	}
+	return (pfd.revents & POLLIN) ? 1 : 0;
+}
+
+/*! /dev/akm8975_dev etc. */
+static const AKD_BACKEND s_devBackend = {
+	"device",
+	AKD_DevOpen,
+	AKD_DevClose,
+	AKD_DevIoctl,
+	AKD_DevPoll,
+	NULL,
+	NULL
+};
+
+/*!
+ Issue an ioctl to the backend and count it. Requests which are issued in
+ the measurement loop are timed.
+ @param[in,out] ctx A context.
+ */
+static int AKD_Ioctl(AKD_CONTEXT* ctx, int request, void* arg)
+{
+	int64_t	start;
+	int		id;
+	int		ret;
+
+	__sync_fetch_and_add(&ctx->syscallCount[
+		(request == ECS_IOCTL_SET_YPR) ? AKD_STAGE_OUTPUT : AKD_STAGE_MEASURE], 1);
+	switch (request) {
+	case ECS_IOCTL_GET_DELAY:
+		id = AKFS_STATS_IO_GET_DELAY;
+		break;
+	case ECS_IOCTL_GET_ACCEL:
+		id = AKFS_STATS_IO_GET_ACCEL;
+		break;
+	case ECS_IOCTL_SET_MODE:
+		id = AKFS_STATS_IO_SET_MODE;
+		break;
+	case ECS_IOCTL_GET_DATA:
+		id = AKFS_STATS_IO_GET_DATA;
+		break;
+	case ECS_IOCTL_SET_YPR:
+		id = AKFS_STATS_IO_SET_YPR;
+		break;
+	default:
+		return ctx->backend->ioctl(ctx, request, arg);
+	}
+
+	start = AKFS_StatsNow();
+	ret = ctx->backend->ioctl(ctx, request, arg);
+	AKFS_StatsAdd(ctx->stats, id, AKFS_StatsNow() - start);
+	return ret;
+}
+
+/*!
+ Initialize a context. The device driver is selected as its backend.
+ @param[out] ctx A context.
+ */
+void AKD_InitContext(AKD_CONTEXT* ctx)
+{
+	memset(ctx, 0, sizeof(AKD_CONTEXT));
+	ctx->backend = &s_devBackend;
+	ctx->fd = -1;
+	ctx->opened = AKD_FALSE;
+	ctx->pollDRDY = AKD_TRUE;
+}
+
+/*!
+ Select hardware backend. This function must be called before
+ #AKD_InitDevice. When this function is not called, the device driver is used.
+ @param[in,out] ctx A context.
+ @param[in] backend A backend. NULL selects the device driver.
+ @param[in] priv State of the backend, which the backend finds in ctx->priv.
+ It must live until the context is closed.
+ */
+void AKD_SetBackend(
+		AKD_CONTEXT* ctx,
+		const AKD_BACKEND* backend,
+		void* priv)
+{
+	if (ctx->opened == AKD_TRUE) {
+		AKMERROR_STR("Backend is already opened.");
+		return;
+	}
+	ctx->backend = (backend != NULL) ? backend : &s_devBackend;
+	ctx->priv = priv;
+}
+
+/*!
+ Select statistics to which requests in the measurement loop are timed.
+ Requests are not timed until this function is called.
+ @param[in,out] ctx A context.
+ @param[in] stats Statistics, or NULL. It must live until the context is
+ closed.
+ */
+void AKD_SetStats(AKD_CONTEXT* ctx, AKFS_STATS* stats)
+{
+	ctx->stats = stats;
+}
 
 /*!
  Open device driver.
@@ -29,15 +160,19 @@ static int s_fdDev = -1;
  measurement range, built-in filter function and etc.
  @return If this function succeeds, the return value is #AKD_SUCCESS.
  Otherwise the return value is #AKD_ERROR.
+ @param[in,out] ctx A context.
  */
-int16_t AKD_InitDevice(void)
+int16_t AKD_InitDevice(AKD_CONTEXT* ctx)
 {
-	if (s_fdDev < 0) {
+	if (ctx->opened == AKD_FALSE) {
 		/* Open magnetic sensor's device driver. */
-		if ((s_fdDev = open("/dev/" AKM_MISCDEV_NAME, O_RDWR)) < 0) {
+		if (ctx->backend->open(ctx) < 0) {
 			AKMERROR_STR("open");
 			return AKD_ERROR;
 		}
+		AKMDEBUG(AKMDATA_DRV, "%s: backend=%s\n", __FUNCTION__, ctx->backend->name);
+		ctx->opened = AKD_TRUE;
+		ctx->pollDRDY = AKD_TRUE;
 	}
 
 	return AKD_SUCCESS;
@@ -47,12 +182,13 @@ int16_t AKD_InitDevice(void)
  Close device driver.
  This function closes both device drivers of magnetic sensor and acceleration
  sensor.
+ @param[in,out] ctx A context.
  */
-void AKD_DeinitDevice(void)
+void AKD_DeinitDevice(AKD_CONTEXT* ctx)
 {
-	if (s_fdDev >= 0) {
-		close(s_fdDev);
-		s_fdDev = -1;
+	if (ctx->opened == AKD_TRUE) {
+		ctx->backend->close(ctx);
+		ctx->opened = AKD_FALSE;
 	}
 }
 
@@ -62,6 +198,7 @@ void AKD_DeinitDevice(void)
  address specified in \a address.
  @return If this function succeeds, the return value is #AKD_SUCCESS. Otherwise
  the return value is #AKD_ERROR.
+ @param[in,out] ctx A context.
  @param[in] address Specify the address of a register in which data is to be
  written.
  @param[in] data Specify data to write or a pointer to a data array containing
@@ -72,6 +209,7 @@ void AKD_DeinitDevice(void)
  equals the number of elements of the array.
  */
 int16_t AKD_TxData(
+		AKD_CONTEXT* ctx,
 		const BYTE address,
 		const BYTE * data,
 		const uint16_t numberOfBytesToWrite)
@@ -79,7 +217,7 @@ int16_t AKD_TxData(
 	int i;
 	char buf[AKM_RWBUF_SIZE];
 
-	if (s_fdDev < 0) {
+	if (ctx->opened == AKD_FALSE) {
 		AKMERROR;
 		return AKD_ERROR;
 	}
@@ -94,17 +232,21 @@ int16_t AKD_TxData(
 	for (i = 0; i < numberOfBytesToWrite; i++) {
 		buf[i + 2] = data[i];
 	}
-	if (ioctl(s_fdDev, ECS_IOCTL_WRITE, buf) < 0) {
+	if (AKD_Ioctl(ctx, ECS_IOCTL_WRITE, buf) < 0) {
 		AKMERROR_STR("ioctl");
 		return AKD_ERROR;
 	} else {
 
 #if ENABLE_AKMDEBUG
-		AKMDEBUG(AKMDATA_DRV, "addr(HEX)=%02x data(HEX)=", address);
-		for (i = 0; i < numberOfBytesToWrite; i++) {
-			AKMDEBUG(AKMDATA_DRV, " %02x", data[i]);
+		/* One trace record keeps the first 6 bytes. */
+		{
+			BYTE d[6] = {0};
+			memcpy(d, data, (numberOfBytesToWrite < 6)
+					? numberOfBytesToWrite : 6);
+			AKMDEBUG(AKMDATA_DRV,
+				"addr(HEX)=%02x len=%d data(HEX)=%02x %02x %02x %02x %02x %02x\n",
+				address, numberOfBytesToWrite, d[0], d[1], d[2], d[3], d[4], d[5]);
 		}
-		AKMDEBUG(AKMDATA_DRV, "\n");
 #endif
 		return AKD_SUCCESS;
 	}
@@ -114,6 +256,7 @@ int16_t AKD_TxData(
  Acquires data from a register or the EEPROM of the AKM E-Compass.
  @return If this function succeeds, the return value is #AKD_SUCCESS. Otherwise
  the return value is #AKD_ERROR.
+ @param[in,out] ctx A context.
  @param[in] address Specify the address of a register from which data is to be
  read.
  @param[out] data Specify a pointer to a data array which the read data are
@@ -123,6 +266,7 @@ int16_t AKD_TxData(
  equals the number of elements of the array.
  */
 int16_t AKD_RxData(
+		AKD_CONTEXT* ctx,
 		const BYTE address,
 		BYTE * data,
 		const uint16_t numberOfBytesToRead)
@@ -132,7 +276,7 @@ int16_t AKD_RxData(
 
 	memset(data, 0, numberOfBytesToRead);
 
-	if (s_fdDev < 0) {
+	if (ctx->opened == AKD_FALSE) {
 		AKMERROR;
 		return AKD_ERROR;
 	}
@@ -144,7 +288,7 @@ int16_t AKD_RxData(
 	buf[0] = numberOfBytesToRead;
 	buf[1] = address;
 
-	if (ioctl(s_fdDev, ECS_IOCTL_READ, buf) < 0) {
+	if (AKD_Ioctl(ctx, ECS_IOCTL_READ, buf) < 0) {
 		AKMERROR_STR("ioctl");
 		return AKD_ERROR;
 	} else {
@@ -152,12 +296,15 @@ int16_t AKD_RxData(
 			data[i] = buf[i + 1];
 		}
 #if ENABLE_AKMDEBUG
-		AKMDEBUG(AKMDATA_DRV, "addr(HEX)=%02x len=%d data(HEX)=",
-				address, numberOfBytesToRead);
-		for (i = 0; i < numberOfBytesToRead; i++) {
-			AKMDEBUG(AKMDATA_DRV, " %02x", data[i]);
+		/* One trace record keeps the first 6 bytes. */
+		{
+			BYTE d[6] = {0};
+			memcpy(d, data, (numberOfBytesToRead < 6)
+					? numberOfBytesToRead : 6);
+			AKMDEBUG(AKMDATA_DRV,
+				"addr(HEX)=%02x len=%d data(HEX)=%02x %02x %02x %02x %02x %02x\n",
+				address, numberOfBytesToRead, d[0], d[1], d[2], d[3], d[4], d[5]);
 		}
-		AKMDEBUG(AKMDATA_DRV, "\n");
 #endif
 		return AKD_SUCCESS;
 	}
@@ -167,13 +314,14 @@ int16_t AKD_RxData(
  Reset the e-compass.
  @return If this function succeeds, the return value is #AKD_SUCCESS. Otherwise
  the return value is #AKD_ERROR.
+ @param[in,out] ctx A context.
  */
-int16_t AKD_Reset(void) {
-	if (s_fdDev < 0) {
+int16_t AKD_Reset(AKD_CONTEXT* ctx) {
+	if (ctx->opened == AKD_FALSE) {
 		AKMERROR;
 		return AKD_ERROR;
 	}
-	if (ioctl(s_fdDev, ECS_IOCTL_RESET, NULL) < 0) {
+	if (AKD_Ioctl(ctx, ECS_IOCTL_RESET, NULL) < 0) {
 		AKMERROR_STR("ioctl");
 		return AKD_ERROR;
 	}
@@ -184,18 +332,19 @@ int16_t AKD_Reset(void) {
  Get magnetic sensor information from device. This function returns WIA value.
  @return If this function succeeds, the return value is #AKD_SUCCESS. Otherwise
  the return value is #AKD_ERROR.
+ @param[in,out] ctx A context.
  @param[out] data An information data array. The size should be larger than
  #AKM_SENSOR_INFO_SIZE
  */
-int16_t AKD_GetSensorInfo(BYTE data[AKM_SENSOR_INFO_SIZE])
+int16_t AKD_GetSensorInfo(AKD_CONTEXT* ctx, BYTE data[AKM_SENSOR_INFO_SIZE])
 {
 	memset(data, 0, AKM_SENSOR_INFO_SIZE);
 
-	if (s_fdDev < 0) {
+	if (ctx->opened == AKD_FALSE) {
 		AKMERROR;
 		return AKD_ERROR;
 	}
-	if (ioctl(s_fdDev, ECS_IOCTL_GET_INFO, data) < 0) {
+	if (AKD_Ioctl(ctx, ECS_IOCTL_GET_INFO, data) < 0) {
 		AKMERROR_STR("ioctl");
 		return AKD_ERROR;
 	}
@@ -206,46 +355,65 @@ int16_t AKD_GetSensorInfo(BYTE data[AKM_SENSOR_INFO_SIZE])
  Get magnetic sensor configuration from device. This function returns ASA value.
  @return If this function succeeds, the return value is #AKD_SUCCESS. Otherwise
  the return value is #AKD_ERROR.
+ @param[in,out] ctx A context.
  @param[out] data An configuration data array. The size should be larger than
  #AKM_SENSOR_CONF_SIZE
  */
-int16_t AKD_GetSensorConf(BYTE data[AKM_SENSOR_CONF_SIZE])
+int16_t AKD_GetSensorConf(AKD_CONTEXT* ctx, BYTE data[AKM_SENSOR_CONF_SIZE])
 {
 	memset(data, 0, AKM_SENSOR_CONF_SIZE);
 
-	if (s_fdDev < 0) {
+	if (ctx->opened == AKD_FALSE) {
 		AKMERROR;
 		return AKD_ERROR;
 	}
-	if (ioctl(s_fdDev, ECS_IOCTL_GET_CONF, data) < 0) {
+	if (AKD_Ioctl(ctx, ECS_IOCTL_GET_CONF, data) < 0) {
 		AKMERROR_STR("ioctl");
 		return AKD_ERROR;
 	}
 	return AKD_SUCCESS;
 }
 
+/*!
+ Wait until the device driver signals DRDY, or until one measurement time
+ elapses.
+ @return If the driver reported readable data, the return value is #AKD_TRUE.
+ Otherwise the return value is #AKD_FALSE.
+ @param[in,out] ctx A context.
+ */
+static int AKD_WaitDRDY(AKD_CONTEXT* ctx)
+{
+	__sync_fetch_and_add(&ctx->syscallCount[AKD_STAGE_MEASURE], 1);
+	return (ctx->backend->poll(ctx, AKM_DRDY_TIMEOUT_MS) > 0) ? AKD_TRUE : AKD_FALSE;
+}
+
 /*!
  Acquire magnetic data from AKM E-Compass. If measurement is not done, this
- function waits until measurement completion.
+ function waits until measurement completion. When the driver supports poll(),
+ the wait is done on DRDY. Otherwise it falls back to sleeping one measurement
+ time between retries.
  @return If this function succeeds, the return value is #AKD_SUCCESS. Otherwise
  the return value is #AKD_ERROR.
+ @param[in,out] ctx A context.
  @param[out] data A magnetic data array. The size should be larger than
  #AKM_SENSOR_DATA_SIZE.
  */
-int16_t AKD_GetMagneticData(BYTE data[AKM_SENSOR_DATA_SIZE])
+int16_t AKD_GetMagneticData(AKD_CONTEXT* ctx, BYTE data[AKM_SENSOR_DATA_SIZE])
 {
 	int ret;
 	int i;
+	int ready;
 
 	memset(data, 0, AKM_SENSOR_DATA_SIZE);
 
-	if (s_fdDev < 0) {
+	if (ctx->opened == AKD_FALSE) {
 		AKMERROR;
 		return AKD_ERROR;
 	}
 
+	ready = AKD_FALSE;
 	for (i = 0; i < AKM_MEASURE_RETRY_NUM; i++) {
-		ret = ioctl(s_fdDev, ECS_IOCTL_GET_DATA, data);
+		ret = AKD_Ioctl(ctx, ECS_IOCTL_GET_DATA, data);
 
 		if (ret >= 0) {
 			/* Success */
@@ -256,9 +424,22 @@ int16_t AKD_GetMagneticData(BYTE data[AKM_SENSOR_DATA_SIZE])
 			return AKD_ERROR;
 		}
 		AKMDEBUG(AKMDATA_DRV, "Try Again.");
-		usleep(AKM_MEASURE_TIME_US);
+		/* poll() said readable but data is not ready yet, i.e. the driver
+		   has no poll support. Don't trust poll() from now on. */
+		if (ready == AKD_TRUE) {
+			AKMDEBUG(AKMDATA_DRV, "DRDY poll is not supported.");
+			ctx->pollDRDY = AKD_FALSE;
+		}
+		if (ctx->pollDRDY == AKD_TRUE) {
+			ready = AKD_WaitDRDY(ctx);
+		} else {
+			ready = AKD_FALSE;
+			__sync_fetch_and_add(&ctx->syscallCount[AKD_STAGE_MEASURE], 1);
+			usleep(AKM_MEASURE_TIME_US);
+		}
 	}
 
+	AKFS_StatsCount(ctx->stats, AKFS_STATS_CNT_RETRY, i);
 	if (i >= AKM_MEASURE_RETRY_NUM) {
 		AKMERROR;
 		return AKD_ERROR;
@@ -272,28 +453,38 @@ int16_t AKD_GetMagneticData(BYTE data[AKM_SENSOR_DATA_SIZE])
 
 /*!
  Set calculated data to device driver.
+ @param[in,out] ctx A context.
  @param[in] buf The order of input data depends on driver's specification.
  */
-void AKD_SetYPR(const int buf[AKM_YPR_DATA_SIZE])
+void AKD_SetYPR(AKD_CONTEXT* ctx, const int buf[AKM_YPR_DATA_SIZE])
 {
-	if (s_fdDev < 0) {
+	if (ctx->opened == AKD_FALSE) {
 		AKMERROR;
 		return;
 	}
-	if (ioctl(s_fdDev, ECS_IOCTL_SET_YPR, buf) < 0) {
+	if (AKD_Ioctl(ctx, ECS_IOCTL_SET_YPR, (void*)buf) < 0) {
 		AKMERROR_STR("ioctl");
 	}
 }
 
 /*!
+ Wait until the device driver is opened.
+ @return If this function succeeds, the return value is #AKD_SUCCESS. When
+ the backend has no more data to replay, the return value is #AKD_EOF.
+ Otherwise the return value is #AKD_ERROR.
+ @param[in,out] ctx A context.
+ @param[out] status Open status.
  */
-int16_t AKD_GetOpenStatus(int* status)
+int16_t AKD_GetOpenStatus(AKD_CONTEXT* ctx, int* status)
 {
-	if (s_fdDev < 0) {
+	if (ctx->opened == AKD_FALSE) {
 		AKMERROR;
 		return AKD_ERROR;
 	}
-	if (ioctl(s_fdDev, ECS_IOCTL_GET_OPEN_STATUS, status) < 0) {
+	if (AKD_Ioctl(ctx, ECS_IOCTL_GET_OPEN_STATUS, status) < 0) {
+		if (errno == ENODATA) {
+			return AKD_EOF;
+		}
 		AKMERROR_STR("ioctl");
 		return AKD_ERROR;
 	}
@@ -302,13 +493,13 @@ int16_t AKD_GetOpenStatus(int* status)
 
 /*!
  */
-int16_t AKD_GetCloseStatus(int* status)
+int16_t AKD_GetCloseStatus(AKD_CONTEXT* ctx, int* status)
 {
-	if (s_fdDev < 0) {
+	if (ctx->opened == AKD_FALSE) {
 		AKMERROR;
 		return AKD_ERROR;
 	}
-	if (ioctl(s_fdDev, ECS_IOCTL_GET_CLOSE_STATUS, status) < 0) {
+	if (AKD_Ioctl(ctx, ECS_IOCTL_GET_CLOSE_STATUS, status) < 0) {
 		AKMERROR_STR("ioctl");
 		return AKD_ERROR;
 	}
@@ -322,13 +513,13 @@ int16_t AKD_GetCloseStatus(int* status)
  @param[in] mode This value should be one of the AKM_MODE which is defined in
  header file.
  */
-int16_t AKD_SetMode(const BYTE mode)
+int16_t AKD_SetMode(AKD_CONTEXT* ctx, const BYTE mode)
 {
-	if (s_fdDev < 0) {
+	if (ctx->opened == AKD_FALSE) {
 		AKMERROR;
 		return AKD_ERROR;
 	}
-	if (ioctl(s_fdDev, ECS_IOCTL_SET_MODE, &mode) < 0) {
+	if (AKD_Ioctl(ctx, ECS_IOCTL_SET_MODE, (void*)&mode) < 0) {
 		AKMERROR_STR("ioctl");
 		return AKD_ERROR;
 	}
@@ -339,15 +530,16 @@ int16_t AKD_SetMode(const BYTE mode)
  Acquire delay
  @return If this function succeeds, the return value is #AKD_SUCCESS. Otherwise
  the return value is #AKD_ERROR.
+ @param[in,out] ctx A context.
  @param[out] delay A delay in microsecond.
  */
-int16_t AKD_GetDelay(int64_t delay[AKM_NUM_SENSORS])
+int16_t AKD_GetDelay(AKD_CONTEXT* ctx, int64_t delay[AKM_NUM_SENSORS])
 {
-	if (s_fdDev < 0) {
+	if (ctx->opened == AKD_FALSE) {
 		AKMERROR;
 		return AKD_ERROR;
 	}
-	if (ioctl(s_fdDev, ECS_IOCTL_GET_DELAY, delay) < 0) {
+	if (AKD_Ioctl(ctx, ECS_IOCTL_GET_DELAY, delay) < 0) {
 		AKMERROR_STR("ioctl");
 		return AKD_ERROR;
 	}
@@ -358,16 +550,17 @@ int16_t AKD_GetDelay(int64_t delay[AKM_NUM_SENSORS])
 
 /*!
  Get layout information from device driver, i.e. platform data.
+ @param[in,out] ctx A context.
  */
-int16_t AKD_GetLayout(int16_t* layout)
+int16_t AKD_GetLayout(AKD_CONTEXT* ctx, int16_t* layout)
 {
 	char tmp;
 
-	if (s_fdDev < 0) {
+	if (ctx->opened == AKD_FALSE) {
 		AKMERROR;
 		return AKD_ERROR;
 	}
-	if (ioctl(s_fdDev, ECS_IOCTL_GET_LAYOUT, &tmp) < 0) {
+	if (AKD_Ioctl(ctx, ECS_IOCTL_GET_LAYOUT, &tmp) < 0) {
 		AKMERROR_STR("ioctl");
 		return AKD_ERROR;
 	}
@@ -379,13 +572,13 @@ int16_t AKD_GetLayout(int16_t* layout)
 }
 
 /* Get acceleration data. */
-int16_t AKD_GetAccelerationData(int16_t data[3])
+int16_t AKD_GetAccelerationData(AKD_CONTEXT* ctx, int16_t data[3])
 {
-	if (s_fdDev < 0) {
+	if (ctx->opened == AKD_FALSE) {
 		AKMERROR;
 		return AKD_ERROR;
 	}
-	if (ioctl(s_fdDev, ECS_IOCTL_GET_ACCEL, data) < 0) {
+	if (AKD_Ioctl(ctx, ECS_IOCTL_GET_ACCEL, data) < 0) {
 		AKMERROR_STR("ioctl");
 		return AKD_ERROR;
 	}
@@ -395,3 +588,59 @@ int16_t AKD_GetAccelerationData(int16_t data[3])
 
 	return AKD_SUCCESS;
 }
+
+/*!
+ Get the number of system calls issued to the device driver so far by a
+ stage. Take the difference of two values to count the calls in between.
+ Since each stage runs in its own thread, the calls of the other thread are
+ not counted.
+ @param[in,out] ctx A context.
+ @param[in] stage #AKD_STAGE_MEASURE or #AKD_STAGE_OUTPUT.
+ */
+uint32_t AKD_GetSyscallCount(AKD_CONTEXT* ctx, int stage)
+{
+	return __sync_fetch_and_add(&ctx->syscallCount[stage], 0);
+}
+
+/*!
+ Whether the backend runs on a virtual clock, i.e. the caller must not sleep
+ but call #AKD_AdvanceTime.
+ @return #AKD_TRUE or #AKD_FALSE.
+ @param[in,out] ctx A context.
+ */
+int16_t AKD_IsVirtualClock(AKD_CONTEXT* ctx)
+{
+	return (ctx->backend->now != NULL) ? AKD_TRUE : AKD_FALSE;
+}
+
+/*!
+ Get the time of the backend.
+ @return Time in ns. The virtual clock of the backend if it has one,
+ otherwise CLOCK_MONOTONIC. -1 on error.
+ @param[in,out] ctx A context.
+ */
+int64_t AKD_GetTime(AKD_CONTEXT* ctx)
+{
+	struct timespec ts;
+
+	if (ctx->backend->now != NULL) {
+		return ctx->backend->now(ctx);
+	}
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+		return -1;
+	}
+	return (ts.tv_sec * 1000000000LL) + ts.tv_nsec;
+}
+
+/*!
+ Advance the virtual clock of the backend. Nothing is done for a backend
+ which runs on the real clock.
+ @param[in,out] ctx A context.
+ @param[in] t Time in ns.
+ */
+void AKD_AdvanceTime(AKD_CONTEXT* ctx, int64_t t)
+{
+	if (ctx->backend->advance != NULL) {
+		ctx->backend->advance(ctx, t);
+	}
+}
@@ -33,9 +33,16 @@
 #define AKD_FALSE	0		/*!< Represents false */
 #define AKD_SUCCESS	0		/*!< Represents success.*/
 #define AKD_ERROR	-1		/*!< Represents error. */
+#define AKD_EOF		-2		/*!< Backend has no more data, i.e. replay ended */
 
 /*! 0:Don't Output data, 1:Output data */
 #define AKD_DBG_DATA	0
+/*! Stages to which system calls are counted. SET_YPR is issued by the
+  calculation thread, and everything else by the measurement thread. */
+#define AKD_STAGE_MEASURE	0		/*!< Acquisition */
+#define AKD_STAGE_OUTPUT	1		/*!< Output of results */
+#define AKD_STAGE_NUM		2
+
 /*! Typical interval in ns */
 #define AKM_MEASUREMENT_TIME_NS	((AKM_MEASURE_TIME_US) * 1000)
 
@@ -43,45 +50,103 @@
 /*** Type declaration *********************************************************/
 typedef unsigned char BYTE;
 
+typedef struct _AKD_CONTEXT AKD_CONTEXT;
+
+struct _AKFS_STATS;
+
+/*! Hardware access. The AKD_* functions below issue ECS_IOCTL_* requests
+  through the selected backend. open, close and ioctl return the same value
+  as the system call which they stand for, and set errno on failure. Every
+  function takes the context, so that one backend can serve many contexts. */
+typedef struct _AKD_BACKEND {
+	const char*	name;
+	int		(*open)(AKD_CONTEXT* ctx);
+	void	(*close)(AKD_CONTEXT* ctx);
+	int		(*ioctl)(AKD_CONTEXT* ctx, int request, void* arg);
+	/*! Wait for readable data. Returns 1 when data is readable, and 0 on
+	  timeout or error. */
+	int		(*poll)(AKD_CONTEXT* ctx, int timeout_ms);
+	/*! Virtual clock in ns, or NULL to use CLOCK_MONOTONIC. */
+	int64_t	(*now)(AKD_CONTEXT* ctx);
+	/*! Advance the virtual clock to the time in ns, instead of sleeping.
+	  NULL when now is NULL. */
+	void	(*advance)(AKD_CONTEXT* ctx, int64_t t);
+} AKD_BACKEND;
+
+/*! An opened device. Everything which the AKD_* functions keep is here, so
+  independent contexts can be used from different threads at the same time.
+  Initialize it with #AKD_InitContext. */
+struct _AKD_CONTEXT {
+	const AKD_BACKEND*	backend;
+	void*		priv;		/*!< State of the backend */
+	int			fd;			/*!< File descriptor of the device backend */
+	int			opened;		/*!< AKD_TRUE while the backend is opened */
+	/*! AKD_TRUE while the driver is believed to signal DRDY through poll() */
+	int			pollDRDY;
+	/*! The number of system calls issued to the device driver per stage */
+	uint32_t	syscallCount[AKD_STAGE_NUM];
+	/*! Statistics to which requests are timed, or NULL */
+	struct _AKFS_STATS*	stats;
+};
+
 
 /*** Global variables *********************************************************/
 
 /*** Prototype of Function  ***************************************************/
 
-int16_t AKD_InitDevice(void);
+void AKD_InitContext(AKD_CONTEXT* ctx);
+
+void AKD_SetBackend(
+		AKD_CONTEXT* ctx,
+		const AKD_BACKEND* backend,
+		void* priv);
+
+void AKD_SetStats(AKD_CONTEXT* ctx, struct _AKFS_STATS* stats);
+
+int16_t AKD_InitDevice(AKD_CONTEXT* ctx);
 
-void AKD_DeinitDevice(void);
+void AKD_DeinitDevice(AKD_CONTEXT* ctx);
 
 int16_t AKD_TxData(
+		AKD_CONTEXT* ctx,
 		const BYTE address,
 		const BYTE* data,
 		const uint16_t numberOfBytesToWrite);
 
 int16_t AKD_RxData(
+		AKD_CONTEXT* ctx,
 		const BYTE address,
 		BYTE* data,
 		const uint16_t numberOfBytesToRead);
 
-int16_t AKD_Reset(void);
+int16_t AKD_Reset(AKD_CONTEXT* ctx);
+
+int16_t AKD_GetSensorInfo(AKD_CONTEXT* ctx, BYTE data[AKM_SENSOR_INFO_SIZE]);
+
+int16_t AKD_GetSensorConf(AKD_CONTEXT* ctx, BYTE data[AKM_SENSOR_CONF_SIZE]);
+
+int16_t AKD_GetMagneticData(AKD_CONTEXT* ctx, BYTE data[AKM_SENSOR_DATA_SIZE]);
+
+void AKD_SetYPR(AKD_CONTEXT* ctx, const int buf[AKM_YPR_DATA_SIZE]);
 
-int16_t AKD_GetSensorInfo(BYTE data[AKM_SENSOR_INFO_SIZE]);
+int16_t AKD_GetOpenStatus(AKD_CONTEXT* ctx, int* status);
 
-int16_t AKD_GetSensorConf(BYTE data[AKM_SENSOR_CONF_SIZE]);
+int16_t AKD_GetCloseStatus(AKD_CONTEXT* ctx, int* status);
 
-int16_t AKD_GetMagneticData(BYTE data[AKM_SENSOR_DATA_SIZE]);
+int16_t AKD_SetMode(AKD_CONTEXT* ctx, const BYTE mode);
 
-void AKD_SetYPR(const int buf[AKM_YPR_DATA_SIZE]);
+int16_t AKD_GetDelay(AKD_CONTEXT* ctx, int64_t delay[AKM_NUM_SENSORS]);
 
-int16_t AKD_GetOpenStatus(int* status);
+int16_t AKD_GetLayout(AKD_CONTEXT* ctx, int16_t* layout);
 
-int16_t AKD_GetCloseStatus(int* status);
+int16_t AKD_GetAccelerationData(AKD_CONTEXT* ctx, int16_t data[3]);
 
-int16_t AKD_SetMode(const BYTE mode);
+uint32_t AKD_GetSyscallCount(AKD_CONTEXT* ctx, int stage);
 
-int16_t AKD_GetDelay(int64_t delay[AKM_NUM_SENSORS]);
+int16_t AKD_IsVirtualClock(AKD_CONTEXT* ctx);
 
-int16_t AKD_GetLayout(int16_t* layout);
+int64_t AKD_GetTime(AKD_CONTEXT* ctx);
 
-int16_t AKD_GetAccelerationData(int16_t data[3]);
+void AKD_AdvanceTime(AKD_CONTEXT* ctx, int64_t t);
 
 #endif /* AKMD_INC_AKMD_DRIVER_H */
@@ -15,6 +15,8 @@
  * limitations under the License.
  *
  ******************************************************************************/
+#include <fcntl.h>
+#include <sys/stat.h>
 #include "AKFS_FileIO.h"
 
 /*** Constant definition ******************************************************/
@@ -25,6 +27,8 @@
 #endif
 #define AKFS_PRINTF_FORMAT	"%s = %f\n"
 #define LOAD_BUF_SIZE	64
+#define STATE_TMP_SUFFIX	".tmp"
+#define STATE_PATH_MAX	256
 
 /*!
  Load parameters from file which is specified with #path.  This function reads 
@@ -135,3 +139,183 @@ int16 AKFS_SaveParameters(AKMPRMS *prms, const char* path)
 	return AKM_SUCCESS;
 }
 
+/*!
+ Checksum of a state, except the header.
+ @return Checksum.
+ @param[in] st A pointer to #AKFS_STATE structure.
+ */
+static uint32 StateSum(const AKFS_STATE *st)
+{
+	const uint8 *p = (const uint8 *)&st->asa;
+	const uint8 *end = (const uint8 *)st + sizeof(AKFS_STATE);
+	uint32 a = 1;
+	uint32 b = 0;
+
+	/* Adler-32 */
+	for (; p < end; p++) {
+		a = (a + *p) % 65521;
+		b = (b + a) % 65521;
+	}
+	return (b << 16) | a;
+}
+
+/*!
+ Take a snapshot of the calibration state.
+ @param[in] prms A pointer to #AKMPRMS structure.
+ @param[out] st A pointer to #AKFS_STATE structure. The header is not filled.
+ */
+void AKFS_GetState(const AKMPRMS *prms, AKFS_STATE *st)
+{
+	/* Clear padding too, it is a part of the checksum. */
+	memset(st, 0, sizeof(AKFS_STATE));
+
+	st->asa = prms->i8v_asa;
+	st->hpat = (int16)prms->e_hpat;
+	st->aocv = prms->s_aocv;
+	st->ho = prms->fv_ho;
+	st->hstatus = prms->i16_hstatus;
+	st->ecal = prms->s_ecal;
+	memcpy(st->hsi, prms->fm_hsi, sizeof(st->hsi));
+	st->hr = prms->f_hr;
+	st->i16_hsi = prms->i16_hsi;
+}
+
+/*!
+ Restore the calibration state.
+ @return If the state belongs to the current device, the return value is
+  #AKM_SUCCESS and prms is updated. Otherwise the return value is #AKM_ERROR
+  and prms is not changed.
+ @param[in] st A pointer to #AKFS_STATE structure.
+ @param[out] prms A pointer to #AKMPRMS structure.
+ */
+int16 AKFS_PutState(const AKFS_STATE *st, AKMPRMS *prms)
+{
+	if ((st->asa.u.x != prms->i8v_asa.u.x) ||
+		(st->asa.u.y != prms->i8v_asa.u.y) ||
+		(st->asa.u.z != prms->i8v_asa.u.z) ||
+		(st->hpat != (int16)prms->e_hpat)) {
+		AKMDEBUG(AKMDATA_DUMP, "%s: Device is changed.\n", __FUNCTION__);
+		return AKM_ERROR;
+	}
+
+	prms->s_aocv = st->aocv;
+	prms->fv_ho = st->ho;
+	prms->i16_hstatus = st->hstatus;
+	prms->s_ecal = st->ecal;
+	memcpy(prms->fm_hsi, st->hsi, sizeof(prms->fm_hsi));
+	prms->f_hr = st->hr;
+	prms->i16_hsi = st->i16_hsi;
+
+	return AKM_SUCCESS;
+}
+
+/*!
+ Load a state from a binary file with a single read.
+ @return If the file holds a valid state, the return value is #AKM_SUCCESS.
+  Otherwise the return value is #AKM_ERROR and the content of st is undefined.
+  A missing file is a cold start, and it is not reported as an error. Other
+  failures are reported here, so the caller need not report them again.
+ @param[out] st A pointer to #AKFS_STATE structure.
+ @param[in] path A path to the state file.
+ */
+int16 AKFS_LoadState(AKFS_STATE *st, const char* path)
+{
+	int fd;
+	ssize_t len;
+	char extra;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		if (errno == ENOENT) {
+			AKMDEBUG(AKMDATA_DUMP, "%s: no state, cold start.\n", __FUNCTION__);
+		} else {
+			AKMERROR_STR("open");
+		}
+		return AKM_ERROR;
+	}
+	/* Read one more byte to detect a larger file */
+	len = read(fd, st, sizeof(AKFS_STATE));
+	if (len < 0) {
+		AKMERROR_STR("read");
+		close(fd);
+		return AKM_ERROR;
+	}
+	if ((len == (ssize_t)sizeof(AKFS_STATE)) && (read(fd, &extra, 1) != 0)) {
+		len = -1;
+	}
+	close(fd);
+
+	if ((len != (ssize_t)sizeof(AKFS_STATE)) ||
+		(st->magic != AKFS_STATE_MAGIC) ||
+		(st->version != AKFS_STATE_VERSION) ||
+		(st->fsize != sizeof(AKFLOAT)) ||
+		(st->size != sizeof(AKFS_STATE)) ||
+		(st->sum != StateSum(st))) {
+		errno = EINVAL;
+		AKMERROR_STR("Invalid state file");
+		return AKM_ERROR;
+	}
+
+	return AKM_SUCCESS;
+}
+
+/*!
+ Save a state to a binary file. The state is written to a temporary file,
+  and the temporary file is renamed to path. So the file at path always holds
+  either the old state or the new one.
+ @return If function succeeds, the return value is #AKM_SUCCESS. Otherwise
+  the return value is #AKM_ERROR and the file at path is not changed.
+ @param[in,out] st A pointer to #AKFS_STATE structure, which is made by
+  #AKFS_GetState. The header is filled in this function.
+ @param[in] path A path to the state file.
+ */
+int16 AKFS_SaveState(AKFS_STATE *st, const char* path)
+{
+	char tmp[STATE_PATH_MAX];
+	int fd;
+	int16 ret = 1;
+
+	if (snprintf(tmp, sizeof(tmp), "%s%s", path, STATE_TMP_SUFFIX)
+			>= (int)sizeof(tmp)) {
+		AKMERROR;
+		return AKM_ERROR;
+	}
+
+	st->magic = AKFS_STATE_MAGIC;
+	st->version = AKFS_STATE_VERSION;
+	st->fsize = sizeof(AKFLOAT);
+	st->size = sizeof(AKFS_STATE);
+	st->sum = StateSum(st);
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0660);
+	if (fd < 0) {
+		AKMERROR_STR("open");
+		return AKM_ERROR;
+	}
+	if (write(fd, st, sizeof(AKFS_STATE)) != (ssize_t)sizeof(AKFS_STATE)) {
+		AKMERROR_STR("write");
+		ret = 0;
+	}
+	/* The content must reach the storage before rename. */
+	if ((ret != 0) && (fsync(fd) != 0)) {
+		AKMERROR_STR("fsync");
+		ret = 0;
+	}
+	if (close(fd) != 0) {
+		AKMERROR_STR("close");
+		ret = 0;
+	}
+	if ((ret != 0) && (rename(tmp, path) != 0)) {
+		AKMERROR_STR("rename");
+		ret = 0;
+	}
+
+	if (ret == 0) {
+		unlink(tmp);
+		AKMERROR;
+		return AKM_ERROR;
+	}
+
+	return AKM_SUCCESS;
+}
+
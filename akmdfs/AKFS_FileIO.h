@@ -25,8 +25,35 @@
 #include "AKFS_Compass.h"
 
 /*** Constant definition ******************************************************/
+#define AKFS_STATE_MAGIC	0x54534B41	/* "AKST" */
+#define AKFS_STATE_VERSION	2
 
 /*** Type declaration *********************************************************/
+/*! Calibration state, which is saved as is to a binary file. The file is
+  valid only for the same build, i.e. the same version, AKFLOAT and size. */
+typedef struct _AKFS_STATE {
+	/* Header */
+	uint32			magic;
+	uint16			version;
+	uint16			fsize;		/* sizeof(AKFLOAT) */
+	uint32			size;		/* sizeof(AKFS_STATE) */
+	uint32			sum;		/* Checksum of the rest */
+
+	/* The state is discarded when the device is changed. */
+	uint8vec		asa;
+	int16			hpat;
+
+	/* AOC */
+	AKFS_AOC_VAR	aocv;
+	AKFVEC			ho;
+	int16			hstatus;
+
+	/* Ellipsoid calibration */
+	AKFS_ECAL_BIN	ecal;
+	AKFLOAT			hsi[3][3];
+	AKFLOAT			hr;
+	int16			i16_hsi;
+} AKFS_STATE;
 
 /*** Global variables *********************************************************/
 
@@ -35,5 +62,13 @@ int16 AKFS_LoadParameters(AKMPRMS *prms, const char* path);
 
 int16 AKFS_SaveParameters(AKMPRMS* prms, const char* path);
 
+void AKFS_GetState(const AKMPRMS *prms, AKFS_STATE *st);
+
+int16 AKFS_PutState(const AKFS_STATE *st, AKMPRMS *prms);
+
+int16 AKFS_LoadState(AKFS_STATE *st, const char* path);
+
+int16 AKFS_SaveState(AKFS_STATE *st, const char* path);
+
 #endif
 
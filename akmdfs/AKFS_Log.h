@@ -120,15 +120,22 @@
 #define AKMDATA_CONSOLE		DATA_AREA08
 #define AKMDATA_CHECK		DATA_AREA09
 
+/* Zones which are recorded into the trace ring by default. */
+#define AKMDATA_TRACE \
+	(AKMDATA_MAG | AKMDATA_ACC | AKMDATA_ORI | AKMDATA_LOOP | AKMDATA_DRV)
+
 #ifndef ENABLE_AKMDEBUG
 #define ENABLE_AKMDEBUG		(0)	/* Enable debug output when it is 1. */
 #endif
 
 /***** Debug output ******************************************/
+/* Messages are recorded into a ring, and they are formatted only when the
+   ring is dumped. See AKFS_Trace.c. */
+#include "AKFS_Trace.h"
 #if ENABLE_AKMDEBUG
 #define AKMDEBUG(flag, format, ...) \
-	((((int)flag) & g_dbgzone) \
-	  ? (fprintf(stdout, (format), ##__VA_ARGS__)) \
+	((((int)flag) & AKFS_TraceZone()) \
+	  ? (AKFS_Trace((int)(flag), (format), ##__VA_ARGS__)) \
 	  : ((void)0))
 #else
 #define AKMDEBUG(flag, format, ...)
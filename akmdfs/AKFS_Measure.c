@@ -15,6 +15,7 @@
  * limitations under the License.
  */
 #include "AKFS_APIs.h"
+#include "AKFS_Calib.h"
 #include "AKFS_Measure.h"
 
 
@@ -42,82 +43,161 @@ int16 AKFS_Set_MAGNETIC_FIELD(
 {
 	int16 akret;
 	int16 aocret;
+	int16 ecalret;
 	AKFLOAT radius;
+	AKFVEC aocho;
+	AKFS_ECAL_RES ecal;
+#ifdef AKFS_PRECISION_FIXED
+	AKFVEC hdata;
+#endif
 
 	AKMDEBUG(AKMDATA_MAG, "%s: m[0]=%d, m[1]=%d, m[2]=%d, st=%d\n",
 		__FUNCTION__, mag[0], mag[1], mag[2], status);
 
-	/* Decomposition */
+	/* Decomposition and rotate coordination */
 	/* mag  [in] : sensor local coordinate, sensor local unit. */
-	/* hdata[out]: sensor local coordinate, sensitivity adjusted (i.e. uT). */
-	akret = AKFS_Decomp(
+	/* hdata[out]: Android coordinate, sensitivity adjusted (i.e. uT). */
+#ifdef AKFS_PRECISION_FIXED
+	akret = AKFS_QDecompXform(
 		mag,
 		status,
-		&prms->i8v_asa,
-		AKFS_HDATA_SIZE,
-		prms->fva_hdata
+		&prms->s_hxform,
+		&prms->fva_hdata
 	);
+	/* AOC and ellipsoid fit take a float copy of the newest data. */
+	AKFS_QToVec(&AKFS_QBUF_AT(&prms->fva_hdata, 0), &hdata);
+#else
+	akret = AKFS_DecompXform(
+		mag,
+		status,
+		&prms->s_hxform,
+		&prms->fva_hdata
+	);
+#endif
 	if (akret == AKFS_ERROR) {
 		AKMERROR;
 		return AKM_ERROR;
 	}
 
-	/* Rotate coordination */
-	/* hdata[in] : sensor local coordinate, sensitivity adjusted. */
-	/* hdata[out]: Android coordinate, sensitivity adjusted. */
-	akret = AKFS_Rotate(
-		prms->e_hpat,
-		&prms->fva_hdata[0]
-	);
-	if (akret == AKFS_ERROR) {
-		AKMERROR;
-		return AKM_ERROR;
+	/* Request ellipsoid fit to the background thread */
+	/* hdata[in] : Android coordinate, sensitivity adjusted. */
+#ifdef AKFS_PRECISION_FIXED
+	if ((prms->p_calib != NULL) && AKFS_ECalAdd(&prms->s_ecal, &hdata)) {
+#else
+	if ((prms->p_calib != NULL) &&
+		AKFS_ECalAdd(&prms->s_ecal, &AKFS_VBUF_AT(&prms->fva_hdata, 0))) {
+#endif
+		AKFS_CalibPost(prms->p_calib, &prms->s_ecal);
 	}
 
 	/* Offset calculation is done in this function */
 	/* hdata[in] : Android coordinate, sensitivity adjusted. */
 	/* ho   [out]: Android coordinate, sensitivity adjusted. */
+	aocho = prms->fv_ho;
+#ifdef AKFS_PRECISION_FIXED
+	aocret = AKFS_AOC(&prms->s_aocv, &hdata, &aocho);
+#else
 	aocret = AKFS_AOC(
 		&prms->s_aocv,
-		prms->fva_hdata,
-		&prms->fv_ho
+		&AKFS_VBUF_AT(&prms->fva_hdata, 0),
+		&aocho
 	);
+#endif
+	if (aocret == AKFS_SUCCESS) {
+		/* An ellipsoid fit has priority, unless AOC finds the offset has
+		   moved far, e.g. by a change of magnetic environment. */
+		if ((prms->i16_hsi == 0) ||
+			(AKFS_SQRT(
+				(aocho.u.x - prms->fv_ho.u.x) * (aocho.u.x - prms->fv_ho.u.x) +
+				(aocho.u.y - prms->fv_ho.u.y) * (aocho.u.y - prms->fv_ho.u.y) +
+				(aocho.u.z - prms->fv_ho.u.z) * (aocho.u.z - prms->fv_ho.u.z))
+			 > (prms->f_hr * AKFS_HO_TH))) {
+			prms->fv_ho = aocho;
+			prms->i16_hsi = 0;
+			prms->i16_ckpt = 1;
+		}
+	}
+
+	/* Take the result of ellipsoid fit, if any */
+	/* ho   [out]: Android coordinate, sensitivity adjusted. */
+	/* hsi  [out]: Soft-iron correction matrix. */
+	ecalret = AKFS_ERROR;
+	if ((prms->p_calib != NULL) &&
+		(AKFS_CalibTake(prms->p_calib, &ecal) == AKM_SUCCESS)) {
+		prms->fv_ho = ecal.ho;
+		memcpy(prms->fm_hsi, ecal.hsi, sizeof(prms->fm_hsi));
+		prms->f_hr = ecal.hr;
+		prms->i16_hsi = 1;
+		prms->i16_ckpt = 1;
+		ecalret = AKFS_SUCCESS;
+	}
 
 	/* Subtract offset */
 	/* hdata[in] : Android coordinate, sensitivity adjusted. */
 	/* ho   [in] : Android coordinate, sensitivity adjusted. */
 	/* hvbuf[out]: Android coordinate, sensitivity adjusted, */
 	/*			   offset subtracted. */
+#ifdef AKFS_PRECISION_FIXED
+	/* Soft-iron correction is folded into the gain of s_hqn. */
+	akret = AKFS_QNormSet(
+		&prms->fv_ho,
+		&prms->fv_hs,
+		AKM_MAG_SENSE,
+		(prms->i16_hsi != 0) ? prms->fm_hsi : NULL,
+		&prms->s_hqn
+	);
+	if (akret != AKFS_ERROR) {
+		akret = AKFS_QbNorm(
+			&prms->fva_hdata,
+			1,
+			&prms->s_hqn,
+			&prms->fva_hvbuf
+		);
+	}
+	if (akret == AKFS_ERROR) {
+		AKMERROR;
+		return AKM_ERROR;
+	}
+#else
 	akret = AKFS_VbNorm(
-		AKFS_HDATA_SIZE,
-		prms->fva_hdata,
+		&prms->fva_hdata,
 		1,
 		&prms->fv_ho,
 		&prms->fv_hs,
 		AKM_MAG_SENSE,
-		AKFS_HDATA_SIZE,
-		prms->fva_hvbuf
+		&prms->fva_hvbuf
 	);
 	if (akret == AKFS_ERROR) {
 		AKMERROR;
 		return AKM_ERROR;
 	}
 
+	/* Soft-iron correction */
+	if (prms->i16_hsi != 0) {
+		AKFS_ECalApply(prms->fm_hsi, &AKFS_VBUF_AT(&prms->fva_hvbuf, 0));
+	}
+#endif
+
 	/* Averaging */
 	/* hvbuf[in] : Android coordinate, sensitivity adjusted, */
 	/*			   offset subtracted. */
 	/* hvec [out]: Android coordinate, sensitivity adjusted, */
 	/*			   offset subtracted, averaged. */
-	akret = AKFS_VbAve(
-		AKFS_HDATA_SIZE,
-		prms->fva_hvbuf,
-		CSPEC_HNAVE_V,
-		&prms->fv_hvec
-	);
-	if (akret == AKFS_ERROR) {
+#ifdef AKFS_PRECISION_FIXED
+	if ((AKFS_QAveUpdate(&prms->fva_hvbuf, &prms->s_hvave) == AKFS_ERROR) ||
+		(AKFS_QAveUpdate(&prms->fva_hvbuf, &prms->s_hdave) == AKFS_ERROR)) {
+		AKMERROR;
+		return AKM_ERROR;
+	}
+	AKFS_QAveGet(&prms->s_hvave, &prms->fv_hvec);
+#else
+	if ((AKFS_VAveUpdate(&prms->fva_hvbuf, &prms->s_hvave) == AKFS_ERROR) ||
+		(AKFS_VAveUpdate(&prms->fva_hvbuf, &prms->s_hdave) == AKFS_ERROR)) {
 		AKMERROR;
 		return AKM_ERROR;
 	}
+	AKFS_VAveGet(&prms->s_hvave, &prms->fv_hvec);
+#endif
 
 	/* Check the size of magnetic vector */
 	radius = AKFS_SQRT(
@@ -128,11 +208,18 @@ int16 AKFS_Set_MAGNETIC_FIELD(
 	if (radius > AKFS_GEOMAG_MAX) {
 		prms->i16_hstatus = 0;
 	} else {
-		if (aocret == AKFS_SUCCESS) {
+		if ((aocret == AKFS_SUCCESS) || (ecalret == AKFS_SUCCESS)) {
 			prms->i16_hstatus = 3;
 		}
 	}
 
+	/* Save a new offset in background. Retry later, if the thread is busy. */
+	if ((prms->i16_ckpt != 0) && (prms->p_calib != NULL)) {
+		if (AKFS_CalibCheckpoint(prms->p_calib, prms) == AKM_SUCCESS) {
+			prms->i16_ckpt = 0;
+		}
+	}
+
 	/* Debug output */
 	AKMDEBUG(AKMDATA_MAG, "Mag(%d):%8.2f, %8.2f, %8.2f\n",
 		prms->i16_hstatus, prms->fv_hvec.u.x, prms->fv_hvec.u.y, prms->fv_hvec.u.z);
@@ -159,28 +246,50 @@ int16 AKFS_Set_ACCELEROMETER(
 	const	int16		status
 )
 {
-	int16 akret;
+#ifdef AKFS_PRECISION_FIXED
+	AKFS_QVEC qa;
+#else
+	AKFVEC *av;
+#endif
 
 	AKMDEBUG(AKMDATA_ACC, "%s: a[0]=%d, a[1]=%d, a[2]=%d, st=%d\n",
 		__FUNCTION__, acc[0], acc[1], acc[2], status);
 
-	/* Make a spare area for new data */
-	akret = AKFS_BufShift(
-		AKFS_ADATA_SIZE,
-		1,
-		prms->fva_avbuf
-	);
-	if (akret == AKFS_ERROR) {
-		AKMERROR;
-		return AKM_ERROR;
-	}
 	/* Subtract offset, adjust sensitivity */
 	/* acc  [in] : Android coordinate, sensor local unit. */
 	/* avbuf[out]: Android coordinate, sensitivity adjusted (SI unit), */
 	/*			   offset subtracted. */
-	prms->fva_avbuf[0].u.x = AKM_ACC_TARGET * (((AKFLOAT)acc[0] - prms->fv_ao.u.x) / prms->fv_as.u.x);
-	prms->fva_avbuf[0].u.y = AKM_ACC_TARGET * (((AKFLOAT)acc[1] - prms->fv_ao.u.y) / prms->fv_as.u.y);
-	prms->fva_avbuf[0].u.z = AKM_ACC_TARGET * (((AKFLOAT)acc[2] - prms->fv_ao.u.z) / prms->fv_as.u.z);
+#ifdef AKFS_PRECISION_FIXED
+	if (AKFS_QNormSet(&prms->fv_ao, &prms->fv_as, AKM_ACC_TARGET, NULL,
+			&prms->s_aqn) == AKFS_ERROR) {
+		AKMERROR;
+		return AKM_ERROR;
+	}
+	qa.u.x = (AKFS_Q16)acc[0] * AKFS_Q16_ONE;
+	qa.u.y = (AKFS_Q16)acc[1] * AKFS_Q16_ONE;
+	qa.u.z = (AKFS_Q16)acc[2] * AKFS_Q16_ONE;
+	AKFS_QNormApply(&prms->s_aqn, &qa, AKFS_QBufPush(&prms->fva_avbuf));
+#else
+	/* Make a spare area for new data */
+	av = AKFS_VBufPush(&prms->fva_avbuf);
+
+	av->u.x = AKM_ACC_TARGET * (((AKFLOAT)acc[0] - prms->fv_ao.u.x) / prms->fv_as.u.x);
+	av->u.y = AKM_ACC_TARGET * (((AKFLOAT)acc[1] - prms->fv_ao.u.y) / prms->fv_as.u.y);
+	av->u.z = AKM_ACC_TARGET * (((AKFLOAT)acc[2] - prms->fv_ao.u.z) / prms->fv_as.u.z);
+#endif
+
+	/* Averaging */
+	/* avbuf[in] : Android coordinate, sensitivity adjusted, */
+	/*			   offset subtracted. */
+	/* adave[out]: Running average for orientation. */
+#ifdef AKFS_PRECISION_FIXED
+	if (AKFS_QAveUpdate(&prms->fva_avbuf, &prms->s_adave) == AKFS_ERROR) {
+#else
+	if (AKFS_VAveUpdate(&prms->fva_avbuf, &prms->s_adave) == AKFS_ERROR) {
+#endif
+		AKMERROR;
+		return AKM_ERROR;
+	}
 
 #ifdef AKFS_OUTPUT_AVEC
 	/* Averaging */
@@ -188,16 +297,19 @@ int16 AKFS_Set_ACCELEROMETER(
 	/*			   offset subtracted. */
 	/* avec [out]: Android coordinate, sensitivity adjusted, */
 	/*			   offset subtracted, averaged. */
-	akret = AKFS_VbAve(
-		AKFS_ADATA_SIZE,
-		prms->fva_avbuf,
-		CSPEC_ANAVE_V,
-		&prms->fv_avec
-	);
-	if (akret == AKFS_ERROR) {
+#ifdef AKFS_PRECISION_FIXED
+	if (AKFS_QAveUpdate(&prms->fva_avbuf, &prms->s_avave) == AKFS_ERROR) {
 		AKMERROR;
 		return AKM_ERROR;
 	}
+	AKFS_QAveGet(&prms->s_avave, &prms->fv_avec);
+#else
+	if (AKFS_VAveUpdate(&prms->fva_avbuf, &prms->s_avave) == AKFS_ERROR) {
+		AKMERROR;
+		return AKM_ERROR;
+	}
+	AKFS_VAveGet(&prms->s_avave, &prms->fv_avec);
+#endif
 
 	/* Debug output (accuracy is always '3' */
 	AKMDEBUG(AKMDATA_ACC, "Acc(3):%8.2f, %8.2f, %8.2f\n",
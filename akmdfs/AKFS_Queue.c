@@ -0,0 +1,233 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2012 Asahi Kasei Microdevices Corporation, Japan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************/
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include "AKFS_Common.h"
+#include "AKFS_Queue.h"
+
+/*
+ * The consumer copies the oldest frame and then advances tail with a
+ * compare-and-swap. In lossy mode the producer drops the oldest frame in
+ * the same way when the queue is full. So a frame which the consumer was
+ * copying while it was dropped, and its slot was overwritten, is discarded,
+ * and the consumer takes the next one. Slots are copied word by word with
+ * atomic accesses, so such a copy is not a data race.
+ *
+ * A side which has to wait sets parked, checks the queue again, and sleeps
+ * on the futex. The other side changes the queue first, and wakes it only
+ * if parked is set. Both steps are full barriers, so at least one side sees
+ * the change of the other one.
+ */
+
+static void QueueStore(uint32_t *slot, const AKFS_FRAME *frame)
+{
+	uint32_t w[AKFS_FRAME_WORDS];
+	unsigned int i;
+
+	memcpy(w, frame, sizeof(AKFS_FRAME));
+	for (i = 0; i < AKFS_FRAME_WORDS; i++) {
+		__atomic_store_n(&slot[i], w[i], __ATOMIC_RELAXED);
+	}
+}
+
+static void QueueLoad(const uint32_t *slot, AKFS_FRAME *frame)
+{
+	uint32_t w[AKFS_FRAME_WORDS];
+	unsigned int i;
+
+	for (i = 0; i < AKFS_FRAME_WORDS; i++) {
+		w[i] = __atomic_load_n(&slot[i], __ATOMIC_RELAXED);
+	}
+	memcpy(frame, w, sizeof(AKFS_FRAME));
+}
+
+/*! Snapshot of the futex word, taken before parked is set. */
+static uint32_t QueueParkBegin(AKFS_QUEUE_WAITER *w)
+{
+	uint32_t seq;
+
+	seq = __sync_fetch_and_add(&w->seq, 0);
+	__sync_lock_test_and_set(&w->parked, 1);
+	__sync_synchronize();
+	return seq;
+}
+
+/*! Sleeps until woken, unless a wake is already issued after seq. */
+static void QueuePark(AKFS_QUEUE_WAITER *w, uint32_t seq)
+{
+	/* EAGAIN and EINTR: the caller checks the queue again. */
+	syscall(__NR_futex, &w->seq, FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+	__sync_lock_release(&w->parked);
+}
+
+static void QueueParkCancel(AKFS_QUEUE_WAITER *w)
+{
+	__sync_lock_release(&w->parked);
+}
+
+/*! Wakes the other side, only when it is parked. */
+static void QueueWake(AKFS_QUEUE_WAITER *w)
+{
+	__sync_synchronize();
+	if (__sync_fetch_and_add(&w->parked, 0) != 0) {
+		__sync_fetch_and_add(&w->seq, 1);
+		syscall(__NR_futex, &w->seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+	}
+}
+
+/*!
+ Initializes a queue.
+ @return The return value is #AKM_SUCCESS.
+ @param[out] q A queue.
+ @param[in] lossless When #AKM_TRUE, #AKFS_QueuePush waits while the queue is
+ full. Otherwise the oldest frame is dropped.
+ */
+int16 AKFS_QueueInit(
+			AKFS_QUEUE	*q,
+	const	int			lossless)
+{
+	memset(q, 0, sizeof(AKFS_QUEUE));
+	q->lossless = lossless;
+	return AKM_SUCCESS;
+}
+
+/*!
+ Releases a queue. Neither the producer nor the consumer may use it any more.
+ @param[in] q A queue.
+ */
+void AKFS_QueueRelease(
+			AKFS_QUEUE	*q)
+{
+	(void)q;
+}
+
+/*!
+ Adds a frame at the end of a queue. This function is called only by the
+ producer. When the queue is full, it waits in lossless mode. Otherwise the
+ oldest frame is dropped, so the consumer always gets the newest data.
+ @return The number of frames dropped for this frame, i.e. 0 or 1.
+ @param[in] q A queue.
+ @param[in] frame A frame.
+ */
+int AKFS_QueuePush(
+			AKFS_QUEUE	*q,
+	const	AKFS_FRAME	*frame)
+{
+	uint32_t head;
+	uint32_t tail;
+	uint32_t seq;
+	int dropped = 0;
+
+	head = __sync_fetch_and_add(&q->head, 0);
+	for (;;) {
+		tail = __sync_fetch_and_add(&q->tail, 0);
+		if ((head - tail) < AKFS_QUEUE_DEPTH) {
+			break;
+		}
+		if (!q->lossless) {
+			/* Fails only when the consumer took it meanwhile. */
+			if (__sync_bool_compare_and_swap(&q->tail, tail, tail + 1)) {
+				__sync_fetch_and_add(&q->dropped, 1);
+				dropped = 1;
+			}
+			continue;
+		}
+		seq = QueueParkBegin(&q->spaces);
+		if ((head - __sync_fetch_and_add(&q->tail, 0)) < AKFS_QUEUE_DEPTH) {
+			QueueParkCancel(&q->spaces);
+			continue;
+		}
+		QueuePark(&q->spaces, seq);
+	}
+
+	QueueStore(q->ring[head & (AKFS_QUEUE_DEPTH - 1)], frame);
+	/* Publish the frame, then wake up the consumer if it sleeps. */
+	__sync_fetch_and_add(&q->head, 1);
+	QueueWake(&q->items);
+
+	return dropped;
+}
+
+/*!
+ Takes a frame from the top of a queue. It waits while the queue is empty.
+ This function is called only by the consumer.
+ @return If this function succeeds, the return value is #AKM_SUCCESS. When
+ the queue is closed and empty, the return value is #AKM_ERROR.
+ @param[in] q A queue.
+ @param[out] frame A frame.
+ */
+int16 AKFS_QueuePop(
+			AKFS_QUEUE	*q,
+			AKFS_FRAME	*frame)
+{
+	uint32_t tail;
+	uint32_t seq;
+
+	for (;;) {
+		tail = __sync_fetch_and_add(&q->tail, 0);
+		if (tail != __sync_fetch_and_add(&q->head, 0)) {
+			QueueLoad(q->ring[tail & (AKFS_QUEUE_DEPTH - 1)], frame);
+			/* Fails when the producer dropped the frame meanwhile. */
+			if (__sync_bool_compare_and_swap(&q->tail, tail, tail + 1)) {
+				break;
+			}
+			continue;
+		}
+		if (__sync_fetch_and_add(&q->closed, 0) != 0) {
+			return AKM_ERROR;
+		}
+		seq = QueueParkBegin(&q->items);
+		if ((tail != __sync_fetch_and_add(&q->head, 0)) ||
+			(__sync_fetch_and_add(&q->closed, 0) != 0)) {
+			QueueParkCancel(&q->items);
+			continue;
+		}
+		QueuePark(&q->items, seq);
+	}
+
+	/* Give the slot back to the producer, if it waits for one. */
+	if (q->lossless) {
+		QueueWake(&q->spaces);
+	}
+
+	return AKM_SUCCESS;
+}
+
+/*!
+ Returns the number of frames in a queue.
+ @param[in] q A queue.
+ */
+int AKFS_QueueDepth(
+			AKFS_QUEUE	*q)
+{
+	return (int)(__sync_fetch_and_add(&q->head, 0)
+			- __sync_fetch_and_add(&q->tail, 0));
+}
+
+/*!
+ Closes a queue. The consumer takes frames left in the queue, and then
+ #AKFS_QueuePop returns #AKM_ERROR. This function is called by the producer
+ after the last push.
+ @param[in] q A queue.
+ */
+void AKFS_QueueClose(
+			AKFS_QUEUE	*q)
+{
+	__sync_fetch_and_add(&q->closed, 1);
+	QueueWake(&q->items);
+}
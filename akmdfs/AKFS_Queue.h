@@ -0,0 +1,97 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2012 Asahi Kasei Microdevices Corporation, Japan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************/
+#ifndef AKFS_INC_QUEUE_H
+#define AKFS_INC_QUEUE_H
+
+#include <stdint.h>
+
+#include "AKFS_Compass.h"
+
+/*** Constant definition ******************************************************/
+/*! Maximum number of frames in a queue. This must be a power of two. */
+#define AKFS_QUEUE_DEPTH	8
+
+/*** Type declaration *********************************************************/
+/*! Raw data of one cycle, which the acquisition stage hands to the
+  calculation stage. */
+typedef struct _AKFS_FRAME {
+	int64_t	ts;		/*!< CLOCK_MONOTONIC when data is acquired */
+	uint16	flag;	/*!< Sensors to be calculated (*_DATA_READY) */
+	int16	acc[3];
+	int16	mag[3];
+	int16	mstat;
+	int16	reuse;	/*!< Magnetic field is not measured in this cycle */
+} AKFS_FRAME;
+
+/*! Size of #AKFS_FRAME in 32 bit words */
+#define AKFS_FRAME_WORDS	((sizeof(AKFS_FRAME) + 3) / 4)
+
+/*! A side which may sleep on a futex. The other side issues a system call
+  only when parked is set. */
+typedef struct _AKFS_QUEUE_WAITER {
+	uint32_t	seq;		/*!< Futex word, incremented on each wake */
+	uint32_t	parked;		/*!< 1 while sleeping, or about to sleep */
+} AKFS_QUEUE_WAITER;
+
+/*! A single-producer single-consumer queue of #AKFS_FRAME. Frames are passed
+  without a lock, and no system call is issued while neither side has to
+  sleep. */
+typedef struct _AKFS_QUEUE {
+	uint32_t	ring[AKFS_QUEUE_DEPTH][AKFS_FRAME_WORDS];	/*!< Frames */
+	uint32_t	head;		/*!< Written only by the producer */
+	uint32_t	tail;		/*!< Advanced by the consumer, and by the
+							  producer when it drops the oldest frame */
+	uint32_t	closed;
+	uint32_t	dropped;	/*!< Frames dropped so far */
+	int			lossless;
+	AKFS_QUEUE_WAITER	items;	/*!< The consumer waits for a frame */
+	AKFS_QUEUE_WAITER	spaces;	/*!< The producer waits for a slot */
+} AKFS_QUEUE;
+
+/*** Global variables *********************************************************/
+
+/*** Prototype of function ****************************************************/
+int16 AKFS_QueueInit(
+			AKFS_QUEUE	*q,
+	const	int			lossless
+);
+
+void AKFS_QueueRelease(
+			AKFS_QUEUE	*q
+);
+
+int AKFS_QueuePush(
+			AKFS_QUEUE	*q,
+	const	AKFS_FRAME	*frame
+);
+
+int16 AKFS_QueuePop(
+			AKFS_QUEUE	*q,
+			AKFS_FRAME	*frame
+);
+
+int AKFS_QueueDepth(
+			AKFS_QUEUE	*q
+);
+
+void AKFS_QueueClose(
+			AKFS_QUEUE	*q
+);
+
+#endif
+
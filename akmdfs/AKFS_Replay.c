@@ -0,0 +1,418 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2012 Asahi Kasei Microdevices Corporation, Japan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************/
+#include "AKFS_Common.h"
+#include "AKFS_Replay.h"
+
+/*
+ * Replay file format. One record per line, and '#' begins a comment line.
+ *   L <layout>                 Layout pattern. Default is 1.
+ *   C <asax> <asay> <asaz>     ASA values. Default is 128.
+ *   M <st1> <hxl> ... <st2>    ST1..ST2 in hex, i.e. one ECS_IOCTL_GET_DATA.
+ *   A <x> <y> <z>              One ECS_IOCTL_GET_ACCEL.
+ *   D <acc> <mag> <fusion>     Delay in ns, negative means disabled.
+ *   R <azimuth> <pitch> <roll> Reference orientation at the last "M" record.
+ * "M" and "A" records are read as two independent streams. A "D" record takes
+ * effect when the "M" records before it have been read. The compass is opened
+ * once, and is closed when either stream runs out.
+ * The log has no wall clock. Replay runs on a virtual clock, which starts at 0
+ * and is advanced by the measurement loop by one period per cycle instead of
+ * sleeping. So the sample at which a "D" record is seen does not depend on the
+ * speed of the host, and replay runs as fast as the host can calculate. Each ECS_IOCTL_SET_YPR is
+ * written to the output as a line of AKM_YPR_DATA_SIZE integers. "R" records
+ * are not used by the backend, but by offline evaluation.
+ */
+
+/*** Constant definition ******************************************************/
+#define REPLAY_LINE_SIZE	128
+
+#define REPLAY_CLOSED		0	/*!< Compass is not opened yet */
+#define REPLAY_OPENED		1	/*!< Replaying */
+#define REPLAY_END			2	/*!< A stream ran out */
+
+/*!
+ Initialize the state of replay. Files are opened by #AKD_InitDevice, after
+ the state is given to a context with #AKD_SetBackend.
+ @return If this function succeeds, the return value is #AKD_SUCCESS.
+ Otherwise the return value is #AKD_ERROR.
+ @param[out] rp Release it with #AKD_ReplayRelease.
+ @param[in] input A path to a replay file.
+ @param[in] output A path to which the output is written. If NULL, the output
+ is written to stdout.
+ */
+int16_t AKD_ReplayInit(
+		AKD_REPLAY* rp,
+		const char* input,
+		const char* output)
+{
+	if (input == NULL) {
+		return AKD_ERROR;
+	}
+	memset(rp, 0, sizeof(AKD_REPLAY));
+	rp->inPath = input;
+	rp->outPath = output;
+	rp->state = REPLAY_CLOSED;
+	if (pthread_mutex_init(&rp->mutex, NULL) != 0) {
+		return AKD_ERROR;
+	}
+	if (pthread_cond_init(&rp->cond, NULL) != 0) {
+		pthread_mutex_destroy(&rp->mutex);
+		return AKD_ERROR;
+	}
+	return AKD_SUCCESS;
+}
+
+/*!
+ Release the state of replay. The context must be closed already.
+ @param[in,out] rp
+ */
+void AKD_ReplayRelease(AKD_REPLAY* rp)
+{
+	pthread_cond_destroy(&rp->cond);
+	pthread_mutex_destroy(&rp->mutex);
+}
+
+/*!
+ Parse one record.
+ @return If the line is a valid record or a comment, the return value is
+ #AKD_SUCCESS. Otherwise the return value is #AKD_ERROR.
+ @param[in] line A line.
+ @param[in,out] log Buffers must be large enough.
+ */
+static int16_t ReplayParse(const char* line, AKD_REPLAY_LOG* log)
+{
+	unsigned int b[AKM_SENSOR_DATA_SIZE];
+	int v[3];
+	long long d[AKM_NUM_SENSORS];
+	float f[3];
+	int i;
+
+	switch (line[0]) {
+	case 'M':
+		if (sscanf(line + 1, "%x %x %x %x %x %x %x %x",
+				&b[0], &b[1], &b[2], &b[3], &b[4], &b[5], &b[6], &b[7])
+				!= AKM_SENSOR_DATA_SIZE) {
+			return AKD_ERROR;
+		}
+		for (i = 0; i < AKM_SENSOR_DATA_SIZE; i++) {
+			log->mag[log->nmag][i] = (BYTE)b[i];
+		}
+		log->nmag++;
+		break;
+	case 'A':
+		if (sscanf(line + 1, "%d %d %d", &v[0], &v[1], &v[2]) != 3) {
+			return AKD_ERROR;
+		}
+		for (i = 0; i < 3; i++) {
+			log->acc[log->nacc][i] = (int16_t)v[i];
+		}
+		log->nacc++;
+		break;
+	case 'D':
+		if (sscanf(line + 1, "%lld %lld %lld", &d[0], &d[1], &d[2])
+				!= AKM_NUM_SENSORS) {
+			return AKD_ERROR;
+		}
+		log->delay[log->ndelay].at = log->nmag;
+		for (i = 0; i < AKM_NUM_SENSORS; i++) {
+			log->delay[log->ndelay].delay[i] = d[i];
+		}
+		log->ndelay++;
+		break;
+	case 'R':
+		if (sscanf(line + 1, "%f %f %f", &f[0], &f[1], &f[2]) != 3) {
+			return AKD_ERROR;
+		}
+		log->ref[log->nref].at = log->nmag;
+		for (i = 0; i < 3; i++) {
+			log->ref[log->nref].ypr[i] = f[i];
+		}
+		log->nref++;
+		break;
+	case 'L':
+		if (sscanf(line + 1, "%d", &v[0]) != 1) {
+			return AKD_ERROR;
+		}
+		log->layout = (char)v[0];
+		break;
+	case 'C':
+		if (sscanf(line + 1, "%d %d %d", &v[0], &v[1], &v[2]) != 3) {
+			return AKD_ERROR;
+		}
+		for (i = 0; i < AKM_SENSOR_CONF_SIZE; i++) {
+			log->conf[i] = (BYTE)v[i];
+		}
+		break;
+	case '#':
+	case '\n':
+	case '\0':
+		break;
+	default:
+		return AKD_ERROR;
+	}
+	return AKD_SUCCESS;
+}
+
+/*!
+ Read whole replay file to memory. The file is read twice, first to count
+ the records and then to parse them. This function is reentrant, so that
+ many files can be loaded in parallel.
+ @return If this function succeeds, the return value is #AKD_SUCCESS.
+ Otherwise the return value is #AKD_ERROR, and errno is set.
+ @param[in] path A path to a replay file.
+ @param[out] log Release it with #AKD_ReplayFree.
+ */
+int16_t AKD_ReplayLoad(const char* path, AKD_REPLAY_LOG* log)
+{
+	char line[REPLAY_LINE_SIZE];
+	FILE* fp;
+	int nm = 0, na = 0, nd = 0, nr = 0;
+	int lineno = 0;
+
+	memset(log, 0, sizeof(AKD_REPLAY_LOG));
+	if ((fp = fopen(path, "r")) == NULL) {
+		return AKD_ERROR;
+	}
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (line[0] == 'M') { nm++; }
+		if (line[0] == 'A') { na++; }
+		if (line[0] == 'D') { nd++; }
+		if (line[0] == 'R') { nr++; }
+	}
+	log->mag = malloc((nm + 1) * sizeof(*log->mag));
+	log->acc = malloc((na + 1) * sizeof(*log->acc));
+	log->delay = malloc((nd + 1) * sizeof(*log->delay));
+	log->ref = malloc((nr + 1) * sizeof(*log->ref));
+	log->layout = 1;
+	memset(log->conf, 128, sizeof(log->conf));
+	if ((log->mag == NULL) || (log->acc == NULL) ||
+		(log->delay == NULL) || (log->ref == NULL)) {
+		fclose(fp);
+		AKD_ReplayFree(log);
+		errno = ENOMEM;
+		return AKD_ERROR;
+	}
+
+	rewind(fp);
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		lineno++;
+		/* Do not overrun the buffers, if the file grows meanwhile. */
+		if ((log->nmag >= nm) && (line[0] == 'M')) { continue; }
+		if ((log->nacc >= na) && (line[0] == 'A')) { continue; }
+		if ((log->ndelay >= nd) && (line[0] == 'D')) { continue; }
+		if ((log->nref >= nr) && (line[0] == 'R')) { continue; }
+		if (ReplayParse(line, log) != AKD_SUCCESS) {
+			AKMDEBUG(AKMDATA_DRV, "%s: %s: invalid record at line %d\n",
+				__FUNCTION__, path, lineno);
+		}
+	}
+	fclose(fp);
+
+	return AKD_SUCCESS;
+}
+
+/*!
+ Release buffers of a replay file.
+ @param[in,out] log
+ */
+void AKD_ReplayFree(AKD_REPLAY_LOG* log)
+{
+	free(log->mag);
+	free(log->acc);
+	free(log->delay);
+	free(log->ref);
+	memset(log, 0, sizeof(AKD_REPLAY_LOG));
+}
+
+static void ReplayClose(AKD_CONTEXT* ctx);
+
+/*!
+ Open the replay file given to #AKD_ReplayInit.
+ @return If this function succeeds, the return value is 0. Otherwise -1.
+ */
+static int ReplayOpen(AKD_CONTEXT* ctx)
+{
+	AKD_REPLAY* rp = (AKD_REPLAY*)ctx->priv;
+
+	if ((rp == NULL) || (rp->inPath == NULL)) {
+		errno = ENOENT;
+		return -1;
+	}
+	if (AKD_ReplayLoad(rp->inPath, &rp->log) != AKD_SUCCESS) {
+		return -1;
+	}
+	rp->imag = rp->iacc = 0;
+	rp->now = 0;
+
+	if (rp->outPath == NULL) {
+		rp->out = stdout;
+	} else if ((rp->out = fopen(rp->outPath, "w")) == NULL) {
+		ReplayClose(ctx);
+		return -1;
+	}
+
+	AKMDEBUG(AKMDATA_DRV, "%s: M=%d A=%d D=%d\n",
+		__FUNCTION__, rp->log.nmag, rp->log.nacc, rp->log.ndelay);
+
+	pthread_mutex_lock(&rp->mutex);
+	rp->state = REPLAY_CLOSED;
+	pthread_mutex_unlock(&rp->mutex);
+
+	return 0;
+}
+
+static void ReplayClose(AKD_CONTEXT* ctx)
+{
+	AKD_REPLAY* rp = (AKD_REPLAY*)ctx->priv;
+
+	if ((rp->out != NULL) && (rp->out != stdout)) {
+		fclose(rp->out);
+	} else if (rp->out != NULL) {
+		fflush(rp->out);
+	}
+	rp->out = NULL;
+	AKD_ReplayFree(&rp->log);
+}
+
+/*!
+ A stream ran out. This function must be called with the mutex locked.
+ @return -1, and errno is set to ENODATA.
+ */
+static int ReplayEnd(AKD_REPLAY* rp)
+{
+	rp->state = REPLAY_END;
+	pthread_cond_broadcast(&rp->cond);
+	errno = ENODATA;
+	return -1;
+}
+
+static int ReplayIoctl(AKD_CONTEXT* ctx, int request, void* arg)
+{
+	AKD_REPLAY* rp = (AKD_REPLAY*)ctx->priv;
+	int ret = 0;
+	int i;
+
+	pthread_mutex_lock(&rp->mutex);
+	switch ((unsigned int)request) {
+	case ECS_IOCTL_READ:
+		/* Registers read as 0. */
+		memset((char*)arg + 1, 0, ((char*)arg)[0]);
+		break;
+	case ECS_IOCTL_WRITE:
+	case ECS_IOCTL_RESET:
+	case ECS_IOCTL_SET_MODE:
+		break;
+	case ECS_IOCTL_SET_YPR:
+		for (i = 0; i < AKM_YPR_DATA_SIZE; i++) {
+			fprintf(rp->out, (i == 0) ? "%d" : " %d", ((const int*)arg)[i]);
+		}
+		fprintf(rp->out, "\n");
+		break;
+	case ECS_IOCTL_GET_INFO:
+		memset(arg, 0, AKM_SENSOR_INFO_SIZE);
+		break;
+	case ECS_IOCTL_GET_CONF:
+		memcpy(arg, rp->log.conf, AKM_SENSOR_CONF_SIZE);
+		break;
+	case ECS_IOCTL_GET_DATA:
+		if (rp->imag >= rp->log.nmag) {
+			ret = ReplayEnd(rp);
+		} else {
+			memcpy(arg, rp->log.mag[rp->imag++], AKM_SENSOR_DATA_SIZE);
+		}
+		break;
+	case ECS_IOCTL_GET_ACCEL:
+		if (rp->iacc >= rp->log.nacc) {
+			ret = ReplayEnd(rp);
+		} else {
+			memcpy(arg, rp->log.acc[rp->iacc++], sizeof(rp->log.acc[0]));
+		}
+		break;
+	case ECS_IOCTL_GET_OPEN_STATUS:
+		/* Opened only once. */
+		if (rp->state == REPLAY_CLOSED) {
+			rp->state = REPLAY_OPENED;
+			*(int*)arg = 1;
+		} else {
+			errno = ENODATA;
+			ret = -1;
+		}
+		break;
+	case ECS_IOCTL_GET_CLOSE_STATUS:
+		while (rp->state != REPLAY_END) {
+			pthread_cond_wait(&rp->cond, &rp->mutex);
+		}
+		*(int*)arg = 0;
+		break;
+	case ECS_IOCTL_GET_DELAY:
+		for (i = 0; i < AKM_NUM_SENSORS; i++) {
+			((int64_t*)arg)[i] = AKD_REPLAY_DEFAULT_DELAY;
+		}
+		for (i = 0; (i < rp->log.ndelay) && (rp->log.delay[i].at <= rp->imag); i++) {
+			memcpy(arg, rp->log.delay[i].delay, sizeof(rp->log.delay[i].delay));
+		}
+		break;
+	case ECS_IOCTL_GET_LAYOUT:
+		*(char*)arg = rp->log.layout;
+		break;
+	default:
+		errno = EINVAL;
+		ret = -1;
+		break;
+	}
+	pthread_mutex_unlock(&rp->mutex);
+
+	return ret;
+}
+
+/*!
+ Data is always ready.
+ */
+static int ReplayPoll(AKD_CONTEXT* ctx, int timeout_ms)
+{
+	(void)ctx;
+	(void)timeout_ms;
+	return 1;
+}
+
+/*!
+ Virtual clock. It is used only by the measurement thread.
+ */
+static int64_t ReplayNow(AKD_CONTEXT* ctx)
+{
+	return ((AKD_REPLAY*)ctx->priv)->now;
+}
+
+static void ReplayAdvance(AKD_CONTEXT* ctx, int64_t t)
+{
+	AKD_REPLAY* rp = (AKD_REPLAY*)ctx->priv;
+
+	if (t > rp->now) {
+		rp->now = t;
+	}
+}
+
+const AKD_BACKEND g_akdReplay = {
+	"replay",
+	ReplayOpen,
+	ReplayClose,
+	ReplayIoctl,
+	ReplayPoll,
+	ReplayNow,
+	ReplayAdvance
+};
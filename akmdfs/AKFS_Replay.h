@@ -0,0 +1,91 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2012 Asahi Kasei Microdevices Corporation, Japan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************/
+#ifndef AKFS_INC_REPLAY_H
+#define AKFS_INC_REPLAY_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include "AKFS_Driver.h"
+
+/*** Constant definition ******************************************************/
+/*! Delay of each sensor until the first "D" record, in nano second. */
+#define AKD_REPLAY_DEFAULT_DELAY	(10000000LL)
+
+/*** Type declaration *********************************************************/
+/*! A "D" record */
+typedef struct _AKD_REPLAY_DELAY {
+	int		at;		/*!< The number of "M" records before this record */
+	int64_t	delay[AKM_NUM_SENSORS];
+} AKD_REPLAY_DELAY;
+
+/*! A "R" record */
+typedef struct _AKD_REPLAY_REF {
+	int		at;		/*!< The number of "M" records before this record */
+	float	ypr[3];	/*!< Azimuth, pitch and roll in degree */
+} AKD_REPLAY_REF;
+
+/*! Whole contents of a replay file. */
+typedef struct _AKD_REPLAY_LOG {
+	BYTE				(*mag)[AKM_SENSOR_DATA_SIZE];
+	int					nmag;
+	int16_t				(*acc)[3];
+	int					nacc;
+	AKD_REPLAY_DELAY	*delay;
+	int					ndelay;
+	AKD_REPLAY_REF		*ref;
+	int					nref;
+	char				layout;
+	BYTE				conf[AKM_SENSOR_CONF_SIZE];
+} AKD_REPLAY_LOG;
+
+/*! State of the replay backend. One is given to each #AKD_CONTEXT with
+  #AKD_SetBackend, so that many files can be replayed at the same time.
+  Initialize it with #AKD_ReplayInit. */
+typedef struct _AKD_REPLAY {
+	const char*		inPath;
+	const char*		outPath;
+	FILE*			out;
+	AKD_REPLAY_LOG	log;
+	int				imag;	/*!< The next "M" record */
+	int				iacc;	/*!< The next "A" record */
+	int64_t			now;	/*!< Virtual clock in ns */
+	/* state is accessed from both main thread and measurement thread. */
+	pthread_mutex_t	mutex;
+	pthread_cond_t	cond;
+	int				state;
+} AKD_REPLAY;
+
+
+/*** Global variables *********************************************************/
+/*! Backend which replays a recorded file instead of the device driver. */
+extern const AKD_BACKEND g_akdReplay;
+
+/*** Prototype of function ****************************************************/
+int16_t AKD_ReplayInit(
+		AKD_REPLAY* rp,
+		const char* input,
+		const char* output);
+
+void AKD_ReplayRelease(AKD_REPLAY* rp);
+
+int16_t AKD_ReplayLoad(const char* path, AKD_REPLAY_LOG* log);
+
+void AKD_ReplayFree(AKD_REPLAY_LOG* log);
+
+#endif
+
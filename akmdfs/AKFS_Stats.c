@@ -0,0 +1,249 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2012 Asahi Kasei Microdevices Corporation, Japan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************/
+#include "AKFS_Common.h"
+#include "AKFS_Stats.h"
+
+#include <time.h>
+
+/*** Static variables *********************************************************/
+static const char * const s_name[AKFS_STATS_NUM] = {
+	"period_err",
+	"wakeup",
+	"loop",
+	"io_get_delay",
+	"io_get_accel",
+	"io_set_mode",
+	"io_get_data",
+	"io_set_ypr",
+	"calc_acc",
+	"calc_mag",
+	"calc_ori",
+	"calc_rot",
+	"queue",
+	"e2e"
+};
+
+static const char * const s_cntName[AKFS_STATS_CNT_NUM] = {
+	"drdy_retry",
+	"queue_depth"
+};
+
+/*!
+ Returns the current time.
+ @return CLOCK_MONOTONIC in nano second.
+ */
+int64_t AKFS_StatsNow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((int64_t)ts.tv_sec * 1000000000LL) + ts.tv_nsec;
+}
+
+/*!
+ Clears all histograms.
+ @param[out] st Statistics.
+ */
+void AKFS_InitStats(
+			AKFS_STATS	*st)
+{
+	memset(st, 0, sizeof(AKFS_STATS));
+}
+
+/*!
+ Adds a value to a histogram. A negative value is counted as 0.
+ @param[in,out] st Statistics. Nothing is done when it is NULL.
+ @param[in] id One of AKFS_STATS_*.
+ @param[in] ns A value in nano second.
+ */
+void AKFS_StatsAdd(
+			AKFS_STATS	*st,
+	const	int			id,
+	const	int64_t		ns)
+{
+	AKFS_HIST	*h;
+	int64_t		v;
+	int64_t		m;
+	int			n;
+
+	if ((st == NULL) || (id < 0) || (AKFS_STATS_NUM <= id)) {
+		return;
+	}
+	h = &st->hist[id];
+	v = (ns < 0) ? 0 : ns;
+
+	/* 1 + floor(log2(usec)) */
+	n = 0;
+	for (m = v / 1000; (m > 0) && (n < (AKFS_STATS_NBIN - 1)); m >>= 1) {
+		n++;
+	}
+
+	__sync_fetch_and_add(&h->bin[n], 1);
+	__sync_fetch_and_add(&h->count, 1);
+	__sync_fetch_and_add(&h->sum, v);
+	m = __sync_fetch_and_add(&h->max, 0);
+	while (v > m) {
+		m = __sync_val_compare_and_swap(&h->max, m, v);
+	}
+}
+
+/*!
+ Adds a value to a histogram of count.
+ @param[in,out] st Statistics. Nothing is done when it is NULL.
+ @param[in] id One of AKFS_STATS_CNT_*.
+ @param[in] count A value.
+ */
+void AKFS_StatsCount(
+			AKFS_STATS	*st,
+	const	int			id,
+	const	int			count)
+{
+	int n = count;
+
+	if ((st == NULL) || (id < 0) || (AKFS_STATS_CNT_NUM <= id)) {
+		return;
+	}
+	if (n < 0) {
+		n = 0;
+	}
+	if (n > AKFS_STATS_MAX_COUNT) {
+		n = AKFS_STATS_MAX_COUNT;
+	}
+	__sync_fetch_and_add(&st->count[id][n], 1);
+}
+
+/*!
+ Copies a histogram. Each counter is read atomically, but counters may be
+ updated while they are copied.
+ @param[in] src A histogram.
+ @param[out] h A copy.
+ */
+static void StatsSnapshot(
+			AKFS_HIST	*src,
+			AKFS_HIST	*h)
+{
+	int n;
+
+	for (n = 0; n < AKFS_STATS_NBIN; n++) {
+		h->bin[n] = __sync_fetch_and_add(&src->bin[n], 0);
+	}
+	h->count = __sync_fetch_and_add(&src->count, 0);
+	h->sum = __sync_fetch_and_add(&src->sum, 0);
+	h->max = __sync_fetch_and_add(&src->max, 0);
+}
+
+/*!
+ Returns the upper bound of a bucket in which a percentile is.
+ @return Upper bound in usec. The maximum is used for the last bucket.
+ @param[in] h A histogram.
+ @param[in] count The number of values in the histogram.
+ @param[in] permil Percentile in 1/1000.
+ */
+static int64_t StatsPercentile(
+	const	AKFS_HIST	*h,
+	const	uint32_t	count,
+	const	int			permil)
+{
+	uint64_t	acc = 0;
+	uint64_t	target;
+	int			n;
+
+	target = ((uint64_t)count * permil + 999) / 1000;
+	for (n = 0; n < AKFS_STATS_NBIN - 1; n++) {
+		acc += h->bin[n];
+		if (acc >= target) {
+			return (int64_t)1 << n;
+		}
+	}
+	return (h->max + 999) / 1000 + 1;
+}
+
+/*!
+ Writes all histograms to a file as text. Values are in usec. A bucket
+ line "<N" counts values less than N usec, and also not less than N/2 usec
+ except for the first bucket.
+ @return If this function succeeds, the return value is #AKM_SUCCESS.
+ Otherwise the return value is #AKM_ERROR.
+ @param[in] st Statistics.
+ @param[in] path The path to a file.
+ */
+int16 AKFS_StatsDump(
+			AKFS_STATS	*st,
+	const	char		*path)
+{
+	FILE		*fp;
+	AKFS_HIST	h[AKFS_STATS_NUM];
+	int			i;
+	int			n;
+
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		AKMERROR_STR("fopen");
+		return AKM_ERROR;
+	}
+
+	for (i = 0; i < AKFS_STATS_NUM; i++) {
+		StatsSnapshot(&st->hist[i], &h[i]);
+	}
+
+	fprintf(fp, "# name\tcount\tmean\tp50\tp99\tp999\tmax (usec)\n");
+	for (i = 0; i < AKFS_STATS_NUM; i++) {
+		fprintf(fp, "%s\t%u\t%.1f\t<%lld\t<%lld\t<%lld\t%.1f\n",
+			s_name[i], h[i].count,
+			(h[i].count > 0)
+				? ((double)h[i].sum / h[i].count / 1000.0) : 0.0,
+			(long long)StatsPercentile(&h[i], h[i].count, 500),
+			(long long)StatsPercentile(&h[i], h[i].count, 990),
+			(long long)StatsPercentile(&h[i], h[i].count, 999),
+			(double)h[i].max / 1000.0);
+	}
+
+	fprintf(fp, "\n# bucket (usec)");
+	for (i = 0; i < AKFS_STATS_NUM; i++) {
+		fprintf(fp, "\t%s", s_name[i]);
+	}
+	fprintf(fp, "\n");
+	for (n = 0; n < AKFS_STATS_NBIN; n++) {
+		if (n < AKFS_STATS_NBIN - 1) {
+			fprintf(fp, "<%lld", (long long)1 << n);
+		} else {
+			fprintf(fp, ">=%lld", (long long)1 << (n - 1));
+		}
+		for (i = 0; i < AKFS_STATS_NUM; i++) {
+			fprintf(fp, "\t%u", h[i].bin[n]);
+		}
+		fprintf(fp, "\n");
+	}
+
+	fprintf(fp, "\n# count");
+	for (i = 0; i < AKFS_STATS_CNT_NUM; i++) {
+		fprintf(fp, "\t%s", s_cntName[i]);
+	}
+	fprintf(fp, "\n");
+	for (n = 0; n <= AKFS_STATS_MAX_COUNT; n++) {
+		fprintf(fp, "%d%s", n, (n == AKFS_STATS_MAX_COUNT) ? "+" : "");
+		for (i = 0; i < AKFS_STATS_CNT_NUM; i++) {
+			fprintf(fp, "\t%u", __sync_fetch_and_add(&st->count[i][n], 0));
+		}
+		fprintf(fp, "\n");
+	}
+	fclose(fp);
+
+	return AKM_SUCCESS;
+}
+
@@ -0,0 +1,97 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2012 Asahi Kasei Microdevices Corporation, Japan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************/
+#ifndef AKFS_INC_STATS_H
+#define AKFS_INC_STATS_H
+
+#include <stdint.h>
+
+#include "AKFS_Compass.h"
+
+/*** Constant definition ******************************************************/
+/* Histograms of time. */
+#define AKFS_STATS_PERIOD_ERR	0	/*!< Actual period - requested minimum */
+#define AKFS_STATS_WAKEUP		1	/*!< Wake up time - deadline */
+#define AKFS_STATS_LOOP			2	/*!< Busy time of a cycle */
+#define AKFS_STATS_IO_GET_DELAY	3
+#define AKFS_STATS_IO_GET_ACCEL	4
+#define AKFS_STATS_IO_SET_MODE	5
+#define AKFS_STATS_IO_GET_DATA	6
+#define AKFS_STATS_IO_SET_YPR	7
+#define AKFS_STATS_CALC_ACC		8	/*!< AKFS_Get_ACCELEROMETER */
+#define AKFS_STATS_CALC_MAG		9	/*!< AKFS_Get_MAGNETIC_FIELD */
+#define AKFS_STATS_CALC_ORI		10	/*!< AKFS_Get_ORIENTATION */
+#define AKFS_STATS_CALC_ROT		11	/*!< AKFS_Get_ROTATION_VECTOR */
+#define AKFS_STATS_QUEUE		12	/*!< Acquisition - start of calculation */
+#define AKFS_STATS_E2E			13	/*!< Acquisition - end of output */
+#define AKFS_STATS_NUM			14
+
+/* Histograms of count. */
+#define AKFS_STATS_CNT_RETRY	0	/*!< DRDY retries of one reading */
+#define AKFS_STATS_CNT_DEPTH	1	/*!< Queue depth when a frame is pushed */
+#define AKFS_STATS_CNT_NUM		2
+
+/*! Number of buckets of a histogram. Bucket 0 counts values less than
+  1 usec, and bucket n counts values in [2^(n-1), 2^n) usec. */
+#define AKFS_STATS_NBIN			24
+/*! Counts above this value are counted as this value. */
+#define AKFS_STATS_MAX_COUNT	8
+
+/*** Type declaration *********************************************************/
+/*! A histogram of time in nano second. */
+typedef struct _AKFS_HIST {
+	uint32_t	bin[AKFS_STATS_NBIN];
+	uint32_t	count;
+	int64_t		sum;
+	int64_t		max;
+} AKFS_HIST;
+
+/*! Statistics of a daemon. Counters are updated with atomic operations,
+  because they are read by another thread while the measurement goes on. */
+typedef struct _AKFS_STATS {
+	AKFS_HIST	hist[AKFS_STATS_NUM];
+	uint32_t	count[AKFS_STATS_CNT_NUM][AKFS_STATS_MAX_COUNT + 1];
+} AKFS_STATS;
+
+/*** Global variables *********************************************************/
+
+/*** Prototype of function ****************************************************/
+int64_t AKFS_StatsNow(void);
+
+void AKFS_InitStats(
+			AKFS_STATS	*st
+);
+
+void AKFS_StatsAdd(
+			AKFS_STATS	*st,
+	const	int			id,
+	const	int64_t		ns
+);
+
+void AKFS_StatsCount(
+			AKFS_STATS	*st,
+	const	int			id,
+	const	int			count
+);
+
+int16 AKFS_StatsDump(
+			AKFS_STATS	*st,
+	const	char		*path
+);
+
+#endif
+
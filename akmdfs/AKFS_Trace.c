@@ -0,0 +1,443 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2012 Asahi Kasei Microdevices Corporation, Japan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************/
+#include "AKFS_Common.h"
+#include "AKFS_Trace.h"
+
+#include <pthread.h>
+#include <time.h>
+
+/*** Constant definition ******************************************************/
+/* Type of an argument, which is decided by a conversion specifier. */
+#define AKFS_TRACE_NONE		0	/* "%%" */
+#define AKFS_TRACE_INT		1
+#define AKFS_TRACE_LONG		2
+#define AKFS_TRACE_LLONG	3
+#define AKFS_TRACE_DOUBLE	4
+#define AKFS_TRACE_STR		5
+#define AKFS_TRACE_PTR		6
+
+/* Length of a formatted record */
+#define AKFS_TRACE_LINE		512
+
+/* Sequence number of a slot which is being written */
+#define AKFS_TRACE_BUSY		0xFFFFFFFFU
+
+/*** Static variables *********************************************************/
+/* Only the key is shared by the process. Each thread finds its ring by it. */
+static pthread_once_t	s_keyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t	s_key;
+static int				s_keyValid = AKM_FALSE;
+
+/*!
+ Creates the key of the ring of a thread. This is called only once.
+ */
+static void TraceKeyInit(void)
+{
+	s_keyValid = (pthread_key_create(&s_key, NULL) == 0) ? AKM_TRUE : AKM_FALSE;
+}
+
+/*!
+ Initializes a ring. It is empty, it records the zones of #AKMDATA_TRACE,
+ and it does not echo.
+ @param[out] tr A ring.
+ */
+void AKFS_InitTrace(
+			AKFS_TRACE	*tr)
+{
+	memset(tr, 0, sizeof(AKFS_TRACE));
+	tr->echo = AKM_FALSE;
+	tr->zone = AKMDATA_TRACE;
+}
+
+/*!
+ Attaches the calling thread to a ring. Debug messages of the thread are
+ recorded into it from now on. A thread which is not attached records
+ nothing.
+ @param[in] tr A ring, which must live while the thread is attached. NULL
+ detaches the thread.
+ */
+void AKFS_TraceAttach(
+			AKFS_TRACE	*tr)
+{
+	pthread_once(&s_keyOnce, TraceKeyInit);
+	if (s_keyValid == AKM_TRUE) {
+		pthread_setspecific(s_key, tr);
+	}
+}
+
+/*!
+ The ring of the calling thread. A thread which starts another thread passes
+ this to it, so that both record into the same ring.
+ @return The ring, or NULL when the thread is not attached.
+ */
+AKFS_TRACE *AKFS_TraceCurrent(void)
+{
+	pthread_once(&s_keyOnce, TraceKeyInit);
+	if (s_keyValid != AKM_TRUE) {
+		return NULL;
+	}
+	return (AKFS_TRACE *)pthread_getspecific(s_key);
+}
+
+/*!
+ Scans a conversion specification.
+ @return A pointer to the next character of the specification.
+ @param[in] p A pointer to the next character of '%'.
+ @param[out] type Type of the argument.
+ */
+static const char *TraceSpec(
+	const	char	*p,
+			int		*type)
+{
+	int nlong = 0;
+
+	/* flags, width and precision */
+	while ((*p != '\0') && (strchr("-+ #0123456789.", *p) != NULL)) {
+		p++;
+	}
+	/* length modifier */
+	while ((*p == 'h') || (*p == 'l') || (*p == 'L') || (*p == 'q')
+			|| (*p == 'j') || (*p == 'z') || (*p == 't')) {
+		if ((*p == 'l') || (*p == 'L') || (*p == 'q') || (*p == 'j')) {
+			nlong++;
+		}
+		p++;
+	}
+
+	switch (*p) {
+	case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+		*type = (nlong >= 2) ? AKFS_TRACE_LLONG :
+			((nlong == 1) ? AKFS_TRACE_LONG : AKFS_TRACE_INT);
+		break;
+	case 'c':
+		*type = AKFS_TRACE_INT;
+		break;
+	case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+		*type = AKFS_TRACE_DOUBLE;
+		break;
+	case 's':
+		*type = AKFS_TRACE_STR;
+		break;
+	case 'p':
+		*type = AKFS_TRACE_PTR;
+		break;
+	case '\0':
+		*type = AKFS_TRACE_NONE;
+		return p;
+	default:
+		*type = AKFS_TRACE_NONE;
+		break;
+	}
+	return p + 1;
+}
+
+/*!
+ Records a debug message into the ring of the calling thread. The message
+ is formatted only when the ring is dumped, or it is echoed. Any number of
+ threads may call this function at the same time, and it does not block.
+ When a writer has not finished the slot yet after a whole lap of the ring,
+ or a writer of a newer lap has taken the slot already, the message is
+ dropped.
+ A string argument is copied into the record, and it is truncated when it
+ is longer than the room left. A record keeps #AKFS_TRACE_NARG arguments
+ at most, and the others are printed as zero.
+ @param[in] zone Debug zone of the message.
+ @param[in] format A printf-like format. It must be a string literal.
+ */
+void AKFS_Trace(
+	const	int		zone,
+	const	char	*format,
+	...)
+{
+	AKFS_TRACE		*tr;
+	AKFS_TRACE_REC	*rec;
+	struct timespec	ts;
+	va_list			ap;
+	const char		*p;
+	uint32_t		seq;
+	uint32_t		expect;
+	uint32_t		old;
+	int				type;
+	int				n = 0;
+	int				t = 0;
+
+	tr = AKFS_TraceCurrent();
+	if (tr == NULL) {
+		return;
+	}
+
+	if (tr->echo) {
+		va_start(ap, format);
+		vfprintf(stdout, format, ap);
+		va_end(ap);
+	}
+
+	seq = __sync_fetch_and_add(&tr->head, 1);
+	rec = &tr->ring[seq & (AKFS_TRACE_SIZE - 1)];
+
+	/* Take the slot. Readers skip it while it is written. The slot usually
+	   holds the record of the previous lap. It holds an older one when the
+	   writer of the previous lap dropped its message, and then it is taken
+	   too. A record of a newer lap is never overwritten. */
+	expect = (seq >= AKFS_TRACE_SIZE) ? (seq + 1 - AKFS_TRACE_SIZE) : 0;
+	old = __sync_val_compare_and_swap(&rec->seq, expect, AKFS_TRACE_BUSY);
+	if ((old != expect) && ((old == AKFS_TRACE_BUSY)
+		|| ((int32_t)(old - expect) > 0)
+		|| !__sync_bool_compare_and_swap(&rec->seq, old, AKFS_TRACE_BUSY))) {
+		__sync_fetch_and_add(&tr->drop, 1);
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	rec->ts = (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	rec->zone = zone;
+	rec->format = format;
+
+	va_start(ap, format);
+	for (p = format; (*p != '\0') && (n < AKFS_TRACE_NARG); ) {
+		if (*p++ != '%') {
+			continue;
+		}
+		p = TraceSpec(p, &type);
+		switch (type) {
+		case AKFS_TRACE_INT:
+			rec->arg[n++].i = va_arg(ap, int);
+			break;
+		case AKFS_TRACE_LONG:
+			rec->arg[n++].i = va_arg(ap, long);
+			break;
+		case AKFS_TRACE_LLONG:
+			rec->arg[n++].i = va_arg(ap, long long);
+			break;
+		case AKFS_TRACE_DOUBLE:
+			rec->arg[n++].d = va_arg(ap, double);
+			break;
+		case AKFS_TRACE_STR:
+			{
+				const char *s = va_arg(ap, const char *);
+				int room = AKFS_TRACE_TEXT - t - 1;
+				int len = (s == NULL) ? 0 : (int)strlen(s);
+				if (len > room) {
+					len = (room > 0) ? room : 0;
+				}
+				if (t < AKFS_TRACE_TEXT) {
+					/* NULL is recorded as an empty string. */
+					if (s != NULL) {
+						memcpy(&rec->text[t], s, len);
+					}
+					rec->text[t + len] = '\0';
+				}
+				/* The offset to the copy */
+				rec->arg[n++].i = t;
+				t += len + 1;
+			}
+			break;
+		case AKFS_TRACE_PTR:
+			rec->arg[n++].p = va_arg(ap, void *);
+			break;
+		default:
+			break;
+		}
+	}
+	va_end(ap);
+
+	/* Publish the record. */
+	__sync_bool_compare_and_swap(&rec->seq, AKFS_TRACE_BUSY, seq + 1);
+}
+
+/*!
+ Formats a record.
+ @return The length of the text.
+ @param[in] rec A record.
+ @param[out] buf A buffer of #AKFS_TRACE_LINE bytes.
+ */
+static int TraceFormat(
+	const	AKFS_TRACE_REC	*rec,
+			char			*buf)
+{
+	char		spec[32];
+	const char	*p;
+	const char	*q;
+	int			type;
+	int			n = 0;
+	int			len = 0;
+	int			room;
+	AKFS_TRACE_ARG	zero;
+
+	zero.i = 0;
+	for (p = rec->format; (*p != '\0') && (len < AKFS_TRACE_LINE - 1); ) {
+		room = AKFS_TRACE_LINE - len;
+		if (*p != '%') {
+			buf[len++] = *p++;
+			continue;
+		}
+		q = TraceSpec(p + 1, &type);
+		if (type == AKFS_TRACE_NONE) {
+			if (p[1] == '%') {
+				buf[len++] = '%';
+			}
+			p = q;
+			continue;
+		}
+		if ((q - p) >= (int)sizeof(spec)) {
+			break;
+		}
+		memcpy(spec, p, q - p);
+		spec[q - p] = '\0';
+		{
+			const AKFS_TRACE_ARG *a =
+				(n < AKFS_TRACE_NARG) ? &rec->arg[n] : &zero;
+			int r = 0;
+			switch (type) {
+			case AKFS_TRACE_INT:
+				r = snprintf(&buf[len], room, spec, (int)a->i);
+				break;
+			case AKFS_TRACE_LONG:
+				r = snprintf(&buf[len], room, spec, (long)a->i);
+				break;
+			case AKFS_TRACE_LLONG:
+				r = snprintf(&buf[len], room, spec, a->i);
+				break;
+			case AKFS_TRACE_DOUBLE:
+				r = snprintf(&buf[len], room, spec,
+						(n < AKFS_TRACE_NARG) ? a->d : 0.0);
+				break;
+			case AKFS_TRACE_STR:
+				r = snprintf(&buf[len], room, spec,
+						((n < AKFS_TRACE_NARG) && (a->i < AKFS_TRACE_TEXT))
+						? &rec->text[a->i] : "");
+				break;
+			case AKFS_TRACE_PTR:
+				r = snprintf(&buf[len], room, spec, a->p);
+				break;
+			}
+			len += (r < room) ? r : (room - 1);
+		}
+		n++;
+		p = q;
+	}
+	/* One line for one record */
+	while ((len > 0) && (buf[len - 1] == '\n')) {
+		len--;
+	}
+	buf[len] = '\0';
+	return len;
+}
+
+/*!
+ Echoes messages to stdout as soon as they are recorded, as the former
+ debug output did.
+ @param[in,out] tr A ring.
+ @param[in] echo #AKM_TRUE to echo.
+ */
+void AKFS_TraceSetEcho(
+			AKFS_TRACE	*tr,
+	const	int			echo)
+{
+	tr->echo = echo;
+}
+
+/*!
+ Selects debug zones which are recorded into a ring. It should be set before
+ a thread is attached to the ring.
+ @param[in,out] tr A ring.
+ @param[in] zone Debug zones.
+ */
+void AKFS_TraceSetZone(
+			AKFS_TRACE	*tr,
+	const	int			zone)
+{
+	tr->zone = zone;
+}
+
+/*!
+ Debug zones which are recorded by the calling thread.
+ @return Debug zones, or 0 when the thread is not attached to a ring.
+ */
+int AKFS_TraceZone(void)
+{
+	AKFS_TRACE *tr = AKFS_TraceCurrent();
+
+	return (tr != NULL) ? tr->zone : 0;
+}
+
+/*!
+ Formats records in the ring from the oldest, and writes them to a file.
+ Valid records are copied out at first, so writers are not likely to lap the
+ ring while it is read. Records which are overwritten while they are copied
+ are skipped.
+ @return If this function succeeds, the return value is #AKM_SUCCESS.
+ Otherwise the return value is #AKM_ERROR.
+ @param[in] tr A ring.
+ @param[in] path The path to a file.
+ */
+int AKFS_TraceDump(
+			AKFS_TRACE	*tr,
+	const	char		*path)
+{
+	FILE			*fp;
+	AKFS_TRACE_REC	*snap;
+	char			line[AKFS_TRACE_LINE];
+	uint32_t		head;
+	uint32_t		i;
+	uint32_t		seq;
+	int				num = 0;
+	int				lost = 0;
+	int				k;
+
+	snap = (AKFS_TRACE_REC *)malloc(sizeof(AKFS_TRACE_REC) * AKFS_TRACE_SIZE);
+	if (snap == NULL) {
+		AKMERROR_STR("malloc");
+		return AKM_ERROR;
+	}
+
+	head = tr->head;
+	i = (head > AKFS_TRACE_SIZE) ? (head - AKFS_TRACE_SIZE) : 0;
+	for (; i != head; i++) {
+		const AKFS_TRACE_REC *slot = &tr->ring[i & (AKFS_TRACE_SIZE - 1)];
+		seq = slot->seq;
+		__sync_synchronize();
+		memcpy(&snap[num], (const void *)slot, sizeof(AKFS_TRACE_REC));
+		__sync_synchronize();
+		if ((seq != i + 1) || (slot->seq != seq)) {
+			lost++;
+			continue;
+		}
+		num++;
+	}
+
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		AKMERROR_STR("fopen");
+		free(snap);
+		return AKM_ERROR;
+	}
+	for (k = 0; k < num; k++) {
+		TraceFormat(&snap[k], line);
+		fprintf(fp, "%lld.%09lld %04x %s\n",
+			(long long)(snap[k].ts / 1000000000LL),
+			(long long)(snap[k].ts % 1000000000LL),
+			snap[k].zone, line);
+	}
+	fprintf(fp, "# %u records, %d lost, %u dropped\n", head, lost, tr->drop);
+	fclose(fp);
+	free(snap);
+
+	return AKM_SUCCESS;
+}
+
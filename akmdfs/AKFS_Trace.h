@@ -0,0 +1,98 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2012 Asahi Kasei Microdevices Corporation, Japan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************/
+#ifndef AKFS_INC_TRACE_H
+#define AKFS_INC_TRACE_H
+
+#include <stdint.h>
+
+/*** Constant definition ******************************************************/
+/*! Number of records in the ring. This must be a power of two. */
+#define AKFS_TRACE_SIZE		2048
+/*! Maximum number of arguments kept in a record. The rest are dropped. */
+#define AKFS_TRACE_NARG		8
+/*! Size of the area which keeps copies of string arguments of a record. */
+#define AKFS_TRACE_TEXT		48
+
+/*** Type declaration *********************************************************/
+/*! An argument of a record. Which member is valid is decided by the
+  conversion specifier in the format. */
+typedef union _AKFS_TRACE_ARG {
+	long long	i;
+	double		d;
+	const void	*p;
+} AKFS_TRACE_ARG;
+
+/*! A record of the ring. Only the format pointer and raw arguments are
+  stored, and the text is made when the ring is dumped. */
+typedef struct _AKFS_TRACE_REC {
+	volatile uint32_t	seq;	/*!< Index + 1 when the record is complete. */
+	int					zone;
+	int64_t				ts;		/*!< CLOCK_MONOTONIC in nano second */
+	const char			*format;
+	AKFS_TRACE_ARG		arg[AKFS_TRACE_NARG];
+	char				text[AKFS_TRACE_TEXT];
+} AKFS_TRACE_REC;
+
+/*! A ring of records, which a daemon owns. A thread records into the ring
+  which it is attached to by #AKFS_TraceAttach. */
+typedef struct _AKFS_TRACE {
+	AKFS_TRACE_REC		ring[AKFS_TRACE_SIZE];
+	volatile uint32_t	head;	/*!< Index of the next record */
+	volatile uint32_t	drop;	/*!< Records which were dropped */
+	int					echo;	/*!< Print records to stdout, too */
+	int					zone;	/*!< Debug zones which are recorded */
+} AKFS_TRACE;
+
+/*** Global variables *********************************************************/
+
+/*** Prototype of function ****************************************************/
+void AKFS_InitTrace(
+			AKFS_TRACE	*tr
+);
+
+void AKFS_TraceAttach(
+			AKFS_TRACE	*tr
+);
+
+AKFS_TRACE *AKFS_TraceCurrent(void);
+
+void AKFS_Trace(
+	const	int			zone,
+	const	char		*format,
+	...
+) __attribute__((format(printf, 2, 3)));
+
+void AKFS_TraceSetEcho(
+			AKFS_TRACE	*tr,
+	const	int			echo
+);
+
+void AKFS_TraceSetZone(
+			AKFS_TRACE	*tr,
+	const	int			zone
+);
+
+int AKFS_TraceZone(void);
+
+int AKFS_TraceDump(
+			AKFS_TRACE	*tr,
+	const	char		*path
+);
+
+#endif
+
@@ -4,32 +4,54 @@ LOCAL_PATH:= $(call my-dir)
 
 AKM_FS_LIB=libAKM_OSS
 
-##### AKM daemon ###############################################################
-include $(CLEAR_VARS)
-
-LOCAL_C_INCLUDES := \
-	$(KERNEL_HEADERS) \
-	$(LOCAL_PATH)/$(AKM_FS_LIB)
-
-LOCAL_SRC_FILES:= \
+AKM_FS_SRC_FILES := \
 	$(AKM_FS_LIB)/AKFS_AOC.c \
 	$(AKM_FS_LIB)/AKFS_Decomp.c \
 	$(AKM_FS_LIB)/AKFS_Device.c \
 	$(AKM_FS_LIB)/AKFS_Direction.c \
+	$(AKM_FS_LIB)/AKFS_ECal.c \
+	$(AKM_FS_LIB)/AKFS_Fixed.c \
+	$(AKM_FS_LIB)/AKFS_Simd.c \
 	$(AKM_FS_LIB)/AKFS_VNorm.c \
 	AKFS_Driver.c \
 	AKFS_APIs.c \
+	AKFS_Calib.c \
 	AKFS_Disp.c \
 	AKFS_FileIO.c \
 	AKFS_Measure.c \
+	AKFS_Replay.c \
+	AKFS_Trace.c \
+	AKFS_Stats.c \
+	AKFS_Queue.c \
 	main.c
 
-LOCAL_CFLAGS += -Wall
-LOCAL_CFLAGS += -DAKFS_OUTPUT_AVEC
-LOCAL_CFLAGS += -DAKM_VALUE_CHECK
-LOCAL_CFLAGS += -DENABLE_AKMDEBUG=1
+AKM_FS_CFLAGS := -Wall
+AKM_FS_CFLAGS += -DAKFS_OUTPUT_AVEC
+AKM_FS_CFLAGS += -DAKM_VALUE_CHECK
+AKM_FS_CFLAGS += -DENABLE_AKMDEBUG=1
 
-LOCAL_CFLAGS += -DAKM_DEVICE_AK8975
+AKM_FS_CFLAGS += -DAKM_DEVICE_AK8975
+# The transform of magnetic data can be specialized for the layout given
+# to the service in init.target.rc (-m7) by -DAKFS_FIXED_LAYOUT=7. It is
+# left generic, so that replay and batch accept logs of any layout.
+# The per-sample path can be built in Q16.16 fixed point for targets
+# without an FPU by -DAKFS_PRECISION_FIXED. See AKFS_Configure.h.
+
+##### AKM daemon ###############################################################
+include $(CLEAR_VARS)
+
+LOCAL_C_INCLUDES := \
+	$(KERNEL_HEADERS) \
+	$(LOCAL_PATH)/$(AKM_FS_LIB)
+
+LOCAL_SRC_FILES := $(AKM_FS_SRC_FILES)
+
+LOCAL_CFLAGS += $(AKM_FS_CFLAGS)
+
+# libAKM_OSS selects NEON kernels at compile time when available.
+ifeq ($(ARCH_ARM_HAVE_NEON),true)
+LOCAL_ARM_NEON := true
+endif
 
 LOCAL_MODULE := akmdfs
 LOCAL_MODULE_TAGS := eng
@@ -37,6 +59,30 @@ LOCAL_FORCE_STATIC_EXECUTABLE := false
 LOCAL_SHARED_LIBRARIES := libc libm libcutils
 include $(BUILD_EXECUTABLE)
 
+##### AKM offline tools (host) #################################################
+# The same daemon with the stage benchmark (-b) and the batch calibrator (-B),
+# which run on recorded files and need no device. It is not installed to the
+# target.
+include $(CLEAR_VARS)
+
+LOCAL_C_INCLUDES := \
+	$(LOCAL_PATH)/$(AKM_FS_LIB)
+
+LOCAL_SRC_FILES := \
+	$(AKM_FS_SRC_FILES) \
+	AKFS_Bench.c \
+	AKFS_BenchRef.c \
+	AKFS_Batch.c
+
+LOCAL_CFLAGS += $(AKM_FS_CFLAGS)
+LOCAL_CFLAGS += -DAKFS_ENABLE_TOOLS
+
+LOCAL_MODULE := akmdfs_tools
+LOCAL_MODULE_TAGS := optional
+LOCAL_STATIC_LIBRARIES := libcutils liblog
+LOCAL_LDLIBS += -lpthread -lm -lrt
+include $(BUILD_HOST_EXECUTABLE)
+
 
 endif  # TARGET_SIMULATOR != true
 
@@ -15,13 +15,14 @@
  * limitations under the License.
  *
  ******************************************************************************/
+#include <string.h>
 #include "AKFS_AOC.h"
 #include "AKFS_Math.h"
 
 /*
- * CalcR
+ * CalcR2 : squared distance
  */
-static AKFLOAT CalcR(
+static AKFLOAT CalcR2(
 	const	AKFVEC	*x,
 	const	AKFVEC	*y
 ){
@@ -32,11 +33,84 @@ static AKFLOAT CalcR(
 	for (i = 0; i < 3; i++) {
 		r += (x->v[i]-y->v[i]) * (x->v[i]-y->v[i]);
 	}
-	r = sqrt(r);
 
 	return r;
 }
 
+/*
+ * CalcR
+ */
+static AKFLOAT CalcR(
+	const	AKFVEC	*x,
+	const	AKFVEC	*y
+){
+	return AKFS_SQRT(CalcR2(x, y));
+}
+
+/*
+ * ScanBox : find the bounding box of hbuf from scratch
+ */
+static void ScanBox(
+			AKFS_AOC_VAR	*haocv	/*!< (i/o)	: a set of variables */
+){
+	int16	i, j;
+	int16	p;
+	const AKFS_VBUF	*hbuf = &haocv->hbuf;
+
+	for (j = 0; j < 3; j++) {
+		haocv->hmin[j] = hbuf->head;
+		haocv->hmax[j] = hbuf->head;
+	}
+	for (i = 1; i < hbuf->count; i++) {
+		p = AKFS_VBUF_IDX(hbuf, i);
+		for (j = 0; j < 3; j++) {
+			if (hbuf->v[p].v[j] < hbuf->v[haocv->hmin[j]].v[j]) {
+				haocv->hmin[j] = p;
+			}
+			if (hbuf->v[p].v[j] > hbuf->v[haocv->hmax[j]].v[j]) {
+				haocv->hmax[j] = p;
+			}
+		}
+	}
+}
+
+/*
+ * UpdateBox : update the bounding box of hbuf after new data is buffered
+ */
+static void UpdateBox(
+			AKFS_AOC_VAR	*haocv,	/*!< (i/o)	: a set of variables */
+	const	int16			over	/*!< (i)	: 1 if the oldest data is overwritten */
+){
+	int16	j;
+	int16	p;
+	const AKFS_VBUF	*hbuf = &haocv->hbuf;
+
+	p = hbuf->head;
+
+	/* The first data, or an extreme point has just been discarded. */
+	if (hbuf->count == 1) {
+		ScanBox(haocv);
+		return;
+	}
+	if (over) {
+		for (j = 0; j < 3; j++) {
+			if ((haocv->hmin[j] == p) || (haocv->hmax[j] == p)) {
+				ScanBox(haocv);
+				return;
+			}
+		}
+	}
+
+	for (j = 0; j < 3; j++) {
+		if (hbuf->v[p].v[j] < hbuf->v[haocv->hmin[j]].v[j]) {
+			haocv->hmin[j] = p;
+		}
+		if (hbuf->v[p].v[j] > hbuf->v[haocv->hmax[j]].v[j]) {
+			haocv->hmax[j] = p;
+		}
+	}
+}
+
 /*
  * From4Points2Sphere()
  */
@@ -68,7 +142,7 @@ static int16 From4Points2Sphere(
 			r2[i] += (points[i].v[j]*points[i].v[j]
 					- points[3].v[j]*points[3].v[j]);
 		}
-		r2[i] *= 0.5;
+		r2[i] *= AKFS_F(0.5);
 	}
 
 	A = dif[0][0]*dif[2][2] - dif[0][2]*dif[2][0];
@@ -82,7 +156,7 @@ static int16 From4Points2Sphere(
 	OU = D*E + B*G;
 	OD = C*F + A*E;
 
-	if (fabs(OD) < AKFS_EPSILON) {
+	if (AKFS_FABS(OD) < AKFS_EPSILON) {
 		return -1;
 	}
 
@@ -91,7 +165,7 @@ static int16 From4Points2Sphere(
 	OU = F*center->v[2] + G;
 	OD = E;
 
-	if (fabs(OD) < AKFS_EPSILON) {
+	if (AKFS_FABS(OD) < AKFS_EPSILON) {
 		return -1;
 	}
 
@@ -100,7 +174,7 @@ static int16 From4Points2Sphere(
 	OU = r2[0] - dif[0][1]*center->v[1] - dif[0][2]*center->v[2];
 	OD = dif[0][0];
 
-	if (fabs(OD) < AKFS_EPSILON) {
+	if (AKFS_FABS(OD) < AKFS_EPSILON) {
 		return -1;
 	}
 
@@ -116,10 +190,9 @@ static int16 From4Points2Sphere(
  * MeanVar
  */
 static void MeanVar(
-	const	AKFVEC	v[],	/*!< (i)   : input vectors */
-	const	int16	n,		/*!< (i)   : number of vectors */
-			AKFVEC	*mean,	/*!< (o)   : (max+min)/2 */
-			AKFVEC	*var	/*!< (o)   : variation in vectors */
+	const	AKFS_VBUF	*v,		/*!< (i)   : input vectors */
+			AKFVEC		*mean,	/*!< (o)   : (max+min)/2 */
+			AKFVEC		*var	/*!< (o)   : variation in vectors */
 ){
 	int16	i;
 	int16	j;
@@ -127,101 +200,114 @@ static void MeanVar(
 	AKFVEC	min;
 
 	for (j = 0; j < 3; j++) {
-		min.v[j] = v[0].v[j];
-		max.v[j] = v[0].v[j];
-		for (i = 1; i < n; i++) {
-			if (v[i].v[j] < min.v[j]) {
-				min.v[j] = v[i].v[j];
+		min.v[j] = AKFS_VBUF_AT(v, 0).v[j];
+		max.v[j] = AKFS_VBUF_AT(v, 0).v[j];
+		for (i = 1; i < v->count; i++) {
+			if (AKFS_VBUF_AT(v, i).v[j] < min.v[j]) {
+				min.v[j] = AKFS_VBUF_AT(v, i).v[j];
 			}
-			if (v[i].v[j] > max.v[j]) {
-				max.v[j] = v[i].v[j];
+			if (AKFS_VBUF_AT(v, i).v[j] > max.v[j]) {
+				max.v[j] = AKFS_VBUF_AT(v, i).v[j];
 			}
 		}
-		mean->v[j] = (max.v[j] + min.v[j]) / 2.0;	/*mean */
+		mean->v[j] = (max.v[j] + min.v[j]) / AKFS_F(2.0);	/*mean */
 		var->v[j] = max.v[j] - min.v[j];			/*var  */
 	}
 }
 
 /*
- * Get4points
+ * ArgMax
  */
-static void Get4points(
-	const	AKFVEC	v[],	/*!< (i)   : input vectors */
-	const	int16	n,		/*!< (i)   : number of vectors */
-			AKFVEC	out[]	/*!< (o)   : */
+static int16 ArgMax(		/*!< (o) : position of the largest value, -1 if none is positive */
+	const	AKFS_VBUF	*hbuf,	/*!< (i)   : */
+	const	int16		n,		/*!< (i)   : number of vectors */
+	const	AKFLOAT		temp[],	/*!< (i)   : value at each position */
+			AKFLOAT		*d		/*!< (o)   : the largest value, or 0 */
 ){
-	int16	i, j;
-	AKFLOAT temp;
+	int16	p;
+	int16	q;
+	int16	end;
+
+	/* The 1st to (n-1)-th newest elements, in this order. They are at
+	   head+1 to len-1 and then at 0, 1, ..., so no AKFS_VBUF_IDX is needed.
+	   The first of equal values is taken, as in the scalar code. */
+	*d = 0.0;
+	q = -1;
+	end = hbuf->head + n;
+	for (p = hbuf->head + 1; (p < end) && (p < hbuf->len); p++) {
+		if (*d < temp[p]) {
+			*d = temp[p];
+			q = p;
+		}
+	}
+	end -= hbuf->len;
+	for (p = 0; p < end; p++) {
+		if (*d < temp[p]) {
+			*d = temp[p];
+			q = p;
+		}
+	}
+	return q;
+}
+
+/*
+ * AKFS_Get4points
+ */
+int16 AKFS_Get4points(	/*!< (o) : 0 on success, -1 if out 1 is too close */
+	const	AKFS_AOC_VAR	*haocv,	/*!< (i)   : hbuf and its SoA mirror */
+	const	int16			n,		/*!< (i)   : number of vectors */
+			AKFVEC			out[]	/*!< (o)   : */
+){
+	int16	j;
+	int16	q;
 	AKFLOAT d;
+	AKFLOAT	temp[AKFS_VBUF_MAX];
 
-	AKFVEC	dv[AKFS_HBUF_SIZE];
+	AKFVEC	dv0;
+	AKFVEC	dvq;
 	AKFVEC	cross = {{0, 0, 0}};
-	AKFVEC	tempv = {{0, 0, 0}};
+	const AKFS_VBUF	*hbuf = &haocv->hbuf;
 
 	/* out 0 */
-	out[0] = v[0];
+	out[0] = AKFS_VBUF_AT(hbuf, 0);
+	out[1] = out[0];
+	out[2] = out[0];
+	out[3] = out[0];
 
 	/* out 1 */
-	d = 0.0;
-	for (i = 1; i < n; i++) {
-		temp = CalcR(&v[i], &out[0]);
-		if (d < temp) {
-			d = temp;
-			out[1] = v[i];
-		}
+	AKFS_SoaDist2(&haocv->hsoa, hbuf->len, &out[0], temp);
+	q = ArgMax(hbuf, n, temp, &d);
+
+	/* out 0 and out 1 would not pass the distance check anyway. */
+	if (d < (AKFS_HR_TH * AKFS_HR_TH)) {
+		return -1;
 	}
+	out[1] = hbuf->v[q];
 
 	/* out 2 */
-	d = 0.0;
 	for (j = 0; j < 3; j++) {
-		dv[0].v[j] = out[1].v[j] - out[0].v[j];
+		dv0.v[j] = out[1].v[j] - out[0].v[j];
 	}
-	for (i = 1; i < n; i++) {
+	AKFS_SoaCross2(&haocv->hsoa, hbuf->len, &out[0], &dv0, temp);
+	q = ArgMax(hbuf, n, temp, &d);
+	if (q >= 0) {
+		out[2] = hbuf->v[q];
 		for (j = 0; j < 3; j++) {
-			dv[i].v[j] = v[i].v[j] - out[0].v[j];
-		}
-		tempv.v[0] = dv[0].v[1]*dv[i].v[2] - dv[0].v[2]*dv[i].v[1];
-		tempv.v[1] = dv[0].v[2]*dv[i].v[0] - dv[0].v[0]*dv[i].v[2];
-		tempv.v[2] = dv[0].v[0]*dv[i].v[1] - dv[0].v[1]*dv[i].v[0];
-		temp =	tempv.u.x * tempv.u.x
-			  +	tempv.u.y * tempv.u.y
-			  +	tempv.u.z * tempv.u.z;
-		if (d < temp) {
-			d = temp;
-			out[2] = v[i];
-			cross = tempv;
+			dvq.v[j] = out[2].v[j] - out[0].v[j];
 		}
+		cross.v[0] = dv0.v[1]*dvq.v[2] - dv0.v[2]*dvq.v[1];
+		cross.v[1] = dv0.v[2]*dvq.v[0] - dv0.v[0]*dvq.v[2];
+		cross.v[2] = dv0.v[0]*dvq.v[1] - dv0.v[1]*dvq.v[0];
 	}
 
 	/* out 3 */
-	d = 0.0;
-	for (i = 1; i < n; i++) {
-		temp =	  dv[i].u.x * cross.u.x
-				+ dv[i].u.y * cross.u.y
-				+ dv[i].u.z * cross.u.z;
-		temp = fabs(temp);
-		if (d < temp) {
-			d = temp;
-			out[3] = v[i];
-		}
-	}
-}
-
-/*
- * CheckInitFvec
- */
-static int16 CheckInitFvec(
-	const	AKFVEC	*v		/*!< [in]	vector */
-){
-	int16 i;
-
-	for (i = 0; i < 3; i++) {
-		if (AKFS_FMAX <= v->v[i]) {
-			return 1;       /* initvalue */
-		}
+	AKFS_SoaAbsDot(&haocv->hsoa, hbuf->len, &out[0], &cross, temp);
+	q = ArgMax(hbuf, n, temp, &d);
+	if (q >= 0) {
+		out[3] = hbuf->v[q];
 	}
 
-	return 0;       /* not initvalue */
+	return 0;
 }
 
 /*
@@ -234,7 +320,9 @@ int16 AKFS_AOC(				/*!< (o) : calibration success(AKFS_SUCCESS), failure(AKFS_ER
 ){
 	int16	i, j;
 	int16	num;
+	int16	over;
 	AKFLOAT	tempf;
+	AKFLOAT	hr2;
 	AKFVEC	tempho;
 
 	AKFVEC	fourpoints[4];
@@ -243,62 +331,71 @@ int16 AKFS_AOC(				/*!< (o) : calibration success(AKFS_SUCCESS), failure(AKFS_ER
 	AKFVEC	mean;
 
 	/* buffer new data */
-	for (i = 1; i < AKFS_HBUF_SIZE; i++) {
-		haocv->hbuf[AKFS_HBUF_SIZE-i] = haocv->hbuf[AKFS_HBUF_SIZE-i-1];
-	}
-	haocv->hbuf[0] = *hdata;
+	over = (haocv->hbuf.count == haocv->hbuf.len) ? 1 : 0;
+	*AKFS_VBufPush(&haocv->hbuf) = *hdata;
+	AKFS_SoaSet(haocv->hbuf.head, hdata, &haocv->hsoa);
+	UpdateBox(haocv, over);
 
 	/* Check Init */
-	num = 0;
-	for (i = AKFS_HBUF_SIZE; 3 < i; i--) {
-		if (CheckInitFvec(&haocv->hbuf[i-1]) == 0) {
-			num = i;
-			break;
-		}
-	}
+	num = haocv->hbuf.count;
 	if (num < 4) {
 		return AKFS_ERROR;
 	}
 
+	/* No two points in hbuf can be apart more than the diagonal of the
+	   bounding box. So reject quickly when the device is kept still. */
+	tempf = 0.0;
+	for (j = 0; j < 3; j++) {
+		hr2 = haocv->hbuf.v[haocv->hmax[j]].v[j]
+			- haocv->hbuf.v[haocv->hmin[j]].v[j];
+		tempf += hr2 * hr2;
+	}
+	if (tempf < (AKFS_HR_TH * AKFS_HR_TH)) {
+		return AKFS_ERROR;
+	}
+
 	/* get 4 points */
-	Get4points(haocv->hbuf, num, fourpoints);
+	if (0 != AKFS_Get4points(haocv, num, fourpoints)) {
+		return AKFS_ERROR;
+	}
 
-	/* estimate offset */
-	if (0 != From4Points2Sphere(fourpoints, &tempho, &haocv->hraoc)) {
+	/* estimate offset, only when the 4 points differ from the last time */
+	if (memcmp(fourpoints, haocv->fpts, sizeof(fourpoints)) != 0) {
+		memcpy(haocv->fpts, fourpoints, sizeof(fourpoints));
+		haocv->fpret = From4Points2Sphere(fourpoints, &haocv->fpho, &haocv->fpr);
+	}
+	if (0 != haocv->fpret) {
 		return AKFS_ERROR;
 	}
+	tempho = haocv->fpho;
+	haocv->hraoc = haocv->fpr;
 
 	/* check distance */
+	hr2 = haocv->hraoc * haocv->hraoc;
 	for (i = 0; i < 4; i++) {
 		for (j = (i+1); j < 4; j++) {
-			tempf = CalcR(&fourpoints[i], &fourpoints[j]);
-			if ((tempf < haocv->hraoc) || (tempf < AKFS_HR_TH)) {
+			tempf = CalcR2(&fourpoints[i], &fourpoints[j]);
+			if ((tempf < hr2) || (tempf < (AKFS_HR_TH * AKFS_HR_TH))) {
 				return AKFS_ERROR;
 			}
 		}
 	}
 
 	/* update offset buffer */
-	for (i = 1; i < AKFS_HOBUF_SIZE; i++) {
-		haocv->hobuf[AKFS_HOBUF_SIZE-i] = haocv->hobuf[AKFS_HOBUF_SIZE-i-1];
-	}
-	haocv->hobuf[0] = tempho;
+	*AKFS_VBufPush(&haocv->hobuf) = tempho;
 
 	/* clear hbuf */
-	for (i = (AKFS_HBUF_SIZE>>1); i < AKFS_HBUF_SIZE; i++) {
-		for (j = 0; j < 3; j++) {
-			haocv->hbuf[i].v[j] = AKFS_FMAX;
-		}
-	}
+	AKFS_VBufTruncate((AKFS_HBUF_SIZE>>1), &haocv->hbuf);
+	ScanBox(haocv);
 
 	/* Check Init */
-	if (CheckInitFvec(&haocv->hobuf[AKFS_HOBUF_SIZE-1]) == 1) {
+	if (haocv->hobuf.count < AKFS_HOBUF_SIZE) {
 		return AKFS_ERROR;
 	}
 
 	/* Check ovar */
 	tempf = haocv->hraoc * AKFS_HO_TH;
-	MeanVar(haocv->hobuf, AKFS_HOBUF_SIZE, &mean, &var);
+	MeanVar(&haocv->hobuf, &mean, &var);
 	if ((var.u.x >= tempf) || (var.u.y >= tempf) || (var.u.z >= tempf)) {
 		return AKFS_ERROR;
 	}
@@ -314,20 +411,14 @@ int16 AKFS_AOC(				/*!< (o) : calibration success(AKFS_SUCCESS), failure(AKFS_ER
 void AKFS_InitAOC(
 			AKFS_AOC_VAR	*haocv
 ){
-	int16 i, j;
-
 	/* Initialize buffer */
-	for (i = 0; i < AKFS_HBUF_SIZE; i++) {
-		for (j = 0; j < 3; j++) {
-			haocv->hbuf[i].v[j] = AKFS_FMAX;
-		}
-	}
-	for (i = 0; i < AKFS_HOBUF_SIZE; i++) {
-		for (j = 0; j < 3; j++) {
-			haocv->hobuf[i].v[j] = AKFS_FMAX;
-		}
-	}
+	AKFS_InitVBuf(AKFS_HBUF_SIZE, &haocv->hbuf);
+	AKFS_InitVBuf(AKFS_HOBUF_SIZE, &haocv->hobuf);
+	memset(&haocv->hsoa, 0, sizeof(haocv->hsoa));
 
 	haocv->hraoc = 0.0;
-}
 
+	/* No estimation has been done yet */
+	AKFS_InitBuffer(4, haocv->fpts);
+	haocv->fpret = -1;
+}
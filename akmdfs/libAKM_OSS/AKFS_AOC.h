@@ -19,20 +19,32 @@
 #define AKFS_INC_AOC_H
 
 #include "AKFS_Device.h"
+#include "AKFS_Simd.h"
 
 /***** Constant definition ****************************************************/
 #define AKFS_HBUF_SIZE	20
 #define AKFS_HOBUF_SIZE	4
 #define AKFS_HR_TH		10
-#define AKFS_HO_TH		0.15
+#define AKFS_HO_TH		AKFS_F(0.15)
 
 /***** Macro definition *******************************************************/
 
 /***** Type declaration *******************************************************/
 typedef struct _AKFS_AOC_VAR{
-	AKFVEC		hbuf[AKFS_HBUF_SIZE];
-	AKFVEC		hobuf[AKFS_HOBUF_SIZE];
+	AKFS_VBUF	hbuf;
+	AKFS_SOA	hsoa;	/* SoA mirror of hbuf, for AKFS_Get4points */
+	AKFS_VBUF	hobuf;
 	AKFLOAT		hraoc;
+
+	/* Bounding box of hbuf, i.e. position in hbuf.v of min/max element. */
+	int16		hmin[3];
+	int16		hmax[3];
+
+	/* The last 4 points given to From4Points2Sphere and its result. */
+	AKFVEC		fpts[4];
+	AKFVEC		fpho;
+	AKFLOAT		fpr;
+	int16		fpret;
 } AKFS_AOC_VAR;
 
 /***** Prototype of function **************************************************/
@@ -47,6 +59,12 @@ void AKFS_InitAOC(
 			AKFS_AOC_VAR	*haocv
 );
 
+int16 AKFS_Get4points(
+	const	AKFS_AOC_VAR	*haocv,
+	const	int16			n,
+			AKFVEC			out[]
+);
+
 AKLIB_C_API_END
 
 #endif
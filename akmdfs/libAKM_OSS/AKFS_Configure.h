@@ -33,5 +33,36 @@
 #define AKFS_PRECISION_DOUBLE
 */
 
+/*! If following line is commented in, the per-sample path keeps magnetic and
+   acceleration data in Q16.16 fixed point, from the transform of raw data to
+   the averages. AOC, the ellipsoid fit and the orientation are calculated in
+   float. */
+/*
+#define AKFS_PRECISION_FIXED
+*/
+
+/*! If following line is commented in, tilt compensation of azimuth is done by
+   projecting the magnetic vector with the gravity vector, without sin/cos. */
+/*
+#define AKFS_DIRECTION_ALGEBRAIC
+*/
+
+/*! If following line is commented in, angles of orientation are calculated
+   by a polynomial approximation of atan2. Maximum error is less than 1e-5 rad. */
+/*
+#define AKFS_FAST_ATAN2
+*/
+
+/*! If following line is commented in, the layout pattern is fixed at compile
+   time, and the transform of magnetic data is specialized for it. Other
+   layout patterns given at run time use the generic transform. */
+/*
+#define AKFS_FIXED_LAYOUT	7
+*/
+
+#if defined(AKFS_PRECISION_DOUBLE) && defined(AKFS_PRECISION_FIXED)
+#error "AKFS_PRECISION_DOUBLE and AKFS_PRECISION_FIXED are exclusive."
+#endif
+
 #endif
 
@@ -24,28 +24,153 @@
   @param[in] mag
   @param[in] status
   @param[in] asa
-  @param[in] nhdata
-  @param[out] hdata
+  @param[in/out] hdata
  */
 int16 AKFS_Decomp(
 	const	int16		mag[3],
 	const	int16		status,
 	const	uint8vec	*asa,
-	const	int16		nhdata,
-			AKFVEC		hdata[]
+			AKFS_VBUF	*hdata
 )
 {
+	AKFVEC *h;
+
 	/* put st1 and st2 value */
 	if (AKM_ST_ERROR(status)) {
 		return AKFS_ERROR;
 	}
 
 	/* magnetic */
-	AKFS_BufShift(nhdata, 1, hdata);
-	hdata[0].u.x = AKM_HDATA_CONVERTER(mag[0], asa->u.x) * AKM_SENSITIVITY;
-	hdata[0].u.y = AKM_HDATA_CONVERTER(mag[1], asa->u.y) * AKM_SENSITIVITY;
-	hdata[0].u.z = AKM_HDATA_CONVERTER(mag[2], asa->u.z) * AKM_SENSITIVITY;
+	h = AKFS_VBufPush(hdata);
+	h->u.x = AKM_HDATA_CONVERTER(mag[0], asa->u.x) * AKM_SENSITIVITY;
+	h->u.y = AKM_HDATA_CONVERTER(mag[1], asa->u.y) * AKM_SENSITIVITY;
+	h->u.z = AKM_HDATA_CONVERTER(mag[2], asa->u.z) * AKM_SENSITIVITY;
 
 	return AKFS_SUCCESS;
 }
 
+/******************************************************************************/
+/*! Make a transform which is equivalent to #AKFS_Decomp and #AKFS_Rotate.
+  @return #AKFS_SUCCESS on success. Otherwise the return value is #AKFS_ERROR.
+  @param[in] pat Layout pattern
+  @param[in] asa
+  @param[out] xf
+ */
+int16 AKFS_InitHXform(
+	const	AKFS_PATNO	pat,
+	const	uint8vec	*asa,
+			AKFS_HXFORM	*xf
+)
+{
+	AKFVEC col;
+	int i, j;
+
+	/* The i-th column is the result of a unit raw vector of the i-th axis. */
+	for (j = 0; j < 3; j++) {
+		col.u.x = col.u.y = col.u.z = 0;
+		col.v[j] = AKM_HDATA_CONVERTER(1, asa->v[j]) * AKM_SENSITIVITY;
+		if (AKFS_Rotate(pat, &col) != AKFS_SUCCESS) {
+			return AKFS_ERROR;
+		}
+		for (i = 0; i < 3; i++) {
+			xf->m[i][j] = col.v[i];
+#ifdef AKFS_PRECISION_FIXED
+			xf->q[i][j] = AKFS_F2QS(col.v[i], AKFS_QG_SHIFT);
+#endif
+		}
+	}
+
+#if defined(AKFS_FIXED_LAYOUT)
+	/* Other layouts fall back to the generic transform. */
+	xf->fixed = (pat == (AKFS_PATNO)AKFS_FIXED_LAYOUT) ? 1 : 0;
+#else
+	xf->fixed = 0;
+#endif
+
+	return AKFS_SUCCESS;
+}
+
+/******************************************************************************/
+/*! Same as #AKFS_Decomp followed by #AKFS_Rotate, by one transform. When
+  AKFS_FIXED_LAYOUT is defined and the transform is made for that layout,
+  only non-zero elements are multiplied.
+  @return #AKFS_SUCCESS on success. Otherwise the return value is #AKFS_ERROR.
+  @param[in] mag
+  @param[in] status
+  @param[in] xf
+  @param[in/out] hdata
+ */
+int16 AKFS_DecompXform(
+	const	int16		mag[3],
+	const	int16		status,
+	const	AKFS_HXFORM	*xf,
+			AKFS_VBUF	*hdata
+)
+{
+	AKFVEC *h;
+
+	if (AKM_ST_ERROR(status)) {
+		return AKFS_ERROR;
+	}
+
+	h = AKFS_VBufPush(hdata);
+#if defined(AKFS_FIXED_LAYOUT)
+	if (xf->fixed) {
+		h->u.x = xf->m[0][AKFS_HXFORM_CX] * mag[AKFS_HXFORM_CX];
+		h->u.y = xf->m[1][AKFS_HXFORM_CY] * mag[AKFS_HXFORM_CY];
+		h->u.z = xf->m[2][AKFS_HXFORM_CZ] * mag[AKFS_HXFORM_CZ];
+		return AKFS_SUCCESS;
+	}
+#endif
+	h->u.x = xf->m[0][0] * mag[0] + xf->m[0][1] * mag[1] + xf->m[0][2] * mag[2];
+	h->u.y = xf->m[1][0] * mag[0] + xf->m[1][1] * mag[1] + xf->m[1][2] * mag[2];
+	h->u.z = xf->m[2][0] * mag[0] + xf->m[2][1] * mag[1] + xf->m[2][2] * mag[2];
+
+	return AKFS_SUCCESS;
+}
+
+#ifdef AKFS_PRECISION_FIXED
+/******************************************************************************/
+/*! Same as #AKFS_DecompXform, but the result is in Q16.16. The raw data are
+  integer, so no floating point operation is done.
+  @return #AKFS_SUCCESS on success. Otherwise the return value is #AKFS_ERROR.
+  @param[in] mag
+  @param[in] status
+  @param[in] xf
+  @param[in/out] hdata
+ */
+int16 AKFS_QDecompXform(
+	const	int16		mag[3],
+	const	int16		status,
+	const	AKFS_HXFORM	*xf,
+			AKFS_QBUF	*hdata
+)
+{
+	AKFS_QVEC *h;
+	int i;
+
+	if (AKM_ST_ERROR(status)) {
+		return AKFS_ERROR;
+	}
+
+	h = AKFS_QBufPush(hdata);
+#if defined(AKFS_FIXED_LAYOUT)
+	if (xf->fixed) {
+		h->u.x = AKFS_QShr((int64)xf->q[0][AKFS_HXFORM_CX] * mag[AKFS_HXFORM_CX],
+			AKFS_QG_SHIFT - AKFS_Q16_SHIFT);
+		h->u.y = AKFS_QShr((int64)xf->q[1][AKFS_HXFORM_CY] * mag[AKFS_HXFORM_CY],
+			AKFS_QG_SHIFT - AKFS_Q16_SHIFT);
+		h->u.z = AKFS_QShr((int64)xf->q[2][AKFS_HXFORM_CZ] * mag[AKFS_HXFORM_CZ],
+			AKFS_QG_SHIFT - AKFS_Q16_SHIFT);
+		return AKFS_SUCCESS;
+	}
+#endif
+	for (i = 0; i < 3; i++) {
+		h->v[i] = AKFS_QShr(((int64)xf->q[i][0] * mag[0])
+			+ ((int64)xf->q[i][1] * mag[1]) + ((int64)xf->q[i][2] * mag[2]),
+			AKFS_QG_SHIFT - AKFS_Q16_SHIFT);
+	}
+
+	return AKFS_SUCCESS;
+}
+#endif
@@ -19,6 +19,9 @@
 #define AKFS_INC_DECOMP_H
 
 #include "AKFS_Device.h"
+#ifdef AKFS_PRECISION_FIXED
+#include "AKFS_Fixed.h"
+#endif
 
 /***** Constant definition ****************************************************/
 #if defined(AKM_DEVICE_AK8963)
@@ -42,7 +45,33 @@
 #endif
 
 
+/*! Column of raw data which makes each axis of Android coordinate, i.e.
+  the only non-zero element in each row of #AKFS_HXFORM. */
+#if defined(AKFS_FIXED_LAYOUT)
+#if (AKFS_FIXED_LAYOUT == 1) || (AKFS_FIXED_LAYOUT == 3) || \
+	(AKFS_FIXED_LAYOUT == 5) || (AKFS_FIXED_LAYOUT == 7)
+#define AKFS_HXFORM_CX		0
+#define AKFS_HXFORM_CY		1
+#elif (AKFS_FIXED_LAYOUT == 2) || (AKFS_FIXED_LAYOUT == 4) || \
+	(AKFS_FIXED_LAYOUT == 6) || (AKFS_FIXED_LAYOUT == 8)
+#define AKFS_HXFORM_CX		1
+#define AKFS_HXFORM_CY		0
+#else
+#error "AKFS_FIXED_LAYOUT must be 1 to 8."
+#endif
+#define AKFS_HXFORM_CZ		2
+#endif
+
 /***** Type declaration *******************************************************/
+/*! Transform from raw data to Android coordinate in micro tesla, i.e.
+  h = m * mag. ASA, sensitivity and layout are folded into m. */
+typedef struct _AKFS_HXFORM {
+	AKFLOAT	m[3][3];
+#ifdef AKFS_PRECISION_FIXED
+	int32	q[3][3];	/*!< m in Q8.24 */
+#endif
+	int16	fixed;	/*!< m is made for AKFS_FIXED_LAYOUT */
+} AKFS_HXFORM;
 
 /***** Prototype of function **************************************************/
 AKLIB_C_API_START
@@ -50,9 +79,30 @@ int16 AKFS_Decomp(
 	const	int16		mag[3],
 	const	int16		status,
 	const	uint8vec	*asa,
-	const	int16		nhdata,
-			AKFVEC		hdata[]
+			AKFS_VBUF	*hdata
 );
+
+int16 AKFS_InitHXform(
+	const	AKFS_PATNO	pat,
+	const	uint8vec	*asa,
+			AKFS_HXFORM	*xf
+);
+
+int16 AKFS_DecompXform(
+	const	int16		mag[3],
+	const	int16		status,
+	const	AKFS_HXFORM	*xf,
+			AKFS_VBUF	*hdata
+);
+
+#ifdef AKFS_PRECISION_FIXED
+int16 AKFS_QDecompXform(
+	const	int16		mag[3],
+	const	int16		status,
+	const	AKFS_HXFORM	*xf,
+			AKFS_QBUF	*hdata
+);
+#endif
 AKLIB_C_API_END
 
 #endif
@@ -68,6 +68,71 @@ int16 AKFS_BufShift(
 	return AKFS_SUCCESS;
 }
 
+/******************************************************************************/
+/*! Initialize #AKFS_VBUF. All elements are set to #AKFS_INIT_VALUE_F.
+  @return #AKFS_SUCCESS on success. Otherwise the return value is #AKFS_ERROR.
+  @param[in] len
+  @param[out] buf
+ */
+int16 AKFS_InitVBuf(
+	const	int16		len,	/*!< Capacity of the buffer */
+			AKFS_VBUF	*buf	/*!< Vector ring buffer */
+)
+{
+	/* size check */
+	if ((len <= 0) || (AKFS_VBUF_MAX < len)) {
+		return AKFS_ERROR;
+	}
+
+	buf->len = len;
+	buf->head = 0;
+	buf->count = 0;
+
+	return AKFS_InitBuffer(AKFS_VBUF_MAX, buf->v);
+}
+
+/******************************************************************************/
+/*! Make a spare area for new data at the front of #AKFS_VBUF. The oldest
+  element is discarded when the buffer is full. This is the O(1) equivalent of
+  #AKFS_BufShift with shift = 1.
+  @return A pointer to the newest element, which should be filled by caller.
+  @param[in/out] buf
+ */
+AKFVEC* AKFS_VBufPush(
+			AKFS_VBUF	*buf	/*!< Vector ring buffer */
+)
+{
+	buf->head = (buf->head == 0) ? (buf->len - 1) : (buf->head - 1);
+	if (buf->count < buf->len) {
+		buf->count++;
+	}
+	return &buf->v[buf->head];
+}
+
+/******************************************************************************/
+/*! Discard all but the newest n elements of #AKFS_VBUF. Discarded elements
+  are set to #AKFS_INIT_VALUE_F.
+  @return None
+  @param[in] n
+  @param[in/out] buf
+ */
+void AKFS_VBufTruncate(
+	const	int16		n,		/*!< Number of elements to be kept */
+			AKFS_VBUF	*buf	/*!< Vector ring buffer */
+)
+{
+	int16 i;
+
+	for (i = ((n < 0) ? 0 : n); i < buf->count; i++) {
+		AKFS_VBUF_AT(buf, i).u.x = AKFS_INIT_VALUE_F;
+		AKFS_VBUF_AT(buf, i).u.y = AKFS_INIT_VALUE_F;
+		AKFS_VBUF_AT(buf, i).u.z = AKFS_INIT_VALUE_F;
+	}
+	if (n < buf->count) {
+		buf->count = (n < 0) ? 0 : n;
+	}
+}
+
 /******************************************************************************/
 /*! Rotate vector according to the specified layout pattern number.
   @return #AKFS_SUCCESS on success. Otherwise the return value is #AKFS_ERROR.
@@ -28,11 +28,17 @@
 #define AKFS_HDATA_SIZE		32
 #define AKFS_ADATA_SIZE		32
 
+/*! Maximum capacity of #AKFS_VBUF */
+#define AKFS_VBUF_MAX		32
+
 /***** Type declaration *******************************************************/
 typedef signed char     int8;
 typedef signed short    int16;
 typedef unsigned char   uint8;
 typedef unsigned short  uint16;
+typedef signed int      int32;
+typedef unsigned int    uint32;
+typedef signed long long int64;
 
 
 #ifdef AKFS_PRECISION_DOUBLE
@@ -40,12 +46,16 @@ typedef	double			AKFLOAT;
 #define AKFS_EPSILON	DBL_EPSILON
 #define AKFS_FMAX		DBL_MAX
 #define AKFS_FMIN		DBL_MIN
+/*! Floating point constant of AKFLOAT type */
+#define AKFS_F(x)		(x)
 
 #else
 typedef	float			AKFLOAT;
 #define AKFS_EPSILON	FLT_EPSILON
 #define AKFS_FMAX		FLT_MAX
 #define AKFS_FMIN		FLT_MIN
+/*! Floating point constant of AKFLOAT type, so as not to promote to double */
+#define AKFS_F(x)		(x##f)
 
 #endif
 
@@ -71,6 +81,24 @@ typedef union _AKFVEC {
 	AKFLOAT	v[3];
 } AKFVEC;
 
+/***** Vector ring buffer ****************************************************/
+/*! A history of vectors. Element 0 is the newest one. Elements which have
+  never been stored (i.e. index >= count) hold #AKFS_INIT_VALUE_F. */
+typedef struct _AKFS_VBUF {
+	AKFVEC	v[AKFS_VBUF_MAX];
+	int16	len;	/*!< Capacity of the buffer */
+	int16	head;	/*!< Position of the newest element in v */
+	int16	count;	/*!< Number of valid elements */
+} AKFS_VBUF;
+
+/*! Position in v of the i-th newest element. */
+#define AKFS_VBUF_IDX(buf, i) \
+	((((buf)->head + (i)) < (buf)->len) \
+	 ? ((buf)->head + (i)) : ((buf)->head + (i) - (buf)->len))
+
+/*! The i-th newest element, 0 <= i < len. */
+#define AKFS_VBUF_AT(buf, i)	((buf)->v[AKFS_VBUF_IDX((buf), (i))])
+
 /***** Layout pattern ********************************************************/
 typedef enum _AKFS_PATNO {
 	PAT_INVALID = 0,
@@ -97,6 +125,20 @@ int16 AKFS_BufShift(
 			AKFVEC	v[]
 );
 
+int16 AKFS_InitVBuf(
+	const	int16		len,
+			AKFS_VBUF	*buf
+);
+
+AKFVEC* AKFS_VBufPush(
+			AKFS_VBUF	*buf
+);
+
+void AKFS_VBufTruncate(
+	const	int16		n,
+			AKFS_VBUF	*buf
+);
+
 int16 AKFS_Rotate(
 	const   AKFS_PATNO	pat,
 			AKFVEC		*vec
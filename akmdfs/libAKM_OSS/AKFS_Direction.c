@@ -36,6 +36,121 @@
 */
 
 
+#ifdef AKFS_FAST_ATAN2
+/******************************************************************************/
+/*! Polynomial approximation of atan2. Maximum error is less than 1e-5 rad.
+  It is not static, so that AKFS_Bench can check it against atan2.
+  @return Angle in radian, [-PI, PI]. Zero when both y and x are zero.
+  @param[in] y
+  @param[in] x
+ */
+AKFLOAT AKFS_FastAtan2(
+	const	AKFLOAT		y,
+	const	AKFLOAT		x
+)
+{
+	AKFLOAT ax, ay;
+	AKFLOAT z, z2;
+	AKFLOAT r;
+
+	ax = AKFS_FABS(x);
+	ay = AKFS_FABS(y);
+
+	/* atan(z), 0 <= z <= 1 */
+	if (ax < ay) {
+		z = ax / ay;
+	} else if (ax > 0) {
+		z = ay / ax;
+	} else {
+		return 0;
+	}
+	z2 = z * z;
+	r = z * (AKFS_F(0.99997726) + z2 * (AKFS_F(-0.33262347)
+		+ z2 * (AKFS_F(0.19354346) + z2 * (AKFS_F(-0.11643287)
+		+ z2 * (AKFS_F(0.05265332) + z2 * AKFS_F(-0.01172120))))));
+
+	/* Back to the quadrant */
+	if (ax < ay) {
+		r = (AKFS_PI / 2) - r;
+	}
+	if (x < 0) {
+		r = AKFS_PI - r;
+	}
+	if (y < 0) {
+		r = -r;
+	}
+	return r;
+}
+#define AKFS_DIR_ATAN2(y, x)	AKFS_FastAtan2((y), (x))
+#else
+#define AKFS_DIR_ATAN2(y, x)	AKFS_ATAN2((y), (x))
+#endif
+
+#ifdef AKFS_DIRECTION_ALGEBRAIC
+/******************************************************************************/
+/*! Calculate orientation without sin/cos. Since pitch = asin(-gy) and
+  roll = asin(gx) where g is the normalized gravity, sin and cos of them are
+  -gy, sqrt(1 - gy^2), gx and sqrt(1 - gx^2). The magnetic vector is projected
+  to horizontal plane with them directly. With AKFS_FAST_ATAN2, pitch and roll
+  are atan2 of them, otherwise asin.
+  Output is RADIAN!
+  @return #AKFS_SUCCESS on success. Otherwise the return value is #AKFS_ERROR.
+  @param[in] hvec
+  @param[in] avec
+  @param[out] azimuth
+  @param[out] pitch
+  @param[out] roll
+ */
+static int16 AKFS_TiltCompensate(
+	const	AKFVEC		*hvec,
+	const	AKFVEC		*avec,
+			AKFLOAT		*azimuth,	/* radian */
+			AKFLOAT		*pitch,		/* radian */
+			AKFLOAT		*roll		/* radian */
+)
+{
+	AKFLOAT	av;	/* Size of vector */
+	AKFLOAT sinP; /* sin value of pitch angle */
+	AKFLOAT cosP; /* cos value of pitch angle */
+	AKFLOAT sinR; /* sin value of roll angle */
+	AKFLOAT cosR; /* cos value of roll angle */
+	AKFLOAT Xh;   /* X axis element of vector which is projected to horizontal plane */
+	AKFLOAT Yh;   /* Y axis element of vector which is projected to horizontal plane */
+
+	av = AKFS_SQRT((avec->u.x)*(avec->u.x) + (avec->u.y)*(avec->u.y) + (avec->u.z)*(avec->u.z));
+
+	if (av < AKFS_EPSILON) {
+		return AKFS_ERROR;
+	}
+
+	sinP = -(avec->u.y) / av;
+	sinR = (avec->u.x) / av;
+	cosP = AKFS_F(1.0) - sinP * sinP;
+	cosR = AKFS_F(1.0) - sinR * sinR;
+	/* Rounding error may make them slightly negative */
+	cosP = (cosP > 0) ? AKFS_SQRT(cosP) : 0;
+	cosR = (cosR > 0) ? AKFS_SQRT(cosR) : 0;
+
+	Yh = -(hvec->u.x)*cosR + (hvec->u.z)*sinR;
+	Xh = (hvec->u.x)*sinP*sinR + (hvec->u.y)*cosP + (hvec->u.z)*sinP*cosR;
+
+#ifdef AKFS_FAST_ATAN2
+	/* asin(s) = atan2(s, sqrt(1 - s^2)) */
+	*pitch = AKFS_DIR_ATAN2(sinP, cosP);
+	*roll = AKFS_DIR_ATAN2(sinR, cosR);
+#else
+	/* atan2 of libm is slower than asin. */
+	*pitch = AKFS_ASIN(sinP);
+	*roll = AKFS_ASIN(sinR);
+#endif
+
+	/* atan2(y, x) -> divisor and dividend is opposite from mathematical equation. */
+	*azimuth = AKFS_DIR_ATAN2(Yh, Xh);
+
+	return AKFS_SUCCESS;
+}
+
+#else
 /******************************************************************************/
 /*! This function is used internally, so output is RADIAN!
   @return #AKFS_SUCCESS on success. Otherwise the return value is #AKFS_ERROR.
@@ -94,16 +209,15 @@ static void AKFS_Azimuth(
 	Xh = (hvec->u.x)*sinP*sinR + (hvec->u.y)*cosP + (hvec->u.z)*sinP*cosR;
 
 	/* atan2(y, x) -> divisor and dividend is opposite from mathematical equation. */
-	*azimuth = AKFS_ATAN2(Yh, Xh);
+	*azimuth = AKFS_DIR_ATAN2(Yh, Xh);
 }
+#endif
 
 /******************************************************************************/
 /*! Output is DEGREE!
   @return #AKFS_SUCCESS on success. Otherwise the return value is #AKFS_ERROR.
-  @param[in] nhvec
   @param[in] hvec
   @param[in] hnave
-  @param[in] navec
   @param[in] avec
   @param[in] anave
   @param[out] azimuth
@@ -111,11 +225,9 @@ static void AKFS_Azimuth(
   @param[out] roll
  */
 int16 AKFS_Direction(
-	const	int16		nhvec,
-	const	AKFVEC		hvec[],
+	const	AKFS_VBUF	*hvec,
 	const	int16		hnave,
-	const	int16		navec,
-	const	AKFVEC		avec[],
+	const	AKFS_VBUF	*avec,
 	const	int16		anave,
 			AKFLOAT		*azimuth,
 			AKFLOAT		*pitch,
@@ -123,33 +235,63 @@ int16 AKFS_Direction(
 )
 {
 	AKFVEC have, aave;
-	AKFLOAT azimuthRad;
-	AKFLOAT pitchRad;
-	AKFLOAT rollRad;
 
 	/* arguments check */
-	if ((nhvec <= 0) || (navec <= 0) || (hnave <= 0) || (anave <= 0)) {
+	if ((hvec->len <= 0) || (avec->len <= 0) || (hnave <= 0) || (anave <= 0)) {
 		return AKFS_ERROR;
 	}
-	if ((nhvec < hnave) || (navec < anave)) {
+	if ((hvec->len < hnave) || (avec->len < anave)) {
 		return AKFS_ERROR;
 	}
 
 	/* average */
-	if (AKFS_VbAve(nhvec, hvec, hnave, &have) != AKFS_SUCCESS) {
+	if (AKFS_VbAve(hvec, hnave, &have) != AKFS_SUCCESS) {
 		return AKFS_ERROR;
 	}
-	if (AKFS_VbAve(navec, avec, anave, &aave) != AKFS_SUCCESS) {
+	if (AKFS_VbAve(avec, anave, &aave) != AKFS_SUCCESS) {
 		return AKFS_ERROR;
 	}
 
+	return AKFS_DirectionVec(&have, &aave, azimuth, pitch, roll);
+}
+
+/******************************************************************************/
+/*! Same as #AKFS_Direction, but takes already averaged vectors.
+  Output is DEGREE!
+  @return #AKFS_SUCCESS on success. Otherwise the return value is #AKFS_ERROR.
+  @param[in] have Averaged magnetic vector
+  @param[in] aave Averaged acceleration vector
+  @param[out] azimuth
+  @param[out] pitch
+  @param[out] roll
+ */
+int16 AKFS_DirectionVec(
+	const	AKFVEC		*have,
+	const	AKFVEC		*aave,
+			AKFLOAT		*azimuth,
+			AKFLOAT		*pitch,
+			AKFLOAT		*roll
+)
+{
+	AKFLOAT azimuthRad;
+	AKFLOAT pitchRad;
+	AKFLOAT rollRad;
+
+#ifdef AKFS_DIRECTION_ALGEBRAIC
+	/* calculate pitch, roll and azimuth */
+	if (AKFS_TiltCompensate(have, aave, &azimuthRad, &pitchRad, &rollRad)
+			!= AKFS_SUCCESS) {
+		return AKFS_ERROR;
+	}
+#else
 	/* calculate pitch and roll */
-	if (AKFS_Angle(&aave, &pitchRad, &rollRad) != AKFS_SUCCESS) {
+	if (AKFS_Angle(aave, &pitchRad, &rollRad) != AKFS_SUCCESS) {
 		return AKFS_ERROR;
 	}
 
 	/* calculate azimuth */
-	AKFS_Azimuth(&have, pitchRad, rollRad, &azimuthRad);
+	AKFS_Azimuth(have, pitchRad, rollRad, &azimuthRad);
+#endif
 
 	*azimuth = RAD2DEG(azimuthRad);
 	*pitch = RAD2DEG(pitchRad);
@@ -163,4 +305,90 @@ int16 AKFS_Direction(
 	return AKFS_SUCCESS;
 }
 
+/******************************************************************************/
+/*! Calculate a unit quaternion which rotates the device coordinate to the
+  world coordinate (X: east, Y: north, Z: up), i.e. Android rotation vector.
+  The rotation matrix is made of east, north and up vectors directly, so no
+  Euler angle is used.
+  @return #AKFS_SUCCESS on success. Otherwise the return value is #AKFS_ERROR.
+  @param[in] have Averaged magnetic vector
+  @param[in] aave Averaged acceleration vector
+  @param[out] quat x, y, z and w. w is not negative.
+ */
+int16 AKFS_Quaternion(
+	const	AKFVEC		*have,
+	const	AKFVEC		*aave,
+			AKFLOAT		quat[4]
+)
+{
+	AKFVEC	e;	/* east */
+	AKFVEC	n;	/* north */
+	AKFVEC	a;	/* up */
+	AKFLOAT	ev, av;
+	AKFLOAT	tr;
+	AKFLOAT	s;
+	int16	i;
+
+	/* east = h x a */
+	e.u.x = have->u.y * aave->u.z - have->u.z * aave->u.y;
+	e.u.y = have->u.z * aave->u.x - have->u.x * aave->u.z;
+	e.u.z = have->u.x * aave->u.y - have->u.y * aave->u.x;
+
+	ev = AKFS_SQRT(e.u.x * e.u.x + e.u.y * e.u.y + e.u.z * e.u.z);
+	av = AKFS_SQRT(aave->u.x * aave->u.x + aave->u.y * aave->u.y
+		+ aave->u.z * aave->u.z);
+
+	/* Free fall, or the field is parallel to the gravity */
+	if ((ev < AKFS_EPSILON) || (av < AKFS_EPSILON)) {
+		return AKFS_ERROR;
+	}
+
+	for (i = 0; i < 3; i++) {
+		e.v[i] /= ev;
+		a.v[i] = aave->v[i] / av;
+	}
+
+	/* north = a x e, already a unit vector */
+	n.u.x = a.u.y * e.u.z - a.u.z * e.u.y;
+	n.u.y = a.u.z * e.u.x - a.u.x * e.u.z;
+	n.u.z = a.u.x * e.u.y - a.u.y * e.u.x;
+
+	/* Rotation matrix R = [e; n; a] (rows) to quaternion. The largest of
+	   four candidates is used as divisor for numerical stability. */
+	tr = e.u.x + n.u.y + a.u.z;
+	if (tr > 0) {
+		s = AKFS_SQRT(tr + AKFS_F(1.0)) * 2;
+		quat[3] = AKFS_F(0.25) * s;
+		quat[0] = (a.u.y - n.u.z) / s;
+		quat[1] = (e.u.z - a.u.x) / s;
+		quat[2] = (n.u.x - e.u.y) / s;
+	} else if ((e.u.x > n.u.y) && (e.u.x > a.u.z)) {
+		s = AKFS_SQRT(AKFS_F(1.0) + e.u.x - n.u.y - a.u.z) * 2;
+		quat[3] = (a.u.y - n.u.z) / s;
+		quat[0] = AKFS_F(0.25) * s;
+		quat[1] = (e.u.y + n.u.x) / s;
+		quat[2] = (e.u.z + a.u.x) / s;
+	} else if (n.u.y > a.u.z) {
+		s = AKFS_SQRT(AKFS_F(1.0) + n.u.y - e.u.x - a.u.z) * 2;
+		quat[3] = (e.u.z - a.u.x) / s;
+		quat[0] = (e.u.y + n.u.x) / s;
+		quat[1] = AKFS_F(0.25) * s;
+		quat[2] = (n.u.z + a.u.y) / s;
+	} else {
+		s = AKFS_SQRT(AKFS_F(1.0) + a.u.z - e.u.x - n.u.y) * 2;
+		quat[3] = (n.u.x - e.u.y) / s;
+		quat[0] = (e.u.z + a.u.x) / s;
+		quat[1] = (n.u.z + a.u.y) / s;
+		quat[2] = AKFS_F(0.25) * s;
+	}
+
+	/* q and -q are the same rotation */
+	if (quat[3] < 0) {
+		for (i = 0; i < 4; i++) {
+			quat[i] = -quat[i];
+		}
+	}
+
+	return AKFS_SUCCESS;
+}
 
@@ -23,16 +23,35 @@
 /***** Prototype of function **************************************************/
 AKLIB_C_API_START
 int16 AKFS_Direction(
-	const	int16		nhvec,
-	const	AKFVEC		hvec[],
+	const	AKFS_VBUF	*hvec,
 	const	int16		hnave,
-	const	int16		navec,
-	const	AKFVEC		avec[],
+	const	AKFS_VBUF	*avec,
 	const	int16		anave,
 			AKFLOAT		*azimuth,
 			AKFLOAT		*pitch,
 			AKFLOAT		*roll
 );
+
+int16 AKFS_DirectionVec(
+	const	AKFVEC		*have,
+	const	AKFVEC		*aave,
+			AKFLOAT		*azimuth,
+			AKFLOAT		*pitch,
+			AKFLOAT		*roll
+);
+
+int16 AKFS_Quaternion(
+	const	AKFVEC		*have,
+	const	AKFVEC		*aave,
+			AKFLOAT		quat[4]
+);
+
+#ifdef AKFS_FAST_ATAN2
+AKFLOAT AKFS_FastAtan2(
+	const	AKFLOAT		y,
+	const	AKFLOAT		x
+);
+#endif
 AKLIB_C_API_END
 
 #endif
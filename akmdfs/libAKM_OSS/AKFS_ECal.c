@@ -0,0 +1,562 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2012 Asahi Kasei Microdevices Corporation, Japan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************/
+#include <math.h>
+#include "AKFS_ECal.h"
+#include "AKFS_Math.h"
+
+/* The fit runs off the measurement loop, so it is always done in double
+   precision to keep the normal equation well conditioned. */
+#define ECAL_NPRM		9
+#define ECAL_EPSILON	1e-12
+#define ECAL_JACOBI_MAX	16
+/* Bounds of an empty bounding box, far out of any magnetic field. */
+#define ECAL_BOX_EMPTY	1.0e6f
+
+/*
+ * BinIndex : cube map of the direction of d
+ */
+static int16 BinIndex(
+	const	AKFVEC	*d		/*!< (i)	: vector from the center */
+){
+	int16	m, i;
+	int16	cu, cv;
+	AKFLOAT	am;
+	AKFLOAT	u, v;
+
+	/* dominant axis */
+	m = 0;
+	for (i = 1; i < 3; i++) {
+		if (AKFS_FABS(d->v[i]) > AKFS_FABS(d->v[m])) {
+			m = i;
+		}
+	}
+	am = AKFS_FABS(d->v[m]);
+	if (am < AKFS_EPSILON) {
+		return -1;
+	}
+
+	/* position on the face, in [-1, 1] */
+	u = d->v[(m + 1) % 3] / am;
+	v = d->v[(m + 2) % 3] / am;
+	cu = (int16)((u + 1.0f) * 0.5f * AKFS_ECAL_DIV);
+	cv = (int16)((v + 1.0f) * 0.5f * AKFS_ECAL_DIV);
+	if (cu >= AKFS_ECAL_DIV) {
+		cu = AKFS_ECAL_DIV - 1;
+	}
+	if (cv >= AKFS_ECAL_DIV) {
+		cv = AKFS_ECAL_DIV - 1;
+	}
+
+	return (int16)(((2 * m + ((d->v[m] < 0) ? 1 : 0)) * AKFS_ECAL_DIV + cu)
+			* AKFS_ECAL_DIV + cv);
+}
+
+/*
+ * ClearBox : make the bounding box empty
+ */
+static void ClearBox(
+			AKFS_ECAL_BIN	*bins	/*!< (i/o)	: bins */
+){
+	int16	i;
+
+	for (i = 0; i < 3; i++) {
+		bins->hmin.v[i] = ECAL_BOX_EMPTY;
+		bins->hmax.v[i] = -ECAL_BOX_EMPTY;
+	}
+}
+
+/*
+ * ExtendBox : extend the bounding box to h
+ */
+static void ExtendBox(
+			AKFS_ECAL_BIN	*bins,	/*!< (i/o)	: bins */
+	const	AKFVEC			*h		/*!< (i)	: sample */
+){
+	int16	i;
+
+	for (i = 0; i < 3; i++) {
+		if (h->v[i] < bins->hmin.v[i]) {
+			bins->hmin.v[i] = h->v[i];
+		}
+		if (h->v[i] > bins->hmax.v[i]) {
+			bins->hmax.v[i] = h->v[i];
+		}
+	}
+}
+
+/*
+ * Put : put h into its bin relative to hc. An older sample is replaced.
+ */
+static int16 Put(
+			AKFS_ECAL_BIN	*bins,	/*!< (i/o)	: bins */
+	const	AKFVEC			*h,		/*!< (i)	: sample */
+	const	uint32			age		/*!< (i)	: serial of the sample */
+){
+	int16	i;
+	AKFVEC	d;
+
+	for (i = 0; i < 3; i++) {
+		d.v[i] = h->v[i] - bins->hc.v[i];
+	}
+	i = BinIndex(&d);
+	if (i < 0) {
+		return -1;
+	}
+	if (bins->age[i] == 0) {
+		bins->nbin++;
+	} else if (bins->age[i] > age) {
+		return i;
+	}
+	bins->h[i] = *h;
+	bins->age[i] = age;
+	return i;
+}
+
+/*
+ * Recenter : move hc to the midpoint of the bounding box, when it has moved
+ * far, and put the samples into the bins again. Samples too old for a fit
+ * are dropped, and the bounding box shrinks to the rest.
+ */
+static void Recenter(
+			AKFS_ECAL_BIN	*bins	/*!< (i/o)	: bins */
+){
+	AKFVEC	h[AKFS_ECAL_NBIN];
+	uint32	age[AKFS_ECAL_NBIN];
+	AKFLOAT	mid, ext, shift;
+	int16	i;
+
+	ext = 0;
+	shift = 0;
+	for (i = 0; i < 3; i++) {
+		mid = (bins->hmin.v[i] + bins->hmax.v[i]) * 0.5f;
+		if ((bins->hmax.v[i] - bins->hmin.v[i]) > ext) {
+			ext = bins->hmax.v[i] - bins->hmin.v[i];
+		}
+		if (AKFS_FABS(mid - bins->hc.v[i]) > shift) {
+			shift = AKFS_FABS(mid - bins->hc.v[i]);
+		}
+	}
+	if (shift <= (ext * AKFS_ECAL_RECENTER)) {
+		return;
+	}
+
+	for (i = 0; i < 3; i++) {
+		bins->hc.v[i] = (bins->hmin.v[i] + bins->hmax.v[i]) * 0.5f;
+	}
+	for (i = 0; i < AKFS_ECAL_NBIN; i++) {
+		h[i] = bins->h[i];
+		age[i] = bins->age[i];
+		bins->age[i] = 0;
+	}
+	bins->nbin = 0;
+	ClearBox(bins);
+	for (i = 0; i < AKFS_ECAL_NBIN; i++) {
+		if ((age[i] == 0) ||
+			((bins->serial - age[i]) > AKFS_ECAL_MAX_AGE)) {
+			continue;
+		}
+		if (Put(bins, &h[i], age[i]) >= 0) {
+			ExtendBox(bins, &h[i]);
+		}
+	}
+}
+
+/*
+ * Solve : solve a x = b by Gaussian elimination with partial pivoting.
+ * a and b are destroyed.
+ */
+static int16 Solve(
+	const	int16	n,					/*!< (i)	: dimension */
+			double	a[][ECAL_NPRM],		/*!< (i/o)	: matrix */
+			double	b[],				/*!< (i/o)	: vector */
+			double	x[]					/*!< (o)	: solution */
+){
+	int16	i, j, k, p;
+	double	t;
+
+	for (k = 0; k < n; k++) {
+		p = k;
+		for (i = k + 1; i < n; i++) {
+			if (fabs(a[i][k]) > fabs(a[p][k])) {
+				p = i;
+			}
+		}
+		if (fabs(a[p][k]) < ECAL_EPSILON) {
+			return -1;
+		}
+		if (p != k) {
+			for (j = 0; j < n; j++) {
+				t = a[k][j]; a[k][j] = a[p][j]; a[p][j] = t;
+			}
+			t = b[k]; b[k] = b[p]; b[p] = t;
+		}
+		for (i = k + 1; i < n; i++) {
+			t = a[i][k] / a[k][k];
+			for (j = k; j < n; j++) {
+				a[i][j] -= t * a[k][j];
+			}
+			b[i] -= t * b[k];
+		}
+	}
+	for (i = n - 1; i >= 0; i--) {
+		t = b[i];
+		for (j = i + 1; j < n; j++) {
+			t -= a[i][j] * x[j];
+		}
+		x[i] = t / a[i][i];
+	}
+	return 0;
+}
+
+/*
+ * Jacobi : eigen decomposition of a symmetric 3x3 matrix, a = v diag(e) v^T
+ */
+static void Jacobi(
+			double	a[3][3],	/*!< (i/o)	: matrix, destroyed */
+			double	e[3],		/*!< (o)	: eigen values */
+			double	v[3][3]		/*!< (o)	: eigen vectors in columns */
+){
+	int16	i, j, k, p, q, sweep;
+	double	th, t, c, s, tau;
+	double	apq, app, aqq;
+
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 3; j++) {
+			v[i][j] = (i == j) ? 1.0 : 0.0;
+		}
+	}
+
+	for (sweep = 0; sweep < ECAL_JACOBI_MAX; sweep++) {
+		if ((fabs(a[0][1]) + fabs(a[0][2]) + fabs(a[1][2])) < ECAL_EPSILON) {
+			break;
+		}
+		for (p = 0; p < 2; p++) {
+			for (q = p + 1; q < 3; q++) {
+				apq = a[p][q];
+				if (fabs(apq) < ECAL_EPSILON) {
+					continue;
+				}
+				app = a[p][p];
+				aqq = a[q][q];
+				th = (aqq - app) / (2.0 * apq);
+				t = ((th < 0) ? -1.0 : 1.0) / (fabs(th) + sqrt(th * th + 1.0));
+				c = 1.0 / sqrt(t * t + 1.0);
+				s = t * c;
+				tau = s / (1.0 + c);
+				a[p][p] = app - t * apq;
+				a[q][q] = aqq + t * apq;
+				a[p][q] = a[q][p] = 0.0;
+				for (k = 0; k < 3; k++) {
+					if ((k != p) && (k != q)) {
+						double akp = a[k][p];
+						double akq = a[k][q];
+						a[k][p] = a[p][k] = akp - s * (akq + tau * akp);
+						a[k][q] = a[q][k] = akq + s * (akp - tau * akq);
+					}
+				}
+				for (k = 0; k < 3; k++) {
+					double vkp = v[k][p];
+					double vkq = v[k][q];
+					v[k][p] = vkp - s * (vkq + tau * vkp);
+					v[k][q] = vkq + s * (vkp - tau * vkq);
+				}
+			}
+		}
+	}
+
+	for (i = 0; i < 3; i++) {
+		e[i] = a[i][i];
+	}
+}
+
+/******************************************************************************/
+/*! Initialize bins.
+  @return None
+  @param[out] bins
+ */
+void AKFS_InitECal(
+			AKFS_ECAL_BIN	*bins
+){
+	int16 i;
+
+	for (i = 0; i < AKFS_ECAL_NBIN; i++) {
+		bins->age[i] = 0;
+	}
+	AKFS_InitBuffer(AKFS_ECAL_NBIN, bins->h);
+	bins->hc.u.x = 0;
+	bins->hc.u.y = 0;
+	bins->hc.u.z = 0;
+	ClearBox(bins);
+	bins->serial = 0;
+	bins->posted = 0;
+	bins->nbin = 0;
+	bins->pbin = 0;
+}
+
+/******************************************************************************/
+/*! Put a new sample into its bin. This is cheap enough to be called for every
+  sample in the measurement loop. When the midpoint of the bounding box of the
+  samples moves far, the bins are rebuilt around it, which costs one pass
+  over the bins.
+  @return 1 when a fit should be tried with the current bins, otherwise 0.
+  @param[in/out] bins
+  @param[in] hdata Android coordinate, sensitivity adjusted.
+ */
+int16 AKFS_ECalAdd(
+			AKFS_ECAL_BIN	*bins,
+	const	AKFVEC			*hdata
+){
+	/* The box is rebuilt by Recenter, so hdata is added again after it. */
+	ExtendBox(bins, hdata);
+	Recenter(bins);
+
+	if (Put(bins, hdata, bins->serial + 1) < 0) {
+		return 0;
+	}
+	bins->serial++;
+	ExtendBox(bins, hdata);
+
+	if ((bins->nbin >= AKFS_ECAL_MIN_BINS) &&
+		((bins->nbin != bins->pbin) ||
+		 ((bins->serial - bins->posted) >= AKFS_ECAL_REFIT))) {
+		bins->pbin = bins->nbin;
+		bins->posted = bins->serial;
+		return 1;
+	}
+	return 0;
+}
+
+/******************************************************************************/
+/*! Fit an ellipsoid to the binned samples by linear least squares, i.e.
+  x^T A x + 2 b^T x = 1, and derive the hard-iron offset and the soft-iron
+  correction matrix from it. This takes a few tens of microseconds, so this
+  should be called out of the measurement loop.
+  @return #AKFS_SUCCESS if a fit is found and passes the acceptance criteria.
+   Otherwise the return value is #AKFS_ERROR.
+  @param[in] bins
+  @param[out] res
+ */
+int16 AKFS_ECalFit(
+	const	AKFS_ECAL_BIN	*bins,
+			AKFS_ECAL_RES	*res
+){
+	double	p[AKFS_ECAL_NBIN][3];
+	double	nm[ECAL_NPRM][ECAL_NPRM];
+	double	nv[ECAL_NPRM];
+	double	th[ECAL_NPRM];
+	double	phi[ECAL_NPRM];
+	double	a[3][ECAL_NPRM];
+	double	b[3];
+	double	c[3];
+	double	m[3][3];
+	double	e[3];
+	double	v[3][3];
+	double	w[3][3];
+	double	scale, k, rs, emin, emax, err, r, t;
+	int16	faces[6];
+	int16	n, nf;
+	int16	i, j, l;
+
+	/* Collect usable bins, relative to the center of the bins. */
+	for (i = 0; i < 6; i++) {
+		faces[i] = 0;
+	}
+	n = 0;
+	scale = 0.0;
+	for (i = 0; i < AKFS_ECAL_NBIN; i++) {
+		if ((bins->age[i] == 0) ||
+			((bins->serial - bins->age[i]) > AKFS_ECAL_MAX_AGE)) {
+			continue;
+		}
+		for (j = 0; j < 3; j++) {
+			p[n][j] = (double)bins->h[i].v[j] - (double)bins->hc.v[j];
+		}
+		scale += sqrt(p[n][0]*p[n][0] + p[n][1]*p[n][1] + p[n][2]*p[n][2]);
+		faces[i / (AKFS_ECAL_DIV * AKFS_ECAL_DIV)] = 1;
+		n++;
+	}
+	nf = 0;
+	for (i = 0; i < 6; i++) {
+		nf += faces[i];
+	}
+	if ((n < AKFS_ECAL_MIN_BINS) || (nf < AKFS_ECAL_MIN_FACES) ||
+		(scale < ECAL_EPSILON)) {
+		return AKFS_ERROR;
+	}
+	/* Normalize, so that the mean distance is 1. */
+	scale = n / scale;
+
+	/* Normal equation */
+	for (i = 0; i < ECAL_NPRM; i++) {
+		nv[i] = 0.0;
+		for (j = 0; j < ECAL_NPRM; j++) {
+			nm[i][j] = 0.0;
+		}
+	}
+	for (l = 0; l < n; l++) {
+		double x = p[l][0] * scale;
+		double y = p[l][1] * scale;
+		double z = p[l][2] * scale;
+		phi[0] = x * x;
+		phi[1] = y * y;
+		phi[2] = z * z;
+		phi[3] = 2.0 * x * y;
+		phi[4] = 2.0 * x * z;
+		phi[5] = 2.0 * y * z;
+		phi[6] = 2.0 * x;
+		phi[7] = 2.0 * y;
+		phi[8] = 2.0 * z;
+		for (i = 0; i < ECAL_NPRM; i++) {
+			nv[i] += phi[i];
+			for (j = i; j < ECAL_NPRM; j++) {
+				nm[i][j] += phi[i] * phi[j];
+			}
+		}
+	}
+	for (i = 0; i < ECAL_NPRM; i++) {
+		for (j = 0; j < i; j++) {
+			nm[i][j] = nm[j][i];
+		}
+	}
+	if (Solve(ECAL_NPRM, nm, nv, th) != 0) {
+		return AKFS_ERROR;
+	}
+
+	/* Center: c = -A^-1 b */
+	a[0][0] = th[0]; a[0][1] = th[3]; a[0][2] = th[4];
+	a[1][0] = th[3]; a[1][1] = th[1]; a[1][2] = th[5];
+	a[2][0] = th[4]; a[2][1] = th[5]; a[2][2] = th[2];
+	b[0] = -th[6];
+	b[1] = -th[7];
+	b[2] = -th[8];
+	if (Solve(3, a, b, c) != 0) {
+		return AKFS_ERROR;
+	}
+
+	/* (x-c)^T (A/k) (x-c) = 1, where k = 1 + c^T A c */
+	m[0][0] = th[0]; m[0][1] = th[3]; m[0][2] = th[4];
+	m[1][0] = th[3]; m[1][1] = th[1]; m[1][2] = th[5];
+	m[2][0] = th[4]; m[2][1] = th[5]; m[2][2] = th[2];
+	k = 1.0;
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 3; j++) {
+			k += c[i] * m[i][j] * c[j];
+		}
+	}
+	if (k < ECAL_EPSILON) {
+		return AKFS_ERROR;
+	}
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 3; j++) {
+			m[i][j] /= k;
+		}
+	}
+
+	/* Must be an ellipsoid, and not too flat. */
+	Jacobi(m, e, v);
+	emin = e[0];
+	emax = e[0];
+	for (i = 1; i < 3; i++) {
+		if (e[i] < emin) {
+			emin = e[i];
+		}
+		if (e[i] > emax) {
+			emax = e[i];
+		}
+	}
+	if (emin < ECAL_EPSILON) {
+		return AKFS_ERROR;
+	}
+	/* ratio of axes = sqrt(emax / emin) */
+	if ((emax / emin) > (AKFS_ECAL_AXRATIO * AKFS_ECAL_AXRATIO)) {
+		return AKFS_ERROR;
+	}
+
+	/* Radius which keeps the volume: cube root of the product of axes. */
+	rs = pow(e[0] * e[1] * e[2], -1.0 / 6.0);
+
+	/* w = rs * sqrt(A/k), maps the ellipsoid to the sphere of radius rs. */
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 3; j++) {
+			w[i][j] = 0.0;
+			for (l = 0; l < 3; l++) {
+				w[i][j] += v[i][l] * sqrt(e[l]) * v[j][l];
+			}
+			w[i][j] *= rs;
+		}
+	}
+
+	/* Back to the original scale. w is linear, so it does not change. */
+	rs /= scale;
+	for (i = 0; i < 3; i++) {
+		c[i] /= scale;
+	}
+	if ((rs < AKFS_ECAL_RMIN) || (AKFS_ECAL_RMAX < rs)) {
+		return AKFS_ERROR;
+	}
+
+	/* Residual */
+	err = 0.0;
+	for (l = 0; l < n; l++) {
+		r = 0.0;
+		for (i = 0; i < 3; i++) {
+			t = 0.0;
+			for (j = 0; j < 3; j++) {
+				t += w[i][j] * (p[l][j] - c[j]);
+			}
+			r += t * t;
+		}
+		r = sqrt(r) - rs;
+		err += r * r;
+	}
+	err = sqrt(err / n);
+	if (err > (AKFS_ECAL_RESTH * rs)) {
+		return AKFS_ERROR;
+	}
+
+	/* Accepted */
+	for (i = 0; i < 3; i++) {
+		res->ho.v[i] = (AKFLOAT)((double)bins->hc.v[i] + c[i]);
+		for (j = 0; j < 3; j++) {
+			res->hsi[i][j] = (AKFLOAT)w[i][j];
+		}
+	}
+	res->hr = (AKFLOAT)rs;
+	res->resid = (AKFLOAT)err;
+
+	return AKFS_SUCCESS;
+}
+
+/******************************************************************************/
+/*! Apply the soft-iron correction matrix to an offset subtracted vector.
+  @return None
+  @param[in] hsi
+  @param[in/out] vec
+ */
+void AKFS_ECalApply(
+	const	AKFLOAT			hsi[3][3],
+			AKFVEC			*vec
+){
+	AKFVEC tmp;
+
+	tmp.u.x = hsi[0][0]*vec->u.x + hsi[0][1]*vec->u.y + hsi[0][2]*vec->u.z;
+	tmp.u.y = hsi[1][0]*vec->u.x + hsi[1][1]*vec->u.y + hsi[1][2]*vec->u.z;
+	tmp.u.z = hsi[2][0]*vec->u.x + hsi[2][1]*vec->u.y + hsi[2][2]*vec->u.z;
+
+	*vec = tmp;
+}
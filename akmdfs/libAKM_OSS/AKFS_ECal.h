@@ -0,0 +1,92 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2012 Asahi Kasei Microdevices Corporation, Japan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************/
+#ifndef AKFS_INC_ECAL_H
+#define AKFS_INC_ECAL_H
+
+#include "AKFS_Device.h"
+
+/***** Constant definition ****************************************************/
+/* Bins: 6 faces of a cube, each face is divided into DIV x DIV cells. */
+#define AKFS_ECAL_DIV		3
+#define AKFS_ECAL_NBIN		(6 * AKFS_ECAL_DIV * AKFS_ECAL_DIV)
+/* Minimum number of filled bins and cube faces to try a fit. */
+#define AKFS_ECAL_MIN_BINS	16
+#define AKFS_ECAL_MIN_FACES	5
+/* A bin older than this number of samples is not used for a fit. */
+#define AKFS_ECAL_MAX_AGE	3000
+/* Try a fit again after this number of samples, even if no new bin is filled. */
+#define AKFS_ECAL_REFIT		64
+/* Re-bin when the midpoint of the bounding box moves by more than this ratio
+   of the largest side of the box. */
+#define AKFS_ECAL_RECENTER	0.125
+
+/* Acceptance criteria of a fit. */
+#define AKFS_ECAL_RMIN		10		/* Minimum radius (uT) */
+#define AKFS_ECAL_RMAX		70		/* Maximum radius (uT) */
+#define AKFS_ECAL_AXRATIO	1.5		/* Maximum ratio of ellipsoid axes */
+#define AKFS_ECAL_RESTH		0.05	/* Maximum RMS residual, relative to radius */
+
+/***** Type declaration *******************************************************/
+/*! Spatially binned magnetic data. Each bin keeps the latest sample whose
+  direction from hc falls into the bin. hc is the midpoint of the bounding
+  box of the samples, so binning does not depend on the offset estimation,
+  which may be far off until the first fit. */
+typedef struct _AKFS_ECAL_BIN {
+	AKFVEC		h[AKFS_ECAL_NBIN];		/*!< The latest sample in each bin */
+	uint32		age[AKFS_ECAL_NBIN];	/*!< Serial of the sample, 0: empty */
+	AKFVEC		hc;						/*!< Center, which bins are relative to */
+	AKFVEC		hmin;					/*!< Bounding box of the samples */
+	AKFVEC		hmax;
+	uint32		serial;					/*!< Serial of the latest sample */
+	uint32		posted;					/*!< Serial when a fit was requested */
+	int16		nbin;					/*!< Number of filled bins */
+	int16		pbin;					/*!< nbin when a fit was requested */
+} AKFS_ECAL_BIN;
+
+/*! Result of an ellipsoid fit. A calibrated vector is hsi * (h - ho). */
+typedef struct _AKFS_ECAL_RES {
+	AKFVEC		ho;				/*!< Hard-iron offset */
+	AKFLOAT		hsi[3][3];		/*!< Soft-iron correction matrix */
+	AKFLOAT		hr;				/*!< Radius of the corrected sphere */
+	AKFLOAT		resid;			/*!< RMS residual of the fit */
+} AKFS_ECAL_RES;
+
+/***** Prototype of function **************************************************/
+AKLIB_C_API_START
+void AKFS_InitECal(
+			AKFS_ECAL_BIN	*bins
+);
+
+int16 AKFS_ECalAdd(
+			AKFS_ECAL_BIN	*bins,
+	const	AKFVEC			*hdata
+);
+
+int16 AKFS_ECalFit(
+	const	AKFS_ECAL_BIN	*bins,
+			AKFS_ECAL_RES	*res
+);
+
+void AKFS_ECalApply(
+	const	AKFLOAT			hsi[3][3],
+			AKFVEC			*vec
+);
+AKLIB_C_API_END
+
+#endif
+
@@ -0,0 +1,329 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2012 Asahi Kasei Microdevices Corporation, Japan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************/
+#include <string.h>
+#include "AKFS_Fixed.h"
+
+/*
+ * The fixed point backend of the per-sample path, i.e. AKFS_QDecompXform in
+ * AKFS_Decomp.c and the functions below. Data are kept in Q16.16 from the
+ * transform to the averages, and only the averages are converted to AKFLOAT.
+ * AOC and the ellipsoid fit take an AKFLOAT copy of the newest sample, since
+ * the sphere fit does not fit in the range of Q16.16.
+ */
+#ifdef AKFS_PRECISION_FIXED
+
+/******************************************************************************/
+/*! Initialize #AKFS_QBUF. Same as #AKFS_InitVBuf.
+  @return #AKFS_SUCCESS on success. Otherwise the return value is #AKFS_ERROR.
+  @param[in] len
+  @param[out] buf
+ */
+int16 AKFS_InitQBuf(
+	const	int16		len,	/*!< Capacity of the buffer */
+			AKFS_QBUF	*buf	/*!< Vector ring buffer */
+)
+{
+	/* size check */
+	if ((len <= 0) || (AKFS_VBUF_MAX < len)) {
+		return AKFS_ERROR;
+	}
+
+	buf->len = len;
+	buf->head = 0;
+	buf->count = 0;
+	memset(buf->v, 0, sizeof(buf->v));
+
+	return AKFS_SUCCESS;
+}
+
+/******************************************************************************/
+/*! Make a spare area for new data at the front of #AKFS_QBUF. Same as
+  #AKFS_VBufPush.
+  @return A pointer to the newest element, which should be filled by caller.
+  @param[in/out] buf
+ */
+AKFS_QVEC* AKFS_QBufPush(
+			AKFS_QBUF	*buf	/*!< Vector ring buffer */
+)
+{
+	buf->head = (buf->head == 0) ? (buf->len - 1) : (buf->head - 1);
+	if (buf->count < buf->len) {
+		buf->count++;
+	}
+	return &buf->v[buf->head];
+}
+
+/******************************************************************************/
+/*! Initialize #AKFS_QNORM, so that the next #AKFS_QNormSet makes it.
+  @return None
+  @param[out] qn
+ */
+void AKFS_InitQNorm(
+			AKFS_QNORM	*qn
+)
+{
+	memset(qn, 0, sizeof(*qn));
+}
+
+/******************************************************************************/
+/*! Make the offset and the gain of #AKFS_QbNorm, i.e. g = hsi * tgt / s.
+  Nothing is done when the parameters are the same as the last time.
+  @return #AKFS_SUCCESS on success. Otherwise the return value is #AKFS_ERROR.
+  @param[in] o Offset
+  @param[in] s Sensitivity
+  @param[in] tgt Target sensitivity
+  @param[in] hsi Soft-iron correction matrix. NULL if not corrected.
+  @param[in/out] qn
+ */
+int16 AKFS_QNormSet(
+	const	AKFVEC		*o,
+	const	AKFVEC		*s,
+	const	AKFLOAT		tgt,
+	const	AKFLOAT		hsi[3][3],
+			AKFS_QNORM	*qn
+)
+{
+	int i, j;
+
+	/* sensitivity check */
+	if ((s->u.x <= AKFS_EPSILON) ||
+		(s->u.y <= AKFS_EPSILON) ||
+		(s->u.z <= AKFS_EPSILON) ||
+		(tgt <= 0)) {
+		return AKFS_ERROR;
+	}
+
+	if ((qn->valid != 0) &&
+		(memcmp(&qn->fo, o, sizeof(*o)) == 0) &&
+		(memcmp(&qn->fs, s, sizeof(*s)) == 0) &&
+		(qn->ftgt == tgt) &&
+		((hsi == NULL) ? (qn->fsi == 0) :
+			((qn->fsi != 0) && (memcmp(qn->fm, hsi, sizeof(qn->fm)) == 0)))) {
+		return AKFS_SUCCESS;
+	}
+
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 3; j++) {
+			qn->fm[i][j] = (hsi != NULL) ? hsi[i][j] : ((i == j) ? 1 : 0);
+		}
+	}
+	for (i = 0; i < 3; i++) {
+		qn->o.v[i] = AKFS_F2Q(o->v[i]);
+		for (j = 0; j < 3; j++) {
+			qn->g[i][j] = AKFS_F2QS(qn->fm[i][j] * tgt / s->v[j], AKFS_QG_SHIFT);
+		}
+	}
+	qn->fo = *o;
+	qn->fs = *s;
+	qn->ftgt = tgt;
+	qn->fsi = (hsi != NULL) ? 1 : 0;
+	qn->valid = 1;
+
+	return AKFS_SUCCESS;
+}
+
+/******************************************************************************/
+/*! Normalize a vector, i.e. v = g (d - o).
+  @return None
+  @param[in] qn
+  @param[in] d Raw vector
+  @param[out] v Normalized vector
+ */
+void AKFS_QNormApply(
+	const	AKFS_QNORM	*qn,
+	const	AKFS_QVEC	*d,
+			AKFS_QVEC	*v
+)
+{
+	int64 dv[3];
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		dv[i] = (int64)d->v[i] - qn->o.v[i];
+	}
+	for (i = 0; i < 3; i++) {
+		v->v[i] = AKFS_QShr(
+			(dv[0] * qn->g[i][0]) + (dv[1] * qn->g[i][1]) + (dv[2] * qn->g[i][2]),
+			AKFS_QG_SHIFT);
+	}
+}
+
+/******************************************************************************/
+/*! Normalize vectors. Same as #AKFS_VbNorm followed by #AKFS_ECalApply.
+  @return #AKFS_SUCCESS on success. Otherwise the return value is #AKFS_ERROR.
+  @param[in] qdata Raw vector buffer
+  @param[in] nbuf Size of data to be buffered
+  @param[in] qn Offset and gain, made by #AKFS_QNormSet
+  @param[in/out] qvec Normalized vector buffer
+ */
+int16 AKFS_QbNorm(
+	const	AKFS_QBUF	*qdata,
+	const	int16		nbuf,
+	const	AKFS_QNORM	*qn,
+			AKFS_QBUF	*qvec
+)
+{
+	int i;
+
+	/* size check */
+	if ((qdata->len <= 0) || (qvec->len <= 0) || (nbuf <= 0)) {
+		return AKFS_ERROR;
+	}
+	/* dependency check */
+	if ((qdata->len < nbuf) || (qvec->len < nbuf) || (qn->valid == 0)) {
+		return AKFS_ERROR;
+	}
+
+	/* calculate and store data to buffer, the oldest one first */
+	for (i = nbuf - 1; i >= 0; i--) {
+		AKFS_QNormApply(qn, &AKFS_QBUF_AT(qdata, i), AKFS_QBufPush(qvec));
+	}
+
+	return AKFS_SUCCESS;
+}
+
+/******************************************************************************/
+/*! Calculate an averaged vector form a given buffer. Same as #AKFS_VbAve.
+  @return #AKFS_SUCCESS on success. Otherwise the return value is #AKFS_ERROR.
+  @param[in] qvec Normalized vector buffer
+  @param[in] nave Number of average
+  @param[out] vave Averaged vector
+ */
+int16 AKFS_QbAve(
+	const	AKFS_QBUF	*qvec,
+	const	int16		nave,
+			AKFVEC		*vave
+)
+{
+	AKFS_QAVE ave;
+	int i, j;
+
+	/* arguments check */
+	if ((nave <= 0) || (qvec->len <= 0) || (qvec->len < nave)) {
+		return AKFS_ERROR;
+	}
+
+	ave.nave = nave;
+	ave.n = (qvec->count < nave) ? qvec->count : nave;
+	for (j = 0; j < 3; j++) {
+		ave.sum[j] = 0;
+		for (i = 0; i < ave.n; i++) {
+			ave.sum[j] += AKFS_QBUF_AT(qvec, i).v[j];
+		}
+	}
+	AKFS_QAveGet(&ave, vave);
+	return AKFS_SUCCESS;
+}
+
+/******************************************************************************/
+/*! Initialize a running average. Same as #AKFS_InitVAve.
+  @return #AKFS_SUCCESS on success. Otherwise the return value is #AKFS_ERROR.
+  @param[in] nave Number of average
+  @param[out] ave Running average
+ */
+int16 AKFS_InitQAve(
+	const	int16		nave,
+			AKFS_QAVE	*ave
+)
+{
+	/* arguments check */
+	if (nave <= 0) {
+		return AKFS_ERROR;
+	}
+
+	ave->sum[0] = 0;
+	ave->sum[1] = 0;
+	ave->sum[2] = 0;
+	ave->nave = nave;
+	ave->n = 0;
+
+	return AKFS_SUCCESS;
+}
+
+/******************************************************************************/
+/*! Update a running average after a new element is pushed to a given buffer.
+  Same as #AKFS_VAveUpdate, except that the sum is exact.
+  @return #AKFS_SUCCESS on success. Otherwise the return value is #AKFS_ERROR.
+  @param[in] qvec Normalized vector buffer
+  @param[in/out] ave Running average
+ */
+int16 AKFS_QAveUpdate(
+	const	AKFS_QBUF	*qvec,
+			AKFS_QAVE	*ave
+)
+{
+	int i, j;
+	int n;
+
+	/* arguments check, the leaving element must be still in the buffer. */
+	if ((ave->nave <= 0) || (qvec->len <= ave->nave)) {
+		return AKFS_ERROR;
+	}
+
+	n = (qvec->count < ave->nave) ? qvec->count : ave->nave;
+
+	if ((0 < n) && (ave->n == n)) {
+		/* Window is full: add newest, subtract the one that left. */
+		for (j = 0; j < 3; j++) {
+			ave->sum[j] += (int64)AKFS_QBUF_AT(qvec, 0).v[j]
+						 - AKFS_QBUF_AT(qvec, n).v[j];
+		}
+	} else if ((0 < n) && (ave->n + 1 == n)) {
+		/* Window is being filled. */
+		for (j = 0; j < 3; j++) {
+			ave->sum[j] += AKFS_QBUF_AT(qvec, 0).v[j];
+		}
+		ave->n = n;
+	} else {
+		/* Re-calculate from scratch. */
+		for (j = 0; j < 3; j++) {
+			ave->sum[j] = 0;
+			for (i = 0; i < n; i++) {
+				ave->sum[j] += AKFS_QBUF_AT(qvec, i).v[j];
+			}
+		}
+		ave->n = n;
+	}
+
+	return AKFS_SUCCESS;
+}
+
+/******************************************************************************/
+/*! Get an averaged vector from a running average. Same as #AKFS_VAveGet.
+  This is where the data leave Q16.16.
+  @return None
+  @param[in] ave Running average
+  @param[out] vave Averaged vector
+ */
+void AKFS_QAveGet(
+	const	AKFS_QAVE	*ave,
+			AKFVEC		*vave
+)
+{
+	if (ave->n <= 0) {
+		vave->u.x = 0;
+		vave->u.y = 0;
+		vave->u.z = 0;
+	} else {
+		vave->u.x = AKFS_Q2F(AKFS_QDivN(ave->sum[0], ave->n));
+		vave->u.y = AKFS_Q2F(AKFS_QDivN(ave->sum[1], ave->n));
+		vave->u.z = AKFS_Q2F(AKFS_QDivN(ave->sum[2], ave->n));
+	}
+}
+
+#endif
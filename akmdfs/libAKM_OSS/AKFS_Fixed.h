@@ -0,0 +1,209 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2012 Asahi Kasei Microdevices Corporation, Japan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************/
+#ifndef AKFS_INC_FIXED_H
+#define AKFS_INC_FIXED_H
+
+#include "AKFS_Device.h"
+
+/***** Constant definition ****************************************************/
+/*! Q16.16 fixed point. The range is about +/-32768, the resolution is
+  1/65536. This is enough for the magnetic field in uT and the acceleration
+  in m/s^2. */
+#define AKFS_Q16_SHIFT		16
+#define AKFS_Q16_ONE		(1 << AKFS_Q16_SHIFT)
+#define AKFS_Q16_MAX		((AKFS_Q16)0x7FFFFFFF)
+#define AKFS_Q16_MIN		(-AKFS_Q16_MAX - 1)
+
+/*! Gains of #AKFS_QNORM are in Q8.24, since the gain of acceleration is
+  about 0.0136, which has only 10 bits in Q16.16. */
+#define AKFS_QG_SHIFT		24
+#define AKFS_QG_ONE			(1 << AKFS_QG_SHIFT)
+
+/***** Type declaration *******************************************************/
+typedef int32	AKFS_Q16;
+
+typedef union _AKFS_QVEC {
+	struct {
+		AKFS_Q16 x;
+		AKFS_Q16 y;
+		AKFS_Q16 z;
+	} u;
+	AKFS_Q16	v[3];
+} AKFS_QVEC;
+
+/*! Same as #AKFS_VBUF, but of #AKFS_QVEC. AKFS_VBUF_IDX works on it. */
+typedef struct _AKFS_QBUF {
+	AKFS_QVEC	v[AKFS_VBUF_MAX];
+	int16	len;	/*!< Capacity of the buffer */
+	int16	head;	/*!< Position of the newest element in v */
+	int16	count;	/*!< Number of valid elements */
+} AKFS_QBUF;
+
+/*! The i-th newest element, 0 <= i < len. */
+#define AKFS_QBUF_AT(buf, i)	((buf)->v[AKFS_VBUF_IDX((buf), (i))])
+
+/*! Normalization of #AKFS_QbNorm, i.e. v = g (d - o). The soft-iron
+  correction is folded into g. They are made again only when the float
+  parameters below change, which is rare. */
+typedef struct _AKFS_QNORM {
+	AKFS_QVEC	o;			/*!< Offset in Q16.16 */
+	int32		g[3][3];	/*!< Gain in Q8.24 */
+	AKFVEC		fo;			/*!< Offset */
+	AKFVEC		fs;			/*!< Sensitivity */
+	AKFLOAT		ftgt;		/*!< Target sensitivity */
+	AKFLOAT		fm[3][3];	/*!< Soft-iron correction, or identity */
+	int16		fsi;		/*!< 1: fm is given */
+	int16		valid;		/*!< 1: o and g are made of the above */
+} AKFS_QNORM;
+
+/*! Running sum of the newest nave elements of an #AKFS_QBUF. The sum has no
+  rounding error, so it is not re-calculated from scratch to bound a drift. */
+typedef struct _AKFS_QAVE {
+	int64	sum[3];	/*!< Sum of the newest n elements, in Q16.16 */
+	int16	nave;	/*!< Number of average */
+	int16	n;		/*!< Number of elements in sum */
+} AKFS_QAVE;
+
+/***** Fixed point operation **************************************************/
+/*! Saturate a wide value to Q16.16 range. */
+static inline AKFS_Q16 AKFS_QSat(int64 a)
+{
+	if (a > AKFS_Q16_MAX) {
+		return AKFS_Q16_MAX;
+	}
+	if (a < AKFS_Q16_MIN) {
+		return AKFS_Q16_MIN;
+	}
+	return (AKFS_Q16)a;
+}
+
+/*! AKFLOAT to fixed point of a given shift, rounded to nearest and
+  saturated. */
+static inline int32 AKFS_F2QS(AKFLOAT f, const int shift)
+{
+	f *= (AKFLOAT)(1 << shift);
+	if (f >= (AKFLOAT)AKFS_Q16_MAX) {
+		return AKFS_Q16_MAX;
+	}
+	if (f <= (AKFLOAT)AKFS_Q16_MIN) {
+		return AKFS_Q16_MIN;
+	}
+	return (int32)((f < 0) ? (f - AKFS_F(0.5)) : (f + AKFS_F(0.5)));
+}
+
+/*! AKFLOAT to Q16.16. */
+static inline AKFS_Q16 AKFS_F2Q(AKFLOAT f)
+{
+	return AKFS_F2QS(f, AKFS_Q16_SHIFT);
+}
+
+/*! Q16.16 to AKFLOAT. */
+static inline AKFLOAT AKFS_Q2F(AKFS_Q16 q)
+{
+	return (AKFLOAT)q * (AKFS_F(1.0) / AKFS_Q16_ONE);
+}
+
+/*! Shift a wide value right, rounded to nearest and saturated. */
+static inline AKFS_Q16 AKFS_QShr(int64 a, const int shift)
+{
+	return AKFS_QSat((a + ((int64)1 << (shift - 1))) >> shift);
+}
+
+/*! sum / n, where sum is a wide sum of Q16.16 values. Rounded to nearest
+  and saturated. n must be positive. A sum which fits in 32 bits, i.e. any
+  geomagnetic field or gravity, is divided in 32 bits, since a 64-bit
+  division is a library call on ARMv7. */
+static inline AKFS_Q16 AKFS_QDivN(int64 sum, int16 n)
+{
+	int32 s;
+
+	if ((sum > (AKFS_Q16_MAX / 2)) || (sum < (AKFS_Q16_MIN / 2))) {
+		return AKFS_QSat(((sum < 0) ? (sum - (n / 2)) : (sum + (n / 2))) / n);
+	}
+	s = (int32)sum;
+	return ((s < 0) ? (s - (n / 2)) : (s + (n / 2))) / n;
+}
+
+/*! #AKFS_QVEC to #AKFVEC. */
+static inline void AKFS_QToVec(const AKFS_QVEC *q, AKFVEC *v)
+{
+	v->u.x = AKFS_Q2F(q->u.x);
+	v->u.y = AKFS_Q2F(q->u.y);
+	v->u.z = AKFS_Q2F(q->u.z);
+}
+
+/***** Prototype of function **************************************************/
+AKLIB_C_API_START
+int16 AKFS_InitQBuf(
+	const	int16		len,
+			AKFS_QBUF	*buf
+);
+
+AKFS_QVEC* AKFS_QBufPush(
+			AKFS_QBUF	*buf
+);
+
+void AKFS_InitQNorm(
+			AKFS_QNORM	*qn
+);
+
+int16 AKFS_QNormSet(
+	const	AKFVEC		*o,
+	const	AKFVEC		*s,
+	const	AKFLOAT		tgt,
+	const	AKFLOAT		hsi[3][3],
+			AKFS_QNORM	*qn
+);
+
+void AKFS_QNormApply(
+	const	AKFS_QNORM	*qn,
+	const	AKFS_QVEC	*d,
+			AKFS_QVEC	*v
+);
+
+int16 AKFS_QbNorm(
+	const	AKFS_QBUF	*qdata,
+	const	int16		nbuf,
+	const	AKFS_QNORM	*qn,
+			AKFS_QBUF	*qvec
+);
+
+int16 AKFS_QbAve(
+	const	AKFS_QBUF	*qvec,
+	const	int16		nave,
+			AKFVEC		*vave
+);
+
+int16 AKFS_InitQAve(
+	const	int16		nave,
+			AKFS_QAVE	*ave
+);
+
+int16 AKFS_QAveUpdate(
+	const	AKFS_QBUF	*qvec,
+			AKFS_QAVE	*ave
+);
+
+void AKFS_QAveGet(
+	const	AKFS_QAVE	*ave,
+			AKFVEC		*vave
+);
+AKLIB_C_API_END
+
+#endif
+
@@ -34,6 +34,7 @@
 #define AKFS_ACOS(x)		acos(x)
 #define AKFS_ATAN2(y, x)	atan2((y), (x))
 #define AKFS_SQRT(x)		sqrt(x)
+#define AKFS_FABS(x)		fabs(x)
 #else
 #define AKFS_SIN(x)			sinf(x)
 #define AKFS_COS(x)			cosf(x)
@@ -41,6 +42,7 @@
 #define AKFS_ACOS(x)		acosf(x)
 #define AKFS_ATAN2(y, x)	atan2f((y), (x))
 #define AKFS_SQRT(x)		sqrtf(x)
+#define AKFS_FABS(x)		fabsf(x)
 #endif
 
 #endif
@@ -0,0 +1,230 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2012 Asahi Kasei Microdevices Corporation, Japan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************/
+#include "AKFS_Math.h"
+#include "AKFS_Simd.h"
+
+/*
+ * The batch kernels below process 4 positions at a time, i.e. positions
+ * from 0 up to n rounded up to a multiple of 4. So out[] must have
+ * AKFS_VBUF_MAX elements. Results at positions which hold no valid data
+ * are meaningless. Each lane is calculated in the same order as the scalar
+ * code, so the results are the same on every kernel set. The scalar code
+ * processes positions one by one up to n.
+ */
+
+#if !defined(AKFS_SIMD_SCALAR)
+/*
+ * Load4 : load 4 consecutive elements
+ */
+static inline AKFS_V4 Load4(const AKFLOAT *a)
+{
+#if defined(AKFS_SIMD_NEON)
+	return vld1q_f32(a);
+#else
+	return _mm_loadu_ps(a);
+#endif
+}
+
+/*
+ * Store4 : store 4 consecutive elements
+ */
+static inline void Store4(AKFS_V4 a, AKFLOAT *r)
+{
+#if defined(AKFS_SIMD_NEON)
+	vst1q_f32(r, a);
+#else
+	_mm_storeu_ps(r, a);
+#endif
+}
+
+/*
+ * Abs4 : absolute value of each lane
+ */
+static inline AKFS_V4 Abs4(AKFS_V4 a)
+{
+#if defined(AKFS_SIMD_NEON)
+	return vabsq_f32(a);
+#else
+	return _mm_andnot_ps(_mm_set1_ps(-0.0f), a);
+#endif
+}
+#endif
+
+/******************************************************************************/
+/*! Store a vector to a structure-of-arrays buffer.
+  @param[in] p Position
+  @param[in] v Vector
+  @param[out] soa Buffer
+ */
+void AKFS_SoaSet(
+	const	int16		p,
+	const	AKFVEC		*v,
+			AKFS_SOA	*soa
+)
+{
+	soa->x[p] = v->u.x;
+	soa->y[p] = v->u.y;
+	soa->z[p] = v->u.z;
+}
+
+/******************************************************************************/
+/*! Squared distance from o, i.e. |v[p] - o|^2.
+  @param[in] soa Buffer
+  @param[in] n Number of positions
+  @param[in] o Origin
+  @param[out] out Result at each position
+ */
+void AKFS_SoaDist2(
+	const	AKFS_SOA	*soa,
+	const	int16		n,
+	const	AKFVEC		*o,
+			AKFLOAT		out[]
+)
+{
+	int p;
+#if defined(AKFS_SIMD_SCALAR)
+	AKFLOAT dx, dy, dz;
+
+	for (p = 0; p < n; p++) {
+		dx = soa->x[p] - o->u.x;
+		dy = soa->y[p] - o->u.y;
+		dz = soa->z[p] - o->u.z;
+		out[p] = ((dx * dx) + (dy * dy)) + (dz * dz);
+	}
+#else
+	AKFS_V4 ox, oy, oz;
+	AKFS_V4 dx, dy, dz;
+
+	ox = AKFS_V4Set1(o->u.x);
+	oy = AKFS_V4Set1(o->u.y);
+	oz = AKFS_V4Set1(o->u.z);
+
+	for (p = 0; p < n; p += 4) {
+		dx = AKFS_V4Sub(Load4(&soa->x[p]), ox);
+		dy = AKFS_V4Sub(Load4(&soa->y[p]), oy);
+		dz = AKFS_V4Sub(Load4(&soa->z[p]), oz);
+		Store4(AKFS_V4Add(AKFS_V4Add(
+			AKFS_V4Mul(dx, dx), AKFS_V4Mul(dy, dy)), AKFS_V4Mul(dz, dz)),
+			&out[p]);
+	}
+#endif
+}
+
+/******************************************************************************/
+/*! Squared norm of cross product, i.e. |d x (v[p] - o)|^2.
+  @param[in] soa Buffer
+  @param[in] n Number of positions
+  @param[in] o Origin
+  @param[in] d Direction
+  @param[out] out Result at each position
+ */
+void AKFS_SoaCross2(
+	const	AKFS_SOA	*soa,
+	const	int16		n,
+	const	AKFVEC		*o,
+	const	AKFVEC		*d,
+			AKFLOAT		out[]
+)
+{
+	int p;
+#if defined(AKFS_SIMD_SCALAR)
+	AKFLOAT dx, dy, dz;
+	AKFLOAT cx, cy, cz;
+
+	for (p = 0; p < n; p++) {
+		dx = soa->x[p] - o->u.x;
+		dy = soa->y[p] - o->u.y;
+		dz = soa->z[p] - o->u.z;
+		cx = (d->u.y * dz) - (d->u.z * dy);
+		cy = (d->u.z * dx) - (d->u.x * dz);
+		cz = (d->u.x * dy) - (d->u.y * dx);
+		out[p] = ((cx * cx) + (cy * cy)) + (cz * cz);
+	}
+#else
+	AKFS_V4 ox, oy, oz;
+	AKFS_V4 ux, uy, uz;
+	AKFS_V4 dx, dy, dz;
+	AKFS_V4 cx, cy, cz;
+
+	ox = AKFS_V4Set1(o->u.x);
+	oy = AKFS_V4Set1(o->u.y);
+	oz = AKFS_V4Set1(o->u.z);
+	ux = AKFS_V4Set1(d->u.x);
+	uy = AKFS_V4Set1(d->u.y);
+	uz = AKFS_V4Set1(d->u.z);
+
+	for (p = 0; p < n; p += 4) {
+		dx = AKFS_V4Sub(Load4(&soa->x[p]), ox);
+		dy = AKFS_V4Sub(Load4(&soa->y[p]), oy);
+		dz = AKFS_V4Sub(Load4(&soa->z[p]), oz);
+		cx = AKFS_V4Sub(AKFS_V4Mul(uy, dz), AKFS_V4Mul(uz, dy));
+		cy = AKFS_V4Sub(AKFS_V4Mul(uz, dx), AKFS_V4Mul(ux, dz));
+		cz = AKFS_V4Sub(AKFS_V4Mul(ux, dy), AKFS_V4Mul(uy, dx));
+		Store4(AKFS_V4Add(AKFS_V4Add(
+			AKFS_V4Mul(cx, cx), AKFS_V4Mul(cy, cy)), AKFS_V4Mul(cz, cz)),
+			&out[p]);
+	}
+#endif
+}
+
+/******************************************************************************/
+/*! Absolute value of dot product, i.e. |(v[p] - o) . c|.
+  @param[in] soa Buffer
+  @param[in] n Number of positions
+  @param[in] o Origin
+  @param[in] c Normal vector
+  @param[out] out Result at each position
+ */
+void AKFS_SoaAbsDot(
+	const	AKFS_SOA	*soa,
+	const	int16		n,
+	const	AKFVEC		*o,
+	const	AKFVEC		*c,
+			AKFLOAT		out[]
+)
+{
+	int p;
+#if defined(AKFS_SIMD_SCALAR)
+	for (p = 0; p < n; p++) {
+		out[p] = AKFS_FABS((((soa->x[p] - o->u.x) * c->u.x)
+			+ ((soa->y[p] - o->u.y) * c->u.y))
+			+ ((soa->z[p] - o->u.z) * c->u.z));
+	}
+#else
+	AKFS_V4 ox, oy, oz;
+	AKFS_V4 cx, cy, cz;
+	AKFS_V4 dx, dy, dz;
+
+	ox = AKFS_V4Set1(o->u.x);
+	oy = AKFS_V4Set1(o->u.y);
+	oz = AKFS_V4Set1(o->u.z);
+	cx = AKFS_V4Set1(c->u.x);
+	cy = AKFS_V4Set1(c->u.y);
+	cz = AKFS_V4Set1(c->u.z);
+
+	for (p = 0; p < n; p += 4) {
+		dx = AKFS_V4Sub(Load4(&soa->x[p]), ox);
+		dy = AKFS_V4Sub(Load4(&soa->y[p]), oy);
+		dz = AKFS_V4Sub(Load4(&soa->z[p]), oz);
+		Store4(Abs4(AKFS_V4Add(AKFS_V4Add(
+			AKFS_V4Mul(dx, cx), AKFS_V4Mul(dy, cy)), AKFS_V4Mul(dz, cz))),
+			&out[p]);
+	}
+#endif
+}
+
@@ -0,0 +1,205 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2012 Asahi Kasei Microdevices Corporation, Japan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************/
+#ifndef AKFS_INC_SIMD_H
+#define AKFS_INC_SIMD_H
+
+#include "AKFS_Device.h"
+
+/***** Kernel selection *******************************************************/
+/*! The kernel set is selected at compile time. Define AKFS_SIMD_DISABLE to
+  force the scalar kernels. SIMD kernels are single precision only. */
+#if defined(AKFS_SIMD_DISABLE) || defined(AKFS_PRECISION_DOUBLE)
+#define AKFS_SIMD_SCALAR
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define AKFS_SIMD_NEON
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#define AKFS_SIMD_SSE2
+#include <emmintrin.h>
+#else
+#define AKFS_SIMD_SCALAR
+#endif
+
+/***** Type declaration *******************************************************/
+/*! A vector in a 4-lane register, the 4th lane is not used. The scalar
+  4-lane operations do not calculate the 4th lane at all, so the batch
+  kernels in AKFS_Simd.c do not use them on the scalar kernel set. */
+#if defined(AKFS_SIMD_NEON)
+typedef float32x4_t	AKFS_V4;
+#elif defined(AKFS_SIMD_SSE2)
+typedef __m128		AKFS_V4;
+#else
+typedef struct _AKFS_V4 {
+	AKFLOAT	f[4];
+} AKFS_V4;
+#endif
+
+/*! Structure-of-arrays mirror of an #AKFS_VBUF. Element at position p in
+  AKFS_VBUF.v is stored at x[p], y[p] and z[p]. */
+typedef struct _AKFS_SOA {
+	AKFLOAT	x[AKFS_VBUF_MAX];
+	AKFLOAT	y[AKFS_VBUF_MAX];
+	AKFLOAT	z[AKFS_VBUF_MAX];
+} AKFS_SOA;
+
+/***** 4-lane vector operation ************************************************/
+static inline AKFS_V4 AKFS_V4Load3(const AKFVEC *a)
+{
+#if defined(AKFS_SIMD_NEON)
+	return vcombine_f32(vld1_f32(&a->v[0]), vld1_dup_f32(&a->v[2]));
+#elif defined(AKFS_SIMD_SSE2)
+	return _mm_setr_ps(a->v[0], a->v[1], a->v[2], 0.0f);
+#else
+	AKFS_V4 r;
+	r.f[0] = a->v[0];
+	r.f[1] = a->v[1];
+	r.f[2] = a->v[2];
+	r.f[3] = 0;
+	return r;
+#endif
+}
+
+static inline void AKFS_V4Store3(AKFS_V4 a, AKFVEC *r)
+{
+#if defined(AKFS_SIMD_NEON)
+	vst1_f32(&r->v[0], vget_low_f32(a));
+	vst1q_lane_f32(&r->v[2], a, 2);
+#elif defined(AKFS_SIMD_SSE2)
+	_mm_storel_pi((__m64 *)&r->v[0], a);
+	_mm_store_ss(&r->v[2], _mm_movehl_ps(a, a));
+#else
+	r->v[0] = a.f[0];
+	r->v[1] = a.f[1];
+	r->v[2] = a.f[2];
+#endif
+}
+
+static inline AKFS_V4 AKFS_V4Set1(AKFLOAT a)
+{
+#if defined(AKFS_SIMD_NEON)
+	return vdupq_n_f32(a);
+#elif defined(AKFS_SIMD_SSE2)
+	return _mm_set1_ps(a);
+#else
+	AKFS_V4 r;
+	r.f[0] = r.f[1] = r.f[2] = a;
+	r.f[3] = 0;
+	return r;
+#endif
+}
+
+static inline AKFS_V4 AKFS_V4Add(AKFS_V4 a, AKFS_V4 b)
+{
+#if defined(AKFS_SIMD_NEON)
+	return vaddq_f32(a, b);
+#elif defined(AKFS_SIMD_SSE2)
+	return _mm_add_ps(a, b);
+#else
+	a.f[0] += b.f[0];
+	a.f[1] += b.f[1];
+	a.f[2] += b.f[2];
+	return a;
+#endif
+}
+
+static inline AKFS_V4 AKFS_V4Sub(AKFS_V4 a, AKFS_V4 b)
+{
+#if defined(AKFS_SIMD_NEON)
+	return vsubq_f32(a, b);
+#elif defined(AKFS_SIMD_SSE2)
+	return _mm_sub_ps(a, b);
+#else
+	a.f[0] -= b.f[0];
+	a.f[1] -= b.f[1];
+	a.f[2] -= b.f[2];
+	return a;
+#endif
+}
+
+static inline AKFS_V4 AKFS_V4Mul(AKFS_V4 a, AKFS_V4 b)
+{
+#if defined(AKFS_SIMD_NEON)
+	return vmulq_f32(a, b);
+#elif defined(AKFS_SIMD_SSE2)
+	return _mm_mul_ps(a, b);
+#else
+	a.f[0] *= b.f[0];
+	a.f[1] *= b.f[1];
+	a.f[2] *= b.f[2];
+	return a;
+#endif
+}
+
+/* ARMv7 NEON has no exact division, so divide lane by lane there. */
+static inline AKFS_V4 AKFS_V4Div(AKFS_V4 a, AKFS_V4 b)
+{
+#if defined(AKFS_SIMD_NEON) && defined(__aarch64__)
+	return vdivq_f32(a, b);
+#elif defined(AKFS_SIMD_NEON)
+	float fa[4], fb[4];
+	vst1q_f32(fa, a);
+	vst1q_f32(fb, b);
+	fa[0] /= fb[0];
+	fa[1] /= fb[1];
+	fa[2] /= fb[2];
+	fa[3] = 0.0f;
+	return vld1q_f32(fa);
+#elif defined(AKFS_SIMD_SSE2)
+	return _mm_div_ps(a, b);
+#else
+	a.f[0] /= b.f[0];
+	a.f[1] /= b.f[1];
+	a.f[2] /= b.f[2];
+	return a;
+#endif
+}
+
+/***** Prototype of function **************************************************/
+AKLIB_C_API_START
+void AKFS_SoaSet(
+	const	int16		p,
+	const	AKFVEC		*v,
+			AKFS_SOA	*soa
+);
+
+void AKFS_SoaDist2(
+	const	AKFS_SOA	*soa,
+	const	int16		n,
+	const	AKFVEC		*o,
+			AKFLOAT		out[]
+);
+
+void AKFS_SoaCross2(
+	const	AKFS_SOA	*soa,
+	const	int16		n,
+	const	AKFVEC		*o,
+	const	AKFVEC		*d,
+			AKFLOAT		out[]
+);
+
+void AKFS_SoaAbsDot(
+	const	AKFS_SOA	*soa,
+	const	int16		n,
+	const	AKFVEC		*o,
+	const	AKFVEC		*c,
+			AKFLOAT		out[]
+);
+AKLIB_C_API_END
+
+#endif
+
@@ -16,39 +16,37 @@
  *
  ******************************************************************************/
 #include "AKFS_Device.h"
+#include "AKFS_Simd.h"
 #include "AKFS_VNorm.h"
 
 /******************************************************************************/
 /*! Normalize vector.
   @return #AKFS_SUCCESS on success. Otherwise the return value is #AKFS_ERROR.
-  @param[in] ndata Size of raw vector buffer
   @param[in] vdata Raw vector buffer
   @param[in] nbuf Size of data to be buffered
   @param[in] o Offset
   @param[in] s Sensitivity
   @param[in] tgt Target sensitivity
-  @param[in] nvec Size of normalized vector buffer
-  @param[out] vvec Normalized vector buffer
+  @param[in/out] vvec Normalized vector buffer
  */
 int16 AKFS_VbNorm(
-	const	int16	ndata,
-	const	AKFVEC	vdata[],
-	const	int16	nbuf,
-	const	AKFVEC	*o,
-	const	AKFVEC	*s,
-	const	AKFLOAT	tgt,
-	const	int16	nvec,
-			AKFVEC	vvec[]
+	const	AKFS_VBUF	*vdata,
+	const	int16		nbuf,
+	const	AKFVEC		*o,
+	const	AKFVEC		*s,
+	const	AKFLOAT		tgt,
+			AKFS_VBUF	*vvec
 )
 {
 	int i;
+	AKFS_V4 vo, vs, vt;
 
 	/* size check */
-	if ((ndata <= 0) || (nvec <= 0) || (nbuf <= 0)) {
+	if ((vdata->len <= 0) || (vvec->len <= 0) || (nbuf <= 0)) {
 		return AKFS_ERROR;
 	}
 	/* dependency check */
-	if ((nbuf < 1) || (ndata < nbuf) || (nvec < nbuf)) {
+	if ((nbuf < 1) || (vdata->len < nbuf) || (vvec->len < nbuf)) {
 		return AKFS_ERROR;
 	}
 	/* sensitivity check */
@@ -59,14 +57,16 @@ int16 AKFS_VbNorm(
 		return AKFS_ERROR;
 	}
 
-	/* calculate and store data to buffer */
-	if (AKFS_BufShift(nvec, nbuf, vvec) != AKFS_SUCCESS) {
-		return AKFS_ERROR;
-	}
-	for (i = 0; i < nbuf; i++) {
-		vvec[i].u.x = ((vdata[i].u.x - o->u.x) / (s->u.x) * (AKFLOAT)tgt);
-		vvec[i].u.y = ((vdata[i].u.y - o->u.y) / (s->u.y) * (AKFLOAT)tgt);
-		vvec[i].u.z = ((vdata[i].u.z - o->u.z) / (s->u.z) * (AKFLOAT)tgt);
+	/* calculate and store data to buffer, the oldest one first */
+	/* v = (d - o) / s * tgt */
+	vo = AKFS_V4Load3(o);
+	vs = AKFS_V4Load3(s);
+	vt = AKFS_V4Set1((AKFLOAT)tgt);
+	for (i = nbuf - 1; i >= 0; i--) {
+		AKFS_V4Store3(
+			AKFS_V4Mul(AKFS_V4Div(
+				AKFS_V4Sub(AKFS_V4Load3(&AKFS_VBUF_AT(vdata, i)), vo), vs), vt),
+			AKFS_VBufPush(vvec));
 	}
 
 	return AKFS_SUCCESS;
@@ -75,49 +75,138 @@ int16 AKFS_VbNorm(
 /******************************************************************************/
 /*! Calculate an averaged vector form a given buffer.
   @return #AKFS_SUCCESS on success. Otherwise the return value is #AKFS_ERROR.
-  @param[in] nvec Size of normalized vector buffer
   @param[in] vvec Normalized vector buffer
   @param[in] nave Number of average
   @param[out] vave Averaged vector
  */
 int16 AKFS_VbAve(
-	const	int16	nvec,
-	const	AKFVEC	vvec[],
-	const	int16	nave,
-			AKFVEC	*vave
+	const	AKFS_VBUF	*vvec,
+	const	int16		nave,
+			AKFVEC		*vave
 )
 {
 	int i;
+	int n;
+	AKFS_V4 sum;
 
 	/* arguments check */
-	if ((nave <= 0) || (nvec <= 0) || (nvec < nave)) {
+	if ((nave <= 0) || (vvec->len <= 0) || (vvec->len < nave)) {
 		return AKFS_ERROR;
 	}
 
+	/* Elements beyond count hold the initial value, so stop there. */
+	n = (vvec->count < nave) ? vvec->count : nave;
+
 	/* calculate average */
-	vave->u.x = 0;
-	vave->u.y = 0;
-	vave->u.z = 0;
-	for (i = 0; i < nave; i++) {
-		if ((vvec[i].u.x == AKFS_INIT_VALUE_F) ||
-			(vvec[i].u.y == AKFS_INIT_VALUE_F) ||
-			(vvec[i].u.z == AKFS_INIT_VALUE_F)) {
-				break;
+	sum = AKFS_V4Set1(0);
+	for (i = 0; i < n; i++) {
+		sum = AKFS_V4Add(sum, AKFS_V4Load3(&AKFS_VBUF_AT(vvec, i)));
+	}
+	if (n > 0) {
+		sum = AKFS_V4Div(sum, AKFS_V4Set1((AKFLOAT)n));
+	}
+	AKFS_V4Store3(sum, vave);
+	return AKFS_SUCCESS;
+}
+
+/******************************************************************************/
+/*! Initialize a running average. #AKFS_VAveUpdate should be called every time
+  a new element is pushed to the corresponding buffer.
+  @return #AKFS_SUCCESS on success. Otherwise the return value is #AKFS_ERROR.
+  @param[in] nave Number of average
+  @param[out] ave Running average
+ */
+int16 AKFS_InitVAve(
+	const	int16		nave,
+			AKFS_VAVE	*ave
+)
+{
+	/* arguments check */
+	if (nave <= 0) {
+		return AKFS_ERROR;
+	}
+
+	ave->sum.u.x = 0;
+	ave->sum.u.y = 0;
+	ave->sum.u.z = 0;
+	ave->nave = nave;
+	ave->n = 0;
+	ave->nupd = 0;
+
+	return AKFS_SUCCESS;
+}
+
+/******************************************************************************/
+/*! Update a running average after a new element is pushed to a given buffer.
+  The newest element is added, and the element which just left the window is
+  subtracted. When the buffer was re-initialized or truncated in between, or
+  every #AKFS_VAVE_RESUM updates, the sum is calculated from scratch.
+  @return #AKFS_SUCCESS on success. Otherwise the return value is #AKFS_ERROR.
+  @param[in] vvec Normalized vector buffer
+  @param[in/out] ave Running average
+ */
+int16 AKFS_VAveUpdate(
+	const	AKFS_VBUF	*vvec,
+			AKFS_VAVE	*ave
+)
+{
+	int i;
+	int n;
+	AKFS_V4 sum;
+	AKFS_V4 v;
+
+	/* arguments check, the leaving element must be still in the buffer. */
+	if ((ave->nave <= 0) || (vvec->len <= ave->nave)) {
+		return AKFS_ERROR;
+	}
+
+	n = (vvec->count < ave->nave) ? vvec->count : ave->nave;
+
+	v = AKFS_V4Load3(&AKFS_VBUF_AT(vvec, 0));
+
+	if ((ave->nupd < AKFS_VAVE_RESUM) && (0 < n) && (ave->n == n)) {
+		/* Window is full: add newest, subtract the one that left. */
+		sum = AKFS_V4Add(AKFS_V4Load3(&ave->sum),
+			AKFS_V4Sub(v, AKFS_V4Load3(&AKFS_VBUF_AT(vvec, n))));
+		ave->nupd++;
+	} else if ((ave->nupd < AKFS_VAVE_RESUM) && (0 < n) && (ave->n + 1 == n)) {
+		/* Window is being filled. */
+		sum = AKFS_V4Add(AKFS_V4Load3(&ave->sum), v);
+		ave->n = n;
+		ave->nupd++;
+	} else {
+		/* Re-calculate from scratch. */
+		sum = AKFS_V4Set1(0);
+		for (i = 0; i < n; i++) {
+			sum = AKFS_V4Add(sum, AKFS_V4Load3(&AKFS_VBUF_AT(vvec, i)));
 		}
-		vave->u.x += vvec[i].u.x;
-		vave->u.y += vvec[i].u.y;
-		vave->u.z += vvec[i].u.z;
+		ave->n = n;
+		ave->nupd = 0;
 	}
-	if (i == 0) {
+	AKFS_V4Store3(sum, &ave->sum);
+
+	return AKFS_SUCCESS;
+}
+
+/******************************************************************************/
+/*! Get an averaged vector from a running average. The result is the same as
+  #AKFS_VbAve, i.e. zero vector when the buffer is empty.
+  @return None
+  @param[in] ave Running average
+  @param[out] vave Averaged vector
+ */
+void AKFS_VAveGet(
+	const	AKFS_VAVE	*ave,
+			AKFVEC		*vave
+)
+{
+	if (ave->n <= 0) {
 		vave->u.x = 0;
 		vave->u.y = 0;
 		vave->u.z = 0;
 	} else {
-		vave->u.x /= i;
-		vave->u.y /= i;
-		vave->u.z /= i;
+		vave->u.x = ave->sum.u.x / ave->n;
+		vave->u.y = ave->sum.u.y / ave->n;
+		vave->u.z = ave->sum.u.z / ave->n;
 	}
-	return AKFS_SUCCESS;
 }
-
-
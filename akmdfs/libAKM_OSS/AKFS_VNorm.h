@@ -20,24 +20,50 @@
 
 #include "AKFS_Device.h"
 
+/***** Constant definition ****************************************************/
+/*! Running sums are re-calculated from scratch at this interval, so that
+  rounding error does not accumulate. */
+#define AKFS_VAVE_RESUM		256
+
+/***** Type declaration *******************************************************/
+/*! Running sum of the newest nave elements of an #AKFS_VBUF. */
+typedef struct _AKFS_VAVE {
+	AKFVEC	sum;	/*!< Sum of the newest n elements */
+	int16	nave;	/*!< Number of average */
+	int16	n;		/*!< Number of elements in sum */
+	int16	nupd;	/*!< Updates since the last re-calculation */
+} AKFS_VAVE;
+
 /***** Prototype of function **************************************************/
 AKLIB_C_API_START
 int16 AKFS_VbNorm(
-	const	int16	ndata,
-	const	AKFVEC	vdata[],
-	const	int16	nbuf,
-	const	AKFVEC	*o,
-	const	AKFVEC	*s,
-	const	AKFLOAT	tgt,
-	const	int16	nvec,
-			AKFVEC	vvec[]
+	const	AKFS_VBUF	*vdata,
+	const	int16		nbuf,
+	const	AKFVEC		*o,
+	const	AKFVEC		*s,
+	const	AKFLOAT		tgt,
+			AKFS_VBUF	*vvec
 );
 
 int16 AKFS_VbAve(
-	const	int16	nvec,
-	const	AKFVEC	vvec[],
-	const	int16	nave,
-			AKFVEC	*vave
+	const	AKFS_VBUF	*vvec,
+	const	int16		nave,
+			AKFVEC		*vave
+);
+
+int16 AKFS_InitVAve(
+	const	int16		nave,
+			AKFS_VAVE	*ave
+);
+
+int16 AKFS_VAveUpdate(
+	const	AKFS_VBUF	*vvec,
+			AKFS_VAVE	*ave
+);
+
+void AKFS_VAveGet(
+	const	AKFS_VAVE	*ave,
+			AKFVEC		*vave
 );
 
 AKLIB_C_API_END
@@ -16,14 +16,23 @@
  *
  ******************************************************************************/
 #include "AKFS_Common.h"
+#include "AKFS_Calib.h"
 #include "AKFS_Compass.h"
 #include "AKFS_Disp.h"
 #include "AKFS_FileIO.h"
 #include "AKFS_Measure.h"
 #include "AKFS_APIs.h"
+#include "AKFS_Replay.h"
+#ifdef AKFS_ENABLE_TOOLS
+#include "AKFS_Bench.h"
+#include "AKFS_Batch.h"
+#endif
+#include "AKFS_Stats.h"
+#include "AKFS_Queue.h"
 
 #ifndef WIN32
 #include <sched.h>
+#include <signal.h>
 #include <pthread.h>
 #include <linux/input.h>
 #endif
@@ -37,6 +46,8 @@
 #define ERROR_GETOPEN_STAT		(-6)
 #define ERROR_STARTCLONE		(-7)
 #define ERROR_GETCLOSE_STAT		(-8)
+#define ERROR_BENCH				(-9)
+#define ERROR_BATCH				(-10)
 
 #define AKM_SELFTEST_MIN_X	-100
 #define AKM_SELFTEST_MAX_X	100
@@ -48,25 +59,86 @@
 #define CONVERT_ACC(a)	((int)((a) * 720 / 9.8f))
 #define CONVERT_MAG(m)	((int)((m) / 0.06f))
 #define CONVERT_ORI(o)	((int)((o) * 64))
+#define CONVERT_ROT(q)	((int)((q) * 16384))
+
+/* Delays are re-read from the driver at most once in this period, which
+   saves one ioctl per cycle. The driver has no notification of a change of
+   delay, so a change takes effect up to this period plus one measurement
+   period late. This applies to enabling and disabling a sensor while
+   another one keeps the compass open, too. The first sensor to be enabled
+   is not delayed, since a new measurement loop reads delays at its first
+   cycle. Replay sees the same latency on its virtual clock. */
+#define AKM_DELAY_REFRESH_NS	(100000000LL)
+
+/* Options of the offline tools, which are built only with AKFS_ENABLE_TOOLS. */
+#ifdef AKFS_ENABLE_TOOLS
+#define AKFS_TOOL_OPTIONS	"b:B:j:"
+#else
+#define AKFS_TOOL_OPTIONS	""
+#endif
+
+/*** Type declaration *********************************************************/
+/*! A window of acceleration to detect that the device is still. */
+typedef struct _AKFS_STILL {
+	AKFLOAT	a[CSPEC_STILL_NAVE][3];
+	int		num;
+	int		idx;
+} AKFS_STILL;
+
+/*! A daemon, i.e. the pipeline from a device to the results. Everything of
+  the pipeline is here and in the contexts which it points, so independent
+  daemons can run in one process. */
+typedef struct _AKFS_DAEMON {
+	AKMPRMS		*prms;			/*!< Library state */
+	AKD_CONTEXT	*dev;			/*!< Device or replay backend */
+	int			opmode;			/*!< OPMODE_* */
+	int			adaptive;		/*!< Adaptive sampling is enabled */
+	int			lossless;		/*!< Every result is output, i.e. replay */
+	AKFS_CALIB	calib;			/*!< Background calibration */
+	/* stopRequest and quit are changed under this mutex, and the change is
+	   notified with cond. cond uses CLOCK_MONOTONIC. */
+	pthread_mutex_t	mutex;
+	pthread_cond_t	cond;
+	int			stopRequest;	/*!< 0:Not stop,  1:Stop */
+	int			quit;			/*!< AKD_TRUE when the daemon quits */
+	pthread_t	thread;			/*!< Measurement thread */
+	int			threadValid;
+	AKFS_QUEUE	queue;			/*!< Acquisition to calculation stage */
+	int			lastYPR[AKM_YPR_DATA_SIZE];	/*!< The last output to driver */
+	int			lastYPRValid;
+	AKFS_STATS	stats;			/*!< Timing of the pipeline */
+	AKFS_TRACE	trace;			/*!< Debug messages of the threads */
+} AKFS_DAEMON;
+
+/*! Options which select what the process does, apart from the daemon. */
+typedef struct _AKFS_OPTION {
+	const char*	replay;			/*!< Replay file */
+	const char*	output;			/*!< Output of replay or batch mode */
+	const char*	golden;			/*!< Golden file of benchmark */
+	const char*	batchDir;		/*!< Directory of batch mode */
+	int			batchThread;	/*!< Worker threads of batch mode */
+} AKFS_OPTION;
 
 /*** Global variables *********************************************************/
-int g_stopRequest = 0;
-int g_opmode = 0;
-int g_dbgzone = 0;
-int g_mainQuit = AKD_FALSE;
 
 /* Static variable. */
-static pthread_t s_thread;  /*!< Thread handle */
+/* The signal thread is shared by the process, like the signals. */
+static pthread_t s_sigThread;	/*!< Thread which waits for dump requests */
+static AKFS_DAEMON* s_sigDaemon = NULL;	/*!< The daemon which SIGINT stops */
+static int s_sigThreadValid = AKM_FALSE;
+static int s_sigQuit = AKM_FALSE;
 
 /*** Sub Function *************************************************************/
 /*!
   Read sensitivity adjustment data from fuse ROM.
   @return If data are read successfully, the return value is #AKM_SUCCESS.
    Otherwise the return value is #AKM_ERROR.
+  @param[in,out] dev A device.
   @param[out] regs The read ASA values. When this function succeeds, ASAX value
    is saved in regs[0], ASAY is saved in regs[1], ASAZ is saved in regs[2].
  */
 int16 AKFS_ReadConf(
+		AKD_CONTEXT*	dev,
 		uint8	regs[3]
 )
 {
@@ -79,7 +151,7 @@ int16 AKFS_ReadConf(
 	}
 #endif
 
-	if (AKD_GetSensorConf(conf) != AKD_SUCCESS) {
+	if (AKD_GetSensorConf(dev, conf) != AKD_SUCCESS) {
 		AKMERROR;
 		return AKM_ERROR;
 	}
@@ -94,45 +166,28 @@ int16 AKFS_ReadConf(
 }
 
 /*!
-  This function calculate the duration of sleep for maintaining
-   the loop keep the period.
-  This function calculates "minimum - (end - start)".
-  @return The result of above equation in nanosecond.
-  @param end The time of after execution.
+  This function calculates the time at which the next loop should begin,
+   i.e. "start + minimum".
+  @return The deadline in absolute CLOCK_MONOTONIC time.
   @param start The time of before execution.
   @param minimum Loop period of each execution.
  */
-struct timespec AKFS_CalcSleep(
-	const struct timespec* end,
+struct timespec AKFS_CalcDeadline(
 	const struct timespec* start,
 	const int64_t minimum
 )
 {
-	int64_t endL;
 	int64_t startL;
-	int64_t diff;
-
 	struct timespec ret;
 
-	endL = (end->tv_sec * 1000000000) + end->tv_nsec;
-	startL = (start->tv_sec * 1000000000) + start->tv_nsec;
-	diff = minimum;
-
-	diff -= (endL - startL);
-
-	/* Don't allow negative value */
-	if (diff < 0) {
-		diff = 0;
+	startL = (start->tv_sec * 1000000000LL) + start->tv_nsec;
+	if (minimum > 0) {
+		startL += minimum;
 	}
 
 	/* Convert to timespec */
-	if (diff > 1000000000) {
-	ret.tv_sec = diff / 1000000000;
-		ret.tv_nsec = diff % 1000000000;
-	} else {
-		ret.tv_sec = 0;
-		ret.tv_nsec = diff;
-	}
+	ret.tv_sec = startL / 1000000000LL;
+	ret.tv_nsec = startL % 1000000000LL;
 	return ret;
 }
 
@@ -140,10 +195,12 @@ struct timespec AKFS_CalcSleep(
   Get interval of each sensors from device driver.
   @return If this function succeeds, the return value is #AKM_SUCCESS.
    Otherwise the return value is #AKM_ERROR.
+  @param dev A device.
   @param flag This variable indicates what sensor frequency is updated.
   @param minimum This value show the minimum loop period in all sensors.
  */
 int16 AKFS_GetInterval(
+		AKD_CONTEXT* dev,
 		uint16*  flag,
 		int64_t* minimum
 )
@@ -161,7 +218,7 @@ int16 AKFS_GetInterval(
 	}
 #endif
 
-	if (AKD_GetDelay(delay) != AKD_SUCCESS) {
+	if (AKD_GetDelay(dev, delay) != AKD_SUCCESS) {
 		AKMERROR;
 		return AKM_ERROR;
 	}
@@ -187,18 +244,22 @@ int16 AKFS_GetInterval(
   If this program run as console mode, measurement result will be displayed
    on console terminal.
   @return None.
+  @param[in,out] d A daemon. The last output is kept in it.
  */
 void AKFS_OutputResult(
+			AKFS_DAEMON*	d,
 	const	uint16			flag,
 	const	AKSENSOR_DATA*	acc,
 	const	AKSENSOR_DATA*	mag,
-	const	AKSENSOR_DATA*	ori
+	const	AKSENSOR_DATA*	ori,
+	const	AKFLOAT*		rot
 )
 {
 	int buf[AKM_YPR_DATA_SIZE];
 
+	memset(buf, 0, sizeof(buf));
 #ifdef AKM_VALUE_CHECK
-	if (AKM_YPR_DATA_SIZE < 12) {
+	if (AKM_YPR_DATA_SIZE < 16) {
 		AKMERROR_STR("You may refer invalid header file.");
 		return;
 	}
@@ -216,134 +277,507 @@ void AKFS_OutputResult(
 	buf[9] = CONVERT_ORI(ori->x);	/* yaw */
 	buf[10] = CONVERT_ORI(ori->y);	/* pitch */
 	buf[11] = CONVERT_ORI(ori->z);	/* roll */
+	buf[12] = CONVERT_ROT(rot[0]);	/* Rotation vector x */
+	buf[13] = CONVERT_ROT(rot[1]);	/* Rotation vector y */
+	buf[14] = CONVERT_ROT(rot[2]);	/* Rotation vector z */
+	buf[15] = CONVERT_ROT(rot[3]);	/* Rotation vector w */
 
-	if (g_opmode & OPMODE_CONSOLE) {
+	if (d->opmode & OPMODE_CONSOLE) {
 		/* Console mode */
 		Disp_Result(buf);
 	}
 
+	/* Nothing to report */
+	if (flag == 0) {
+		return;
+	}
+	/* The driver reports the same values as input events, and the input
+	   core drops unchanged values anyway. So skip identical output. */
+	if ((d->lastYPRValid == AKM_TRUE) &&
+		(memcmp(d->lastYPR, buf, sizeof(buf)) == 0)) {
+		return;
+	}
+	memcpy(d->lastYPR, buf, sizeof(buf));
+	d->lastYPRValid = AKM_TRUE;
+
 	/* Set result to driver */
-	AKD_SetYPR(buf);
+	AKD_SetYPR(d->dev, buf);
 }
 
 
 /*!
- A thread function which is raised when measurement is started.
- @param[in] args This parameter is not used currently.
+  Initialize a daemon. The measurement is stopped until
+   #AKFS_SetStopRequest clears it.
+  @return If this function succeeds, the return value is #AKM_SUCCESS.
+   Otherwise the return value is #AKM_ERROR.
+  @param[out] d A daemon. Release it with #AKFS_ReleaseDaemon.
+  @param[in] prms Library state, which the daemon uses.
+  @param[in] dev A device, which the daemon uses.
  */
-static void* thread_main(void* args)
+static int16 AKFS_InitDaemon(
+			AKFS_DAEMON*	d,
+			AKMPRMS*		prms,
+			AKD_CONTEXT*	dev)
 {
-	AKMPRMS	*prms;
-	BYTE    i2cData[AKM_SENSOR_DATA_SIZE]; /* ST1 ~ ST2 */
-	int16	mag[3];
-	int16	mstat;
-	int16	acc[3];
-	struct	timespec tsstart= {0, 0};
-	struct	timespec tsend = {0, 0};
-	struct	timespec doze;
-	int64_t	minimum;
+	pthread_condattr_t attr;
+	int16 ret = AKM_SUCCESS;
+
+	memset(d, 0, sizeof(AKFS_DAEMON));
+	d->prms = prms;
+	d->dev = dev;
+	d->stopRequest = 1;
+	d->quit = AKD_FALSE;
+	d->threadValid = AKM_FALSE;
+	d->lastYPRValid = AKM_FALSE;
+	AKFS_InitStats(&d->stats);
+	AKFS_InitTrace(&d->trace);
+	AKD_SetStats(dev, &d->stats);
+
+	if (AKFS_CalibInit(&d->calib) != AKM_SUCCESS) {
+		return AKM_ERROR;
+	}
+	if (pthread_mutex_init(&d->mutex, NULL) != 0) {
+		AKFS_CalibRelease(&d->calib);
+		return AKM_ERROR;
+	}
+	if (pthread_condattr_init(&attr) != 0) {
+		ret = AKM_ERROR;
+	} else {
+		if ((pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) != 0) ||
+			(pthread_cond_init(&d->cond, &attr) != 0)) {
+			ret = AKM_ERROR;
+		}
+		pthread_condattr_destroy(&attr);
+	}
+	if (ret != AKM_SUCCESS) {
+		pthread_mutex_destroy(&d->mutex);
+		AKFS_CalibRelease(&d->calib);
+	}
+	return ret;
+}
+
+/*!
+  Release a daemon. Its threads must be stopped already.
+  @param[in,out] d A daemon.
+ */
+static void AKFS_ReleaseDaemon(AKFS_DAEMON* d)
+{
+	AKFS_CalibRelease(&d->calib);
+	pthread_cond_destroy(&d->cond);
+	pthread_mutex_destroy(&d->mutex);
+	AKD_SetStats(d->dev, NULL);
+}
+
+/*!
+  Set stopRequest and wake up measurement thread, whether it is sleeping
+   in a cycle or waiting for open.
+  @param[in,out] d A daemon.
+  @param[in] stop 0: Start measurement, 1: Stop measurement.
+ */
+static void AKFS_SetStopRequest(AKFS_DAEMON* d, int stop)
+{
+	pthread_mutex_lock(&d->mutex);
+	d->stopRequest = stop;
+	pthread_cond_broadcast(&d->cond);
+	pthread_mutex_unlock(&d->mutex);
+}
+
+/*!
+  Request the daemon to quit, and wake up measurement thread.
+  @param[in,out] d A daemon.
+ */
+static void AKFS_SetQuit(AKFS_DAEMON* d)
+{
+	pthread_mutex_lock(&d->mutex);
+	d->stopRequest = 1;
+	d->quit = AKD_TRUE;
+	pthread_cond_broadcast(&d->cond);
+	pthread_mutex_unlock(&d->mutex);
+}
+
+/*!
+  Whether stop is requested.
+  @return #AKM_TRUE or #AKM_FALSE.
+  @param[in,out] d A daemon.
+ */
+static int AKFS_IsStopRequested(AKFS_DAEMON* d)
+{
+	return (__sync_fetch_and_add(&d->stopRequest, 0) != 0) ? AKM_TRUE : AKM_FALSE;
+}
+
+/*!
+  Sleep until deadline. This function returns immediately when stop is
+   requested, so stop latency is not limited by the measurement period.
+  @param[in,out] d A daemon.
+  @param[in] deadline Absolute CLOCK_MONOTONIC time.
+ */
+static void AKFS_SleepUntil(AKFS_DAEMON* d, const struct timespec* deadline)
+{
+	pthread_mutex_lock(&d->mutex);
+	while (d->stopRequest == 0) {
+		if (pthread_cond_timedwait(&d->cond, &d->mutex, deadline) != 0) {
+			/* ETIMEDOUT */
+			break;
+		}
+	}
+	pthread_mutex_unlock(&d->mutex);
+}
+
+/*!
+ Adds an acceleration to the window, and checks whether the device is still.
+ @return #AKM_TRUE when the window is full, and the variance of it is less
+ than #CSPEC_STILL_VAR. Otherwise #AKM_FALSE.
+ @param[in,out] st A window.
+ @param[in] acc Acceleration in the unit of the driver, i.e. #AKM_ACC_SENSE
+ for 1G.
+ */
+static int16 AKFS_CheckStill(
+			AKFS_STILL		*st,
+	const	int16			acc[3])
+{
+	AKFLOAT	mean[3];
+	AKFLOAT	var;
+	AKFLOAT	d;
+	int		i, k;
+
+	for (k = 0; k < 3; k++) {
+		st->a[st->idx][k] = acc[k] * (AKM_ACC_TARGET / AKM_ACC_SENSE);
+	}
+	st->idx = (st->idx + 1) % CSPEC_STILL_NAVE;
+	if (st->num < CSPEC_STILL_NAVE) {
+		st->num++;
+		return AKM_FALSE;
+	}
+
+	var = 0.0f;
+	for (k = 0; k < 3; k++) {
+		mean[k] = 0.0f;
+		for (i = 0; i < CSPEC_STILL_NAVE; i++) {
+			mean[k] += st->a[i][k];
+		}
+		mean[k] /= CSPEC_STILL_NAVE;
+		for (i = 0; i < CSPEC_STILL_NAVE; i++) {
+			d = st->a[i][k] - mean[k];
+			var += d * d;
+		}
+	}
+	var /= CSPEC_STILL_NAVE;
+
+	return (var < CSPEC_STILL_VAR) ? AKM_TRUE : AKM_FALSE;
+}
+
+/*!
+ A thread function of the calculation stage. It takes frames from the queue
+ of the daemon, calculates and outputs the results, until the queue is
+ closed. When frames are queued behind, only the newest one is output, but
+ all of them are calculated in order. All frames are output in lossless mode.
+ @param[in] args A pointer to #AKFS_DAEMON structure.
+ */
+static void* compute_main(void* args)
+{
+	AKFS_DAEMON	*d = (AKFS_DAEMON *)args;
+	AKMPRMS	*prms = d->prms;
+	AKFS_FRAME frame;
+	int64_t	t0;
 	uint16	flag;
+	uint16	holdFlag;
 	AKSENSOR_DATA sv_acc;
 	AKSENSOR_DATA sv_mag;
 	AKSENSOR_DATA sv_ori;
+	AKFLOAT sv_rot[4];
 	AKFLOAT tmpx, tmpy, tmpz;
 	int16 tmp_accuracy;
+	int16 ret;
+	uint32_t	nsys;
+
+	AKFS_TraceAttach(&d->trace);
+
+	/* Sensors which are disabled are output as 0. */
+	memset(&sv_acc, 0, sizeof(sv_acc));
+	memset(&sv_mag, 0, sizeof(sv_mag));
+	memset(&sv_ori, 0, sizeof(sv_ori));
+	memset(sv_rot, 0, sizeof(sv_rot));
+	holdFlag = 0;
+	while (AKFS_QueuePop(&d->queue, &frame) == AKM_SUCCESS) {
+		t0 = AKFS_StatsNow();
+		AKFS_StatsAdd(&d->stats, AKFS_STATS_QUEUE, t0 - frame.ts);
+		flag = frame.flag;
 
-	prms = (AKMPRMS *)args;
-	minimum = -1;
+		if ((flag & ACC_DATA_READY) || (flag & FUSION_DATA_READY)) {
+			/* Calculate accelerometer vector */
+			ret = AKFS_Get_ACCELEROMETER(prms, frame.acc, 0, &tmpx, &tmpy, &tmpz, &tmp_accuracy);
+			AKFS_StatsAdd(&d->stats, AKFS_STATS_CALC_ACC, AKFS_StatsNow() - t0);
+			if (ret == AKM_SUCCESS) {
+				sv_acc.x = tmpx;
+				sv_acc.y = tmpy;
+				sv_acc.z = tmpz;
+				sv_acc.status = tmp_accuracy;
+			} else {
+				flag &= ~ACC_DATA_READY;
+				flag &= ~FUSION_DATA_READY;
+			}
+		}
 
-	/* Initialize library functions and device */
-	if (AKFS_Start(prms, CSPEC_SETTING_FILE) != AKM_SUCCESS) {
+		if (frame.reuse == AKM_TRUE) {
+			/* The device is still. Output the last results again, as far
+			   as they are available. */
+			flag &= ~(MAG_DATA_READY | FUSION_DATA_READY) | holdFlag;
+		} else {
+			if ((flag & MAG_DATA_READY) || (flag & FUSION_DATA_READY)) {
+				/* Calculate magnetic field vector */
+				t0 = AKFS_StatsNow();
+				ret = AKFS_Get_MAGNETIC_FIELD(prms, frame.mag, frame.mstat, &tmpx, &tmpy, &tmpz, &tmp_accuracy);
+				AKFS_StatsAdd(&d->stats, AKFS_STATS_CALC_MAG, AKFS_StatsNow() - t0);
+				if (ret == AKM_SUCCESS) {
+					sv_mag.x = tmpx;
+					sv_mag.y = tmpy;
+					sv_mag.z = tmpz;
+					sv_mag.status = tmp_accuracy;
+				} else {
+					flag &= ~MAG_DATA_READY;
+					flag &= ~FUSION_DATA_READY;
+				}
+			}
+
+			if (flag & FUSION_DATA_READY) {
+				t0 = AKFS_StatsNow();
+				ret = AKFS_Get_ORIENTATION(prms, &tmpx, &tmpy, &tmpz, &tmp_accuracy);
+				AKFS_StatsAdd(&d->stats, AKFS_STATS_CALC_ORI, AKFS_StatsNow() - t0);
+				if (ret == AKM_SUCCESS) {
+					sv_ori.x = tmpx;
+					sv_ori.y = tmpy;
+					sv_ori.z = tmpz;
+					sv_ori.status = tmp_accuracy;
+				} else {
+					flag &= ~FUSION_DATA_READY;
+				}
+			}
+
+			if (flag & FUSION_DATA_READY) {
+				t0 = AKFS_StatsNow();
+				ret = AKFS_Get_ROTATION_VECTOR(prms, &sv_rot[0], &sv_rot[1],
+						&sv_rot[2], &sv_rot[3], &tmp_accuracy);
+				AKFS_StatsAdd(&d->stats, AKFS_STATS_CALC_ROT, AKFS_StatsNow() - t0);
+				if (ret != AKM_SUCCESS) {
+					flag &= ~FUSION_DATA_READY;
+				}
+			}
+
+			/* Results which can be output again */
+			holdFlag = flag & (MAG_DATA_READY | FUSION_DATA_READY);
+		}
+
+		/* Output result, unless a newer frame is already waiting. */
+		if (d->queue.lossless || (AKFS_QueueDepth(&d->queue) == 0)) {
+			nsys = AKD_GetSyscallCount(d->dev, AKD_STAGE_OUTPUT);
+			AKFS_OutputResult(d, flag, &sv_acc, &sv_mag, &sv_ori, sv_rot);
+			AKFS_StatsAdd(&d->stats, AKFS_STATS_E2E, AKFS_StatsNow() - frame.ts);
+			nsys = AKD_GetSyscallCount(d->dev, AKD_STAGE_OUTPUT) - nsys;
+			AKMDEBUG(AKMDATA_LOOP, "Output syscalls: %u\n", nsys);
+		}
+	}
+	return ((void*)0);
+}
+
+/*!
+ Measurement loop, which runs until stop is requested or an error occurs.
+ This is the acquisition stage. Raw data is timestamped and handed to the
+ calculation stage (#compute_main) through the queue of the daemon, so a
+ slow calculation does not delay the next acquisition. When the queue is
+ full, the oldest frame is dropped.
+ The library must be started with #AKFS_Start before this function is called.
+ @param[in,out] d A daemon.
+ */
+static void measure_main(AKFS_DAEMON *d)
+{
+	AKD_CONTEXT	*dev = d->dev;
+	BYTE    i2cData[AKM_SENSOR_DATA_SIZE]; /* ST1 ~ ST2 */
+	AKFS_FRAME frame;
+	pthread_t thread;
+	struct	timespec tsstart= {0, 0};
+	struct	timespec deadline;
+	int64_t	now;
+	int64_t	lastDelay;
+	int64_t	minimum;
+	int64_t	lastStart;
+	int64_t	lastMinimum;
+	int64_t	t0;
+	uint16	flag;
+	uint16	dflag;
+	uint32_t	nsys;
+	int16 measuring;
+	AKFS_STILL still;
+	int16 isStill;
+	int16 skip;
+	uint16 holdFlag;
+
+	minimum = -1;
+	dflag = 0;
+	lastDelay = 0;
+	lastStart = -1;
+	lastMinimum = -1;
+	measuring = AKM_FALSE;
+	d->lastYPRValid = AKM_FALSE;
+	memset(&still, 0, sizeof(still));
+	isStill = AKM_FALSE;
+	skip = 0;
+	holdFlag = 0;
+
+	/* Outputs of the last session must not be averaged into this one.
+	   The library is started only once, so the calibration is kept. */
+	if (AKFS_ResetBuffers(d->prms) != AKM_SUCCESS) {
 		AKMERROR;
-		goto MEASURE_END;
+		return;
 	}
 
-	while (g_stopRequest != AKM_TRUE) {
-		/* Beginning time */
-		if (clock_gettime(CLOCK_MONOTONIC, &tsstart) < 0) {
+	/* Start the calculation stage. Replay needs every result in order. */
+	if (AKFS_QueueInit(&d->queue, d->lossless) != AKM_SUCCESS) {
+		return;
+	}
+	if (pthread_create(&thread, NULL, compute_main, d) != 0) {
+		AKMERROR_STR("pthread_create");
+		AKFS_QueueRelease(&d->queue);
+		return;
+	}
+
+	while (AKFS_IsStopRequested(d) != AKM_TRUE) {
+		nsys = AKD_GetSyscallCount(dev, AKD_STAGE_MEASURE);
+
+		/* Beginning time. Replay runs on the virtual clock of the log. */
+		if ((now = AKD_GetTime(dev)) < 0) {
 			AKMERROR;
 			goto MEASURE_END;
 		}
+		tsstart.tv_sec = now / 1000000000LL;
+		tsstart.tv_nsec = now % 1000000000LL;
 
-		/* Get interval */
-		if (AKFS_GetInterval(&flag, &minimum) != AKM_SUCCESS) {
-			AKMERROR;
-			goto MEASURE_END;
+		/* Period error. The first cycle and a change of rate are skipped. */
+		if ((lastStart >= 0) && (lastMinimum == minimum)) {
+			AKFS_StatsAdd(&d->stats, AKFS_STATS_PERIOD_ERR,
+				(now - lastStart) - minimum);
 		}
+		lastStart = now;
+
+		/* Get interval, only when the cached one may be outdated. Delays are
+		   polled every AKM_DELAY_REFRESH_NS, since the driver does not notify
+		   a change of delay. */
+		if ((minimum < 0) || ((now - lastDelay) >= AKM_DELAY_REFRESH_NS)) {
+			if (AKFS_GetInterval(dev, &dflag, &minimum) != AKM_SUCCESS) {
+				AKMERROR;
+				goto MEASURE_END;
+			}
+			lastDelay = now;
+		}
+		lastMinimum = minimum;
+		flag = dflag;
+		frame.flag = flag;
+		frame.reuse = AKM_FALSE;
 
 		if ((flag & ACC_DATA_READY) || (flag & FUSION_DATA_READY)) {
 			/* Get accelerometer */
-			if (AKD_GetAccelerationData(acc) != AKD_SUCCESS) {
+			if (AKD_GetAccelerationData(dev, frame.acc) != AKD_SUCCESS) {
 				AKMERROR;
 				goto MEASURE_END;
 			}
+		}
 
-			/* Calculate accelerometer vector */
-			if (AKFS_Get_ACCELEROMETER(prms, acc, 0, &tmpx, &tmpy, &tmpz, &tmp_accuracy) == AKM_SUCCESS) {
-				sv_acc.x = tmpx;
-				sv_acc.y = tmpy;
-				sv_acc.z = tmpz;
-				sv_acc.status = tmp_accuracy;
-			} else {
-				flag &= ~ACC_DATA_READY;
-				flag &= ~FUSION_DATA_READY;
+		/* Adaptive sampling: while the device is still, the magnetic field
+		   and the orientation of the last measurement are output again in
+		   most cycles. The first sample of motion returns to full rate. */
+		if ((d->adaptive == AKM_TRUE) &&
+			((flag & ACC_DATA_READY) || (flag & FUSION_DATA_READY))) {
+			if (AKFS_CheckStill(&still, frame.acc) != isStill) {
+				isStill = !isStill;
+				AKMDEBUG(AKMDATA_LOOP, "%s\n", isStill ? "Still." : "Moving.");
+			}
+		} else {
+			/* Stillness is not known without acceleration. */
+			still.num = 0;
+			isStill = AKM_FALSE;
+		}
+		if ((isStill == AKM_TRUE) && (skip > 0) &&
+			((flag & (MAG_DATA_READY | FUSION_DATA_READY) & ~holdFlag) == 0)) {
+			frame.reuse = AKM_TRUE;
+			skip--;
+			/* Trigger a measurement one cycle before it is read. */
+			if ((skip == 0) && (measuring == AKM_FALSE)) {
+				if (AKD_SetMode(dev, AKM_MODE_SNG_MEASURE) != AKD_SUCCESS) {
+					AKMERROR;
+					goto MEASURE_END;
+				}
+				measuring = AKM_TRUE;
 			}
 		}
 
-		if ((flag & MAG_DATA_READY) || (flag & FUSION_DATA_READY)) {
-			/* Set to measurement mode  */
-			if (AKD_SetMode(AKM_MODE_SNG_MEASURE) != AKD_SUCCESS) {
-				AKMERROR;
-				goto MEASURE_END;
+		if (((flag & MAG_DATA_READY) || (flag & FUSION_DATA_READY)) &&
+			(frame.reuse == AKM_FALSE)) {
+			/* Set to measurement mode, only when no measurement is in
+			   flight (i.e. the first cycle). */
+			if (measuring == AKM_FALSE) {
+				if (AKD_SetMode(dev, AKM_MODE_SNG_MEASURE) != AKD_SUCCESS) {
+					AKMERROR;
+					goto MEASURE_END;
+				}
 			}
 
 			/* Wait for DRDY and get data from device */
-			if (AKD_GetMagneticData(i2cData) != AKD_SUCCESS) {
+			if (AKD_GetMagneticData(dev, i2cData) != AKD_SUCCESS) {
 				AKMERROR;
 				goto MEASURE_END;
 			}
-			/* raw data to x,y,z value */
-			mag[0] = (int)((int16_t)(i2cData[2]<<8)+((int16_t)i2cData[1]));
-			mag[1] = (int)((int16_t)(i2cData[4]<<8)+((int16_t)i2cData[3]));
-			mag[2] = (int)((int16_t)(i2cData[6]<<8)+((int16_t)i2cData[5]));
-			mstat = i2cData[0] | i2cData[7];
-
-			/* Calculate magnetic field vector */
-			if (AKFS_Get_MAGNETIC_FIELD(prms, mag, mstat, &tmpx, &tmpy, &tmpz, &tmp_accuracy) == AKM_SUCCESS) {
-				sv_mag.x = tmpx;
-				sv_mag.y = tmpy;
-				sv_mag.z = tmpz;
-				sv_mag.status = tmp_accuracy;
+
+			/* Trigger the next measurement right away, so that the
+			   conversion overlaps with calculation and sleep, and the
+			   data is ready by the next cycle. While still, it is
+			   triggered later to keep the data fresh. */
+			if ((isStill == AKM_TRUE) && (CSPEC_STILL_DIV > 1)) {
+				skip = CSPEC_STILL_DIV - 1;
+				measuring = AKM_FALSE;
 			} else {
-				flag &= ~MAG_DATA_READY;
-				flag &= ~FUSION_DATA_READY;
+				skip = 0;
+				if (AKD_SetMode(dev, AKM_MODE_SNG_MEASURE) != AKD_SUCCESS) {
+					AKMERROR;
+					goto MEASURE_END;
+				}
+				measuring = AKM_TRUE;
 			}
+			/* raw data to x,y,z value */
+			frame.mag[0] = (int)((int16_t)(i2cData[2]<<8)+((int16_t)i2cData[1]));
+			frame.mag[1] = (int)((int16_t)(i2cData[4]<<8)+((int16_t)i2cData[3]));
+			frame.mag[2] = (int)((int16_t)(i2cData[6]<<8)+((int16_t)i2cData[5]));
+			frame.mstat = i2cData[0] | i2cData[7];
+			holdFlag = flag & (MAG_DATA_READY | FUSION_DATA_READY);
 		}
 
-		if (flag & FUSION_DATA_READY) {
-			if (AKFS_Get_ORIENTATION(prms, &tmpx, &tmpy, &tmpz, &tmp_accuracy) == AKM_SUCCESS) {
-				sv_ori.x = tmpx;
-				sv_ori.y = tmpy;
-				sv_ori.z = tmpz;
-				sv_ori.status = tmp_accuracy;
-			} else {
-				flag &= ~FUSION_DATA_READY;
-			}
+		/* Hand the frame to the calculation stage */
+		frame.ts = AKFS_StatsNow();
+		AKFS_StatsCount(&d->stats, AKFS_STATS_CNT_DEPTH,
+			AKFS_QueueDepth(&d->queue));
+		if (AKFS_QueuePush(&d->queue, &frame) > 0) {
+			AKMDEBUG(AKMDATA_LOOP, "The oldest frame is dropped.\n");
 		}
 
-		/* Output result */
-		AKFS_OutputResult(flag, &sv_acc, &sv_mag, &sv_ori);
+		/* Calls to the driver by this stage. The output of the results is
+		   counted by the calculation stage. */
+		nsys = AKD_GetSyscallCount(dev, AKD_STAGE_MEASURE) - nsys;
+		AKMDEBUG(AKMDATA_LOOP, "Syscalls: %u\n", nsys);
 
-		/* Ending time */
-		if (clock_gettime(CLOCK_MONOTONIC, &tsend) < 0) {
-			AKMERROR;
-			goto MEASURE_END;
+		/* Sleep until the next period begins */
+		deadline = AKFS_CalcDeadline(&tsstart, minimum);
+		if (AKD_IsVirtualClock(dev) == AKD_TRUE) {
+			AKD_AdvanceTime(dev, (deadline.tv_sec * 1000000000LL) + deadline.tv_nsec);
+			continue;
+		}
+		t0 = AKFS_StatsNow();
+		AKFS_StatsAdd(&d->stats, AKFS_STATS_LOOP, t0 - now);
+		AKFS_SleepUntil(d, &deadline);
+		if (AKFS_IsStopRequested(d) != AKM_TRUE) {
+			/* Only when the deadline was in the future */
+			int64_t dl = (deadline.tv_sec * 1000000000LL) + deadline.tv_nsec;
+			if (dl > t0) {
+				AKFS_StatsAdd(&d->stats, AKFS_STATS_WAKEUP, AKFS_StatsNow() - dl);
+			}
 		}
-
-		/* Calculate duration */
-		doze = AKFS_CalcSleep(&tsend, &tsstart, minimum);
-		AKMDEBUG(AKMDATA_LOOP, "Sleep: %6.2f msec\n", (doze.tv_nsec/1000000.0f));
-		nanosleep(&doze, NULL);
 
 #ifdef WIN32
 		if (_kbhit()) {
@@ -355,10 +789,67 @@ static void* thread_main(void* args)
 
 MEASURE_END:
 	/* Set to PowerDown mode */
-	if (AKD_SetMode(AKM_MODE_POWERDOWN) != AKD_SUCCESS) {
+	if (AKD_SetMode(dev, AKM_MODE_POWERDOWN) != AKD_SUCCESS) {
+		AKMERROR;
+	}
+
+	/* Frames left in the queue are still output. */
+	AKFS_QueueClose(&d->queue);
+	pthread_join(thread, NULL);
+	AKFS_QueueRelease(&d->queue);
+}
+
+/*!
+ A thread function which lives as long as the daemon. It waits for the
+ compass to be opened, measures until it is closed, and waits again. The
+ library is started only once, so the calibration state is kept in memory
+ across open and close.
+ @param[in] args A pointer to #AKFS_DAEMON structure.
+ */
+static void* thread_main(void* args)
+{
+	AKFS_DAEMON	*d = (AKFS_DAEMON *)args;
+	AKMPRMS	*prms = d->prms;
+
+	AKFS_TraceAttach(&d->trace);
+
+	/* Initialize library functions */
+	if (AKFS_Start(prms, CSPEC_SETTING_FILE) != AKM_SUCCESS) {
 		AKMERROR;
 	}
 
+	/* Calibration runs in background. Measurement goes on without it. */
+	if (AKFS_CalibStart(prms->p_calib) != AKM_SUCCESS) {
+		AKMERROR;
+	}
+
+	pthread_mutex_lock(&d->mutex);
+	while (d->quit == AKD_FALSE) {
+		/* Wait until device driver is opened. */
+		if (d->stopRequest != 0) {
+			pthread_cond_wait(&d->cond, &d->mutex);
+			continue;
+		}
+		pthread_mutex_unlock(&d->mutex);
+
+		measure_main(d);
+
+		/* Save the state in background. It is saved at exit anyway. */
+		if (AKFS_CalibCheckpoint(prms->p_calib, prms) != AKM_SUCCESS) {
+			AKMDEBUG(AKMDATA_LOOP, "Checkpoint is skipped.\n");
+		}
+
+		/* When measurement stopped by an error, wait until closed. */
+		pthread_mutex_lock(&d->mutex);
+		while ((d->stopRequest == 0) && (d->quit == AKD_FALSE)) {
+			pthread_cond_wait(&d->cond, &d->mutex);
+		}
+	}
+	pthread_mutex_unlock(&d->mutex);
+
+	/* Stop background calibration */
+	AKFS_CalibStop(prms->p_calib);
+
 	/* Save parameters */
 	if (AKFS_Stop(prms, CSPEC_SETTING_FILE) != AKM_SUCCESS) {
 		AKMERROR;
@@ -372,31 +863,127 @@ MEASURE_END:
  */
 static void signal_handler(int sig)
 {
-	if (sig == SIGINT) {
+	if ((sig == SIGINT) && (s_sigDaemon != NULL)) {
 		AKMERROR;
-		g_stopRequest = 1;
-		g_mainQuit = AKD_TRUE;
+		s_sigDaemon->stopRequest = 1;
+		s_sigDaemon->quit = AKD_TRUE;
 	}
 }
 
 /*!
- Starts new thread.
+ Starts new thread. The thread waits until stopRequest of the daemon is
+ cleared.
  @return If this function succeeds, the return value is 1. Otherwise,
  the return value is 0.
+ @param[in,out] d A daemon.
  */
-static int startClone(void *mem)
+static int startClone(AKFS_DAEMON *d)
 {
 	pthread_attr_t attr;
 
 	pthread_attr_init(&attr);
-	g_stopRequest = 0;
-	if (pthread_create(&s_thread, &attr, thread_main, mem) == 0) {
+	AKFS_SetStopRequest(d, 1);
+	if (pthread_create(&d->thread, &attr, thread_main, d) == 0) {
+		d->threadValid = AKM_TRUE;
 		return 1;
 	} else {
 		return 0;
 	}
 }
 
+/*!
+ Stops the thread which is started by #startClone, and waits for it.
+ @param[in,out] d A daemon.
+ */
+static void stopClone(AKFS_DAEMON *d)
+{
+	if (d->threadValid == AKM_FALSE) {
+		return;
+	}
+	AKFS_SetQuit(d);
+
+	pthread_join(d->thread, NULL);
+	d->threadValid = AKM_FALSE;
+}
+
+/*!
+ A thread function which writes statistics on SIGUSR1, and the trace ring on
+ SIGUSR2. Files are written here instead of a signal handler, so the
+ measurement thread is not interrupted.
+ @param[in] args A pointer to #AKFS_DAEMON structure.
+ */
+static void* signal_main(void* args)
+{
+	AKFS_DAEMON	*d = (AKFS_DAEMON *)args;
+	sigset_t	set;
+	int			sig;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	sigaddset(&set, SIGUSR2);
+	while (AKD_TRUE) {
+		if (sigwait(&set, &sig) != 0) {
+			continue;
+		}
+		if (__sync_fetch_and_add(&s_sigQuit, 0)) {
+			break;
+		}
+		if (sig == SIGUSR1) {
+			if (AKFS_StatsDump(&d->stats, CSPEC_STATS_FILE) == AKM_SUCCESS) {
+				ALOGI("Statistics are written to %s", CSPEC_STATS_FILE);
+			}
+		}
+#if ENABLE_AKMDEBUG
+		if (sig == SIGUSR2) {
+			if (AKFS_TraceDump(&d->trace, CSPEC_TRACE_FILE) == AKM_SUCCESS) {
+				ALOGI("Trace is written to %s", CSPEC_TRACE_FILE);
+			}
+		}
+#endif
+	}
+	return ((void*)0);
+}
+
+/*!
+ Starts the thread which waits for dump requests. SIGUSR1 and SIGUSR2 are
+ blocked in the calling thread, and the mask is inherited by threads created
+ later. So this must be called before any other thread is created.
+ @return If this function succeeds, the return value is 1. Otherwise,
+ the return value is 0.
+ @param[in] d The daemon whose statistics and trace are written. It must be
+ initialized.
+ */
+static int startSignalThread(AKFS_DAEMON *d)
+{
+	sigset_t set;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	sigaddset(&set, SIGUSR2);
+	if (pthread_sigmask(SIG_BLOCK, &set, NULL) != 0) {
+		return 0;
+	}
+	if (pthread_create(&s_sigThread, NULL, signal_main, d) != 0) {
+		return 0;
+	}
+	s_sigThreadValid = AKM_TRUE;
+	return 1;
+}
+
+/*!
+ Stops the thread which is started by #startSignalThread, and waits for it.
+ */
+static void stopSignalThread(void)
+{
+	if (s_sigThreadValid == AKM_FALSE) {
+		return;
+	}
+	__sync_lock_test_and_set(&s_sigQuit, AKM_TRUE);
+	pthread_kill(s_sigThread, SIGUSR1);
+	pthread_join(s_sigThread, NULL);
+	s_sigThreadValid = AKM_FALSE;
+}
+
 /*!
  This function parse the option.
  @retval 1 Parse succeeds.
@@ -404,11 +991,15 @@ static int startClone(void *mem)
  @param[in] argc Argument count
  @param[in] argv Argument vector
  @param[out] layout_patno
+ @param[in,out] d The daemon. Its mode is set.
+ @param[out] opt Other options.
  */
 int OptParse(
 	int		argc,
 	char*	argv[],
-	AKFS_PATNO*	layout_patno)
+	AKFS_PATNO*	layout_patno,
+	AKFS_DAEMON*	d,
+	AKFS_OPTION*	opt)
 {
 #ifdef WIN32
 	/* Static */
@@ -425,17 +1016,18 @@ int OptParse(
 #else
 	*layout_patno = PAT1;
 #endif
-	g_opmode = OPMODE_CONSOLE;
-	/*g_opmode = 0;*/
-	g_dbgzone = AKMDATA_DUMP | AKMDATA_DEBUG | AKMDATA_CONSOLE;
+	d->opmode = OPMODE_CONSOLE;
+	/*d->opmode = 0;*/
+	AKFS_TraceSetZone(&d->trace, AKMDATA_DUMP | AKMDATA_DEBUG | AKMDATA_CONSOLE);
+	AKFS_TraceSetEcho(&d->trace, AKM_TRUE);
 #else
-	int		opt;
+	int		c;
 	char	optVal;
 
 	*layout_patno = PAT_INVALID;
 
-	while ((opt = getopt(argc, argv, "sm:z:")) != -1) {
-		switch(opt){
+	while ((c = getopt(argc, argv, "sam:z:r:o:" AKFS_TOOL_OPTIONS)) != -1) {
+		switch(c){
 			case 'm':
 				optVal = (char)(optarg[0] - '0');
 				if ((PAT1 <= optVal) && (optVal <= PAT8)) {
@@ -444,24 +1036,74 @@ int OptParse(
 				}
 				break;
 			case 's':
-				g_opmode |= OPMODE_CONSOLE;
+				d->opmode |= OPMODE_CONSOLE;
+				break;
+			case 'a':
+				d->adaptive = AKM_TRUE;
 				break;
             case 'z':
                 /* If error detected, hopefully 0 is returned. */
                 errno = 0;
-                g_dbgzone = (int)strtol(optarg, (char**)NULL, 0); 
-                AKMDEBUG(AKMDATA_DEBUG, "%s: Dbg Zone=%d\n", __FUNCTION__, g_dbgzone);
+                AKFS_TraceSetZone(&d->trace, (int)strtol(optarg, (char**)NULL, 0));
+                /* Zones given explicitly are printed as they come. */
+                AKFS_TraceSetEcho(&d->trace, AKM_TRUE);
+                AKMDEBUG(AKMDATA_DEBUG, "%s: Dbg Zone=%d\n", __FUNCTION__, AKFS_TraceZone());
                 break;
+			case 'r':
+				opt->replay = optarg;
+				break;
+			case 'o':
+				opt->output = optarg;
+				break;
+#ifdef AKFS_ENABLE_TOOLS
+			case 'b':
+				d->opmode |= OPMODE_BENCH;
+				opt->golden = optarg;
+				break;
+			case 'B':
+				d->opmode |= OPMODE_BATCH;
+				opt->batchDir = optarg;
+				break;
+			case 'j':
+				opt->batchThread = atoi(optarg);
+				break;
+#endif
 			default:
 				AKMERROR_STR("Invalid argument");
 				return 0;
 		}
 	}
 
-	/* If layout is not specified with argument, get parameter from driver */
+	/* Batch mode reads files by itself. */
+	if (d->opmode & OPMODE_BATCH) {
+		return 1;
+	}
+
+	/* Replay needs every result in order, independent of timing. */
+	if (opt->replay != NULL) {
+		d->lossless = AKM_TRUE;
+		AKFS_CalibSetSync(&d->calib, AKM_TRUE);
+	}
+#endif
+
+	return 1;
+}
+
+/*!
+ If layout is not specified with argument, get parameter from driver.
+ @retval 1 Layout is valid.
+ @retval 0 No layout is specified.
+ @param[in,out] dev A device.
+ @param[in,out] layout_patno
+ */
+int GetLayout(
+	AKD_CONTEXT*	dev,
+	AKFS_PATNO*	layout_patno)
+{
+#ifndef WIN32
 	if (*layout_patno == PAT_INVALID) {
 		int16_t n = 0;
-		if (AKD_GetLayout(&n) == AKD_SUCCESS) {
+		if (AKD_GetLayout(dev, &n) == AKD_SUCCESS) {
 			if ((PAT1 <= n) && (n <= PAT8)) {
 				*layout_patno = (AKFS_PATNO)n;
 			}
@@ -478,7 +1120,7 @@ int OptParse(
 	return 1;
 }
 
-void ConsoleMode(void *mem)
+void ConsoleMode(AKFS_DAEMON *d)
 {
 	/*** Console Mode *********************************************/
 	while (AKD_TRUE) {
@@ -486,9 +1128,19 @@ void ConsoleMode(void *mem)
 		switch (Menu_Main()) {
 		case MODE_Measure:
 			/* Reset flag */
-			g_stopRequest = 0;
+			AKFS_SetStopRequest(d, 0);
 			/* Measurement routine */
-			thread_main(mem);
+			if (AKFS_Start(d->prms, CSPEC_SETTING_FILE) != AKM_SUCCESS) {
+				AKMERROR;
+			}
+			if (AKFS_CalibStart(d->prms->p_calib) != AKM_SUCCESS) {
+				AKMERROR;
+			}
+			measure_main(d);
+			AKFS_CalibStop(d->prms->p_calib);
+			if (AKFS_Stop(d->prms, CSPEC_SETTING_FILE) != AKM_SUCCESS) {
+				AKMERROR;
+			}
 			break;
 
 		case MODE_Quit:
@@ -507,31 +1159,95 @@ int main(int argc, char **argv)
 	AKMPRMS		prms;
 	AKFS_PATNO	pat;
 	uint8		regs[3];
+	AKD_CONTEXT	dev;
+	AKD_REPLAY	replay;
+	int			replayValid = AKM_FALSE;
+	AKFS_DAEMON	daemon;
+	int			daemonValid = AKM_FALSE;
+	AKFS_OPTION	opt;
 
 	/* Show the version info of this software. */
 	Disp_StartMessage();
 
+	/* Device driver is used, unless replay is selected. */
+	AKD_InitContext(&dev);
+	memset(&opt, 0, sizeof(opt));
+
+	/* The daemon. The option may change it. No thread is started yet. */
+	if (AKFS_InitDaemon(&daemon, &prms, &dev) != AKM_SUCCESS) {
+		retValue = ERROR_INIT;
+		goto MAIN_QUIT;
+	}
+	daemonValid = AKM_TRUE;
+	AKFS_TraceAttach(&daemon.trace);
+
+	/* Dump statistics on SIGUSR1, and the trace ring on SIGUSR2. */
+	if (startSignalThread(&daemon) == 0) {
+		AKMERROR;
+	}
+
 #if ENABLE_AKMDEBUG
 	/* Register signal handler */
+	s_sigDaemon = &daemon;
 	signal(SIGINT, signal_handler);
 #endif
 
+	/* Parse command-line options */
+	if (OptParse(argc, argv, &pat, &daemon, &opt) == 0) {
+		retValue = ERROR_OPTPARSE;
+		goto MAIN_QUIT;
+	}
+
+#ifdef AKFS_ENABLE_TOOLS
+	/* Process recorded files offline, and quit */
+	if (daemon.opmode & OPMODE_BATCH) {
+		if (AKFS_Batch(opt.batchDir, opt.output, pat, opt.batchThread)
+				!= AKM_SUCCESS) {
+			retValue = ERROR_BATCH;
+		}
+		goto MAIN_QUIT;
+	}
+
+	/* Without a recorded stream, run benchmark on the synthetic stream
+	   only, which needs no device, and quit */
+	if ((daemon.opmode & OPMODE_BENCH) && (opt.replay == NULL)) {
+		if (pat == PAT_INVALID) {
+			pat = AKFS_BENCH_LAYOUT;
+		}
+		memset(regs, AKFS_BENCH_ASA, sizeof(regs));
+		if (AKFS_Bench(pat, regs, opt.golden, NULL) != AKM_SUCCESS) {
+			retValue = ERROR_BENCH;
+		}
+		goto MAIN_QUIT;
+	}
+#endif
+
+	/* Replay a recorded file instead of the device driver. The backend is
+	   selected before opening driver. */
+	if (opt.replay != NULL) {
+		if (AKD_ReplayInit(&replay, opt.replay, opt.output) != AKD_SUCCESS) {
+			retValue = ERROR_OPTPARSE;
+			goto MAIN_QUIT;
+		}
+		replayValid = AKM_TRUE;
+		AKD_SetBackend(&dev, &g_akdReplay, &replay);
+	}
+
 	/* Open device driver */
-	if(AKD_InitDevice() != AKD_SUCCESS) {
+	if(AKD_InitDevice(&dev) != AKD_SUCCESS) {
 		retValue = ERROR_INITDEVICE;
 		goto MAIN_QUIT;
 	}
 
-	/* Parse command-line options */
 	/* This function calls device driver function to get layout */
-	if (OptParse(argc, argv, &pat) == 0) {
+	if (GetLayout(&dev, &pat) == 0) {
 		retValue = ERROR_OPTPARSE;
 		goto MAIN_QUIT;
 	}
 
 	/* Self Test */
 	/*
-	if (g_opmode & OPMODE_FST){
+	if (daemon.opmode & OPMODE_FST){
 		if (AKFS_SelfTest() != AKD_SUCCESS) {
 			retValue = ERROR_SELF_TEST;
 			goto MAIN_QUIT;
@@ -539,7 +1255,7 @@ int main(int argc, char **argv)
 	}*/
 
 	/* OK, then start */
-	if (AKFS_ReadConf(regs) != AKM_SUCCESS) {
+	if (AKFS_ReadConf(&dev, regs) != AKM_SUCCESS) {
 		retValue = ERROR_READ_FUSE;
 		goto MAIN_QUIT;
 	}
@@ -549,18 +1265,41 @@ int main(int argc, char **argv)
 		retValue = ERROR_INIT;
 		goto MAIN_QUIT;
 	}
+	prms.p_calib = &daemon.calib;
+
+#ifdef AKFS_ENABLE_TOOLS
+	/* Run benchmark on the synthetic and the recorded stream, and quit */
+	if (daemon.opmode & OPMODE_BENCH) {
+		if (AKFS_Bench(pat, regs, opt.golden, &dev) != AKM_SUCCESS) {
+			retValue = ERROR_BENCH;
+		}
+		goto MAIN_QUIT;
+	}
+#endif
 
 	/* Start console mode */
-	if (g_opmode & OPMODE_CONSOLE) {
-		ConsoleMode((void *)&prms);
+	if (daemon.opmode & OPMODE_CONSOLE) {
+		ConsoleMode(&daemon);
 		goto MAIN_QUIT;
 	}
 
 	/*** Start Daemon ********************************************/
-	while (g_mainQuit == AKD_FALSE) {
+	/* Start measurement thread. It waits until the compass is opened. */
+	if (startClone(&daemon) == 0) {
+		retValue = ERROR_STARTCLONE;
+		goto MAIN_QUIT;
+	}
+
+	while (daemon.quit == AKD_FALSE) {
 		int st = 0;
+		int16_t ret;
 		/* Wait until device driver is opened. */
-		if (AKD_GetOpenStatus(&st) != AKD_SUCCESS) {
+		ret = AKD_GetOpenStatus(&dev, &st);
+		if (ret == AKD_EOF) {
+			/* Replay is finished */
+			break;
+		}
+		if (ret != AKD_SUCCESS) {
 			retValue = ERROR_GETOPEN_STAT;
 			goto MAIN_QUIT;
 		}
@@ -568,32 +1307,52 @@ int main(int argc, char **argv)
 			AKMDEBUG(AKMDATA_LOOP, "Suspended.");
 		} else {
 			AKMDEBUG(AKMDATA_LOOP, "Compass Opened.");
-			/* Reset flag */
-			g_stopRequest = 0;
-			/* Start measurement thread. */
-			if (startClone((void *)&prms) == 0) {
-				retValue = ERROR_STARTCLONE;
-				goto MAIN_QUIT;
-			}
+			/* Resume measurement thread. */
+			AKFS_SetStopRequest(&daemon, 0);
 
 			/* Wait until device driver is closed. */
-			if (AKD_GetCloseStatus(&st) != AKD_SUCCESS) {
+			if (AKD_GetCloseStatus(&dev, &st) != AKD_SUCCESS) {
 				retValue = ERROR_GETCLOSE_STAT;
-				g_mainQuit = AKD_TRUE;
+				AKFS_SetQuit(&daemon);
 			}
-			/* Wait thread completion. */
-			g_stopRequest = 1;
-			pthread_join(s_thread, NULL);
+			/* Suspend measurement thread. It does not wait for the thread. */
+			AKFS_SetStopRequest(&daemon, 1);
 			AKMDEBUG(AKMDATA_LOOP, "Compass Closed.");
 		}
 	}
 
 MAIN_QUIT:
+	/* Stop measurement thread, and save parameters. */
+	if (daemonValid == AKM_TRUE) {
+		stopClone(&daemon);
+	}
+	stopSignalThread();
+	/* Leave statistics of this run, and what happened before the error. */
+	if ((daemonValid == AKM_TRUE) && (daemon.opmode == 0)) {
+		AKFS_StatsDump(&daemon.stats, CSPEC_STATS_FILE);
+	}
+#if ENABLE_AKMDEBUG
+	if ((daemonValid == AKM_TRUE) && (retValue != 0)) {
+		AKFS_TraceDump(&daemon.trace, CSPEC_TRACE_FILE);
+	}
+#endif
+
 
 	/* Release library */
 	AKFS_Release(&prms);
 	/* Close device driver. */
-	AKD_DeinitDevice();
+	AKD_DeinitDevice(&dev);
+	if (replayValid == AKM_TRUE) {
+		AKD_ReplayRelease(&replay);
+	}
+#if ENABLE_AKMDEBUG
+	signal(SIGINT, SIG_DFL);
+	s_sigDaemon = NULL;
+#endif
+	if (daemonValid == AKM_TRUE) {
+		AKFS_TraceAttach(NULL);
+		AKFS_ReleaseDaemon(&daemon);
+	}
 	/* Show the last message. */
 	Disp_EndMessage(retValue);
 
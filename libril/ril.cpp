@@ -47,7 +47,7 @@
 #include <errno.h>
 #include <assert.h>
 #include <ctype.h>
-#include <alloca.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <assert.h>
 #include <netinet/in.h>
@@ -77,10 +77,26 @@ namespace android {
 // memory usage issues sooner.
 #define MEMSET_FREED 1
 
+// Scratch memory for decoding one request. A command is at most
+// MAX_COMMAND_BYTES, and its strings in UTF-8 plus the pointer arrays
+// to them never take more than this.
+#define REQUEST_ARENA_SIZE (4 * MAX_COMMAND_BYTES)
+
+// Responses are framed by a 4-byte length header in network order.
+// Response buffers start with this capacity, grow as needed and are kept.
+#define RESPONSE_HEADER_SIZE sizeof(uint32_t)
+#define RESPONSE_BUFFER_SIZE 1024
+
 #define NUM_ELEMS(a)     (sizeof (a) / sizeof (a)[0])
 
 #define MIN(a,b) ((a)<(b) ? (a) : (b))
 
+// Outstanding requests are kept in a fixed table of slots. A RIL_Token
+// is the slot index and the generation of the slot.
+#define REQUEST_SLOT_BITS 9
+#define MAX_PENDING_REQUESTS (1 << REQUEST_SLOT_BITS)
+#define REQUEST_GEN_MASK ((uint32_t)-1 >> REQUEST_SLOT_BITS)
+
 /* Constants for response types */
 #define RESPONSE_SOLICITED 0
 #define RESPONSE_UNSOLICITED 1
@@ -136,8 +152,9 @@ typedef struct {
 typedef struct RequestInfo {
     int32_t token;      //this is not RIL_Token
     CommandInfo *pCI;
-    struct RequestInfo *p_next;
-    char cancelled;
+    struct RequestInfo *p_next;     // next free slot
+    uint32_t gen;       // odd while pending, even while free
+    uint32_t epoch;     // s_commandsEpoch when issued
     char local;         // responses to local commands do not go back to command process
 } RequestInfo;
 
@@ -145,7 +162,7 @@ typedef struct UserCallbackInfo {
     RIL_TimedCallback p_callback;
     void *userParam;
     struct ril_event event;
-    struct UserCallbackInfo *p_next;
+    struct UserCallbackInfo *p_next;    // next free node in the pool
 } UserCallbackInfo;
 
 extern "C"
@@ -183,16 +200,46 @@ static pthread_cond_t s_startupCond = PTHREAD_COND_INITIALIZER;
 static pthread_mutex_t s_dispatchMutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t s_dispatchCond = PTHREAD_COND_INITIALIZER;
 
-static RequestInfo *s_pendingRequests = NULL;
+static char s_requestArena[REQUEST_ARENA_SIZE] __attribute__((aligned(8)));
+static size_t s_requestArenaUsed = 0;
+
+static RequestInfo s_requestSlots[MAX_PENDING_REQUESTS];
+static RequestInfo *s_freeRequests = NULL;
+static int s_requestSlotsInit = 0;
+static uint32_t s_commandsEpoch = 0;
 
 static RequestInfo *s_toDispatchHead = NULL;
 static RequestInfo *s_toDispatchTail = NULL;
 
+static pthread_mutex_t s_userCallbackMutex = PTHREAD_MUTEX_INITIALIZER;
+static UserCallbackInfo *s_freeUserCallbacks = NULL;
+
+static pthread_mutex_t s_wakeTimeoutMutex = PTHREAD_MUTEX_INITIALIZER;
 static UserCallbackInfo *s_last_wake_timeout_info = NULL;
+static uint32_t s_wakeTimeoutGen = 0;  // generation of the current wake timeout
 
 static void *s_lastNITZTimeData = NULL;
 static size_t s_lastNITZTimeDataSize;
 
+static pthread_once_t s_responseBufferOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t s_responseBufferKey;
+
+/**
+ * The response buffer of the calling thread, with space for the length
+ * header reserved at the start. The buffer is reused from one response to
+ * the next. A response built while another one is in progress on the same
+ * thread (e.g. from processRadioState) gets a buffer of its own.
+ */
+class ResponseBuffer {
+public:
+    ResponseBuffer();
+    ~ResponseBuffer();
+    Parcel &parcel() { return *mParcel; }
+
+private:
+    Parcel *mParcel;
+};
+
 #if RILC_LOG
     static char printBuf[PRINTBUF_SIZE];
 #endif
@@ -222,6 +269,8 @@ static void dispatchGsmBrSmsCnf(Parcel &p, RequestInfo *pRI);
 static void dispatchCdmaBrSmsCnf(Parcel &p, RequestInfo *pRI);
 static void dispatchRilCdmaSmsWriteArgs(Parcel &p, RequestInfo *pRI);
 static void dispatchUiccSubscripton(Parcel &p, RequestInfo *pRI);
+static int checkAndDequeueRequestInfo(RIL_Token t, RequestInfo **ppRI);
+static int sendResponse (Parcel &p);
 static int responseInts(Parcel &p, void *response, size_t responselen);
 static int responseStrings(Parcel &p, void *response, size_t responselen);
 static int responseStringsNetworks(Parcel &p, void *response, size_t responselen);
@@ -269,6 +318,7 @@ extern "C" void RIL_onUnsolicitedResponse(int unsolResponse, void *data,
 static UserCallbackInfo * internalRequestTimedCallback
     (RIL_TimedCallback callback, void *param,
         const struct timeval *relativeTime);
+static bool cancelTimedCallback(UserCallbackInfo *p_info);
 
 /** Index == requestNumber */
 static CommandInfo s_commands[] = {
@@ -308,14 +358,66 @@ void RIL_setRilSocketName(char * s) {
     strncpy(rild, s, MAX_SOCKET_NAME_LENGTH);
 }
 
-static char *
-strdupReadString(Parcel &p) {
+/**
+ * Allocates from the request arena. Everything allocated is released at
+ * once by arenaReset, after the request has been dispatched.
+ * Returns NULL if the arena is exhausted.
+ */
+static void *
+arenaAlloc(size_t size) {
+    size_t offset = (s_requestArenaUsed + 7) & ~(size_t)7;
+
+    if (size > REQUEST_ARENA_SIZE - offset) {
+        RLOGE("request arena exhausted (%u + %u)",
+                (unsigned)offset, (unsigned)size);
+        return NULL;
+    }
+    s_requestArenaUsed = offset + size;
+    return s_requestArena + offset;
+}
+
+/** Allocates an array from the request arena, with count from the parcel */
+static void *
+arenaAllocArray(int32_t count, size_t size) {
+    if (count < 0 || (size_t)count > REQUEST_ARENA_SIZE / size) {
+        RLOGE("invalid array size %d", count);
+        return NULL;
+    }
+    return arenaAlloc(count * size);
+}
+
+static void
+arenaReset() {
+#ifdef MEMSET_FREED
+    memset(s_requestArena, 0, s_requestArenaUsed);
+#endif
+    s_requestArenaUsed = 0;
+}
+
+/**
+ * Reads a string into the request arena. *ps is set to NULL for a null
+ * string. Returns NO_MEMORY if the arena is exhausted, so that the caller
+ * can tell it from a null string.
+ */
+static status_t
+arenaReadString(Parcel &p, char **ps) {
     size_t stringlen;
     const char16_t *s16;
+    char *s8;
 
+    *ps = NULL;
     s16 = p.readString16Inplace(&stringlen);
+    if (s16 == NULL) {
+        return NO_ERROR;
+    }
 
-    return strndup16to8(s16, stringlen);
+    s8 = (char *)arenaAlloc(strnlen16to8(s16, stringlen) + 1);
+    if (s8 == NULL) {
+        return NO_MEMORY;
+    }
+    strncpy16to8(s8, s16, stringlen);
+    *ps = s8;
+    return NO_ERROR;
 }
 
 static void writeStringToParcel(Parcel &p, const char *s) {
@@ -327,47 +429,140 @@ static void writeStringToParcel(Parcel &p, const char *s) {
 }
 
 
-static void
-memsetString (char *s) {
-    if (s != NULL) {
-        memset (s, 0, strlen(s));
-    }
-}
-
 void   nullParcelReleaseFunction (const uint8_t* data, size_t dataSize,
                                     const size_t* objects, size_t objectsSize,
                                         void* cookie) {
     // do nothing -- the data reference lives longer than the Parcel object
 }
 
+static void
+deleteResponseBuffer(void *parcel) {
+    delete (Parcel *)parcel;
+}
+
+static void
+createResponseBufferKey() {
+    pthread_key_create(&s_responseBufferKey, deleteResponseBuffer);
+}
+
+ResponseBuffer::ResponseBuffer() {
+    pthread_once(&s_responseBufferOnce, createResponseBufferKey);
+
+    // Take the idle buffer of this thread, if any
+    mParcel = (Parcel *)pthread_getspecific(s_responseBufferKey);
+    if (mParcel != NULL) {
+        pthread_setspecific(s_responseBufferKey, NULL);
+        // keeps the capacity
+        mParcel->setDataSize(0);
+        mParcel->setDataPosition(0);
+    } else {
+        mParcel = new Parcel();
+        mParcel->setDataCapacity(RESPONSE_BUFFER_SIZE);
+    }
+
+    // filled in by sendResponse
+    mParcel->writeInt32(0);
+}
+
+ResponseBuffer::~ResponseBuffer() {
+    if (pthread_getspecific(s_responseBufferKey) == NULL) {
+        pthread_setspecific(s_responseBufferKey, mParcel);
+    } else {
+        delete mParcel;
+    }
+}
+
 /**
- * To be called from dispatch thread
- * Issue a single local request, ensuring that the response
- * is not sent back up to the command process
+ * Takes a free slot for a request. Returns NULL if all slots are pending.
  */
-static void
-issueLocalRequest(int request, void *data, int len) {
+static RequestInfo *
+allocRequestInfo(CommandInfo *pCI) {
     RequestInfo *pRI;
     int ret;
 
-    pRI = (RequestInfo *)calloc(1, sizeof(RequestInfo));
+    ret = pthread_mutex_lock(&s_pendingRequestsMutex);
+    assert (ret == 0);
 
-    pRI->local = 1;
-    pRI->token = 0xffffffff;        // token is not used in this context
-    pRI->pCI = &(s_commands[request]);
+    if (!s_requestSlotsInit) {
+        for (int i = MAX_PENDING_REQUESTS - 1; i >= 0; i--) {
+            s_requestSlots[i].p_next = s_freeRequests;
+            s_freeRequests = &s_requestSlots[i];
+        }
+        s_requestSlotsInit = 1;
+    }
+
+    pRI = s_freeRequests;
+    if (pRI != NULL) {
+        s_freeRequests = pRI->p_next;
+    }
+
+    ret = pthread_mutex_unlock(&s_pendingRequestsMutex);
+    assert (ret == 0);
+
+    if (pRI == NULL) {
+        return NULL;
+    }
+
+    pRI->pCI = pCI;
+    pRI->local = 0;
+    pRI->epoch = __sync_fetch_and_add(&s_commandsEpoch, 0);
+    // Mark pending last, once the slot is ready to be completed
+    __sync_synchronize();
+    __sync_lock_test_and_set(&pRI->gen, (pRI->gen + 1) & REQUEST_GEN_MASK);
+
+    return pRI;
+}
+
+/**
+ * Returns a slot taken by checkAndDequeueRequestInfo to the free list
+ */
+static void
+freeRequestInfo(RequestInfo *pRI) {
+    int ret;
 
     ret = pthread_mutex_lock(&s_pendingRequestsMutex);
     assert (ret == 0);
 
-    pRI->p_next = s_pendingRequests;
-    s_pendingRequests = pRI;
+    pRI->p_next = s_freeRequests;
+    s_freeRequests = pRI;
 
     ret = pthread_mutex_unlock(&s_pendingRequestsMutex);
     assert (ret == 0);
+}
+
+/**
+ * The RIL_Token handed to the vendor RIL for a pending request.
+ * Never NULL, since a pending generation is odd.
+ */
+static RIL_Token
+requestToken(RequestInfo *pRI) {
+    uintptr_t slot = pRI - s_requestSlots;
+
+    return (RIL_Token)(((uintptr_t)pRI->gen << REQUEST_SLOT_BITS) | slot);
+}
+
+/**
+ * To be called from dispatch thread
+ * Issue a single local request, ensuring that the response
+ * is not sent back up to the command process
+ */
+static void
+issueLocalRequest(int request, void *data, int len) {
+    RequestInfo *pRI;
+
+    pRI = allocRequestInfo(&(s_commands[request]));
+    if (pRI == NULL) {
+        RLOGE("C[locl]> %s: too many pending requests",
+                requestToString(request));
+        return;
+    }
+
+    pRI->local = 1;
+    pRI->token = 0xffffffff;        // token is not used in this context
 
     RLOGD("C[locl]> %s", requestToString(request));
 
-    s_callbacks.onRequest(request, data, len, pRI);
+    s_callbacks.onRequest(request, data, len, requestToken(pRI));
 }
 
 
@@ -379,7 +574,6 @@ processCommandBuffer(void *buffer, size_t buflen) {
     int32_t request;
     int32_t token;
     RequestInfo *pRI;
-    int ret;
 
     p.setData((uint8_t *) buffer, buflen);
 
@@ -392,19 +586,21 @@ processCommandBuffer(void *buffer, size_t buflen) {
         return 0;
     }
 
-    pRI = (RequestInfo *)calloc(1, sizeof(RequestInfo));
+    pRI = allocRequestInfo(&(s_commands[request]));
+    if (pRI == NULL) {
+        ResponseBuffer rb;
+        Parcel &pErr = rb.parcel();
+
+        RLOGE("too many pending requests, request %d token %d",
+                request, token);
+        pErr.writeInt32 (RESPONSE_SOLICITED);
+        pErr.writeInt32 (token);
+        pErr.writeInt32 (RIL_E_GENERIC_FAILURE);
+        sendResponse(pErr);
+        return 0;
+    }
 
     pRI->token = token;
-    pRI->pCI = &(s_commands[request]);
-
-    ret = pthread_mutex_lock(&s_pendingRequestsMutex);
-    assert (ret == 0);
-
-    pRI->p_next = s_pendingRequests;
-    s_pendingRequests = pRI;
-
-    ret = pthread_mutex_unlock(&s_pendingRequestsMutex);
-    assert (ret == 0);
 
 /*    sLastDispatchedToken = token; */
 
@@ -412,12 +608,15 @@ processCommandBuffer(void *buffer, size_t buflen) {
         s_commands[request].requestNumber == 0) {
         RLOGE("unsupported request code %d token %d", request, token);
         // FIXME this should perhaps return a response
-        RIL_onRequestComplete(pRI, RIL_E_GENERIC_FAILURE, NULL, 0);
+        RIL_onRequestComplete(requestToken(pRI), RIL_E_GENERIC_FAILURE, NULL, 0);
         return 0;
     }
 
     pRI->pCI->dispatchFunction(p, pRI);
 
+    // Decoded strings and arrays are dead once onRequest has returned
+    arenaReset();
+
     return 0;
 }
 
@@ -425,6 +624,11 @@ static void
 invalidCommandBlock (RequestInfo *pRI) {
     RLOGE("invalid command block for token %d request %s",
                 pRI->token, requestToString(pRI->pCI->requestNumber));
+
+    // No response is sent, but the slot must not leak
+    if (checkAndDequeueRequestInfo(requestToken(pRI), &pRI)) {
+        freeRequestInfo(pRI);
+    }
 }
 
 /** Callee expects NULL */
@@ -432,7 +636,7 @@ static void
 dispatchVoid (Parcel& p, RequestInfo *pRI) {
     clearPrintBuf;
     printRequest(pRI->token, pRI->pCI->requestNumber);
-    s_callbacks.onRequest(pRI->pCI->requestNumber, NULL, 0, pRI);
+    s_callbacks.onRequest(pRI->pCI->requestNumber, NULL, 0, requestToken(pRI));
 }
 
 /** Callee expects const char * */
@@ -443,7 +647,9 @@ dispatchString (Parcel& p, RequestInfo *pRI) {
     size_t stringlen;
     char *string8 = NULL;
 
-    string8 = strdupReadString(p);
+    if (arenaReadString(p, &string8) != NO_ERROR) {
+        goto invalid;
+    }
 
     startRequest;
     appendPrintBuf("%s%s", printBuf, string8);
@@ -451,13 +657,8 @@ dispatchString (Parcel& p, RequestInfo *pRI) {
     printRequest(pRI->token, pRI->pCI->requestNumber);
 
     s_callbacks.onRequest(pRI->pCI->requestNumber, string8,
-                       sizeof(char *), pRI);
+                       sizeof(char *), requestToken(pRI));
 
-#ifdef MEMSET_FREED
-    memsetString(string8);
-#endif
-
-    free(string8);
     return;
 invalid:
     invalidCommandBlock(pRI);
@@ -481,7 +682,10 @@ dispatchStrings (Parcel &p, RequestInfo *pRI) {
     startRequest;
     if (countStrings == 0) {
         // just some non-null pointer
-        pStrings = (char **)alloca(sizeof(char *));
+        pStrings = (char **)arenaAlloc(sizeof(char *));
+        if (pStrings == NULL) {
+            goto invalid;
+        }
         datalen = 0;
     } else if (((int)countStrings) == -1) {
         pStrings = NULL;
@@ -489,10 +693,15 @@ dispatchStrings (Parcel &p, RequestInfo *pRI) {
     } else {
         datalen = sizeof(char *) * countStrings;
 
-        pStrings = (char **)alloca(datalen);
+        pStrings = (char **)arenaAllocArray(countStrings, sizeof(char *));
+        if (pStrings == NULL) {
+            goto invalid;
+        }
 
         for (int i = 0 ; i < countStrings ; i++) {
-            pStrings[i] = strdupReadString(p);
+            if (arenaReadString(p, &pStrings[i]) != NO_ERROR) {
+                goto invalid;
+            }
             appendPrintBuf("%s%s,", printBuf, pStrings[i]);
         }
     }
@@ -500,20 +709,7 @@ dispatchStrings (Parcel &p, RequestInfo *pRI) {
     closeRequest;
     printRequest(pRI->token, pRI->pCI->requestNumber);
 
-    s_callbacks.onRequest(pRI->pCI->requestNumber, pStrings, datalen, pRI);
-
-    if (pStrings != NULL) {
-        for (int i = 0 ; i < countStrings ; i++) {
-#ifdef MEMSET_FREED
-            memsetString (pStrings[i]);
-#endif
-            free(pStrings[i]);
-        }
-
-#ifdef MEMSET_FREED
-        memset(pStrings, 0, datalen);
-#endif
-    }
+    s_callbacks.onRequest(pRI->pCI->requestNumber, pStrings, datalen, requestToken(pRI));
 
     return;
 invalid:
@@ -536,7 +732,10 @@ dispatchInts (Parcel &p, RequestInfo *pRI) {
     }
 
     datalen = sizeof(int) * count;
-    pInts = (int *)alloca(datalen);
+    pInts = (int *)arenaAllocArray(count, sizeof(int));
+    if (pInts == NULL) {
+        goto invalid;
+    }
 
     startRequest;
     for (int i = 0 ; i < count ; i++) {
@@ -555,11 +754,7 @@ dispatchInts (Parcel &p, RequestInfo *pRI) {
    printRequest(pRI->token, pRI->pCI->requestNumber);
 
    s_callbacks.onRequest(pRI->pCI->requestNumber, const_cast<int *>(pInts),
-                       datalen, pRI);
-
-#ifdef MEMSET_FREED
-    memset(pInts, 0, datalen);
-#endif
+                       datalen, requestToken(pRI));
 
     return;
 invalid:
@@ -585,13 +780,17 @@ dispatchSmsWrite (Parcel &p, RequestInfo *pRI) {
     status = p.readInt32(&t);
     args.status = (int)t;
 
-    args.pdu = strdupReadString(p);
+    if (arenaReadString(p, &args.pdu) != NO_ERROR) {
+        goto invalid;
+    }
 
     if (status != NO_ERROR || args.pdu == NULL) {
         goto invalid;
     }
 
-    args.smsc = strdupReadString(p);
+    if (arenaReadString(p, &args.smsc) != NO_ERROR) {
+        goto invalid;
+    }
 
     startRequest;
     appendPrintBuf("%s%d,%s,smsc=%s", printBuf, args.status,
@@ -599,13 +798,7 @@ dispatchSmsWrite (Parcel &p, RequestInfo *pRI) {
     closeRequest;
     printRequest(pRI->token, pRI->pCI->requestNumber);
 
-    s_callbacks.onRequest(pRI->pCI->requestNumber, &args, sizeof(args), pRI);
-
-#ifdef MEMSET_FREED
-    memsetString (args.pdu);
-#endif
-
-    free (args.pdu);
+    s_callbacks.onRequest(pRI->pCI->requestNumber, &args, sizeof(args), requestToken(pRI));
 
 #ifdef MEMSET_FREED
     memset(&args, 0, sizeof(args));
@@ -634,7 +827,9 @@ dispatchDial (Parcel &p, RequestInfo *pRI) {
 
     memset (&dial, 0, sizeof(dial));
 
-    dial.address = strdupReadString(p);
+    if (arenaReadString(p, &dial.address) != NO_ERROR) {
+        goto invalid;
+    }
 
     status = p.readInt32(&t);
     dial.clir = (int)t;
@@ -695,13 +890,7 @@ dispatchDial (Parcel &p, RequestInfo *pRI) {
     closeRequest;
     printRequest(pRI->token, pRI->pCI->requestNumber);
 
-    s_callbacks.onRequest(pRI->pCI->requestNumber, &dial, sizeOfDial, pRI);
-
-#ifdef MEMSET_FREED
-    memsetString (dial.address);
-#endif
-
-    free (dial.address);
+    s_callbacks.onRequest(pRI->pCI->requestNumber, &dial, sizeOfDial, requestToken(pRI));
 
 #ifdef MEMSET_FREED
     memset(&uusInfo, 0, sizeof(RIL_UUS_Info));
@@ -756,7 +945,9 @@ dispatchSIM_IO (Parcel &p, RequestInfo *pRI) {
     status = p.readInt32(&t);
     simIO.v6.fileid = (int)t;
 
-    simIO.v6.path = strdupReadString(p);
+    if (arenaReadString(p, &simIO.v6.path) != NO_ERROR) {
+        goto invalid;
+    }
 
     status = p.readInt32(&t);
     simIO.v6.p1 = (int)t;
@@ -767,9 +958,15 @@ dispatchSIM_IO (Parcel &p, RequestInfo *pRI) {
     status = p.readInt32(&t);
     simIO.v6.p3 = (int)t;
 
-    simIO.v6.data = strdupReadString(p);
-    simIO.v6.pin2 = strdupReadString(p);
-    simIO.v6.aidPtr = strdupReadString(p);
+    if (arenaReadString(p, &simIO.v6.data) != NO_ERROR) {
+        goto invalid;
+    }
+    if (arenaReadString(p, &simIO.v6.pin2) != NO_ERROR) {
+        goto invalid;
+    }
+    if (arenaReadString(p, &simIO.v6.aidPtr) != NO_ERROR) {
+        goto invalid;
+    }
 
     startRequest;
     appendPrintBuf("%scmd=0x%X,efid=0x%X,path=%s,%d,%d,%d,%s,pin2=%s,aid=%s", printBuf,
@@ -785,19 +982,7 @@ dispatchSIM_IO (Parcel &p, RequestInfo *pRI) {
     }
 
     size = (s_callbacks.version < 6) ? sizeof(simIO.v5) : sizeof(simIO.v6);
-    s_callbacks.onRequest(pRI->pCI->requestNumber, &simIO, size, pRI);
-
-#ifdef MEMSET_FREED
-    memsetString (simIO.v6.path);
-    memsetString (simIO.v6.data);
-    memsetString (simIO.v6.pin2);
-    memsetString (simIO.v6.aidPtr);
-#endif
-
-    free (simIO.v6.path);
-    free (simIO.v6.data);
-    free (simIO.v6.pin2);
-    free (simIO.v6.aidPtr);
+    s_callbacks.onRequest(pRI->pCI->requestNumber, &simIO, size, requestToken(pRI));
 
 #ifdef MEMSET_FREED
     memset(&simIO, 0, sizeof(simIO));
@@ -841,7 +1026,9 @@ dispatchCallForward(Parcel &p, RequestInfo *pRI) {
     status = p.readInt32(&t);
     cff.toa = (int)t;
 
-    cff.number = strdupReadString(p);
+    if (arenaReadString(p, &cff.number) != NO_ERROR) {
+        goto invalid;
+    }
 
     status = p.readInt32(&t);
     cff.timeSeconds = (int)t;
@@ -863,13 +1050,7 @@ dispatchCallForward(Parcel &p, RequestInfo *pRI) {
     closeRequest;
     printRequest(pRI->token, pRI->pCI->requestNumber);
 
-    s_callbacks.onRequest(pRI->pCI->requestNumber, &cff, sizeof(cff), pRI);
-
-#ifdef MEMSET_FREED
-    memsetString(cff.number);
-#endif
-
-    free (cff.number);
+    s_callbacks.onRequest(pRI->pCI->requestNumber, &cff, sizeof(cff), requestToken(pRI));
 
 #ifdef MEMSET_FREED
     memset(&cff, 0, sizeof(cff));
@@ -907,7 +1088,7 @@ dispatchRaw(Parcel &p, RequestInfo *pRI) {
     closeRequest;
     printRequest(pRI->token, pRI->pCI->requestNumber);
 
-    s_callbacks.onRequest(pRI->pCI->requestNumber, const_cast<void *>(data), len, pRI);
+    s_callbacks.onRequest(pRI->pCI->requestNumber, const_cast<void *>(data), len, requestToken(pRI));
 
     return;
 invalid:
@@ -1004,7 +1185,7 @@ dispatchCdmaSms(Parcel &p, RequestInfo *pRI) {
         goto invalid;
     }
 
-    s_callbacks.onRequest(pRI->pCI->requestNumber, &rcsm, sizeof(rcsm),pRI);
+    s_callbacks.onRequest(pRI->pCI->requestNumber, &rcsm, sizeof(rcsm),requestToken(pRI));
 
 #ifdef MEMSET_FREED
     memset(&rcsm, 0, sizeof(rcsm));
@@ -1035,7 +1216,7 @@ dispatchImsCdmaSms(Parcel &p, RequestInfo *pRI, uint8_t retry, int32_t messageRe
 
     s_callbacks.onRequest(pRI->pCI->requestNumber, &rism,
             sizeof(RIL_RadioTechnologyFamily)+sizeof(uint8_t)+sizeof(int32_t)
-            +sizeof(rcsm),pRI);
+            +sizeof(rcsm),requestToken(pRI));
 
 #ifdef MEMSET_FREED
     memset(&rcsm, 0, sizeof(rcsm));
@@ -1073,7 +1254,10 @@ dispatchImsGsmSms(Parcel &p, RequestInfo *pRI, uint8_t retry, int32_t messageRef
     appendPrintBuf("%sformat=%d,", printBuf, rism.format);
     if (countStrings == 0) {
         // just some non-null pointer
-        pStrings = (char **)alloca(sizeof(char *));
+        pStrings = (char **)arenaAlloc(sizeof(char *));
+        if (pStrings == NULL) {
+            goto invalid;
+        }
         datalen = 0;
     } else if (((int)countStrings) == -1) {
         pStrings = NULL;
@@ -1081,10 +1265,15 @@ dispatchImsGsmSms(Parcel &p, RequestInfo *pRI, uint8_t retry, int32_t messageRef
     } else {
         datalen = sizeof(char *) * countStrings;
 
-        pStrings = (char **)alloca(datalen);
+        pStrings = (char **)arenaAllocArray(countStrings, sizeof(char *));
+        if (pStrings == NULL) {
+            goto invalid;
+        }
 
         for (int i = 0 ; i < countStrings ; i++) {
-            pStrings[i] = strdupReadString(p);
+            if (arenaReadString(p, &pStrings[i]) != NO_ERROR) {
+                goto invalid;
+            }
             appendPrintBuf("%s%s,", printBuf, pStrings[i]);
         }
     }
@@ -1095,20 +1284,7 @@ dispatchImsGsmSms(Parcel &p, RequestInfo *pRI, uint8_t retry, int32_t messageRef
     rism.message.gsmMessage = pStrings;
     s_callbacks.onRequest(pRI->pCI->requestNumber, &rism,
             sizeof(RIL_RadioTechnologyFamily)+sizeof(uint8_t)+sizeof(int32_t)
-            +datalen, pRI);
-
-    if (pStrings != NULL) {
-        for (int i = 0 ; i < countStrings ; i++) {
-#ifdef MEMSET_FREED
-            memsetString (pStrings[i]);
-#endif
-            free(pStrings[i]);
-        }
-
-#ifdef MEMSET_FREED
-        memset(pStrings, 0, datalen);
-#endif
-    }
+            +datalen, requestToken(pRI));
 
 #ifdef MEMSET_FREED
     memset(&rism, 0, sizeof(rism));
@@ -1186,7 +1362,7 @@ dispatchCdmaSmsAck(Parcel &p, RequestInfo *pRI) {
 
     printRequest(pRI->token, pRI->pCI->requestNumber);
 
-    s_callbacks.onRequest(pRI->pCI->requestNumber, &rcsa, sizeof(rcsa),pRI);
+    s_callbacks.onRequest(pRI->pCI->requestNumber, &rcsa, sizeof(rcsa),requestToken(pRI));
 
 #ifdef MEMSET_FREED
     memset(&rcsa, 0, sizeof(rcsa));
@@ -1211,8 +1387,16 @@ dispatchGsmBrSmsCnf(Parcel &p, RequestInfo *pRI) {
     }
 
     {
-        RIL_GSM_BroadcastSmsConfigInfo gsmBci[num];
-        RIL_GSM_BroadcastSmsConfigInfo *gsmBciPtrs[num];
+        RIL_GSM_BroadcastSmsConfigInfo *gsmBci;
+        RIL_GSM_BroadcastSmsConfigInfo **gsmBciPtrs;
+
+        gsmBci = (RIL_GSM_BroadcastSmsConfigInfo *)
+                arenaAllocArray(num, sizeof(RIL_GSM_BroadcastSmsConfigInfo));
+        gsmBciPtrs = (RIL_GSM_BroadcastSmsConfigInfo **)
+                arenaAllocArray(num, sizeof(RIL_GSM_BroadcastSmsConfigInfo *));
+        if (gsmBci == NULL || gsmBciPtrs == NULL) {
+            goto invalid;
+        }
 
         startRequest;
         for (int i = 0 ; i < num ; i++ ) {
@@ -1248,12 +1432,7 @@ dispatchGsmBrSmsCnf(Parcel &p, RequestInfo *pRI) {
         s_callbacks.onRequest(pRI->pCI->requestNumber,
                               gsmBciPtrs,
                               num * sizeof(RIL_GSM_BroadcastSmsConfigInfo *),
-                              pRI);
-
-#ifdef MEMSET_FREED
-        memset(gsmBci, 0, num * sizeof(RIL_GSM_BroadcastSmsConfigInfo));
-        memset(gsmBciPtrs, 0, num * sizeof(RIL_GSM_BroadcastSmsConfigInfo *));
-#endif
+                              requestToken(pRI));
     }
 
     return;
@@ -1275,8 +1454,16 @@ dispatchCdmaBrSmsCnf(Parcel &p, RequestInfo *pRI) {
     }
 
     {
-        RIL_CDMA_BroadcastSmsConfigInfo cdmaBci[num];
-        RIL_CDMA_BroadcastSmsConfigInfo *cdmaBciPtrs[num];
+        RIL_CDMA_BroadcastSmsConfigInfo *cdmaBci;
+        RIL_CDMA_BroadcastSmsConfigInfo **cdmaBciPtrs;
+
+        cdmaBci = (RIL_CDMA_BroadcastSmsConfigInfo *)
+                arenaAllocArray(num, sizeof(RIL_CDMA_BroadcastSmsConfigInfo));
+        cdmaBciPtrs = (RIL_CDMA_BroadcastSmsConfigInfo **)
+                arenaAllocArray(num, sizeof(RIL_CDMA_BroadcastSmsConfigInfo *));
+        if (cdmaBci == NULL || cdmaBciPtrs == NULL) {
+            goto invalid;
+        }
 
         startRequest;
         for (int i = 0 ; i < num ; i++ ) {
@@ -1304,12 +1491,7 @@ dispatchCdmaBrSmsCnf(Parcel &p, RequestInfo *pRI) {
         s_callbacks.onRequest(pRI->pCI->requestNumber,
                               cdmaBciPtrs,
                               num * sizeof(RIL_CDMA_BroadcastSmsConfigInfo *),
-                              pRI);
-
-#ifdef MEMSET_FREED
-        memset(cdmaBci, 0, num * sizeof(RIL_CDMA_BroadcastSmsConfigInfo));
-        memset(cdmaBciPtrs, 0, num * sizeof(RIL_CDMA_BroadcastSmsConfigInfo *));
-#endif
+                              requestToken(pRI));
     }
 
     return;
@@ -1400,7 +1582,7 @@ static void dispatchRilCdmaSmsWriteArgs(Parcel &p, RequestInfo *pRI) {
 
     printRequest(pRI->token, pRI->pCI->requestNumber);
 
-    s_callbacks.onRequest(pRI->pCI->requestNumber, &rcsw, sizeof(rcsw),pRI);
+    s_callbacks.onRequest(pRI->pCI->requestNumber, &rcsw, sizeof(rcsw),requestToken(pRI));
 
 #ifdef MEMSET_FREED
     memset(&rcsw, 0, sizeof(rcsw));
@@ -1449,7 +1631,7 @@ static void dispatchVoiceRadioTech(Parcel& p, RequestInfo *pRI) {
     RIL_RadioState state = s_callbacks.onStateRequest();
 
     if ((RADIO_STATE_UNAVAILABLE == state) || (RADIO_STATE_OFF == state)) {
-        RIL_onRequestComplete(pRI, RIL_E_RADIO_NOT_AVAILABLE, NULL, 0);
+        RIL_onRequestComplete(requestToken(pRI), RIL_E_RADIO_NOT_AVAILABLE, NULL, 0);
     }
 
     // RILs that support RADIO_STATE_ON should support this request.
@@ -1464,9 +1646,9 @@ static void dispatchVoiceRadioTech(Parcel& p, RequestInfo *pRI) {
     voiceRadioTech = decodeVoiceRadioTechnology(state);
 
     if (voiceRadioTech < 0)
-        RIL_onRequestComplete(pRI, RIL_E_GENERIC_FAILURE, NULL, 0);
+        RIL_onRequestComplete(requestToken(pRI), RIL_E_GENERIC_FAILURE, NULL, 0);
     else
-        RIL_onRequestComplete(pRI, RIL_E_SUCCESS, &voiceRadioTech, sizeof(int));
+        RIL_onRequestComplete(requestToken(pRI), RIL_E_SUCCESS, &voiceRadioTech, sizeof(int));
 }
 
 // For backwards compatibility in RIL_REQUEST_CDMA_GET_SUBSCRIPTION_SOURCE:.
@@ -1476,7 +1658,7 @@ static void dispatchCdmaSubscriptionSource(Parcel& p, RequestInfo *pRI) {
     RIL_RadioState state = s_callbacks.onStateRequest();
 
     if ((RADIO_STATE_UNAVAILABLE == state) || (RADIO_STATE_OFF == state)) {
-        RIL_onRequestComplete(pRI, RIL_E_RADIO_NOT_AVAILABLE, NULL, 0);
+        RIL_onRequestComplete(requestToken(pRI), RIL_E_RADIO_NOT_AVAILABLE, NULL, 0);
     }
 
     // RILs that support RADIO_STATE_ON should support this request.
@@ -1491,9 +1673,9 @@ static void dispatchCdmaSubscriptionSource(Parcel& p, RequestInfo *pRI) {
     cdmaSubscriptionSource = decodeCdmaSubscriptionSource(state);
 
     if (cdmaSubscriptionSource < 0)
-        RIL_onRequestComplete(pRI, RIL_E_GENERIC_FAILURE, NULL, 0);
+        RIL_onRequestComplete(requestToken(pRI), RIL_E_GENERIC_FAILURE, NULL, 0);
     else
-        RIL_onRequestComplete(pRI, RIL_E_SUCCESS, &cdmaSubscriptionSource, sizeof(int));
+        RIL_onRequestComplete(requestToken(pRI), RIL_E_SUCCESS, &cdmaSubscriptionSource, sizeof(int));
 }
 
 static void dispatchSetInitialAttachApn(Parcel &p, RequestInfo *pRI)
@@ -1504,14 +1686,22 @@ static void dispatchSetInitialAttachApn(Parcel &p, RequestInfo *pRI)
 
     memset(&pf, 0, sizeof(pf));
 
-    pf.apn = strdupReadString(p);
-    pf.protocol = strdupReadString(p);
+    if (arenaReadString(p, &pf.apn) != NO_ERROR) {
+        goto invalid;
+    }
+    if (arenaReadString(p, &pf.protocol) != NO_ERROR) {
+        goto invalid;
+    }
 
     status = p.readInt32(&t);
     pf.authtype = (int) t;
 
-    pf.username = strdupReadString(p);
-    pf.password = strdupReadString(p);
+    if (arenaReadString(p, &pf.username) != NO_ERROR) {
+        goto invalid;
+    }
+    if (arenaReadString(p, &pf.password) != NO_ERROR) {
+        goto invalid;
+    }
 
     startRequest;
     appendPrintBuf("%sapn=%s, protocol=%s, auth_type=%d, username=%s, password=%s",
@@ -1522,19 +1712,7 @@ static void dispatchSetInitialAttachApn(Parcel &p, RequestInfo *pRI)
     if (status != NO_ERROR) {
         goto invalid;
     }
-    s_callbacks.onRequest(pRI->pCI->requestNumber, &pf, sizeof(pf), pRI);
-
-#ifdef MEMSET_FREED
-    memsetString(pf.apn);
-    memsetString(pf.protocol);
-    memsetString(pf.username);
-    memsetString(pf.password);
-#endif
-
-    free(pf.apn);
-    free(pf.protocol);
-    free(pf.username);
-    free(pf.password);
+    s_callbacks.onRequest(pRI->pCI->requestNumber, &pf, sizeof(pf), requestToken(pRI));
 
 #ifdef MEMSET_FREED
     memset(&pf, 0, sizeof(pf));
@@ -1584,7 +1762,7 @@ static void dispatchUiccSubscripton(Parcel &p, RequestInfo *pRI) {
     closeRequest;
     printRequest(pRI->token, pRI->pCI->requestNumber);
 
-    s_callbacks.onRequest(pRI->pCI->requestNumber, &uicc_sub, sizeof(uicc_sub), pRI);
+    s_callbacks.onRequest(pRI->pCI->requestNumber, &uicc_sub, sizeof(uicc_sub), requestToken(pRI));
 
 #ifdef MEMSET_FREED
     memset(&uicc_sub, 0, sizeof(uicc_sub));
@@ -1597,36 +1775,38 @@ invalid:
 }
 
 static int
-blockingWrite(int fd, const void *buffer, size_t len) {
-    size_t writeOffset = 0;
-    const uint8_t *toWrite;
-
-    toWrite = (const uint8_t *)buffer;
-
-    while (writeOffset < len) {
+blockingWritev(int fd, struct iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
         ssize_t written;
         do {
-            written = write (fd, toWrite + writeOffset,
-                                len - writeOffset);
+            written = writev (fd, iov, iovcnt);
         } while (written < 0 && ((errno == EINTR) || (errno == EAGAIN)));
 
-        if (written >= 0) {
-            writeOffset += written;
-        } else {   // written < 0
+        if (written < 0) {
             RLOGE ("RIL Response: unexpected error on write errno:%d", errno);
             close(fd);
             return -1;
         }
+
+        // skip what has been written
+        while (iovcnt > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
     }
 
     return 0;
 }
 
 static int
-sendResponseRaw (const void *data, size_t dataSize) {
+sendResponseIov (struct iovec *iov, int iovcnt, size_t dataSize) {
     int fd = s_fdCommand;
     int ret;
-    uint32_t header;
 
     if (s_fdCommand < 0) {
         return -1;
@@ -1641,31 +1821,52 @@ sendResponseRaw (const void *data, size_t dataSize) {
 
     pthread_mutex_lock(&s_writeMutex);
 
-    header = htonl(dataSize);
+    ret = blockingWritev(fd, iov, iovcnt);
 
-    ret = blockingWrite(fd, (void *)&header, sizeof(header));
+    pthread_mutex_unlock(&s_writeMutex);
 
-    if (ret < 0) {
-        pthread_mutex_unlock(&s_writeMutex);
-        return ret;
-    }
+    return ret;
+}
 
-    ret = blockingWrite(fd, data, dataSize);
+/**
+ * Sends a payload in an external buffer. The header and the payload go
+ * out with a single writev.
+ */
+static int
+sendResponseRaw (const void *data, size_t dataSize) {
+    uint32_t header;
+    struct iovec iov[2];
 
-    if (ret < 0) {
-        pthread_mutex_unlock(&s_writeMutex);
-        return ret;
-    }
+    header = htonl(dataSize);
 
-    pthread_mutex_unlock(&s_writeMutex);
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = const_cast<void *>(data);
+    iov[1].iov_len = dataSize;
 
-    return 0;
+    return sendResponseIov(iov, 2, dataSize);
 }
 
+/**
+ * Sends a response built in a ResponseBuffer. The header is filled in the
+ * reserved space, and the whole frame goes out with a single write.
+ */
 static int
 sendResponse (Parcel &p) {
+    size_t pos = p.dataPosition();
+    size_t dataSize = p.dataSize() - RESPONSE_HEADER_SIZE;
+    struct iovec iov;
+
     printResponse;
-    return sendResponseRaw(p.data(), p.dataSize());
+
+    p.setDataPosition(0);
+    p.writeInt32(htonl(dataSize));
+    p.setDataPosition(pos);
+
+    iov.iov_base = const_cast<uint8_t *>(p.data());
+    iov.iov_len = p.dataSize();
+
+    return sendResponseIov(&iov, 1, dataSize);
 }
 
 /** response is an int* pointing to an array of ints*/
@@ -2982,25 +3183,9 @@ static void processWakeupCallback(int fd, short flags, void *param) {
 }
 
 static void onCommandsSocketClosed() {
-    int ret;
-    RequestInfo *p_cur;
-
-    /* mark pending requests as "cancelled" so we dont report responses */
-
-    ret = pthread_mutex_lock(&s_pendingRequestsMutex);
-    assert (ret == 0);
-
-    p_cur = s_pendingRequests;
-
-    for (p_cur = s_pendingRequests
-            ; p_cur != NULL
-            ; p_cur  = p_cur->p_next
-    ) {
-        p_cur->cancelled = 1;
-    }
-
-    ret = pthread_mutex_unlock(&s_pendingRequestsMutex);
-    assert (ret == 0);
+    /* a new epoch marks pending requests as "cancelled" so we dont
+       report responses */
+    __sync_fetch_and_add(&s_commandsEpoch, 1);
 }
 
 static void processCommandsCallback(int fd, short flags, void *param) {
@@ -3035,11 +3220,12 @@ static void processCommandsCallback(int fd, short flags, void *param) {
             RLOGW("EOS.  Closing command socket.");
         }
 
+        // before the fd number can be reused
+        ril_event_del(&s_commands_event);
+
         close(s_fdCommand);
         s_fdCommand = -1;
 
-        ril_event_del(&s_commands_event);
-
         record_stream_free(p_rs);
 
         /* start listening for new connections again */
@@ -3227,7 +3413,8 @@ static void debugCallback (int fd, short flags, void *param) {
             RLOGI ("Connection on debug port: issuing radio power off.");
             data = 0;
             issueLocalRequest(RIL_REQUEST_RADIO_POWER, &data, sizeof(int));
-            // Close the socket
+            // Close the socket, after its watch is deleted
+            ril_event_del(&s_commands_event);
             close(s_fdCommand);
             s_fdCommand = -1;
             break;
@@ -3301,6 +3488,35 @@ static void debugCallback (int fd, short flags, void *param) {
 }
 
 
+/**
+ * Timer nodes are recycled through a free list, since a timer is
+ * scheduled for every wake lock timeout and by the vendor RIL.
+ */
+static UserCallbackInfo *
+allocUserCallbackInfo() {
+    UserCallbackInfo *p_info;
+
+    pthread_mutex_lock(&s_userCallbackMutex);
+    p_info = s_freeUserCallbacks;
+    if (p_info != NULL) {
+        s_freeUserCallbacks = p_info->p_next;
+    }
+    pthread_mutex_unlock(&s_userCallbackMutex);
+
+    if (p_info == NULL) {
+        p_info = (UserCallbackInfo *) malloc (sizeof(UserCallbackInfo));
+    }
+    return p_info;
+}
+
+static void
+freeUserCallbackInfo(UserCallbackInfo *p_info) {
+    pthread_mutex_lock(&s_userCallbackMutex);
+    p_info->p_next = s_freeUserCallbacks;
+    s_freeUserCallbacks = p_info;
+    pthread_mutex_unlock(&s_userCallbackMutex);
+}
+
 static void userTimerCallback (int fd, short flags, void *param) {
     UserCallbackInfo *p_info;
 
@@ -3308,13 +3524,13 @@ static void userTimerCallback (int fd, short flags, void *param) {
 
     p_info->p_callback(p_info->userParam);
 
-
-    // FIXME generalize this...there should be a cancel mechanism
-    if (s_last_wake_timeout_info != NULL && s_last_wake_timeout_info == p_info) {
+    pthread_mutex_lock(&s_wakeTimeoutMutex);
+    if (s_last_wake_timeout_info == p_info) {
         s_last_wake_timeout_info = NULL;
     }
+    pthread_mutex_unlock(&s_wakeTimeoutMutex);
 
-    free(p_info);
+    freeUserCallbackInfo(p_info);
 }
 
 
@@ -3506,31 +3722,29 @@ RIL_register (const RIL_RadioFunctions *callbacks) {
 
 }
 
+/**
+ * Validates a token and takes its slot out of the pending state. Only one
+ * caller succeeds for a token, and a stale token never matches, since the
+ * generation of the slot has moved on.
+ */
 static int
-checkAndDequeueRequestInfo(struct RequestInfo *pRI) {
-    int ret = 0;
+checkAndDequeueRequestInfo(RIL_Token t, RequestInfo **ppRI) {
+    uintptr_t value = (uintptr_t)t;
+    uint32_t gen = (uint32_t)(value >> REQUEST_SLOT_BITS);
+    RequestInfo *pRI = &s_requestSlots[value & (MAX_PENDING_REQUESTS - 1)];
 
-    if (pRI == NULL) {
+    if ((gen & 1) == 0) {
+        // NULL, or not a token of a pending request
         return 0;
     }
 
-    pthread_mutex_lock(&s_pendingRequestsMutex);
-
-    for(RequestInfo **ppCur = &s_pendingRequests
-        ; *ppCur != NULL
-        ; ppCur = &((*ppCur)->p_next)
-    ) {
-        if (pRI == *ppCur) {
-            ret = 1;
-
-            *ppCur = (*ppCur)->p_next;
-            break;
-        }
+    if (!__sync_bool_compare_and_swap(&pRI->gen, gen,
+            (gen + 1) & REQUEST_GEN_MASK)) {
+        return 0;
     }
 
-    pthread_mutex_unlock(&s_pendingRequestsMutex);
-
-    return ret;
+    *ppRI = pRI;
+    return 1;
 }
 
 
@@ -3540,9 +3754,7 @@ RIL_onRequestComplete(RIL_Token t, RIL_Errno e, void *response, size_t responsel
     int ret;
     size_t errorOffset;
 
-    pRI = (RequestInfo *)t;
-
-    if (!checkAndDequeueRequestInfo(pRI)) {
+    if (!checkAndDequeueRequestInfo(t, &pRI)) {
         RLOGE ("RIL_onRequestComplete: invalid RIL_Token");
         return;
     }
@@ -3558,8 +3770,9 @@ RIL_onRequestComplete(RIL_Token t, RIL_Errno e, void *response, size_t responsel
     appendPrintBuf("[%04d]< %s",
         pRI->token, requestToString(pRI->pCI->requestNumber));
 
-    if (pRI->cancelled == 0) {
-        Parcel p;
+    if (pRI->epoch == __sync_fetch_and_add(&s_commandsEpoch, 0)) {
+        ResponseBuffer rb;
+        Parcel &p = rb.parcel();
 
         p.writeInt32 (RESPONSE_SOLICITED);
         p.writeInt32 (pRI->token);
@@ -3589,7 +3802,7 @@ RIL_onRequestComplete(RIL_Token t, RIL_Errno e, void *response, size_t responsel
     }
 
 done:
-    free(pRI);
+    freeRequestInfo(pRI);
 }
 
 
@@ -3604,18 +3817,22 @@ releaseWakeLock() {
 }
 
 /**
- * Timer callback to put us back to sleep before the default timeout
+ * Timer callback to put us back to sleep before the default timeout.
+ * param is the generation of the timeout. A timeout which could not be
+ * cancelled because it was already firing is stale, and must not release
+ * the wake lock taken for a newer response.
  */
 static void
 wakeTimeoutCallback (void *param) {
-    // We're using "param != NULL" as a cancellation mechanism
-    if (param == NULL) {
+    pthread_mutex_lock(&s_wakeTimeoutMutex);
+    if ((uint32_t)(uintptr_t)param == s_wakeTimeoutGen) {
         //RLOGD("wakeTimeout: releasing wake lock");
 
         releaseWakeLock();
     } else {
         //RLOGD("wakeTimeout: releasing wake lock CANCELLED");
     }
+    pthread_mutex_unlock(&s_wakeTimeoutMutex);
 }
 
 static int
@@ -3810,7 +4027,8 @@ void RIL_onUnsolicitedResponse(int unsolResponse, const void *data,
 
     appendPrintBuf("[UNSL]< %s", requestToString(unsolResponse));
 
-    Parcel p;
+    ResponseBuffer rb;
+    Parcel &p = rb.parcel();
 
     p.writeInt32 (RESPONSE_UNSOLICITED);
     p.writeInt32 (unsolResponse);
@@ -3855,23 +4073,32 @@ void RIL_onUnsolicitedResponse(int unsolResponse, const void *data,
             s_lastNITZTimeData = NULL;
         }
 
-        s_lastNITZTimeData = malloc(p.dataSize());
-        s_lastNITZTimeDataSize = p.dataSize();
-        memcpy(s_lastNITZTimeData, p.data(), p.dataSize());
+        // without the header, which sendResponseRaw adds again
+        s_lastNITZTimeDataSize = p.dataSize() - RESPONSE_HEADER_SIZE;
+        s_lastNITZTimeData = malloc(s_lastNITZTimeDataSize);
+        memcpy(s_lastNITZTimeData, p.data() + RESPONSE_HEADER_SIZE,
+                s_lastNITZTimeDataSize);
     }
 
     // For now, we automatically go back to sleep after TIMEVAL_WAKE_TIMEOUT
     // FIXME The java code should handshake here to release wake lock
 
     if (shouldScheduleTimeout) {
-        // Cancel the previous request
+        pthread_mutex_lock(&s_wakeTimeoutMutex);
+
+        // Cancel the previous request. If it is already firing, the new
+        // generation makes it skip the release.
         if (s_last_wake_timeout_info != NULL) {
-            s_last_wake_timeout_info->userParam = (void *)1;
+            cancelTimedCallback(s_last_wake_timeout_info);
         }
+        s_wakeTimeoutGen++;
 
         s_last_wake_timeout_info
-            = internalRequestTimedCallback(wakeTimeoutCallback, NULL,
+            = internalRequestTimedCallback(wakeTimeoutCallback,
+                                            (void *)(uintptr_t)s_wakeTimeoutGen,
                                             &TIMEVAL_WAKE_TIMEOUT);
+
+        pthread_mutex_unlock(&s_wakeTimeoutMutex);
     }
 
     // Normal exit
@@ -3883,9 +4110,10 @@ error_exit:
     }
 }
 
-/** FIXME generalize this if you track UserCAllbackInfo, clear it
-    when the callback occurs
-*/
+/**
+ * Returns a handle which may be passed to cancelTimedCallback until the
+ * callback occurs
+ */
 static UserCallbackInfo *
 internalRequestTimedCallback (RIL_TimedCallback callback, void *param,
                                 const struct timeval *relativeTime)
@@ -3893,7 +4121,11 @@ internalRequestTimedCallback (RIL_TimedCallback callback, void *param,
     struct timeval myRelativeTime;
     UserCallbackInfo *p_info;
 
-    p_info = (UserCallbackInfo *) malloc (sizeof(UserCallbackInfo));
+    p_info = allocUserCallbackInfo();
+    if (p_info == NULL) {
+        RLOGE("Memory allocation failed in internalRequestTimedCallback");
+        return NULL;
+    }
 
     p_info->p_callback = callback;
     p_info->userParam = param;
@@ -3908,12 +4140,27 @@ internalRequestTimedCallback (RIL_TimedCallback callback, void *param,
 
     ril_event_set(&(p_info->event), -1, false, userTimerCallback, p_info);
 
+    // The timer wakes up the event loop by itself
     ril_timer_add(&(p_info->event), &myRelativeTime);
 
-    triggerEvLoop();
     return p_info;
 }
 
+/**
+ * Cancels a timed callback. Returns false if the callback has already
+ * been taken for firing, in which case the handle is released after it
+ * returns.
+ */
+static bool
+cancelTimedCallback (UserCallbackInfo *p_info)
+{
+    if (!ril_timer_del(&(p_info->event))) {
+        return false;
+    }
+    freeUserCallbackInfo(p_info);
+    return true;
+}
+
 
 extern "C" void
 RIL_requestTimedCallback (RIL_TimedCallback callback, void *param,
@@ -24,7 +24,10 @@
 #include <utils/Log.h>
 #include <ril_event.h>
 #include <string.h>
+#include <stdint.h>
+#include <sys/epoll.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
 #include <time.h>
 
 #include <pthread.h>
@@ -65,11 +68,34 @@ static pthread_mutex_t listMutex;
     } while(0);
 #endif
 
-static fd_set readFds;
-static int nfds = 0;
+static int epollFd = -1;
+static int nwatch = 0;
+
+// Watches are kept in watch_table at ev->index, and registered with epoll
+// by a token of the index and the generation of the slot. A ready token
+// is looked up in the table before its event is touched, so an event
+// deleted (and maybe freed) after epoll_wait returned is never used.
+// Token 0 is the timerfd, since generations start at 1.
+#define WATCH_TABLE_INIT 8
+#define TIMER_TOKEN 0
+struct watch_slot {
+    struct ril_event * ev;  // NULL while free
+    uint32_t gen;           // bumped when the slot is freed
+    int next_free;
+};
+static struct watch_slot * watch_table = NULL;
+static int watch_size = 0;
+static int watch_free = -1;
+
+// Timers are kept in a min-heap ordered by (timeout, seq), and the
+// timerfd is armed with the first one.
+#define TIMER_HEAP_INIT 16
+static int timerFd = -1;
+static struct ril_event ** timer_heap = NULL;
+static int timer_count = 0;
+static int timer_size = 0;
+static unsigned timer_seq = 0;
 
-static struct ril_event * watch_table[MAX_FD_EVENTS];
-static struct ril_event timer_list;
 static struct ril_event pending_list;
 
 #define DEBUG 0
@@ -82,6 +108,7 @@ static void dump_event(struct ril_event * ev)
     dlog("     next    = %x", (unsigned int)ev->next);
     dlog("     prev    = %x", (unsigned int)ev->prev);
     dlog("     fd      = %d", ev->fd);
+    dlog("     index   = %d", ev->index);
     dlog("     pers    = %d", ev->persist);
     dlog("     timeout = %ds + %dus", (int)ev->timeout.tv_sec, (int)ev->timeout.tv_usec);
     dlog("     func    = %x", (unsigned int)ev->func);
@@ -93,16 +120,13 @@ static void dump_event(struct ril_event * ev)
 #define dump_event(x) do {} while(0)
 #endif
 
+// Timers must not jump with the wall clock, so always monotonic
 static void getNow(struct timeval * tv)
 {
-#ifdef HAVE_POSIX_CLOCKS
     struct timespec ts;
     clock_gettime(CLOCK_MONOTONIC, &ts);
     tv->tv_sec = ts.tv_sec;
     tv->tv_usec = ts.tv_nsec/1000;
-#else
-    gettimeofday(tv, NULL);
-#endif
 }
 
 static void init_list(struct ril_event * list)
@@ -134,25 +158,189 @@ static void removeFromList(struct ril_event * ev)
 }
 
 
-static void removeWatch(struct ril_event * ev, int index)
+static uint64_t watchToken(int index)
+{
+    return ((uint64_t)watch_table[index].gen << 32) | (uint32_t)index;
+}
+
+// Find the live event of a ready token, or NULL for the timerfd and for
+// a watch deleted since epoll_wait returned
+static struct ril_event * lookupWatch(uint64_t token)
 {
-    watch_table[index] = NULL;
+    uint32_t index = (uint32_t)token;
+
+    if (token == TIMER_TOKEN || index >= (uint32_t)watch_size
+            || watch_table[index].gen != (uint32_t)(token >> 32)) {
+        return NULL;
+    }
+    return watch_table[index].ev;
+}
+
+static int allocWatch(struct ril_event * ev)
+{
+    int index;
+
+    if (watch_free < 0) {
+        int size = (watch_size > 0) ? watch_size * 2 : WATCH_TABLE_INIT;
+        struct watch_slot * table = (struct watch_slot *)
+                realloc(watch_table, size * sizeof(struct watch_slot));
+        if (table == NULL) {
+            RLOGE("ril_event: out of memory for %d watches", size);
+            return -1;
+        }
+        for (int i = size - 1; i >= watch_size; i--) {
+            table[i].ev = NULL;
+            table[i].gen = 1;
+            table[i].next_free = watch_free;
+            watch_free = i;
+        }
+        watch_table = table;
+        watch_size = size;
+    }
+    index = watch_free;
+    watch_free = watch_table[index].next_free;
+    watch_table[index].ev = ev;
+    return index;
+}
+
+static void freeWatch(int index)
+{
+    watch_table[index].ev = NULL;
+    if (++watch_table[index].gen == 0) {
+        watch_table[index].gen = 1;
+    }
+    watch_table[index].next_free = watch_free;
+    watch_free = index;
+}
+
+// The fd must still be open: once it is closed, its number may be reused
+// by an fd which is added again, and the DEL would remove that one.
+static void removeWatch(struct ril_event * ev)
+{
+    if (epoll_ctl(epollFd, EPOLL_CTL_DEL, ev->fd, NULL) < 0) {
+        RLOGE("ril_event: epoll_ctl(DEL, %d) error (%d)", ev->fd, errno);
+    }
+    freeWatch(ev->index);
     ev->index = -1;
+    nwatch--;
+    dlog("~~~~ nwatch = %d ~~~~", nwatch);
+}
 
-    FD_CLR(ev->fd, &readFds);
+static bool timerBefore(struct ril_event * a, struct ril_event * b)
+{
+    if (timercmp(&a->timeout, &b->timeout, !=)) {
+        return timercmp(&a->timeout, &b->timeout, <);
+    }
+    // same timeout; first added fires first
+    return (int)(a->seq - b->seq) < 0;
+}
 
-    if (ev->fd+1 == nfds) {
-        int n = 0;
+static void heapSet(int i, struct ril_event * ev)
+{
+    timer_heap[i] = ev;
+    ev->index = i;
+}
 
-        for (int i = 0; i < MAX_FD_EVENTS; i++) {
-            struct ril_event * rev = watch_table[i];
+static void heapSiftUp(int i)
+{
+    struct ril_event * ev = timer_heap[i];
 
-            if ((rev != NULL) && (rev->fd > n)) {
-                n = rev->fd;
-            }
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!timerBefore(ev, timer_heap[parent])) {
+            break;
+        }
+        heapSet(i, timer_heap[parent]);
+        i = parent;
+    }
+    heapSet(i, ev);
+}
+
+static void heapSiftDown(int i)
+{
+    struct ril_event * ev = timer_heap[i];
+
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= timer_count) {
+            break;
+        }
+        if (child + 1 < timer_count
+                && timerBefore(timer_heap[child + 1], timer_heap[child])) {
+            child++;
+        }
+        if (!timerBefore(timer_heap[child], ev)) {
+            break;
+        }
+        heapSet(i, timer_heap[child]);
+        i = child;
+    }
+    heapSet(i, ev);
+}
+
+static bool heapInsert(struct ril_event * ev)
+{
+    if (timer_count == timer_size) {
+        int size = (timer_size > 0) ? timer_size * 2 : TIMER_HEAP_INIT;
+        struct ril_event ** heap = (struct ril_event **)
+                realloc(timer_heap, size * sizeof(struct ril_event *));
+        if (heap == NULL) {
+            RLOGE("ril_event: out of memory for %d timers", size);
+            return false;
+        }
+        timer_heap = heap;
+        timer_size = size;
+    }
+    timer_heap[timer_count] = ev;
+    heapSiftUp(timer_count++);
+    return true;
+}
+
+static void heapRemove(struct ril_event * ev)
+{
+    int i = ev->index;
+
+    ev->index = -1;
+    if (--timer_count > i) {
+        struct ril_event * last = timer_heap[timer_count];
+        heapSet(i, last);
+        heapSiftUp(i);
+        heapSiftDown(last->index);
+    }
+}
+
+// Arm timerfd with the first timer, or disarm it if there is none
+static void armTimer()
+{
+    struct itimerspec its;
+
+    if (timerFd < 0) {
+        return;
+    }
+    memset(&its, 0, sizeof(its));
+    if (timer_count > 0) {
+        its.it_value.tv_sec = timer_heap[0]->timeout.tv_sec;
+        its.it_value.tv_nsec = timer_heap[0]->timeout.tv_usec * 1000;
+        if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0) {
+            // zero would disarm
+            its.it_value.tv_nsec = 1;
+        }
+    }
+    if (timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+        RLOGE("ril_event: timerfd_settime error (%d)", errno);
+    }
+}
+
+// Clear timerfd before processTimeouts re-arms it, or the expiration
+// of the new timer may be consumed.
+static void clearTimer(struct epoll_event * events, int n)
+{
+    for (int i = 0; i < n; i++) {
+        if (events[i].data.u64 == TIMER_TOKEN) {
+            uint64_t expirations;
+            read(timerFd, &expirations, sizeof(expirations));
+            break;
         }
-        nfds = n + 1;
-        dlog("~~~~ nfds = %d ~~~~", nfds);
     }
 }
 
@@ -161,38 +349,40 @@ static void processTimeouts()
     dlog("~~~~ +processTimeouts ~~~~");
     MUTEX_ACQUIRE();
     struct timeval now;
-    struct ril_event * tev = timer_list.next;
-    struct ril_event * next;
+    bool fired = false;
 
     getNow(&now);
-    // walk list, see if now >= ev->timeout for any events
+    // pop heap while now >= ev->timeout
 
     dlog("~~~~ Looking for timers <= %ds + %dus ~~~~", (int)now.tv_sec, (int)now.tv_usec);
-    while ((tev != &timer_list) && (timercmp(&now, &tev->timeout, >))) {
+    while ((timer_count > 0) && !timercmp(&now, &timer_heap[0]->timeout, <)) {
         // Timer expired
         dlog("~~~~ firing timer ~~~~");
-        next = tev->next;
-        removeFromList(tev);
+        struct ril_event * tev = timer_heap[0];
+        heapRemove(tev);
         addToList(tev, &pending_list);
-        tev = next;
+        fired = true;
+    }
+    if (fired) {
+        armTimer();
     }
     MUTEX_RELEASE();
     dlog("~~~~ -processTimeouts ~~~~");
 }
 
-static void processReadReadies(fd_set * rfds, int n)
+static void processReadReadies(struct epoll_event * events, int n)
 {
     dlog("~~~~ +processReadReadies (%d) ~~~~", n);
     MUTEX_ACQUIRE();
 
-    for (int i = 0; (i < MAX_FD_EVENTS) && (n > 0); i++) {
-        struct ril_event * rev = watch_table[i];
-        if (rev != NULL && FD_ISSET(rev->fd, rfds)) {
+    for (int i = 0; i < n; i++) {
+        // Skip timerfd, and events deleted since epoll_wait returned
+        struct ril_event * rev = lookupWatch(events[i].data.u64);
+        if (rev != NULL) {
             addToList(rev, &pending_list);
             if (rev->persist == false) {
-                removeWatch(rev, i);
+                removeWatch(rev);
             }
-            n--;
         }
     }
 
@@ -203,50 +393,57 @@ static void processReadReadies(fd_set * rfds, int n)
 static void firePending()
 {
     dlog("~~~~ +firePending ~~~~");
+    // Take one event at a time, so that a timer cancelled by another
+    // thread or by an earlier callback is not fired.
+    MUTEX_ACQUIRE();
     struct ril_event * ev = pending_list.next;
     while (ev != &pending_list) {
-        struct ril_event * next = ev->next;
+        // ev may be deleted and freed by another thread once unlocked
+        ril_event_cb func = ev->func;
+        int fd = ev->fd;
+        void * param = ev->param;
+
         removeFromList(ev);
-        ev->func(ev->fd, 0, ev->param);
-        ev = next;
+        MUTEX_RELEASE();
+        func(fd, 0, param);
+        MUTEX_ACQUIRE();
+        ev = pending_list.next;
     }
+    MUTEX_RELEASE();
     dlog("~~~~ -firePending ~~~~");
 }
 
-static int calcNextTimeout(struct timeval * tv)
+// Initialize internal data structs
+void ril_event_init()
 {
-    struct ril_event * tev = timer_list.next;
-    struct timeval now;
-
-    getNow(&now);
+    MUTEX_INIT();
 
-    // Sorted list, so calc based on first node
-    if (tev == &timer_list) {
-        // no pending timers
-        return -1;
+    epollFd = epoll_create(MAX_FD_EVENTS);
+    if (epollFd < 0) {
+        RLOGE("ril_event: epoll_create error (%d)", errno);
+    } else {
+        fcntl(epollFd, F_SETFD, FD_CLOEXEC);
     }
+    nwatch = 0;
 
-    dlog("~~~~ now = %ds + %dus ~~~~", (int)now.tv_sec, (int)now.tv_usec);
-    dlog("~~~~ next = %ds + %dus ~~~~",
-            (int)tev->timeout.tv_sec, (int)tev->timeout.tv_usec);
-    if (timercmp(&tev->timeout, &now, >)) {
-        timersub(&tev->timeout, &now, tv);
+    timerFd = timerfd_create(CLOCK_MONOTONIC, 0);
+    if (timerFd < 0) {
+        RLOGE("ril_event: timerfd_create error (%d)", errno);
     } else {
-        // timer already expired.
-        tv->tv_sec = tv->tv_usec = 0;
+        struct epoll_event eev;
+
+        fcntl(timerFd, F_SETFD, FD_CLOEXEC);
+        fcntl(timerFd, F_SETFL, O_NONBLOCK);
+        memset(&eev, 0, sizeof(eev));
+        eev.events = EPOLLIN;
+        eev.data.u64 = TIMER_TOKEN;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, timerFd, &eev) < 0) {
+            RLOGE("ril_event: epoll_ctl(ADD, timerfd) error (%d)", errno);
+        }
     }
-    return 0;
-}
-
-// Initialize internal data structs
-void ril_event_init()
-{
-    MUTEX_INIT();
+    timer_count = 0;
 
-    FD_ZERO(&readFds);
-    init_list(&timer_list);
     init_list(&pending_list);
-    memset(watch_table, 0, sizeof(watch_table));
 }
 
 // Initialize an event
@@ -267,16 +464,26 @@ void ril_event_add(struct ril_event * ev)
 {
     dlog("~~~~ +ril_event_add ~~~~");
     MUTEX_ACQUIRE();
-    for (int i = 0; i < MAX_FD_EVENTS; i++) {
-        if (watch_table[i] == NULL) {
-            watch_table[i] = ev;
-            ev->index = i;
-            dlog("~~~~ added at %d ~~~~", i);
+    if (ev->index < 0) {
+        struct epoll_event eev;
+        int index = allocWatch(ev);
+
+        memset(&eev, 0, sizeof(eev));
+        eev.events = EPOLLIN;
+        if (index >= 0) {
+            eev.data.u64 = watchToken(index);
+        }
+        if (index < 0) {
+            // logged by allocWatch
+        } else if (epoll_ctl(epollFd, EPOLL_CTL_ADD, ev->fd, &eev) < 0) {
+            RLOGE("ril_event: epoll_ctl(ADD, %d) error (%d)", ev->fd, errno);
+            freeWatch(index);
+        } else {
+            ev->index = index;
+            nwatch++;
+            dlog("~~~~ added fd %d ~~~~", ev->fd);
             dump_event(ev);
-            FD_SET(ev->fd, &readFds);
-            if (ev->fd >= nfds) nfds = ev->fd+1;
-            dlog("~~~~ nfds = %d ~~~~", nfds);
-            break;
+            dlog("~~~~ nwatch = %d ~~~~", nwatch);
         }
     }
     MUTEX_RELEASE();
@@ -289,96 +496,115 @@ void ril_timer_add(struct ril_event * ev, struct timeval * tv)
     dlog("~~~~ +ril_timer_add ~~~~");
     MUTEX_ACQUIRE();
 
-    struct ril_event * list;
-    if (tv != NULL) {
-        // add to timer list
-        list = timer_list.next;
+    if (tv != NULL && ev->index < 0) {
+        // add to timer heap
         ev->fd = -1; // make sure fd is invalid
+        ev->seq = timer_seq++;
 
         struct timeval now;
         getNow(&now);
         timeradd(&now, tv, &ev->timeout);
 
-        // keep list sorted
-        while (timercmp(&list->timeout, &ev->timeout, < )
-                && (list != &timer_list)) {
-            list = list->next;
+        // arming the timerfd also wakes up the event loop
+        if (heapInsert(ev) && ev->index == 0) {
+            armTimer();
         }
-        // list now points to the first event older than ev
-        addToList(ev, list);
     }
 
     MUTEX_RELEASE();
     dlog("~~~~ -ril_timer_add ~~~~");
 }
 
+// Cancel timer event, whether it is waiting or has expired but not fired
+bool ril_timer_del(struct ril_event * ev)
+{
+    bool ret = true;
+
+    dlog("~~~~ +ril_timer_del ~~~~");
+    MUTEX_ACQUIRE();
+
+    if (ev->index >= 0) {
+        bool first = (ev->index == 0);
+        heapRemove(ev);
+        if (first) {
+            armTimer();
+        }
+    } else if (ev->next != NULL) {
+        removeFromList(ev);
+    } else {
+        ret = false;
+    }
+
+    MUTEX_RELEASE();
+    dlog("~~~~ -ril_timer_del ~~~~");
+    return ret;
+}
+
 // Remove event from watch or timer list
 void ril_event_del(struct ril_event * ev)
 {
     dlog("~~~~ +ril_event_del ~~~~");
-    MUTEX_ACQUIRE();
 
-    if (ev->index < 0 || ev->index >= MAX_FD_EVENTS) {
-        MUTEX_RELEASE();
+    if (ev->fd < 0) {
+        ril_timer_del(ev);
         return;
     }
 
-    removeWatch(ev, ev->index);
+    MUTEX_ACQUIRE();
+
+    if (ev->index >= 0) {
+        removeWatch(ev);
+    }
+    // ready but not fired yet, so it is not touched after it is freed
+    if (ev->next != NULL) {
+        removeFromList(ev);
+    }
 
     MUTEX_RELEASE();
     dlog("~~~~ -ril_event_del ~~~~");
 }
 
 #if DEBUG
-static void printReadies(fd_set * rfds)
+static void printReadies(struct epoll_event * events, int n)
 {
-    for (int i = 0; (i < MAX_FD_EVENTS); i++) {
-        struct ril_event * rev = watch_table[i];
-        if (rev != NULL && FD_ISSET(rev->fd, rfds)) {
-          dlog("DON: fd=%d is ready", rev->fd);
-        }
+    for (int i = 0; i < n; i++) {
+        dlog("DON: token=%llx is ready (0x%x)",
+                (unsigned long long)events[i].data.u64, events[i].events);
     }
 }
 #else
-#define printReadies(rfds) do {} while(0)
+#define printReadies(events, n) do {} while(0)
 #endif
 
 void ril_event_loop()
 {
     int n;
-    fd_set rfds;
-    struct timeval tv;
-    struct timeval * ptv;
+    struct epoll_event events[MAX_FD_EVENTS];
 
+    if (epollFd < 0 || timerFd < 0) {
+        RLOGE("ril_event: not initialized");
+        return;
+    }
 
     for (;;) {
 
-        // make local copy of read fd_set
-        memcpy(&rfds, &readFds, sizeof(fd_set));
-        if (-1 == calcNextTimeout(&tv)) {
-            // no pending timers; block indefinitely
-            dlog("~~~~ no timers; blocking indefinitely ~~~~");
-            ptv = NULL;
-        } else {
-            dlog("~~~~ blocking for %ds + %dus ~~~~", (int)tv.tv_sec, (int)tv.tv_usec);
-            ptv = &tv;
-        }
-        printReadies(&rfds);
-        n = select(nfds, &rfds, NULL, NULL, ptv);
-        printReadies(&rfds);
+        // timers wake us up through the timerfd
+        n = epoll_wait(epollFd, events, MAX_FD_EVENTS, -1);
         dlog("~~~~ %d events fired ~~~~", n);
         if (n < 0) {
             if (errno == EINTR) continue;
 
-            RLOGE("ril_event: select error (%d)", errno);
+            RLOGE("ril_event: epoll_wait error (%d)", errno);
             // bail?
             return;
         }
+        printReadies(events, n);
 
         // Check for timeouts
+        clearTimer(events, n);
         processTimeouts();
         // Check for read-ready
-        processReadReadies(&rfds, n);
+        processReadReadies(events, n);
         // Fire away
         firePending();
     }
@@ -15,8 +15,9 @@
 ** limitations under the License.
 */
 
-// Max number of fd's we watch at any one time.  Increase if necessary.
-#define MAX_FD_EVENTS 8
+// Max number of ready fd's handled per wakeup.  There is no limit on the
+// number of fd's watched; fd's not handled are reported again next wakeup.
+#define MAX_FD_EVENTS 16
 
 typedef void (*ril_event_cb)(int fd, short events, void *userdata);
 
@@ -25,7 +26,8 @@ struct ril_event {
     struct ril_event *prev;
 
     int fd;
-    int index;
+    int index;      // slot in the watch table, or the timer heap, or -1
+    unsigned seq;   // orders timers with the same timeout
     bool persist;
     struct timeval timeout;
     ril_event_cb func;
@@ -44,9 +46,15 @@ void ril_event_add(struct ril_event * ev);
 // Add timer event
 void ril_timer_add(struct ril_event * ev, struct timeval * tv);
 
-// Remove event from watch list
+// Remove event from watch list, or cancel timer event. Call it before the
+// fd is closed. The event may be freed when it returns, unless its
+// callback is running.
 void ril_event_del(struct ril_event * ev);
 
+// Cancel timer event. Returns false if the timer has already been taken
+// for firing, in which case the callback runs (or is running) anyway.
+bool ril_timer_del(struct ril_event * ev);
+
 // Event loop
 void ril_event_loop();
 
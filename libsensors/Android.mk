@@ -28,6 +28,10 @@ LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/hw
 LOCAL_MODULE_TAGS := optional
 
 LOCAL_CFLAGS := -DLOG_TAG=\"Sensors\"
+# The kernel driver reports the rotation vector on the ROTVEC axes.
+ifeq ($(BOARD_AKM_HAS_ROTATION_VECTOR),true)
+LOCAL_CFLAGS += -DAKM_HAS_ROTATION_VECTOR
+endif
 LOCAL_SRC_FILES :=          \
     sensors.cpp             \
     InputEventReader.cpp    \
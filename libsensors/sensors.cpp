@@ -85,13 +85,13 @@ static const struct sensor_t sSensorList[] = {
         0,
         { 0 },
     },
-#if 0
+#ifdef AKM_HAS_ROTATION_VECTOR
     { "AKM Rotation vector sensor",
         "Asahi Kasei Microdevices",
         1,
         ID_R,
         SENSOR_TYPE_ROTATION_VECTOR,
-        34.907f,
+        1.0f,
         CONVERT_R,
         1.0f,
         10000,